@@ -4,6 +4,7 @@
 #include <cassert>
 #include <algorithm>
 
+std::atomic<PAR2ProcTraceHook> IPAR2ProcBackend::traceHook(nullptr);
 
 PAR2Proc::PAR2Proc() IF_LIBUV(: endSignalled(false)) {
 	gfmat_init();
@@ -227,13 +228,28 @@ bool PAR2Proc::addInput(const void* buffer, size_t size, const uint16_t* coeffs,
 	return _addInput(buffer, size, coeffs[0], coeffs, flush, cb);
 }
 #else
+// with a single backend (the usual case), its future is passed straight through, rather than starting a thread per call just to wait on it
 static std::future<void> combine_futures(std::vector<std::future<void>>&& futures) {
+	if(futures.size() == 1)
+		return std::move(futures[0]);
+	if(futures.empty()) {
+		std::promise<void> prom;
+		prom.set_value();
+		return prom.get_future();
+	}
 	return std::async(std::launch::async, [](std::vector<std::future<void>>&& futures) {
 		for(auto& f : futures)
 			f.get();
 	}, std::move(futures));
 }
 static std::future<bool> combine_futures_and(std::vector<std::future<bool>>&& futures) {
+	if(futures.size() == 1)
+		return std::move(futures[0]);
+	if(futures.empty()) {
+		std::promise<bool> prom;
+		prom.set_value(true);
+		return prom.get_future();
+	}
 	return std::async(std::launch::async, [](std::vector<std::future<bool>>&& futures) -> bool {
 		bool result = true;
 		for(auto& f : futures)
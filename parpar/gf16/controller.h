@@ -4,6 +4,8 @@
 #include "../src/stdint.h"
 #include <vector>
 #include <cstring>
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <unordered_map>
 #include <unordered_set>
@@ -34,6 +36,9 @@ typedef std::function<void(unsigned)> PAR2ProcCompleteCb;
 #define NOTIFY_BOOL_DECL(cb, prom) std::promise<bool> prom
 #endif
 
+// optional tracing of the work done on backend threads; called on the thread which did the work
+typedef void(*PAR2ProcTraceHook)(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
 // backend interface
 enum PAR2ProcBackendAddResult {
 	PROC_ADD_OK,
@@ -86,6 +91,7 @@ protected:
 	unsigned currentStagingArea, currentStagingInputs;
 	unsigned inputBatchSize, minInBatchSize;
 	unsigned statBatchesStarted;
+	static std::atomic<PAR2ProcTraceHook> traceHook;
 	
 #ifdef USE_LIBUV
 	unsigned stagingActiveCount, pendingInCallbacks, pendingOutCallbacks;
@@ -122,7 +128,8 @@ protected:
 		for(const auto& area : staging) {
 			futures.push_back(area.promFuture);
 		}
-		return std::async(std::launch::async, [this](std::vector<std::shared_future<void>>&& futures) {
+		// deferred, so that the waiting is done by whoever waits for the end of input, rather than on a thread of its own
+		return std::async(std::launch::deferred, [this](std::vector<std::shared_future<void>>&& futures) {
 			for(const auto& f : futures)
 				f.get();
 			processing_finished();
@@ -208,6 +215,10 @@ public:
 	inline unsigned getBatchesStarted() const {
 		return statBatchesStarted;
 	}
+	// applies to all backends; NULL to stop tracing
+	static inline void setTraceHook(PAR2ProcTraceHook hook) {
+		traceHook.store(hook, std::memory_order_relaxed);
+	}
 	
 	inline void setMinInputBatchSize(unsigned size) {
 		minInBatchSize = size ? size : inputBatchSize;
@@ -237,8 +237,12 @@ struct transfer_data {
 void PAR2ProcCPU::transfer_slice(ThreadMessageQueue<void*>& q) {
 	struct transfer_data* data;
 	while((data = static_cast<struct transfer_data*>(q.pop())) != NULL) {
+		PAR2ProcTraceHook trace = traceHook.load(std::memory_order_relaxed);
+		std::chrono::steady_clock::time_point traceStart;
+		if(trace) traceStart = std::chrono::steady_clock::now();
 		if(data->finish) {
 			data->cksumSuccess = data->gf->finish_packed_cksum(data->dst, data->src, data->size, data->numBufs, data->index, data->chunkLen);
+			if(trace) trace("gf_finish", traceStart, std::chrono::steady_clock::now());
 			NOTIFY_DONE(data, _queueRecv, data->promOut, data->cksumSuccess);
 		} else {
 			if(data->src)
@@ -247,6 +251,7 @@ void PAR2ProcCPU::transfer_slice(ThreadMessageQueue<void*>& q) {
 				// queue async compute
 				data->parent->run_kernel(data->inBufId, data->submitInBufs);
 			}
+			if(trace) trace("gf_prepare", traceStart, std::chrono::steady_clock::now());
 			
 			// signal main thread that prepare has completed
 			NOTIFY_DONE(data, _queueSent, data->promPrep);
@@ -463,6 +468,9 @@ typedef struct __compute_req : PAR2ProcBackendBaseComputeReq<PAR2ProcCPU> {
 void PAR2ProcCPU::compute_worker(ThreadMessageQueue<void*>& q) {
 	compute_req* req;
 	while((req = static_cast<compute_req*>(q.pop())) != NULL) {
+		PAR2ProcTraceHook trace = traceHook.load(std::memory_order_relaxed);
+		std::chrono::steady_clock::time_point traceStart;
+		if(trace) traceStart = std::chrono::steady_clock::now();
 		
 		const Galois16MethodInfo& gfInfo = req->gf->info();
 		// compute how many inputs regions get prefetched in a muladd_multi call
@@ -516,6 +524,8 @@ void PAR2ProcCPU::compute_worker(ThreadMessageQueue<void*>& q) {
 		
 		// TODO: allow worker to peek into next queue entry for prefetching?
 		
+		if(trace) trace("gf_kernel", traceStart, std::chrono::steady_clock::now());
+		
 #ifdef DEBUG_STAT_THREAD_EMPTY
 		if(q.empty() && !(req->parent->endSignalled IF_NOT_LIBUV(.load(std::memory_order_relaxed))))
 			req->parent->statWorkerIdleEvents.fetch_add(1, std::memory_order_relaxed);
@@ -23,6 +23,11 @@ struct Galois16RecMatrixComputeState {
 	std::vector<Galois16RecMatrixWorker> workers;
 	unsigned pfFactor;
 	
+	// for substituting unusable recovery rows
+	const std::vector<bool>* inputValid;
+	std::vector<uint16_t>* recovery;
+	unsigned recStart; // first row of the row group being processed
+	
 	Galois16RecMatrixComputeState(Galois16Methods method) : gf(method) {}
 };
 
@@ -146,8 +151,10 @@ int Galois16RecMatrix::scaleRows(Galois16RecMatrixComputeState& state, unsigned
 	
 	#define SCALE_ROW(row) \
 		tmpCoeff = REPLACE_WORD(rec+row, missingCol+row, 1); \
-		if(HEDLEY_UNLIKELY(tmpCoeff == 0)) /* bad recovery coeff */ \
-			return row; \
+		while(HEDLEY_UNLIKELY(tmpCoeff == 0)) { /* bad recovery coeff - substitute another recovery row, if possible */ \
+			if(!replaceRow(state, rec, row)) return row; \
+			tmpCoeff = REPLACE_WORD(rec+row, missingCol+row, 1); \
+		} \
 		if(HEDLEY_LIKELY(tmpCoeff != 1)) { \
 			for(unsigned stripe=0; stripe<numStripes; stripe++) \
 				state.gf.mul(MAT_ROW(stripe, rec+row), MAT_ROW(stripe, rec+row), stripeWidth, gf16_recip[tmpCoeff], state.gfScratch); \
@@ -277,6 +284,58 @@ int Galois16RecMatrix::scaleRows(Galois16RecMatrixComputeState& state, unsigned
 	#undef MULADD_MULTI_LASTROW
 }
 
+// eliminate rows [recFirst, recLast) from row `rec`; the source rows must have been reduced against each other
+void Galois16RecMatrix::eliminateRows(Galois16RecMatrixComputeState& state, unsigned rec, unsigned recFirst, unsigned recLast) {
+	if(recFirst >= recLast) return;
+	std::vector<uint16_t> coeffs(recLast - recFirst);
+	for(unsigned r=recFirst; r<recLast; r++)
+		coeffs[r-recFirst] = REPLACE_WORD(rec, state.validCount+r, 0);
+	for(unsigned r=recFirst; r<recLast; r++) {
+		uint16_t coeff = coeffs[r-recFirst];
+		if(coeff == 0) continue;
+		for(unsigned stripe=0; stripe<numStripes; stripe++)
+			state.gf.mul_add(MAT_ROW(stripe, rec), MAT_ROW(stripe, r), stripeWidth, coeff, state.gfScratch);
+	}
+}
+
+// replace the row at rec+row, which has a zero pivot, with the next unused recovery block, and bring it to the
+// same state of elimination the original row was at, so that inversion can continue without restarting
+// returns false if there's no spare recovery
+bool Galois16RecMatrix::replaceRow(Galois16RecMatrixComputeState& state, unsigned rec, unsigned row) {
+	std::vector<uint16_t>& recovery = *state.recovery;
+	if(recovery.size() <= numRec) return false;
+	
+	unsigned target = rec+row;
+	uint16_t exp = recovery[numRec];
+	recovery.erase(recovery.begin() + numRec);
+	discarded.push_back(recovery[target]);
+	recovery[target] = exp;
+	
+	// construct the new row
+	const std::vector<bool>& inputValid = *state.inputValid;
+	unsigned sw16 = stripeWidth / sizeof(uint16_t);
+	unsigned validCol = 0;
+	unsigned missingCol = state.validCount;
+	for(unsigned input=0; input<inputValid.size(); input++) {
+		unsigned col = inputValid[input] ? validCol++ : missingCol++;
+		MAT_ROW(col/sw16, target)[col%sw16] = _LE16(gfmat_coeff((uint_fast16_t)input, exp));
+	}
+	if(state.gf.needPrepare()) {
+		for(unsigned stripe=0; stripe<numStripes; stripe++)
+			state.gf.prepare(MAT_ROW(stripe, target), MAT_ROW(stripe, target), stripeWidth);
+	}
+	
+	// apply the same eliminations the original row went through: all previous row groups, then the completed
+	// rows in this row group (both are fully reduced amongst themselves)...
+	eliminateRows(state, target, 0, state.recStart);
+	eliminateRows(state, target, state.recStart, rec);
+	// ...then the rows before it in the set being scaled, which scaleRows applies in pairs, followed by any odd row
+	eliminateRows(state, target, rec, rec + (row & ~1u));
+	if(row & 1)
+		eliminateRows(state, target, rec+row-1, rec+row);
+	return true;
+}
+
 void Galois16RecMatrix::fillCoeffs(Galois16RecMatrixComputeState& state, unsigned rows, unsigned recFirst, unsigned recLast, unsigned rec, unsigned coeffWidth) {
 	assert(rec != recFirst);
 	unsigned missingCol = state.validCount + rec;
@@ -401,6 +460,7 @@ int Galois16RecMatrix::processRows(Galois16RecMatrixComputeState& state, unsigne
 		assert(curRowGroupSize > 0);
 		
 		unsigned recStart = rec;
+		state.recStart = recStart;
 		// for progress indicator, we'll even it out by computing a ratio to advance by
 		unsigned progressRatio = (curRowGroupSize<<16)/numRec;
 		unsigned progressBase = recStart + progressOffset;
@@ -563,6 +623,7 @@ bool Galois16RecMatrix::Compute(const std::vector<bool>& inputValid, unsigned va
 	assert(inputValid.size() <= 32768 && inputValid.size() > 0);
 	assert(recovery.size() <= 65535 && recovery.size() > 0);
 	
+	discarded.clear();
 	if(numRec > recovery.size()) return false;
 	
 	
@@ -573,6 +634,8 @@ bool Galois16RecMatrix::Compute(const std::vector<bool>& inputValid, unsigned va
 	
 	Galois16RecMatrixComputeState state((Galois16Methods)regionMethod);
 	state.validCount = validCount;
+	state.inputValid = &inputValid;
+	state.recovery = &recovery;
 	const auto gfInfo = state.gf.info();
 	state.pfFactor = gfInfo.prefetchDownscale;
 	
@@ -628,7 +691,7 @@ bool Galois16RecMatrix::Compute(const std::vector<bool>& inputValid, unsigned va
 	std::vector<uint16_t> stateCoeff(rowGroupSize*rowGroupSize);
 	state.coeff = stateCoeff.data();
 	
-	invert_loop: { // loop, in the unlikely case we hit the PAR2 un-invertability flaw; TODO: is there a faster way than just retrying?
+	invert_loop: { // loop, in the unlikely case we hit the PAR2 un-invertability flaw and run out of recovery rows to substitute
 		if(numRec > recovery.size()) { // not enough recovery
 			if(_numThreads <= 1)
 				state.gf.mutScratch_free(state.gfScratch);
@@ -656,6 +719,7 @@ bool Galois16RecMatrix::Compute(const std::vector<bool>& inputValid, unsigned va
 				int badRow = processRows<rows>(state, rec, rowGroupSize, progressCb, progressOffset, totalProgress); \
 				if(badRow >= 0) { \
 					/* ignore this recovery row and try again */ \
+					discarded.push_back(recovery[badRow]); \
 					recovery.erase(recovery.begin() + badRow); \
 					goto invert_loop; \
 				} \
@@ -19,6 +19,7 @@ class Galois16RecMatrix {
 	unsigned stripeWidth;
 	unsigned numRec;
 	unsigned numThreads;
+	std::vector<uint16_t> discarded;
 	void Construct(const std::vector<bool>& inputValid, unsigned validCount, const std::vector<uint16_t>& recovery);
 	
 	template<unsigned rows>
@@ -26,6 +27,8 @@ class Galois16RecMatrix {
 	template<unsigned rows>
 	int scaleRows(Galois16RecMatrixComputeState& state, unsigned rec, unsigned recFirst, unsigned recLast);
 	void fillCoeffs(Galois16RecMatrixComputeState& state, unsigned rows, unsigned recFirst, unsigned recLast, unsigned rec, unsigned coeffWidth);
+	void eliminateRows(Galois16RecMatrixComputeState& state, unsigned rec, unsigned recFirst, unsigned recLast);
+	bool replaceRow(Galois16RecMatrixComputeState& state, unsigned rec, unsigned row);
 	template<unsigned rows>
 	void applyRows(Galois16RecMatrixComputeState& state, unsigned rec, unsigned recCount, unsigned recFirst, unsigned recLast, unsigned coeffWidth, int nextRow);
 	template<unsigned rows>
@@ -47,6 +50,10 @@ public:
 	// these should only be queried after Compute has started (i.e. from the progressCb, or after it returns)
 	/*Galois16Methods*/ int regionMethod;
 	const char* getPointMulMethodName() const;
+	// recovery exponents which couldn't be used (and were substituted) in the last Compute
+	const std::vector<uint16_t>& getDiscarded() const {
+		return discarded;
+	}
 };
 
 #endif
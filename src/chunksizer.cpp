@@ -0,0 +1,191 @@
+#include "libpar2internal.h"
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <fstream>
+#endif
+
+
+ChunkSizer::ChunkSizer(void)
+: blocksize(0)
+, maxsize(0)
+, minsize(0)
+, granularity(1)
+, size(0)
+, trialsize(0)
+, trialrate(0)
+, settled(false)
+, passtime(0)
+{
+  for (int wait = 0; wait < wtCount; wait++)
+    waits[wait] = std::chrono::steady_clock::duration::zero();
+}
+
+#ifdef _WIN32
+size_t ChunkSizer::CacheSize(void)
+{
+  DWORD length = 0;
+  GetLogicalProcessorInformation(NULL, &length);
+  if (length == 0)
+    return 0;
+
+  std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) + 1);
+  if (!GetLogicalProcessorInformation(&info[0], &length))
+    return 0;
+
+  // The largest cache is the last level
+  size_t cachesize = 0;
+  for (size_t i = 0; i < length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); i++)
+  {
+    if (info[i].Relationship == RelationCache && info[i].Cache.Size > cachesize)
+      cachesize = info[i].Cache.Size;
+  }
+  return cachesize;
+}
+#elif defined(__APPLE__)
+size_t ChunkSizer::CacheSize(void)
+{
+  const char *names[] = {"hw.l3cachesize", "hw.l2cachesize"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    u64 cachesize = 0;
+    size_t length = sizeof(cachesize);
+    if (sysctlbyname(names[i], &cachesize, &length, NULL, 0) == 0 && cachesize != 0)
+      return (size_t)cachesize;
+  }
+  return 0;
+}
+#else
+size_t ChunkSizer::CacheSize(void)
+{
+#if defined(_SC_LEVEL3_CACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+  long cachesize = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (cachesize <= 0)
+    cachesize = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (cachesize > 0)
+    return (size_t)cachesize;
+#endif
+
+#ifdef __linux__
+  // Not every architecture reports its caches through sysconf, but sysfs
+  // lists them (with sizes such as "2048K")
+  size_t largest = 0;
+  for (int index = 0; ; index++)
+  {
+    std::ifstream file(("/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/size").c_str());
+    size_t value;
+    if (!(file >> value))
+      break;
+    std::string unit;
+    file >> unit;
+    if (unit == "K")
+      value *= 1024;
+    else if (unit == "M")
+      value *= 1048576;
+    if (value > largest)
+      largest = value;
+  }
+  return largest;
+#else
+  return 0;
+#endif
+}
+#endif
+
+size_t ChunkSizer::StartSize(void)
+{
+  static const size_t startsize = []() {
+    size_t cachesize = CacheSize();
+    if (cachesize == 0)
+      return (size_t)START_CHUNK_SIZE;
+    return std::min(std::max(cachesize, (size_t)1048576), (size_t)START_CHUNK_SIZE);
+  }();
+  return startsize;
+}
+
+size_t ChunkSizer::MaxSize(void)
+{
+  // Passes are never made smaller than they could be before sizes adapted
+  return std::max(StartSize() * CHUNK_SIZE_GROWTH, (size_t)START_CHUNK_SIZE);
+}
+
+void ChunkSizer::Start(u64 _blocksize, size_t _maxsize, size_t _minsize, bool directio)
+{
+  blocksize = _blocksize;
+  maxsize = _maxsize;
+  granularity = directio && blocksize % DIRECT_IO_ALIGNMENT == 0 ? DIRECT_IO_ALIGNMENT : 4;
+  minsize = std::min(AlignDown(std::max(_minsize, granularity)), maxsize);
+
+  size = std::max(AlignDown(std::min(StartSize(), maxsize)), minsize);
+  // If a whole block fits, there's only one pass to make
+  if (blocksize <= maxsize)
+    size = (size_t)blocksize;
+
+  trialsize = 0;
+  trialrate = 0;
+  settled = false;
+  passtime = 0;
+}
+
+size_t ChunkSizer::Next(u64 blockoffset)
+{
+  passstart = std::chrono::steady_clock::now();
+  for (int wait = 0; wait < wtCount; wait++)
+    waits[wait] = std::chrono::steady_clock::duration::zero();
+
+  return (size_t)std::min((u64)size, blocksize - blockoffset);
+}
+
+void ChunkSizer::Finish(size_t length)
+{
+  passtime = std::chrono::duration<double>(std::chrono::steady_clock::now() - passstart).count();
+
+  // The last pass may have been only what was left of each block, which
+  // says little about how well the size suits
+  if (length < size || passtime <= 0)
+    return;
+  double rate = length / passtime;
+
+  // If a smaller size was tried and turned out to be slower, go back
+  if (trialsize != 0)
+  {
+    size_t previous = trialsize;
+    trialsize = 0;
+    if (rate < trialrate)
+    {
+      size = previous;
+      settled = true;
+      return;
+    }
+  }
+
+  std::chrono::steady_clock::duration iowait = waits[wtIO];
+  std::chrono::steady_clock::duration computewait = waits[wtCompute];
+  if (iowait > computewait * 2)
+  {
+    // Waiting for I/O: make fewer, larger passes
+    size = std::max(AlignDown(std::min(size * 2, maxsize)), size);
+  }
+  else if (computewait > iowait * 2 && !settled && AlignDown(size / 2) >= minsize)
+  {
+    // Waiting for the backend: see if a pass which fits better in the
+    // cache is any faster
+    trialsize = size;
+    trialrate = rate;
+    size = AlignDown(size / 2);
+  }
+}
+
+size_t ChunkSizer::AlignDown(size_t length) const
+{
+  return length - length % granularity;
+}
@@ -0,0 +1,101 @@
+#ifndef __CHUNKSIZER_H__
+#define __CHUNKSIZER_H__
+
+#include <chrono>
+
+// Chooses how much of each block to process on each pass, when the blocks
+// can't all be processed in one.
+//
+// The first pass is about the size of the CPU's last level of cache, so that
+// a chunk which has just been read is still in cache when it's prepared for
+// the backend. After each pass, how long was spent waiting for reads and
+// writes is compared with how long was spent waiting for the backend: if
+// I/O is what's being waited for, passes are made larger (up to what the
+// buffers can hold), so that there are fewer of them to seek through the
+// files for; if computation is, a smaller pass is tried, and kept if it
+// gets through the data faster.
+
+class ChunkSizer
+{
+public:
+  ChunkSizer(void);
+
+  // What was waited for during a pass
+  enum Wait
+  {
+    wtIO = 0,       // Reading or writing data
+    wtCompute,      // The backend
+    wtCount
+  };
+
+  // The size of the CPU's last level of cache, or 0 if it can't be found
+  static size_t CacheSize(void);
+
+  // How much of each block passes start with, and the most they may grow to
+  // (which is how much of a block is worth allocating buffers for)
+  static size_t StartSize(void);
+  static size_t MaxSize(void);
+
+  // Start choosing sizes for passes through blocks of blocksize, no larger
+  // than the buffers allocated (maxsize) and no smaller than minsize. With
+  // direct I/O, each pass is kept aligned, so that it can be read directly.
+  void Start(u64 blocksize, size_t maxsize, size_t minsize, bool directio);
+
+  // How much to process on the pass starting at blockoffset. The pass is
+  // timed from now until Finish is called.
+  size_t Next(u64 blockoffset);
+
+  // Record the time spent waiting on what during the pass
+  void AddWait(Wait wait, std::chrono::steady_clock::duration duration) {waits[wait] += duration;}
+
+  // Choose the size of the next pass from how the one just done went
+  void Finish(size_t length);
+
+  // How the last pass went
+  double PassTime(void) const {return passtime;}
+  double WaitTime(Wait wait) const {return std::chrono::duration<double>(waits[wait]).count();}
+
+  // The size the next pass will be (if there's enough of each block left)
+  size_t Size(void) const {return size;}
+
+protected:
+  size_t AlignDown(size_t length) const;
+
+protected:
+  u64     blocksize;
+  size_t  maxsize;
+  size_t  minsize;
+  size_t  granularity;
+
+  size_t  size;         // The size of the next pass
+  size_t  trialsize;    // The size before a smaller one was tried (or 0)
+  double  trialrate;    // How fast that was (bytes of each block per second)
+  bool    settled;      // Smaller passes have been found to be no faster
+
+  std::chrono::steady_clock::time_point  passstart;
+  std::chrono::steady_clock::duration    waits[wtCount];
+  double                                 passtime;
+};
+
+// Adds the time for which it's in scope to what a pass waited for
+class ChunkWaitTimer
+{
+public:
+  ChunkWaitTimer(ChunkSizer &chunksizer, ChunkSizer::Wait wait)
+  : chunksizer(chunksizer)
+  , wait(wait)
+  , started(std::chrono::steady_clock::now())
+  {
+  }
+  ~ChunkWaitTimer(void)
+  {
+    chunksizer.AddWait(wait, std::chrono::steady_clock::now() - started);
+  }
+
+protected:
+  ChunkSizer                                  &chunksizer;
+  const ChunkSizer::Wait                       wait;
+  const std::chrono::steady_clock::time_point  started;
+};
+
+#endif // __CHUNKSIZER_H__
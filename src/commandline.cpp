@@ -44,6 +44,11 @@ CommandLine::CommandLine(void)
 , basepath()
 , nthreads(0) // 0 means use default number
 , filethreads( _FILE_THREADS ) // default from header file
+, directio(false)
+, cachepolicy(cpNormal)
+, stats(false)
+, statsfile()
+, tracefile()
 , parfilename()
 , rawfilenames()
 , extrafiles()
@@ -109,12 +114,23 @@ void CommandLine::usage(void)
     "  -B<path> : Set the basepath to use as reference for the datafiles\n"
     "  -v [-v]  : Be more verbose\n"
     "  -q [-q]  : Be more quiet (-q -q gives silence)\n"
-    "  -m<n>    : Memory (in MB) to use (default is half of total physical memory)\n";
+    "  -m<n>    : Memory (in MB) to use, for everything (default is 1/8th of\n"
+    "             physical memory or of a cgroup's limit, at least 256MB, but\n"
+    "             no more than half of a cgroup's limit)\n";
   std::cout <<
     "  -t<n>    : Number of threads used for main processing (" << std::thread::hardware_concurrency() << " detected)\n"
     "  -T<n>    : Number of files hashed in parallel\n"
     "             (" << _FILE_THREADS << " are the default)\n";
   std::cout <<
+    "  -D       : Use direct I/O, bypassing the system's file cache (best with\n"
+    "             a block size that is a multiple of 4096)\n"
+    "  -C<m>    : System file cache use: n(ormal), s(equential) tells the system\n"
+    "             how files are read, d(rop) also drops data from the cache\n"
+    "             once it has been processed (default n)\n"
+    "  --stats[=<file>] : At exit, write how long each stage took (as JSON)\n"
+    "             to the file, or to the output\n"
+    "  --trace=<file> : At exit, write a timeline of what each thread did to\n"
+    "             the file (for chrome://tracing or Perfetto)\n"
     "  --       : Treat all following arguments as filenames\n"
     "Options: (verify or repair)\n"
     "  -p       : Purge backup files and par files on successful recovery or\n"
@@ -816,6 +832,45 @@ bool CommandLine::ReadArgs(int argc, const char * const *argv)
           }
           break;
 
+        case 'D':  // Use direct I/O
+          {
+            if (argv[0][2])
+            {
+              std::cerr << "Invalid option: " << argv[0] << std::endl;
+              return false;
+            }
+            directio = true;
+          }
+          break;
+
+        case 'C':  // Set the cache policy
+          {
+            if (argv[0][2] && !argv[0][3])
+            {
+              switch (argv[0][2])
+              {
+              case 'n':
+                cachepolicy = cpNormal;
+                break;
+              case 's':
+                cachepolicy = cpSequential;
+                break;
+              case 'd':
+                cachepolicy = cpDrop;
+                break;
+              default:
+                std::cerr << "Invalid cache policy option: " << argv[0] << std::endl;
+                return false;
+              }
+            }
+            else
+            {
+              std::cerr << "Invalid cache policy option: " << argv[0] << std::endl;
+              return false;
+            }
+          }
+          break;
+
         case 'B': // Set the basepath manually
           {
             std::string str = argv[0];
@@ -834,6 +889,34 @@ bool CommandLine::ReadArgs(int argc, const char * const *argv)
 
         case '-':
           {
+            std::string str = argv[0];
+            if (str == "--stats")
+            {
+              stats = true;
+              break;
+            }
+            if (str.compare(0, 8, "--stats=") == 0)
+            {
+              if (str.size() == 8)
+              {
+                std::cerr << "Invalid option: " << argv[0] << std::endl;
+                return false;
+              }
+              stats = true;
+              statsfile = str.substr(8);
+              break;
+            }
+            if (str.compare(0, 8, "--trace=") == 0)
+            {
+              if (str.size() == 8)
+              {
+                std::cerr << "Invalid option: " << argv[0] << std::endl;
+                return false;
+              }
+              tracefile = str.substr(8);
+              break;
+            }
+
 	    if (argv[0] != std::string("--")) {
               std::cerr << "Unknown option: " << argv[0] << std::endl;
 	      std::cerr << "  (Options must appear after create, repair or verify.)" << std::endl;
@@ -996,6 +1079,74 @@ u64 CommandLine::GetTotalPhysicalMemory()
 }
 #endif
 
+#ifdef __linux__
+// Read the limit from a cgroup's memory controller file ("max" meaning none)
+static u64 ReadCgroupLimit(const std::string &filename)
+{
+  std::ifstream file(filename.c_str());
+  std::string value;
+  if (!(file >> value) || value == "max")
+    return 0;
+  return strtoull(value.c_str(), NULL, 10);
+}
+
+// The limit is the lowest of those of the cgroup and its ancestors, which
+// are found from /proc/self/cgroup (with either version of cgroups). In a
+// container, the cgroup's path may not be visible, in which case the limit
+// is that of the root of /sys/fs/cgroup.
+u64 CommandLine::GetCgroupMemoryLimit()
+{
+  std::ifstream cgroups("/proc/self/cgroup");
+  std::string line;
+  u64 limit = 0;
+  while (std::getline(cgroups, line))
+  {
+    // Each line is hierarchy-ID:controller-list:path
+    std::string::size_type first = line.find(':');
+    std::string::size_type second = first == std::string::npos ? first : line.find(':', first+1);
+    if (second == std::string::npos)
+      continue;
+
+    std::string controllers = "," + line.substr(first+1, second-first-1) + ",";
+    std::string path = line.substr(second+1);
+    std::string root, filename;
+    if (controllers == ",,")
+    {
+      root = "/sys/fs/cgroup";
+      filename = "/memory.max";
+    }
+    else if (controllers.find(",memory,") != std::string::npos)
+    {
+      root = "/sys/fs/cgroup/memory";
+      filename = "/memory.limit_in_bytes";
+    }
+    else
+    {
+      continue;
+    }
+
+    while (true)
+    {
+      u64 value = ReadCgroupLimit(root + path + filename);
+      if (value != 0 && (limit == 0 || value < limit))
+        limit = value;
+
+      if (path.empty() || path == "/")
+        break;
+      std::string::size_type slash = path.find_last_of('/');
+      path = slash == std::string::npos ? "" : path.substr(0, slash);
+    }
+  }
+
+  return limit;
+}
+#else
+u64 CommandLine::GetCgroupMemoryLimit()
+{
+  return 0;
+}
+#endif
+
 
 bool CommandLine::CheckValuesAndSetDefaults() {
   if (parfilename.length() == 0)
@@ -1011,12 +1162,21 @@ bool CommandLine::CheckValuesAndSetDefaults() {
     noiselevel = nlNormal;
   }
 
-  // Default memorylimit of 256MB
+  // Default memorylimit: 1/8th of the memory available, but at least 256MB.
+  // When in a cgroup with a memory limit (such as a container), the memory
+  // available is no more than that limit, of which no more than half is used.
   if (memorylimit == 0)
   {
     u64 TotalPhysicalMemory = GetTotalPhysicalMemory();
+    u64 CgroupMemoryLimit = GetCgroupMemoryLimit();
+
+    u64 AvailableMemory = TotalPhysicalMemory;
+    if (CgroupMemoryLimit != 0 && (AvailableMemory == 0 || CgroupMemoryLimit < AvailableMemory))
+      AvailableMemory = CgroupMemoryLimit;
+    else
+      CgroupMemoryLimit = 0;
 
-    if (TotalPhysicalMemory == 0)
+    if (AvailableMemory == 0)
     {
       if (noiselevel >= nlDebug)
         std::cout << "[DEBUG] could not detect physical memory" << std::endl;
@@ -1027,12 +1187,20 @@ bool CommandLine::CheckValuesAndSetDefaults() {
     else
     {
       if (noiselevel >= nlDebug)
+      {
         std::cout << "[DEBUG] detected physical memory: " << TotalPhysicalMemory << " bytes" << std::endl;
+        if (CgroupMemoryLimit != 0)
+          std::cout << "[DEBUG] detected cgroup memory limit: " << CgroupMemoryLimit << " bytes" << std::endl;
+      }
 
-      // 1/8th of total physical memory or floor to 256MiB if lower:
-      memorylimit = (size_t)(TotalPhysicalMemory / 1048576 / 8);
+      // 1/8th of available memory or floor to 256MiB if lower:
+      memorylimit = (size_t)(AvailableMemory / 1048576 / 8);
       if (memorylimit < 256)
         memorylimit = 256;
+
+      // but don't take more than half of a cgroup's limit
+      if (CgroupMemoryLimit != 0 && memorylimit > CgroupMemoryLimit / 1048576 / 2)
+        memorylimit = std::max((size_t)(CgroupMemoryLimit / 1048576 / 2), (size_t)1);
     }
   }
 
@@ -98,6 +98,11 @@ public:
   bool                                GetRecursive(void) const   {return recursive;}
   bool                                GetSkipData(void) const    {return skipdata;}
   u64                                 GetSkipLeaway(void) const  {return skipleaway;}
+  bool                                GetDirectIO(void) const    {return directio;}
+  CachePolicy                         GetCachePolicy(void) const {return cachepolicy;}
+  bool                                GetStats(void) const       {return stats;}
+  std::string                         GetStatsFile(void) const   {return statsfile;}
+  std::string                         GetTraceFile(void) const   {return tracefile;}
   u32                                 GetNumThreads(void) {return nthreads;}
   u32                                 GetFileThreads(void) {return filethreads;}
 
@@ -121,6 +126,10 @@ protected:
   // (or 0 if it cannot be determined)
   u64 GetTotalPhysicalMemory();
 
+  // Returns the memory limit of the cgroup the process is in, in BYTES
+  // (or 0 if there is none, or it cannot be determined)
+  u64 GetCgroupMemoryLimit();
+
   // Check values that were set during ReadArgs.
   // If values went unset, set them with default values
   bool CheckValuesAndSetDefaults();
@@ -145,6 +154,11 @@ protected:
   std::string basepath;             // the path par2 is run from
   u32 nthreads;         // Default number of threads
   u32 filethreads;      // Number of threads for file processing
+  bool directio;        // Whether to bypass the OS's file cache
+  CachePolicy cachepolicy; // How to make use of the OS's file cache
+  bool stats;           // Whether to write statistics at exit
+  std::string statsfile; // Where to write them (or empty for the output)
+  std::string tracefile; // Where to write a trace at exit (or empty not to)
   // NOTE: using the "-t" option to set the number of threads does not
   // end up here, but results in a direct call to "omp_set_num_threads"
 
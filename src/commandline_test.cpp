@@ -537,6 +537,14 @@ int test9() {
     return 1;
   if (test9_helper("par2 create -nad foo.par2 input1.txt input2.txt"))
     return 1;
+  if (test9_helper("par2 create -Dx foo.par2 input1.txt input2.txt"))
+    return 1;
+  if (test9_helper("par2 create -C foo.par2 input1.txt input2.txt"))
+    return 1;
+  if (test9_helper("par2 create -Cx foo.par2 input1.txt input2.txt"))
+    return 1;
+  if (test9_helper("par2 create -Cdd foo.par2 input1.txt input2.txt"))
+    return 1;
 
 
   // delete files that were created at start of test.
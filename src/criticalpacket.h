@@ -38,6 +38,9 @@ public:
   // Obtain the length of the packet.
   size_t  PacketLength(void) const;
 
+  // The packet itself
+  const void* PacketData(void) const;
+
   // Allocate some memory for the packet (plus some extra padding).
   void*   AllocatePacket(size_t length, size_t extra = 0);
 
@@ -70,6 +73,11 @@ inline size_t CriticalPacket::PacketLength(void) const
   return packetlength;
 }
 
+inline const void* CriticalPacket::PacketData(void) const
+{
+  return packetdata;
+}
+
 inline void* CriticalPacket::AllocatePacket(size_t length, size_t extra)
 {
   // Hey! We can't allocate the packet twice
@@ -123,6 +131,11 @@ public:
   // Obtain the length of the packet.
   u64    PacketLength(void) const;
 
+  // Where the packet is to be written, and which packet it is
+  DiskFile* GetDiskFile(void) const {return diskfile;}
+  u64    Offset(void) const {return offset;}
+  const CriticalPacket* Packet(void) const {return packet;}
+
 protected:
   DiskFile             *diskfile;
   u64                   offset;
@@ -108,3 +108,119 @@ bool DataBlock::WriteData(u64         position, // Position within the block
 
   return true;
 }
+
+// Queue a read of some data at a specified position within a data block
+
+IOQueue::Ticket DataBlock::QueueRead(IOQueue &queue, u64 position, size_t size, void *buffer)
+{
+  assert(diskfile != 0);
+
+  if (length > position)
+  {
+    u64    fileoffset = offset + position;
+    size_t want       = (size_t)std::min(
+        std::min((u64)size, length - position),
+        diskfile->FileSize() - fileoffset
+    );
+
+    // The part beyond the end of the data block is zeroed now, as only the
+    // rest will be touched by the queued read
+    if (want < size)
+    {
+      memset(&((u8*)buffer)[want], 0, size-want);
+    }
+
+    return queue.Read(diskfile, fileoffset, buffer, want);
+  }
+  else
+  {
+    memset(buffer, 0, size);
+    return queue.Completed();
+  }
+}
+
+// Queue a write of some data at a specified position within a data block
+
+IOQueue::Ticket DataBlock::QueueWrite(IOQueue &queue, u64 position, size_t size, const void *buffer, size_t &wrote)
+{
+  assert(diskfile != 0);
+
+  wrote = 0;
+
+  if (length > position)
+  {
+    u64    fileoffset = offset + position;
+    size_t have       = (size_t)std::min((u64)size, length - position);
+
+    wrote = have;
+    return queue.Write(diskfile, fileoffset, buffer, have);
+  }
+  else
+  {
+    return queue.Completed();
+  }
+}
+
+// Copy some data at a specified position within another data block to the
+// same position within this one, leaving it to the OS
+
+bool DataBlock::CopyData(DataBlock &source,   // Block to copy from
+                         u64        position, // Position within the blocks
+                         size_t     size,     // Amount to copy
+                         size_t    &wrote)    // Amount actually written
+{
+  assert(diskfile != 0 && source.diskfile != 0);
+
+  wrote = 0;
+
+  if (length > position)
+  {
+    size_t have = (size_t)std::min((u64)size, length - position);
+
+    // The source must hold all of it, as the OS can't make up the zeros
+    // which ReadData would pad it with
+    if (source.length <= position ||
+        source.length - position < have ||
+        source.diskfile->FileSize() < source.offset + position + have)
+      return false;
+
+    if (!diskfile->CopyFrom(*source.diskfile, source.offset + position, offset + position, have))
+      return false;
+
+    wrote = have;
+  }
+
+  return true;
+}
+
+// Check whether the data at a specified position within a data block is
+// known to be zeros, without reading it
+
+bool DataBlock::IsHole(u64 position, size_t size)
+{
+  assert(diskfile != 0);
+
+  if (length > position)
+  {
+    u64    fileoffset = offset + position;
+    size_t want       = (size_t)std::min(
+        std::min((u64)size, length - position),
+        diskfile->FileSize() - fileoffset
+    );
+
+    return want == 0 || diskfile->IsHole(fileoffset, want);
+  }
+  else
+  {
+    return true;
+  }
+}
+
+// Check whether a buffer is all zeros. Unless the buffer is, this usually
+// stops at the first byte or two; otherwise memcmp does it at memory speed.
+
+bool DataBlock::IsZero(const void *buffer, size_t size)
+{
+  const u8 *data = (const u8*)buffer;
+  return size == 0 || (data[0] == 0 && memcmp(data, data+1, size-1) == 0);
+}
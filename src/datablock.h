@@ -68,6 +68,25 @@ public:
   // Write some of the data from memory to disk
   bool WriteData(u64 position, size_t size, const void *buffer, size_t &wrote);
 
+  // The same as ReadData and WriteData, but with the transfer done via an
+  // IOQueue. It is only complete once the returned ticket has been waited on.
+  IOQueue::Ticket QueueRead(IOQueue &queue, u64 position, size_t size, void *buffer);
+  IOQueue::Ticket QueueWrite(IOQueue &queue, u64 position, size_t size, const void *buffer, size_t &wrote);
+
+  // Copy some of the data of another block into this one, as WriteData would
+  // write it after ReadData had read it from the other, but without it
+  // passing through memory (see DiskFile::CopyFrom). Returns false if that
+  // isn't possible, in which case ReadData and WriteData should be used.
+  bool CopyData(DataBlock &source, u64 position, size_t size, size_t &wrote);
+
+  // Whether the data that ReadData would read is known to be all zeros
+  // without reading it (it's a hole in the file, or beyond the end of the
+  // block). The disk file must be open.
+  bool IsHole(u64 position, size_t size);
+
+  // Whether a buffer holds nothing but zeros
+  static bool IsZero(const void *buffer, size_t size);
+
 protected:
   DiskFile *diskfile;  // Which disk file is the block associated with
   u64       offset;    // What is the file offset
@@ -33,32 +33,277 @@ static char THIS_FILE[]=__FILE__;
 #define BLKGETSIZE64 DIOCGMEDIASIZE
 #endif
 
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
 #if !defined(_WIN32) && !defined(O_NOFOLLOW)
 #define O_NOFOLLOW 0
 #endif
 
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#ifdef HAVE_PWRITEV
+#include <sys/uio.h>
+#include <limits.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
+
+// Handles of files which were opened for reading, and have since been
+// closed, are kept open in a process-wide LRU cache. Reopening a file (for
+// its next block, on the next pass, or for repair after verification) then
+// needs only a stat of its name, to check that it's still the same version
+// of the same file (another process may have replaced or rewritten it since).
+// The number kept open is bounded by the process's open file limit, and
+// DiskFile drops a file's entry whenever it creates, renames or deletes it.
+namespace
+{
+#ifdef _WIN32
+  typedef HANDLE FileHandle;
+  void CloseFileHandle(HANDLE handle) { ::CloseHandle(handle); }
+
+  // Cached handles share reading, writing and deletion, so that other
+  // programs (and other operations in this one) can still replace, rename
+  // or delete the files. A file is therefore identified by its volume and
+  // index, as well as its size and modification time, as on POSIX.
+  struct FileIdentity
+  {
+    u64 volume;
+    u64 index;
+    u64 size;
+    u64 modified;
+
+    bool operator==(const FileIdentity &other) const
+    {
+      return volume == other.volume && index == other.index && size == other.size && modified == other.modified;
+    }
+  };
+
+  bool IdentifyHandle(HANDLE handle, FileIdentity &identity)
+  {
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!::GetFileInformationByHandle(handle, &info))
+      return false;
+    identity.volume = info.dwVolumeSerialNumber;
+    identity.index = ((u64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    identity.size = ((u64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    identity.modified = ((u64)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+    return true;
+  }
+
+  bool IdentifyName(const std::string &filename, FileIdentity &identity)
+  {
+    // Opening without access to the data is cheap (it isn't scanned, for
+    // instance), and is needed to learn the file's index
+    HANDLE handle = ::CreateFileW(utf8::Utf8ToWide(filename).c_str(), 0,
+                                  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  NULL, OPEN_EXISTING, 0, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+      return false;
+    bool ok = IdentifyHandle(handle, identity);
+    ::CloseHandle(handle);
+    return ok;
+  }
+#else
+  typedef int FileHandle;
+  void CloseFileHandle(int handle) { close(handle); }
+
+  struct FileIdentity
+  {
+    dev_t  device;
+    ino_t  inode;
+    off_t  size;
+    time_t modified;
+
+    bool operator==(const FileIdentity &other) const
+    {
+      return device == other.device && inode == other.inode && size == other.size && modified == other.modified;
+    }
+  };
+
+  void Identify(const struct stat &st, FileIdentity &identity)
+  {
+    identity.device = st.st_dev;
+    identity.inode = st.st_ino;
+    identity.size = st.st_size;
+    identity.modified = st.st_mtime;
+  }
+
+  bool IdentifyHandle(int handle, FileIdentity &identity)
+  {
+    struct stat st;
+    if (fstat(handle, &st) != 0)
+      return false;
+    Identify(st, identity);
+    return true;
+  }
+
+  bool IdentifyName(const std::string &filename, FileIdentity &identity)
+  {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+      return false;
+    Identify(st, identity);
+    return true;
+  }
+#endif
+
+  class FileHandleCache
+  {
+  public:
+    static FileHandleCache &Instance(void)
+    {
+      static FileHandleCache cache;
+      return cache;
+    }
+
+    // Take ownership of the cached handle for a file, if there is one and
+    // the file is as it was when the handle was cached
+    bool Take(const std::string &filename, FileHandle &handle)
+    {
+      FileIdentity identity;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(filename);
+        if (found == index.end())
+          return false;
+        handle = found->second->handle;
+        identity = found->second->identity;
+        entries.erase(found->second);
+        index.erase(found);
+      }
+
+      FileIdentity current;
+      if (!IdentifyName(filename, current) || !(current == identity))
+      {
+        CloseFileHandle(handle);
+        return false;
+      }
+      return true;
+    }
+
+    // Give a handle to the cache, closing the least recently used handle
+    // if it's full
+    void Put(const std::string &filename, FileHandle handle)
+    {
+      FileIdentity identity;
+      if (!IdentifyHandle(handle, identity))
+      {
+        CloseFileHandle(handle);
+        return;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (capacity == 0 || index.count(filename))
+      {
+        // only one handle is kept per file
+        CloseFileHandle(handle);
+        return;
+      }
+      if (entries.size() >= capacity)
+      {
+        CloseFileHandle(entries.back().handle);
+        index.erase(entries.back().filename);
+        entries.pop_back();
+      }
+      entries.push_front(Entry{filename, handle, identity});
+      index[filename] = entries.begin();
+    }
+
+    // Close the cached handle for a file, if there is one
+    void Remove(const std::string &filename)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = index.find(filename);
+      if (found == index.end())
+        return;
+      CloseFileHandle(found->second->handle);
+      entries.erase(found->second);
+      index.erase(found);
+    }
+
+    void Clear(void)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &entry : entries)
+        CloseFileHandle(entry.handle);
+      entries.clear();
+      index.clear();
+    }
+
+  private:
+    FileHandleCache(void)
+    {
+#ifdef _WIN32
+      capacity = 1024;
+#else
+      // Leave most of the allowance for files which are actually in use,
+      // and for whatever else the process has open
+      struct rlimit limit;
+      if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+        capacity = 1024;
+      else
+        capacity = std::min((size_t)limit.rlim_cur / 2, (size_t)65536);
+#endif
+    }
+    ~FileHandleCache(void)
+    {
+      Clear();
+    }
+
+    struct Entry
+    {
+      std::string  filename;
+      FileHandle   handle;
+      FileIdentity identity;  // Of the file when the handle was cached
+    };
+    typedef std::list<Entry> Entries;
+
+    std::mutex mutex;
+    Entries entries;  // most recently used first
+    std::map<std::string, Entries::iterator> index;
+    size_t capacity;
+  };
+}
+
 
 #ifdef _WIN32
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "utf8.h"
 #include <cwctype>
+#include <winioctl.h>
 
 #define OffsetType __int64
 #define MaxOffset 0x7fffffffffffffffI64
 
-DiskFile::DiskFile(std::ostream &sout, std::ostream &serr, std::mutex &serr_lock)
+DiskFile::DiskFile(std::ostream &sout, std::ostream &serr, std::mutex &serr_lock,
+                   const FileAccess &access)
 : sout(&sout)
 , serr(&serr)
 , serr_lock(&serr_lock)
+, access(access)
 {
   filename = "";
   filesize = 0;
-  offset = 0;
 
   hFile = INVALID_HANDLE_VALUE;
+  reusable = false;
+  holes = -1;
+  direct = false;
 
   exists = false;
+  provided = 0;
 }
 
 
@@ -66,6 +311,7 @@ DiskFile::~DiskFile(void)
 {
   if (hFile != INVALID_HANDLE_VALUE)
     ::CloseHandle(hFile);
+  delete provided;
 }
 
 bool DiskFile::CreateParentDirectory(std::string _pathname)
@@ -115,6 +361,13 @@ bool DiskFile::Create(std::string _filename, u64 _filesize)
 
   filename = _filename;
   filesize = _filesize;
+  reusable = false;
+  holes = -1;
+
+  FileHandleCache::Instance().Remove(filename);
+
+  if (FileProvider *owner = ProviderFor(filename))
+    return CreateProvided(owner, _filesize);
 
   if (!DiskFile::CreateParentDirectory(filename))
     return false;
@@ -134,6 +387,27 @@ bool DiskFile::Create(std::string _filename, u64 _filesize)
 
   if (filesize > 0)
   {
+    // Reserve the space up front, so that the file isn't fragmented by being
+    // written out of order, and a lack of space is found now rather than
+    // part way through. Other failures (e.g. a filesystem which can't do
+    // this) are left for SetEndOfFile to deal with.
+    FILE_ALLOCATION_INFO allocation;
+    allocation.AllocationSize.QuadPart = filesize;
+    if (!::SetFileInformationByHandle(hFile, FileAllocationInfo, &allocation, sizeof(allocation))
+        && ::GetLastError() == ERROR_DISK_FULL)
+    {
+      {
+        std::lock_guard<std::mutex> lock(*serr_lock);
+        *serr << "Could not set size of \"" << _filename << "\": " << ErrorMessage(ERROR_DISK_FULL) << std::endl;
+      }
+
+      ::CloseHandle(hFile);
+      hFile = INVALID_HANDLE_VALUE;
+      ::DeleteFileW(wfilename.c_str());
+
+      return false;
+    }
+
     // Seek to the end of the file
     LONG* ptrfilesize = (LONG*)&filesize;
     LONG lowoffset = ptrfilesize[0];
@@ -173,8 +447,6 @@ bool DiskFile::Create(std::string _filename, u64 _filesize)
     }
   }
 
-  offset = filesize;
-
   exists = true;
   return true;
 }
@@ -183,27 +455,10 @@ bool DiskFile::Create(std::string _filename, u64 _filesize)
 
 bool DiskFile::Write(u64 _offset, const void *buffer, size_t length, LengthType maxlength)
 {
-  assert(hFile != INVALID_HANDLE_VALUE);
-
-  if (offset != _offset)
-  {
-    LONG* ptroffset = (LONG*)&_offset;
-    LONG lowoffset = ptroffset[0];
-    LONG highoffset = ptroffset[1];
-
-    // Seek to the required offset
-    if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, lowoffset, &highoffset, FILE_BEGIN))
-    {
-      DWORD error = ::GetLastError();
-
-      std::lock_guard<std::mutex> lock(*serr_lock);
-      *serr << "Could not write " << (u64)length << " bytes to \"" << filename << "\" at offset " << _offset << ": " << ErrorMessage(error) << std::endl;
-
-      return false;
-    }
-    offset = _offset;
-  }
+  if (provided)
+    return WriteProvided(_offset, buffer, length);
 
+  assert(hFile != INVALID_HANDLE_VALUE);
 
   while (length > 0) {
 
@@ -214,8 +469,13 @@ bool DiskFile::Write(u64 _offset, const void *buffer, size_t length, LengthType
       write = (LengthType) length;
     DWORD wrote = 0;
 
-    // Write the data
-    if (!::WriteFile(hFile, buffer, write, &wrote, NULL))
+    // Write the data at the required offset, without using (or disturbing)
+    // a shared file pointer
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)_offset;
+    overlapped.OffsetHigh = (DWORD)(_offset >> 32);
+    if (!::WriteFile(hFile, buffer, write, &wrote, &overlapped))
     {
       DWORD error = ::GetLastError();
 
@@ -231,19 +491,34 @@ bool DiskFile::Write(u64 _offset, const void *buffer, size_t length, LengthType
       *serr << "INFO: Incomplete write to \"" << filename << "\" at offset " << _offset << ".  Expected to write " << write << " bytes and wrote " << wrote << " bytes." << std::endl;
     }
 
-    offset += wrote;
+    _offset += wrote;
     length -= wrote;
     buffer = ((char *) buffer) + wrote;
 
-    if (filesize < offset)
+    if (filesize < _offset)
     {
-      filesize = offset;
+      filesize = _offset;
     }
   }
 
   return true;
 }
 
+// Write several buffers to consecutive ranges of the file. Windows can only
+// gather page-sized buffers (for unbuffered I/O), so they're written in turn.
+
+bool DiskFile::WriteV(u64 _offset, const WriteBuffer *buffers, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    if (!Write(_offset, buffers[i].buffer, buffers[i].length))
+      return false;
+    _offset += buffers[i].length;
+  }
+
+  return true;
+}
+
 // Open the file
 
 bool DiskFile::Open(const std::string &_filename, u64 _filesize)
@@ -252,9 +527,24 @@ bool DiskFile::Open(const std::string &_filename, u64 _filesize)
 
   filename = _filename;
   filesize = _filesize;
+  reusable = true;
+  holes = -1;
+
+  if (FileProvider *owner = ProviderFor(filename))
+    return OpenProvided(owner);
+
+  if (FileHandleCache::Instance().Take(filename, hFile))
+  {
+    exists = true;
+    return true;
+  }
 
   std::wstring wfilename = utf8::Utf8ToWide(_filename);
-  hFile = ::CreateFileW(wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+  DWORD flags = access.cachepolicy != cpNormal ? FILE_FLAG_SEQUENTIAL_SCAN : 0;
+  // (the handle may be cached when the file is closed, so it mustn't stop
+  // anyone else from changing the file: see FileHandleCache)
+  hFile = ::CreateFileW(wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL, OPEN_EXISTING, flags, NULL);
   if (hFile == INVALID_HANDLE_VALUE)
   {
     DWORD error = ::GetLastError();
@@ -272,7 +562,6 @@ bool DiskFile::Open(const std::string &_filename, u64 _filesize)
     return false;
   }
 
-  offset = 0;
   exists = true;
 
   return true;
@@ -282,26 +571,10 @@ bool DiskFile::Open(const std::string &_filename, u64 _filesize)
 
 bool DiskFile::Read(u64 _offset, void *buffer, size_t length, LengthType maxlength)
 {
-  assert(hFile != INVALID_HANDLE_VALUE);
-
-  if (offset != _offset)
-  {
-    LONG* ptroffset = (LONG*)&_offset;
-    LONG lowoffset = ptroffset[0];
-    LONG highoffset = ptroffset[1];
-
-    // Seek to the required offset
-    if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, lowoffset, &highoffset, FILE_BEGIN))
-    {
-      DWORD error = ::GetLastError();
-
-      std::lock_guard<std::mutex> lock(*serr_lock);
-      *serr << "Could not read " << (u64)length << " bytes from \"" << filename << "\" at offset " << _offset << ": " << ErrorMessage(error) << std::endl;
+  if (provided)
+    return ReadProvided(_offset, buffer, length);
 
-      return false;
-    }
-    offset = _offset;
-  }
+  assert(hFile != INVALID_HANDLE_VALUE);
 
   while (length > 0) {
 
@@ -312,8 +585,13 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length, LengthType maxleng
       want = (LengthType)length;
     DWORD got = 0;
 
-    // Read the data
-    if (!::ReadFile(hFile, buffer, want, &got, NULL))
+    // Read the data from the required offset, without using (or disturbing)
+    // a shared file pointer
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)_offset;
+    overlapped.OffsetHigh = (DWORD)(_offset >> 32);
+    if (!::ReadFile(hFile, buffer, want, &got, &overlapped))
     {
       DWORD error = ::GetLastError();
 
@@ -326,10 +604,14 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length, LengthType maxleng
     if (want != got)
     {
       std::lock_guard<std::mutex> lock(*serr_lock);
-      *serr << "Incomplete read from \"" << filename << "\" at offset " << offset << ".  Tried to read " << want << " bytes and received " << got << " bytes." << std::endl;
+      *serr << "Incomplete read from \"" << filename << "\" at offset " << _offset << ".  Tried to read " << want << " bytes and received " << got << " bytes." << std::endl;
+
+      // Nothing more to come if the end of the file has been reached
+      if (got == 0)
+        return false;
     }
 
-    offset += got;
+    _offset += got;
     length -= got;
     buffer = ((char *) buffer) + got;
 
@@ -341,13 +623,95 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length, LengthType maxleng
 
 void DiskFile::Close(void)
 {
+  delete provided;
+  provided = 0;
+
   if (hFile != INVALID_HANDLE_VALUE)
   {
-    ::CloseHandle(hFile);
+    if (reusable)
+    {
+      FileHandleCache::Instance().Put(filename, hFile);
+      if (access.cachedfiles)
+        access.cachedfiles->Add(filename);
+    }
+    else
+      ::CloseHandle(hFile);
     hFile = INVALID_HANDLE_VALUE;
   }
 }
 
+bool DiskFile::OpenCached(const std::string &_filename)
+{
+  assert(hFile == INVALID_HANDLE_VALUE);
+
+  HANDLE handle;
+  if (!FileHandleCache::Instance().Take(_filename, handle))
+    return false;
+
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(handle, &size))
+  {
+    ::CloseHandle(handle);
+    return false;
+  }
+
+  hFile = handle;
+  filename = _filename;
+  filesize = size.QuadPart;
+  reusable = true;
+  holes = -1;
+  exists = true;
+  return true;
+}
+
+// Windows has no equivalent of posix_fadvise, so files opened for reading are
+// just flagged as being scanned sequentially
+void DiskFile::WillNeed(u64, u64)
+{
+}
+
+void DiskFile::DontNeed(u64, u64)
+{
+}
+
+void DiskFile::FlushBehind(bool)
+{
+}
+
+// The only equivalent is block cloning on ReFS, so data is always copied by
+// the caller
+bool DiskFile::CopyFrom(DiskFile &, u64, u64, u64)
+{
+  return false;
+}
+
+bool DiskFile::IsHole(u64 _offset, u64 length)
+{
+  if (hFile == INVALID_HANDLE_VALUE || length == 0)
+    return false;
+  if (_offset >= filesize)
+    return true;
+
+  // Only files flagged as sparse can have holes
+  if (holes < 0)
+  {
+    BY_HANDLE_FILE_INFORMATION info;
+    holes = ::GetFileInformationByHandle(hFile, &info) && (info.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) ? 1 : 0;
+  }
+  if (holes == 0)
+    return false;
+
+  // The range is a hole if no part of it is allocated. If more than one part
+  // is, the call fails with ERROR_MORE_DATA, which comes to the same thing.
+  FILE_ALLOCATED_RANGE_BUFFER query, range;
+  query.FileOffset.QuadPart = _offset;
+  query.Length.QuadPart = std::min(length, filesize - _offset);
+  DWORD got = 0;
+  if (!::DeviceIoControl(hFile, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), &range, sizeof(range), &got, NULL))
+    return false;
+  return got == 0;
+}
+
 std::string DiskFile::GetCanonicalPathname(std::string filename)
 {
   std::wstring wfilename = utf8::Utf8ToWide(filename);
@@ -375,7 +739,8 @@ std::string DiskFile::GetCanonicalPathname(std::string filename)
   return utf8::WideToUtf8(wfullname.get());
 }
 
-std::unique_ptr< std::list<std::string> > DiskFile::FindFiles(std::string path, std::string wildcard, bool recursive)
+std::unique_ptr< std::list<std::string> > DiskFile::FindFiles(std::string path, std::string wildcard, bool recursive,
+                                                               FileProvider *provider)
 {
   // check path, if not ending with path separator, add one
   char pathend = *path.rbegin();
@@ -385,6 +750,12 @@ std::unique_ptr< std::list<std::string> > DiskFile::FindFiles(std::string path,
   }
   std::list<std::string> *matches = new std::list<std::string>;
 
+  if (FileProvider *owner = ProviderFor(provider, path))
+  {
+    owner->FindFiles(path, wildcard, recursive, *matches);
+    return std::unique_ptr< std::list<std::string> >(matches);
+  }
+
   std::wstring wwildcard = utf8::Utf8ToWide(path + wildcard);
   WIN32_FIND_DATAW fd;
   HANDLE h = ::FindFirstFileW(wwildcard.c_str(), &fd);
@@ -417,8 +788,12 @@ std::unique_ptr< std::list<std::string> > DiskFile::FindFiles(std::string path,
   return std::unique_ptr< std::list<std::string> >(matches);
 }
 
-u64 DiskFile::GetFileSize(std::string filename)
+u64 DiskFile::GetFileSize(std::string filename, FileProvider *provider)
 {
+  u64 filesize, filetime;
+  if (FileProvider *owner = ProviderFor(provider, filename))
+    return owner->Stat(filename, filesize, filetime) ? filesize : 0;
+
   std::wstring wfilename = utf8::Utf8ToWide(filename);
   struct _stati64 st;
   if ((0 == _wstati64(wfilename.c_str(), &st)) && (0 != (st.st_mode & S_IFREG)))
@@ -431,51 +806,93 @@ u64 DiskFile::GetFileSize(std::string filename)
   }
 }
 
-bool DiskFile::FileExists(std::string filename)
+bool DiskFile::FileExists(std::string filename, FileProvider *provider)
 {
+  u64 filesize, filetime;
+  if (FileProvider *owner = ProviderFor(provider, filename))
+    return owner->Stat(filename, filesize, filetime);
+
   std::wstring wfilename = utf8::Utf8ToWide(filename);
   struct _stati64 st;
   return ((0 == _wstati64(wfilename.c_str(), &st)) && (0 != (st.st_mode & _S_IFREG))); 
 }
 
+u64 DiskFile::GetFileTime(const std::string &filename, FileProvider *provider)
+{
+  u64 filesize, filetime;
+  if (FileProvider *owner = ProviderFor(provider, filename))
+    return owner->Stat(filename, filesize, filetime) ? filetime : 0;
+
+  // (_wstati64 only has whole seconds, so a file rewritten within the same
+  // second would look unchanged)
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!::GetFileAttributesExW(utf8::Utf8ToWide(filename).c_str(), GetFileExInfoStandard, &data))
+    return 0;
+
+  // in 100ns units since 1601, which is turned into nanoseconds since 1970,
+  // as elsewhere (anything older is treated as being from 1970)
+  const u64 unixepoch = 116444736000000000ULL;
+  u64 modified = ((u64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+  return modified > unixepoch ? (modified - unixepoch) * 100 : 1;
+}
+
+u64 DiskFile::GetDeviceId(const std::string &filename, FileProvider *provider)
+{
+  if (ProviderFor(provider, filename))
+    return UnknownDevice;
+
+  std::wstring wfilename = utf8::Utf8ToWide(filename);
+  struct _stati64 st;
+  if (0 == _wstati64(wfilename.c_str(), &st))
+    return st.st_dev;
+  else
+    return UnknownDevice;
+}
+
+u32 DiskFile::GetDeviceStreamLimit(u64 deviceid, u32 maxstreams)
+{
+  // no cheap way to determine whether a volume incurs a seek penalty
+  return maxstreams;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #else // !_WIN32
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#ifdef HAVE_FSEEKO
-# define OffsetType off_t
-# define MaxOffset ((off_t)0x7fffffffffffffffULL)
-# define fseek fseeko
-#else
-# if _FILE_OFFSET_BITS == 64
-#  define OffsetType unsigned long long
-#  define MaxOffset 0x7fffffffffffffffULL
-# else
-#  define OffsetType long
-#  define MaxOffset 0x7fffffffUL
-# endif
-#endif
+// Files are accessed with pread/pwrite, which take an off_t offset
+#define OffsetType off_t
+#define MaxOffset ((off_t)(sizeof(off_t) >= 8 ? 0x7fffffffffffffffULL : 0x7fffffffUL))
 
+// Largest amount transferred through a bounce buffer at a time, for direct
+// I/O which isn't suitably aligned
+#define DIRECT_IO_BOUNCE_SIZE 1048576
 
-DiskFile::DiskFile(std::ostream &sout, std::ostream &serr, std::mutex &serr_lock)
+
+DiskFile::DiskFile(std::ostream &sout, std::ostream &serr, std::mutex &serr_lock,
+                   const FileAccess &access)
 : sout(&sout)
 , serr(&serr)
 , serr_lock(&serr_lock)
+, access(access)
 {
   //filename;
   filesize = 0;
-  offset = 0;
 
-  file = 0;
+  fd = -1;
+  reusable = false;
+  holes = -1;
+  direct = false;
 
   exists = false;
+  provided = 0;
 }
 
 
 DiskFile::~DiskFile(void)
 {
-  if (file != 0)
-    fclose(file);
+  if (fd >= 0)
+    close(fd);
+  delete provided;
 }
 
 bool DiskFile::CreateParentDirectory(std::string _pathname)
@@ -514,10 +931,17 @@ bool DiskFile::CreateParentDirectory(std::string _pathname)
 // space on disk for it.
 bool DiskFile::Create(std::string _filename, u64 _filesize)
 {
-  assert(file == 0);
+  assert(fd < 0);
 
   filename = _filename;
   filesize = _filesize;
+  reusable = false;
+  holes = -1;
+
+  FileHandleCache::Instance().Remove(filename);
+
+  if (FileProvider *owner = ProviderFor(filename))
+    return CreateProvided(owner, _filesize);
 
   if (!DiskFile::CreateParentDirectory(filename))
     return false;
@@ -529,7 +953,9 @@ bool DiskFile::Create(std::string _filename, u64 _filesize)
     return false;
   }
 
-  int fd = open(_filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  // Unaligned direct writes need to read back what's around them
+  int mode = access.directio ? O_RDWR : O_WRONLY;
+  fd = open(_filename.c_str(), mode | O_CREAT | O_EXCL | O_NOFOLLOW, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
   if (fd < 0)
   {
     std::lock_guard<std::mutex> lock(*serr_lock);
@@ -538,50 +964,40 @@ bool DiskFile::Create(std::string _filename, u64 _filesize)
     return false;
   }
 
-  file = fdopen(fd, "wb");
-  if (file == 0)
-  {
-    int savederrno = errno;
-    close(fd);
-    ::remove(filename.c_str());
-    errno = savederrno;
-
-    std::lock_guard<std::mutex> lock(*serr_lock);
-    *serr << "Could not create " << _filename << ": " << strerror(errno) << std::endl;
-
-    return false;
-  }
-
   if (_filesize > 0)
   {
-    if (fseek(file, (OffsetType)_filesize-1, SEEK_SET))
-    {
-      {
-        std::lock_guard<std::mutex> lock(*serr_lock);
-        *serr << "Could not set end of file of " << _filename << ": " << strerror(errno) << std::endl;
-      }
+    // Reserve the space up front, so that the file isn't fragmented by being
+    // written out of order, and a lack of space is found now rather than
+    // part way through. (glibc's posix_fallocate falls back to writing every
+    // block, which would be too slow, hence fallocate where there is one.)
+    int error = EOPNOTSUPP;
+#if defined(HAVE_FALLOCATE)
+    do
+      error = fallocate(fd, 0, 0, (OffsetType)_filesize) == 0 ? 0 : errno;
+    while (error == EINTR);
+#elif defined(HAVE_POSIX_FALLOCATE)
+    error = posix_fallocate(fd, 0, (OffsetType)_filesize);
+#endif
 
-      fclose(file);
-      file = 0;
-      ::remove(filename.c_str());
-      return false;
-    }
+    // Otherwise, just set the size
+    if (error == EOPNOTSUPP || error == ENOSYS || error == EINVAL)
+      error = 1 == pwrite(fd, &_filesize, 1, (OffsetType)_filesize-1) ? 0 : errno;
 
-    if (1 != fwrite(&_filesize, 1, 1, file))
+    if (error != 0)
     {
       {
         std::lock_guard<std::mutex> lock(*serr_lock);
-        *serr << "Could not set end of file of " << _filename << ": " << strerror(errno) << std::endl;
+        *serr << "Could not set end of file of " << _filename << ": " << strerror(error) << std::endl;
       }
 
-      fclose(file);
-      file = 0;
+      close(fd);
+      fd = -1;
       ::remove(filename.c_str());
       return false;
     }
   }
 
-  offset = filesize;
+  direct = access.directio && EnableDirect();
 
   exists = true;
   return true;
@@ -591,25 +1007,16 @@ bool DiskFile::Create(std::string _filename, u64 _filesize)
 
 bool DiskFile::Write(u64 _offset, const void *buffer, size_t length, LengthType maxlength)
 {
-  assert(file != 0);
+  if (provided)
+    return WriteProvided(_offset, buffer, length);
 
-  if (offset != _offset)
-  {
-    if (_offset > (u64)MaxOffset)
-    {
-        std::lock_guard<std::mutex> lock(*serr_lock);
-        *serr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << std::endl;
-      return false;
-    }
+  assert(fd >= 0);
 
-
-    if (fseek(file, (OffsetType)_offset, SEEK_SET))
-    {
-      std::lock_guard<std::mutex> lock(*serr_lock);
-      *serr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << ": " << strerror(errno) << std::endl;
-      return false;
-    }
-    offset = _offset;
+  if (_offset > (u64)MaxOffset || length > (u64)MaxOffset - _offset)
+  {
+    std::lock_guard<std::mutex> lock(*serr_lock);
+    *serr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << std::endl;
+    return false;
   }
 
   while (length > 0) {
@@ -620,22 +1027,102 @@ bool DiskFile::Write(u64 _offset, const void *buffer, size_t length, LengthType
     else
       write = length;
 
-    LengthType wrote = fwrite(buffer, 1, write, file);
-    if (wrote != write)
+    ssize_t wrote = direct ? DirectWrite(_offset, buffer, write) : pwrite(fd, buffer, write, (OffsetType)_offset);
+    if (wrote <= 0)
     {
+      if (wrote < 0 && errno == EINTR)
+        continue;
+
       std::lock_guard<std::mutex> lock(*serr_lock);
       *serr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << ": " << strerror(errno) << std::endl;
       return false;
     }
 
-    offset += wrote;
+    _offset += wrote;
     length -= wrote;
     buffer = ((char *) buffer) + wrote;
 
-    if (filesize < offset)
+    if (filesize < _offset)
+    {
+      filesize = _offset;
+    }
+  }
+
+  return true;
+}
+
+// Write several buffers to consecutive ranges of the file
+
+bool DiskFile::WriteV(u64 _offset, const WriteBuffer *buffers, size_t count)
+{
+  assert(fd >= 0 || provided);
+
+#ifdef HAVE_PWRITEV
+  // Direct I/O needs every buffer to be aligned, which is left to Write (as
+  // are provided files)
+  if (!direct && !provided)
+  {
+    u64 length = 0;
+    std::vector<struct iovec> iov(count);
+    for (size_t i = 0; i < count; i++)
     {
-      filesize = offset;
+      iov[i].iov_base = const_cast<void*>(buffers[i].buffer);
+      iov[i].iov_len = buffers[i].length;
+      length += buffers[i].length;
+    }
+
+    if (_offset > (u64)MaxOffset || length > (u64)MaxOffset - _offset)
+    {
+      std::lock_guard<std::mutex> lock(*serr_lock);
+      *serr << "Could not write " << length << " bytes to " << filename << " at offset " << _offset << std::endl;
+      return false;
+    }
+
+    size_t first = 0;
+    while (length > 0)
+    {
+      int iovcount = (int)std::min(count - first, (size_t)IOV_MAX);
+      ssize_t wrote = pwritev(fd, &iov[first], iovcount, (OffsetType)_offset);
+      if (wrote <= 0)
+      {
+        if (wrote < 0 && errno == EINTR)
+          continue;
+
+        std::lock_guard<std::mutex> lock(*serr_lock);
+        *serr << "Could not write " << length << " bytes to " << filename << " at offset " << _offset << ": " << strerror(errno) << std::endl;
+        return false;
+      }
+
+      _offset += wrote;
+      length -= wrote;
+
+      if (filesize < _offset)
+      {
+        filesize = _offset;
+      }
+
+      // Move on past whatever was written
+      while (first < count && (size_t)wrote >= iov[first].iov_len)
+      {
+        wrote -= iov[first].iov_len;
+        first++;
+      }
+      if (wrote > 0)
+      {
+        iov[first].iov_base = (char*)iov[first].iov_base + wrote;
+        iov[first].iov_len -= wrote;
+      }
     }
+
+    return true;
+  }
+#endif
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (!Write(_offset, buffers[i].buffer, buffers[i].length))
+      return false;
+    _offset += buffers[i].length;
   }
 
   return true;
@@ -645,11 +1132,14 @@ bool DiskFile::Write(u64 _offset, const void *buffer, size_t length, LengthType
 
 bool DiskFile::Open(const std::string &_filename, u64 _filesize)
 {
-  assert(file == 0);
+  assert(fd < 0);
 
   filename = _filename;
   filesize = _filesize;
 
+  if (FileProvider *owner = ProviderFor(filename))
+    return OpenProvided(owner);
+
   if (_filesize > (u64)MaxOffset)
   {
     std::lock_guard<std::mutex> lock(*serr_lock);
@@ -657,13 +1147,23 @@ bool DiskFile::Open(const std::string &_filename, u64 _filesize)
     return false;
   }
 
-  file = fopen(filename.c_str(), "rb");
-  if (file == 0)
+  reusable = true;
+  holes = -1;
+  if (!FileHandleCache::Instance().Take(filename, fd))
   {
-    return false;
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      return false;
+    }
   }
 
-  offset = 0;
+#ifdef HAVE_POSIX_FADVISE
+  if (access.cachepolicy != cpNormal)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  direct = access.directio && EnableDirect();
+
   exists = true;
 
   return true;
@@ -673,28 +1173,18 @@ bool DiskFile::Open(const std::string &_filename, u64 _filesize)
 
 bool DiskFile::Read(u64 _offset, void *buffer, size_t length, LengthType maxlength)
 {
-  assert(file != 0);
-
-  if (offset != _offset)
-  {
-    if (_offset > (u64)MaxOffset)
-    {
-      std::lock_guard<std::mutex> lock(*serr_lock);
-      *serr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << std::endl;
-      return false;
-    }
+  if (provided)
+    return ReadProvided(_offset, buffer, length);
 
+  assert(fd >= 0);
 
-    if (fseek(file, (OffsetType)_offset, SEEK_SET))
-    {
-      std::lock_guard<std::mutex> lock(*serr_lock);
-      *serr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << ": " << strerror(errno) << std::endl;
-      return false;
-    }
-    offset = _offset;
+  if (_offset > (u64)MaxOffset || length > (u64)MaxOffset - _offset)
+  {
+    std::lock_guard<std::mutex> lock(*serr_lock);
+    *serr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << std::endl;
+    return false;
   }
 
-
   while (length > 0) {
 
     LengthType want;
@@ -703,17 +1193,20 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length, LengthType maxleng
     else
       want = length;
 
-    LengthType got = fread(buffer, 1, want, file);
-    if (got != want)
+    ssize_t got = direct ? DirectRead(_offset, buffer, want) : pread(fd, buffer, want, (OffsetType)_offset);
+    if (got <= 0)
     {
+      if (got < 0 && errno == EINTR)
+        continue;
+
       // NOTE: This can happen on error or when hitting the end-of-file.
 
       std::lock_guard<std::mutex> lock(*serr_lock);
-      *serr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << ": " << strerror(errno) << std::endl;
+      *serr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << ": " << (got < 0 ? strerror(errno) : "end of file") << std::endl;
       return false;
     }
 
-    offset += got;
+    _offset += got;
     length -= got;
     buffer = ((char *) buffer) + got;
 
@@ -725,11 +1218,320 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length, LengthType maxleng
 
 void DiskFile::Close(void)
 {
-  if (file != 0)
+  delete provided;
+  provided = 0;
+
+  if (fd >= 0)
+  {
+    if (reusable)
+    {
+      // The handle may next be used by an operation which accesses files
+      // differently, so it's cached as it would have been opened
+      if (direct)
+        DisableDirect();
+#ifdef HAVE_POSIX_FADVISE
+      if (access.cachepolicy != cpNormal)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_NORMAL);
+#endif
+      FileHandleCache::Instance().Put(filename, fd);
+      if (access.cachedfiles)
+        access.cachedfiles->Add(filename);
+    }
+    else
+      close(fd);
+    fd = -1;
+  }
+}
+
+bool DiskFile::OpenCached(const std::string &_filename)
+{
+  assert(fd < 0);
+
+  int handle;
+  if (!FileHandleCache::Instance().Take(_filename, handle))
+    return false;
+
+  struct stat st;
+  if (fstat(handle, &st) != 0 || (u64)st.st_size > (u64)MaxOffset)
+  {
+    close(handle);
+    return false;
+  }
+
+  fd = handle;
+  filename = _filename;
+  filesize = st.st_size;
+  reusable = true;
+  holes = -1;
+#ifdef HAVE_POSIX_FADVISE
+  if (access.cachepolicy != cpNormal)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  direct = access.directio && EnableDirect();
+  exists = true;
+  return true;
+}
+
+void DiskFile::WillNeed(u64 _offset, u64 length)
+{
+#ifdef HAVE_POSIX_FADVISE
+  if (access.cachepolicy != cpNormal && !direct && _offset < (u64)MaxOffset)
+    posix_fadvise(fd, (OffsetType)_offset, (OffsetType)std::min(length, (u64)MaxOffset - _offset), POSIX_FADV_WILLNEED);
+#endif
+}
+
+void DiskFile::DontNeed(u64 _offset, u64 length)
+{
+#ifdef HAVE_POSIX_FADVISE
+  if (access.cachepolicy == cpDrop && !direct && _offset < (u64)MaxOffset)
+    posix_fadvise(fd, (OffsetType)_offset, (OffsetType)std::min(length, (u64)MaxOffset - _offset), POSIX_FADV_DONTNEED);
+#endif
+}
+
+void DiskFile::FlushBehind(bool wait)
+{
+  if (access.cachepolicy != cpDrop || direct)
+    return;
+
+  // Dirty pages can't be dropped, so they need to be written out first
+#ifdef HAVE_SYNC_FILE_RANGE
+  if (wait)
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  else
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#else
+  if (wait)
+    fsync(fd);
+#endif
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+bool DiskFile::CopyFrom(DiskFile &source, u64 sourceoffset, u64 _offset, u64 length)
+{
+  // Only whole ranges within both files are copied, so the file size doesn't change
+  if (fd < 0 || source.fd < 0 || length == 0 ||
+      sourceoffset > source.filesize || length > source.filesize - sourceoffset ||
+      _offset > filesize || length > filesize - _offset)
+    return false;
+
+#ifdef FICLONERANGE
+  // Filesystems which share data between files can only do so a whole
+  // filesystem block at a time, at the same place within the block in both
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_blksize > 0 &&
+      (sourceoffset % st.st_blksize) == 0 && (_offset % st.st_blksize) == 0 && (length % st.st_blksize) == 0)
+  {
+    struct file_clone_range range;
+    range.src_fd = source.fd;
+    range.src_offset = sourceoffset;
+    range.src_length = length;
+    range.dest_offset = _offset;
+    if (ioctl(fd, FICLONERANGE, &range) == 0)
+      return true;
+  }
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+  // Otherwise, have the kernel copy the data (which fails between different
+  // filesystems, or where it isn't supported at all)
+  OffsetType in = (OffsetType)sourceoffset;
+  OffsetType out = (OffsetType)_offset;
+  while (length > 0)
+  {
+    ssize_t copied = copy_file_range(source.fd, &in, fd, &out, (size_t)std::min(length, (u64)MAX_LENGTH), 0);
+    if (copied < 0 && errno == EINTR)
+      continue;
+    if (copied <= 0)
+      return false;
+    length -= copied;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool DiskFile::IsHole(u64 _offset, u64 length)
+{
+  if (fd < 0 || length == 0)
+    return false;
+  if (_offset >= filesize)
+    return true;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  // Most files have no holes, which a single seek finds out (filesystems
+  // which don't track holes report just the one at the end of the file)
+  if (holes < 0)
+  {
+    off_t hole = lseek(fd, 0, SEEK_HOLE);
+    holes = hole >= 0 && (u64)hole < filesize ? 1 : 0;
+  }
+  if (holes == 0)
+    return false;
+
+  // The range is a hole if the next data is beyond it, or there is none
+  off_t data = lseek(fd, (OffsetType)_offset, SEEK_DATA);
+  if (data < 0)
+    return errno == ENXIO;
+  return (u64)data - _offset >= length;
+#else
+  return false;
+#endif
+}
+
+bool DiskFile::EnableDirect(void)
+{
+#if defined(O_DIRECT)
+  // Filesystems which can't do direct I/O refuse the flag
+  int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && ((flags & O_DIRECT) || fcntl(fd, F_SETFL, flags | O_DIRECT) == 0);
+#elif defined(F_NOCACHE)
+  // macOS can bypass its cache without any alignment requirements
+  fcntl(fd, F_NOCACHE, 1);
+  return false;
+#else
+  return false;
+#endif
+}
+
+void DiskFile::DisableDirect(void)
+{
+#if defined(O_DIRECT)
+  int flags = fcntl(fd, F_GETFL);
+  if (flags >= 0)
+    fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+#endif
+  direct = false;
+}
+
+ssize_t DiskFile::DirectRead(u64 _offset, void *buffer, size_t length)
+{
+  const size_t mask = DIRECT_IO_ALIGNMENT - 1;
+  ssize_t got;
+
+  if (((_offset | (uintptr_t)buffer) & mask) == 0 && length > mask)
+  {
+    // Read whatever is aligned straight into the buffer
+    got = pread(fd, buffer, length & ~mask, (OffsetType)_offset);
+  }
+  else
+  {
+    // Read the aligned region around the start of the request into a bounce
+    // buffer, and copy out the requested part. If the buffer is misaligned
+    // to the same extent as the offset, this only needs to go as far as the
+    // next aligned offset, as everything from there can be read directly.
+    u64 start = _offset & ~(u64)mask;
+    size_t skip = (size_t)(_offset - start);
+    size_t want = std::min(length, (size_t)DIRECT_IO_BOUNCE_SIZE - skip);
+    if ((((uintptr_t)buffer - skip) & mask) == 0)
+      want = std::min(want, DIRECT_IO_ALIGNMENT - skip);
+    size_t span = (skip + want + mask) & ~mask;
+
+    u8 *bounce;
+    ALIGN_ALLOC(bounce, span, DIRECT_IO_ALIGNMENT);
+    if (bounce == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    got = pread(fd, bounce, span, (OffsetType)start);
+    int error = errno;
+    if (got > 0)
+    {
+      // Nothing past the start of the request means the end of the file
+      got = (size_t)got > skip ? (ssize_t)std::min(want, (size_t)got - skip) : 0;
+      memcpy(buffer, bounce + skip, got);
+    }
+    ALIGN_FREE(bounce);
+    errno = error;
+  }
+
+  // Some filesystems only refuse direct I/O when it's attempted
+  if (got < 0 && errno == EINVAL)
+  {
+    DisableDirect();
+    return pread(fd, buffer, length, (OffsetType)_offset);
+  }
+  return got;
+}
+
+ssize_t DiskFile::DirectWrite(u64 _offset, const void *buffer, size_t length)
+{
+  const size_t mask = DIRECT_IO_ALIGNMENT - 1;
+  ssize_t wrote;
+
+  if (((_offset | (uintptr_t)buffer) & mask) == 0 && length > mask)
+  {
+    wrote = pwrite(fd, buffer, length & ~mask, (OffsetType)_offset);
+  }
+  else
+  {
+    // Merge the data into the aligned region around the start of the
+    // request, and write the whole region (see DirectRead)
+    u64 start = _offset & ~(u64)mask;
+    size_t skip = (size_t)(_offset - start);
+    size_t want = std::min(length, (size_t)DIRECT_IO_BOUNCE_SIZE - skip);
+    if ((((uintptr_t)buffer - skip) & mask) == 0)
+      want = std::min(want, DIRECT_IO_ALIGNMENT - skip);
+    size_t span = (skip + want + mask) & ~mask;
+
+    u8 *bounce;
+    ALIGN_ALLOC(bounce, span, DIRECT_IO_ALIGNMENT);
+    if (bounce == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    // Only the first and last blocks of the region can be partly written,
+    // but it's simpler (and no slower) to read the whole region back
+    wrote = 0;
+    if (skip > 0 || ((skip + want) & mask) != 0)
+    {
+      ssize_t got;
+      do
+        got = pread(fd, bounce, span, (OffsetType)start);
+      while (got < 0 && errno == EINTR);
+      if (got < 0)
+        wrote = -1;
+      else if ((size_t)got < span)
+        memset(bounce + got, 0, span - got);
+    }
+
+    if (wrote == 0)
+    {
+      memcpy(bounce + skip, buffer, want);
+      wrote = pwrite(fd, bounce, span, (OffsetType)start);
+      if (wrote > 0)
+      {
+        // Writing the whole of the last block may have extended the file
+        u64 end = std::max(filesize, _offset + want);
+        if (start + wrote > end && ftruncate(fd, (OffsetType)end) != 0)
+          wrote = -1;
+        else if ((size_t)wrote > skip)
+          wrote = (ssize_t)std::min(want, (size_t)wrote - skip);
+        else
+        {
+          errno = EIO;
+          wrote = -1;
+        }
+      }
+    }
+    int error = errno;
+    ALIGN_FREE(bounce);
+    errno = error;
+  }
+
+  if (wrote < 0 && errno == EINVAL)
   {
-    fclose(file);
-    file = 0;
+    DisableDirect();
+    return pwrite(fd, buffer, length, (OffsetType)_offset);
   }
+  return wrote;
 }
 
 // Attempt to get the full pathname of the file
@@ -805,7 +1607,8 @@ std::string DiskFile::GetCanonicalPathname(std::string filename)
   return result;
 }
 
-std::unique_ptr< std::list<std::string> > DiskFile::FindFiles(std::string path, std::string wildcard, bool recursive)
+std::unique_ptr< std::list<std::string> > DiskFile::FindFiles(std::string path, std::string wildcard, bool recursive,
+                                                               FileProvider *provider)
 {
   // check path, if not ending with path separator, add one
   char pathend = *path.rbegin();
@@ -815,6 +1618,12 @@ std::unique_ptr< std::list<std::string> > DiskFile::FindFiles(std::string path,
   }
   std::list<std::string> *matches = new std::list<std::string>;
 
+  if (FileProvider *owner = ProviderFor(provider, path))
+  {
+    owner->FindFiles(path, wildcard, recursive, *matches);
+    return std::unique_ptr< std::list<std::string> >(matches);
+  }
+
   std::string::size_type where;
 
   if ((where = wildcard.find_first_of('*')) != std::string::npos ||
@@ -932,8 +1741,12 @@ std::unique_ptr< std::list<std::string> > DiskFile::FindFiles(std::string path,
   return std::unique_ptr< std::list<std::string> >(matches);
 }
 
-u64 DiskFile::GetFileSize(std::string filename)
+u64 DiskFile::GetFileSize(std::string filename, FileProvider *provider)
 {
+  u64 filesize, filetime;
+  if (FileProvider *owner = ProviderFor(provider, filename))
+    return owner->Stat(filename, filesize, filetime) ? filesize : 0;
+
   struct stat st;
   if ((0 == stat(filename.c_str(), &st)) && (0 != (st.st_mode & S_IFREG)))
   {
@@ -945,11 +1758,70 @@ u64 DiskFile::GetFileSize(std::string filename)
   }
 }
 
-bool DiskFile::FileExists(std::string filename)
+bool DiskFile::FileExists(std::string filename, FileProvider *provider)
 {
+  u64 filesize, filetime;
+  if (FileProvider *owner = ProviderFor(provider, filename))
+    return owner->Stat(filename, filesize, filetime);
+
   struct stat st;
   return ((0 == stat(filename.c_str(), &st)) && (0 != (st.st_mode & S_IFREG)));
 }
+
+u64 DiskFile::GetFileTime(const std::string &filename, FileProvider *provider)
+{
+  u64 filesize, filetime;
+  if (FileProvider *owner = ProviderFor(provider, filename))
+    return owner->Stat(filename, filesize, filetime) ? filetime : 0;
+
+  struct stat st;
+  if (0 != stat(filename.c_str(), &st))
+    return 0;
+#if defined(__APPLE__)
+  return (u64)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  return (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+u64 DiskFile::GetDeviceId(const std::string &filename, FileProvider *provider)
+{
+  if (ProviderFor(provider, filename))
+    return UnknownDevice;
+
+  struct stat st;
+  if (0 == stat(filename.c_str(), &st))
+    return st.st_dev;
+  else
+    return UnknownDevice;
+}
+
+u32 DiskFile::GetDeviceStreamLimit(u64 deviceid, u32 maxstreams)
+{
+#ifdef __linux__
+  if (deviceid == UnknownDevice)
+    return maxstreams;
+
+  // the queue attributes belong to the whole disk, so for a partition, look at its parent
+  char path[64];
+  dev_t dev = (dev_t)deviceid;
+  snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational", major(dev), minor(dev));
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+  {
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational", major(dev), minor(dev));
+    fp = fopen(path, "r");
+  }
+  if (fp)
+  {
+    int rotational = fgetc(fp);
+    fclose(fp);
+    if (rotational == '1')
+      return 1;
+  }
+#endif
+  return maxstreams;
+}
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #endif
 
@@ -962,13 +1834,122 @@ bool DiskFile::Open(void)
 
 bool DiskFile::Open(const std::string &_filename)
 {
-  return Open(_filename, GetFileSize(_filename));
+  // A cached handle saves looking the file up again
+  if (OpenCached(_filename))
+    return true;
+
+  return Open(_filename, GetFileSize(_filename, access.provider));
+}
+
+void DiskFile::CloseCachedFiles(void)
+{
+  FileHandleCache::Instance().Clear();
+}
+
+void DiskFile::CloseCachedFile(const std::string &filename)
+{
+  FileHandleCache::Instance().Remove(filename);
+}
+
+CachedFileSet::~CachedFileSet(void)
+{
+  for (std::set<std::string>::const_iterator filename = filenames.begin(); filename != filenames.end(); ++filename)
+    FileHandleCache::Instance().Remove(*filename);
+}
+
+void CachedFileSet::Add(const std::string &filename)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  filenames.insert(filename);
 }
 
+// Files which belong to a provider
+
+bool DiskFile::CreateProvided(FileProvider *owner, u64 _filesize)
+{
+  provided = owner->Create(filename, _filesize);
+  if (!provided)
+  {
+    std::lock_guard<std::mutex> lock(*serr_lock);
+    *serr << "Could not create " << filename << std::endl;
+    return false;
+  }
+
+  reusable = false;
+  exists = true;
+  return true;
+}
+
+bool DiskFile::OpenProvided(FileProvider *owner)
+{
+  provided = owner->Open(filename);
+  if (!provided)
+    return false;
+
+  reusable = false;
+  exists = true;
+  return true;
+}
+
+bool DiskFile::ReadProvided(u64 _offset, void *buffer, size_t length)
+{
+  if (!provided->Read(_offset, buffer, length))
+  {
+    std::lock_guard<std::mutex> lock(*serr_lock);
+    *serr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool DiskFile::WriteProvided(u64 _offset, const void *buffer, size_t length)
+{
+  if (!provided->Write(_offset, buffer, length))
+  {
+    std::lock_guard<std::mutex> lock(*serr_lock);
+    *serr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << std::endl;
+    return false;
+  }
+
+  if (filesize < _offset + length)
+    filesize = _offset + length;
+
+  return true;
+}
+
+void DiskFile::ReportFailure(bool write, u64 _offset, size_t length, const char *reason)
+{
+  std::lock_guard<std::mutex> lock(*serr_lock);
+  if (write)
+    *serr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << ": " << reason << std::endl;
+  else
+    *serr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << ": " << reason << std::endl;
+}
+
+
 // Delete the file
 
 bool DiskFile::Delete(void)
 {
+  FileHandleCache::Instance().Remove(filename);
+
+  if (FileProvider *owner = ProviderFor(filename))
+  {
+    assert(!provided);
+
+    if (owner->Delete(filename))
+    {
+      exists = false;
+      return true;
+    }
+
+    std::lock_guard<std::mutex> lock(*serr_lock);
+    *serr << "Cannot delete " << filename << std::endl;
+
+    return false;
+  }
+
 #ifdef _WIN32
   assert(hFile == INVALID_HANDLE_VALUE);
 
@@ -979,7 +1960,7 @@ bool DiskFile::Delete(void)
     return true;
   }
 #else
-  assert(file == 0);
+  assert(fd < 0);
 
   if (filename.size() > 0 && 0 == unlink(filename.c_str()))
   {
@@ -1058,7 +2039,7 @@ bool DiskFile::Rename(void)
     wnewname = utf8::Utf8ToWide(newname);
 
     // Check if file exists using wide-character stat
-  } while (_wstati64(wnewname.c_str(), &st) == 0);
+  } while (ProviderFor(newname) ? FileExists(newname, access.provider) : _wstati64(wnewname.c_str(), &st) == 0);
 
   return Rename(newname);
 }
@@ -1081,7 +2062,7 @@ bool DiskFile::Rename(void)
       *serr << filename << " pathlength is more than " << _MAX_PATH << "." << std::endl;
       return false;
     }
-  } while (stat(newname.c_str(), &st) == 0);
+  } while (ProviderFor(newname) ? FileExists(newname, access.provider) : stat(newname.c_str(), &st) == 0);
 
   return Rename(newname);
 }
@@ -1118,10 +2099,14 @@ bool DiskFile::Rename(std::string _filename)
 {
   assert(hFile == INVALID_HANDLE_VALUE);
 
+  FileHandleCache::Instance().Remove(filename);
+  FileHandleCache::Instance().Remove(_filename);
+
   std::wstring wfilename = utf8::Utf8ToWide(filename);
   std::wstring _wfilename = utf8::Utf8ToWide(_filename);
 
-  if (::MoveFileW(wfilename.c_str(), _wfilename.c_str()))
+  FileProvider *owner = ProviderFor(filename);
+  if (owner ? owner->Rename(filename, _filename) : ::MoveFileW(wfilename.c_str(), _wfilename.c_str()))
   {
     filename.swap(_filename);
 
@@ -1136,9 +2121,13 @@ bool DiskFile::Rename(std::string _filename)
 #else
 bool DiskFile::Rename(std::string _filename)
 {
-  assert(file == 0);
+  assert(fd < 0);
+
+  FileHandleCache::Instance().Remove(filename);
+  FileHandleCache::Instance().Remove(_filename);
 
-  if (::rename(filename.c_str(), _filename.c_str()) == 0)
+  FileProvider *owner = ProviderFor(filename);
+  if (owner ? owner->Rename(filename, _filename) : ::rename(filename.c_str(), _filename.c_str()) == 0)
   {
     filename.swap(_filename);
 
@@ -1195,7 +2184,8 @@ DiskFile* DiskFileMap::Find(std::string filename) const
 }
 
 
-FileSizeCache::FileSizeCache()
+FileSizeCache::FileSizeCache(FileProvider *provider)
+: provider(provider)
 {
 }
 
@@ -1205,7 +2195,7 @@ u64 FileSizeCache::get(const std::string &filename) {
     return f->second;
 
   // go to disk
-  u64 filesize = DiskFile::GetFileSize(filename);
+  u64 filesize = DiskFile::GetFileSize(filename, provider);
 
   cache.insert(std::pair<std::string,u64>(filename, filesize));
   //  std::pair<std::map<std::string,u64>::const_iterator,bool> location = cache.insert(std::pair<std::string,u64>(filename, filesize));
@@ -1214,3 +2204,26 @@ u64 FileSizeCache::get(const std::string &filename) {
   //  }
   return filesize;
 }
+
+DeviceIdCache::DeviceIdCache(FileProvider *provider)
+: provider(provider)
+{
+}
+
+u64 DeviceIdCache::get(const std::string &filename)
+{
+  if (provider && provider->Owns(filename))
+    return DiskFile::UnknownDevice;
+
+  std::string path, name;
+  DiskFile::SplitFilename(filename, path, name);
+  std::map<std::string, u64>::const_iterator d = cache.find(path);
+  if (d != cache.end())
+    return d->second;
+
+  // (the directory's "." entry, as a path ending in a separator can't be
+  // looked up everywhere)
+  u64 device = DiskFile::GetDeviceId(path + ".");
+  cache.insert(std::pair<std::string,u64>(path, device));
+  return device;
+}
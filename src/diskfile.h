@@ -33,20 +33,74 @@
 #define LengthType size_t
 #endif
 
+// With direct I/O, transfers must be aligned to the device's block size in
+// offset, length and memory address. This is large enough for any common
+// device; transfers which aren't aligned to it go via a bounce buffer.
+#define DIRECT_IO_ALIGNMENT 4096
+
 
 #include <list>
 #include <map>
+#include <set>
 #include <vector>
 #include <memory>
 #include <mutex>
 
+#include "fileprovider.h"
+
+// The names of the files whose handles an operation has left in the
+// process-wide cache (see DiskFile::Close). When it's destroyed, just those
+// handles are closed, so that an operation doesn't hold files open once
+// it's over, without disturbing those of any other operation.
+class CachedFileSet
+{
+public:
+  CachedFileSet(void) {}
+  ~CachedFileSet(void);
+
+  void Add(const std::string &filename);
+
+private:
+  CachedFileSet(const CachedFileSet&) = delete;
+  CachedFileSet &operator=(const CachedFileSet&) = delete;
+
+  std::mutex mutex;
+  std::set<std::string> filenames;
+};
+
+// How an operation's files are accessed. Each operation (see Par2Creator
+// and Par2Repairer) has its own, which is given to every DiskFile it makes.
+struct FileAccess
+{
+  FileAccess(void) : directio(false), cachepolicy(cpNormal), provider(0), cachedfiles(0) {}
+
+  // Use direct I/O, so that data doesn't pass through (and evict everything
+  // else from) the OS's file cache. Files on filesystems which don't support
+  // it are accessed normally. Not supported on Windows.
+  bool        directio;
+
+  // How files make use of the OS's file cache (see CachePolicy)
+  CachePolicy cachepolicy;
+
+  // Access the files which the provider owns through it, rather than the
+  // filesystem (see FileProvider), or 0 if there's none. The provider
+  // belongs to the caller, and must outlive the operation and every
+  // DiskFile it's given to.
+  FileProvider *provider;
+
+  // Where the names of files whose handles are cached on closing are
+  // recorded, or 0 if the operation doesn't release them itself
+  CachedFileSet *cachedfiles;
+};
+
 // A disk file can be any type of file that par2cmdline needs
 // to read or write data from or to.
 
 class DiskFile
 {
 public:
-  DiskFile(std::ostream &sout, std::ostream &serr, std::mutex &serr_lock);
+  DiskFile(std::ostream &sout, std::ostream &serr, std::mutex &serr_lock,
+           const FileAccess &access = FileAccess());
   ~DiskFile(void);
 
   // Ensures the specified path's parent directory exists
@@ -57,9 +111,25 @@ public:
 
   // Write some data to the file
   // maxlength should be the default value, except during testing.
+  // Reads and writes are positional, so any number of threads may use the
+  // same open file at once (although writes which extend the file must not
+  // be concurrent, as they update the recorded file size, and nor may
+  // unaligned writes to the same DIRECT_IO_ALIGNMENT sized region when using
+  // direct I/O).
   bool Write(u64 offset, const void *buffer, size_t length,
 	     LengthType maxlength = MAX_LENGTH);
 
+  // A buffer to be written as part of a vectored write
+  struct WriteBuffer
+  {
+    const void *buffer;
+    size_t      length;
+  };
+
+  // Write several buffers, one after the other, to the file starting at the
+  // specified offset, using as few system calls as possible
+  bool WriteV(u64 offset, const WriteBuffer *buffers, size_t count);
+
   // Open the file
   bool Open(void);
   bool Open(const std::string &filename);
@@ -67,19 +137,64 @@ public:
 
   // Check to see if the file is open
 #ifdef _WIN32
-  bool IsOpen(void) const {return hFile != INVALID_HANDLE_VALUE;}
+  bool IsOpen(void) const {return hFile != INVALID_HANDLE_VALUE || provided != 0;}
 #else
-  bool IsOpen(void) const {return file != 0;}
+  bool IsOpen(void) const {return fd >= 0 || provided != 0;}
 #endif
 
   // Read some data from the file
   // maxlength should be the default value, except during testing.
+  // May be called concurrently from multiple threads.
   bool Read(u64 offset, void *buffer, size_t length,
 	    LengthType maxlength = MAX_LENGTH);
 
   // Close the file
+  // Files opened for reading are actually kept open in a process-wide cache,
+  // so that they can be reopened cheaply.
   void Close(void);
 
+#ifndef _WIN32
+  // The underlying file descriptor, for I/O which bypasses DiskFile (see
+  // IOQueue), or -1 if the file is provided (see FileAccess)
+  int Descriptor(void) const {return fd;}
+#endif
+
+  // Advice for the OS's file cache, which is only given if the cache policy
+  // calls for it (see FileAccess):
+  // The range is about to be read
+  void WillNeed(u64 offset, u64 length);
+  // The range (or the rest of the file, if length is 0) won't be read again
+  void DontNeed(u64 offset, u64 length);
+  // Start writing out what has been written to the file, and drop whatever
+  // has already been written out from the cache. If wait is set, everything
+  // is written out (and so dropped) before returning.
+  void FlushBehind(bool wait);
+
+  // Copy a range of another file into this one, without the data passing
+  // through memory: the filesystem may share the data between the files
+  // (e.g. on btrfs and XFS), or else the kernel copies it. Returns false if
+  // neither is possible, in which case the caller should copy the data
+  // itself (and any error will be found, and reported, in doing so).
+  bool CopyFrom(DiskFile &source, u64 sourceoffset, u64 offset, u64 length);
+
+  // Whether the range lies within a hole in a sparse file (or beyond the end
+  // of the file), and so reads as zeros without needing to be read. A false
+  // result only means that the range isn't known to be a hole.
+  // Not to be called concurrently on the same file.
+  bool IsHole(u64 offset, u64 length);
+
+  // Whether transfers to the file bypass the OS's cache, and so must be
+  // aligned (if they're not, DiskFile takes care of it, but IOQueue can't)
+  bool IsDirect(void) const {return direct;}
+  static bool IsDirectAligned(u64 offset, const void *buffer, size_t length)
+  {
+    return ((offset | (uintptr_t)buffer | length) & (DIRECT_IO_ALIGNMENT-1)) == 0;
+  }
+
+  // Report a failed transfer which was attempted outside DiskFile (see
+  // IOQueue), in the same way as DiskFile's own
+  void ReportFailure(bool write, u64 offset, size_t length, const char *reason);
+
   // Get the size of the file
   u64 FileSize(void) const {return filesize;}
 
@@ -108,12 +223,36 @@ public:
     return ret;
   }
 
-  static bool FileExists(std::string filename);
-  static u64 GetFileSize(std::string filename);
+  // Close all files being kept open by the cache (see Close), or just one.
+  // An operation closes only its own (see CachedFileSet).
+  static void CloseCachedFiles(void);
+  static void CloseCachedFile(const std::string &filename);
+
+  // These look up files on the filesystem, other than those which belong to
+  // provider (see FileAccess), if one is given
+  static bool FileExists(std::string filename, FileProvider *provider = 0);
+  static u64 GetFileSize(std::string filename, FileProvider *provider = 0);
+
+  // The time at which the specified file was last modified, in nanoseconds,
+  // or 0 if it doesn't exist. Only meaningful for comparison with another
+  // time obtained from here.
+  static u64 GetFileTime(const std::string &filename, FileProvider *provider = 0);
+
+  // Identify the device holding the specified file, so that I/O can be
+  // scheduled per device. Returns UnknownDevice if it cannot be determined
+  // (e.g. the file doesn't exist).
+  static const u64 UnknownDevice = ~(u64)0;
+  static u64 GetDeviceId(const std::string &filename, FileProvider *provider = 0);
+
+  // The number of concurrent sequential streams a device should be given:
+  // just one for rotational disks, where parallel streams cause seek
+  // thrashing, otherwise maxstreams.
+  static u32 GetDeviceStreamLimit(u64 deviceid, u32 maxstreams);
 
   // Search the specified path for files which match the specified wildcard
   // and return their names in a list.
-  static std::unique_ptr< std::list<std::string> > FindFiles(std::string path, std::string wildcard, bool recursive);
+  static std::unique_ptr< std::list<std::string> > FindFiles(std::string path, std::string wildcard, bool recursive,
+                                                              FileProvider *provider = 0);
 
 protected:
   // NOTE: These are pointers so that the operator= works correctly.
@@ -123,6 +262,8 @@ protected:
   std::ostream *serr; // stream for errors (for commandline, this is cerr)
   std::mutex *serr_lock;
 
+  FileAccess  access;
+
   std::string filename;
   u64    filesize;
 
@@ -130,16 +271,56 @@ protected:
 #ifdef _WIN32
   HANDLE hFile;
 #else
-  FILE *file;
+  int    fd;
 #endif
 
-  // Current offset within the file
-  u64    offset;
+  // Whether the handle can be cached for reuse once the file is closed
+  bool   reusable;
+
+  // Whether the handle was opened for direct I/O
+  bool   direct;
+
+  // Whether the open file has any holes: 1 if it does, 0 if it doesn't, and
+  // -1 until IsHole has found out
+  int    holes;
 
   // Does the file exist
   bool   exists;
 
+  // The open file, if it belongs to the provider rather than being on disk
+  FileProvider::File *provided;
+
 protected:
+  // Open the file using a cached handle, if there is one
+  bool OpenCached(const std::string &filename);
+
+#ifndef _WIN32
+  // Switch the open handle to direct I/O, if the filesystem allows it
+  bool EnableDirect(void);
+  // Perform (part of) a transfer with direct I/O, returning the amount
+  // transferred like pread/pwrite
+  ssize_t DirectRead(u64 offset, void *buffer, size_t length);
+  ssize_t DirectWrite(u64 offset, const void *buffer, size_t length);
+  // Go back to normal I/O, if direct I/O turns out not to be usable
+  void DisableDirect(void);
+#endif
+
+  // The provider which owns the specified file, if there is one
+  static FileProvider* ProviderFor(FileProvider *provider, const std::string &filename)
+  {
+    return provider && provider->Owns(filename) ? provider : 0;
+  }
+  FileProvider* ProviderFor(const std::string &filename) const
+  {
+    return ProviderFor(access.provider, filename);
+  }
+
+  // Create, open, read and write files which belong to a provider
+  bool CreateProvided(FileProvider *owner, u64 filesize);
+  bool OpenProvided(FileProvider *owner);
+  bool ReadProvided(u64 offset, void *buffer, size_t length);
+  bool WriteProvided(u64 offset, const void *buffer, size_t length);
+
 #ifdef _WIN32
   static std::string ErrorMessage(DWORD error);
 #endif
@@ -165,9 +346,23 @@ protected:
 class FileSizeCache
 {
 public:
-  FileSizeCache();
+  FileSizeCache(FileProvider *provider = 0);
+  u64 get(const std::string &filename);
+protected:
+  FileProvider *provider;
+  std::map<std::string, u64> cache;
+};
+
+// Identifies the devices files are on (see DiskFile::GetDeviceId), looking up
+// each directory only once rather than each file: there are usually far fewer
+// directories, and a directory's files are on its device.
+class DeviceIdCache
+{
+public:
+  DeviceIdCache(FileProvider *provider = 0);
   u64 get(const std::string &filename);
 protected:
+  FileProvider *provider;
   std::map<std::string, u64> cache;
 };
 
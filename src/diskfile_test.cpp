@@ -20,6 +20,8 @@
 #include <iostream>
 #include <fstream>
 #include <mutex>
+#include <thread>
+#include <atomic>
 
 #include "libpar2internal.h"
 
@@ -740,6 +742,632 @@ int test6() {
 }
 
 
+// test device identification used for per-device scheduling
+int test7() {
+  std::ofstream input1;
+  input1.open("input1.txt", std::ofstream::out | std::ofstream::binary);
+  input1 << "diskfile_test test7 input1.txt";
+  input1.close();
+  std::ofstream input2;
+  input2.open("input2.txt", std::ofstream::out | std::ofstream::binary);
+  input2 << "diskfile_test test7 input2.txt";
+  input2.close();
+
+  u64 device1 = DiskFile::GetDeviceId("input1.txt");
+  u64 device2 = DiskFile::GetDeviceId("input2.txt");
+  if (device1 == DiskFile::UnknownDevice) {
+    std::cout << "GetDeviceId failed on existing file" << std::endl;
+    return 1;
+  }
+  if (device1 != device2) {
+    std::cout << "GetDeviceId returned different devices for files in the same directory" << std::endl;
+    return 1;
+  }
+  if (DiskFile::GetDeviceId("does_not_exist.txt") != DiskFile::UnknownDevice) {
+    std::cout << "GetDeviceId succeeded on non-existent file" << std::endl;
+    return 1;
+  }
+
+  // the cache looks up the directory instead, so a file which doesn't exist
+  // (yet) is on the device of the directory it would be in
+  DeviceIdCache devices;
+  if (devices.get("input1.txt") != device1 || devices.get("does_not_exist.txt") != device1 ||
+      devices.get("." + fs + "input2.txt") != device2) {
+    std::cout << "DeviceIdCache didn't find the device of the files' directory" << std::endl;
+    return 1;
+  }
+
+  if (DiskFile::GetDeviceStreamLimit(DiskFile::UnknownDevice, 4) != 4) {
+    std::cout << "GetDeviceStreamLimit restricted an unknown device" << std::endl;
+    return 1;
+  }
+  u32 limit = DiskFile::GetDeviceStreamLimit(device1, 4);
+  if (limit != 1 && limit != 4) {
+    std::cout << "GetDeviceStreamLimit returned " << limit << std::endl;
+    return 1;
+  }
+
+  remove("input1.txt");
+  remove("input2.txt");
+  return 0;
+}
+
+
+// test IOQueue, both with and without asynchronous I/O
+int test8() {
+  std::mutex output_lock;
+
+  for (int async = 0; async < 2; async++) {
+    IOQueue queue;
+    if (async && !queue.Init(4)) {
+      std::cout << "Asynchronous I/O not available; skipping" << std::endl;
+      break;
+    }
+
+    const size_t chunk = 1000;
+    const u32 chunks = 12;
+    std::vector<u8> data(chunk * chunks);
+    for (size_t i = 0; i < data.size(); i++)
+      data[i] = (u8)(i * 7 + i / 251);
+    queue.RegisterBuffer(data.data(), chunk * 4);
+
+    {
+      DiskFile diskfile(std::cout, std::cerr, output_lock);
+      // the last chunk lies beyond the created size
+      if (!diskfile.Create("input1.txt", chunk * (chunks-1))) {
+        std::cout << "Create failed" << std::endl;
+        return 1;
+      }
+
+      // queue more writes than the queue depth, in reverse order
+      std::vector<IOQueue::Ticket> tickets;
+      for (u32 i = chunks; i-- > 0; )
+        tickets.push_back(queue.Write(&diskfile, i * chunk, &data[i * chunk], chunk));
+      queue.Submit();
+      for (size_t i = 0; i < tickets.size(); i++) {
+        if (!queue.Wait(tickets[i])) {
+          std::cout << "Queued write " << i << " failed" << std::endl;
+          return 1;
+        }
+      }
+      if (diskfile.FileSize() != data.size()) {
+        std::cout << "File size was " << diskfile.FileSize() << " after queued writes" << std::endl;
+        return 1;
+      }
+      diskfile.Close();
+    }
+
+    {
+      DiskFile diskfile(std::cout, std::cerr, output_lock);
+      if (!diskfile.Open("input1.txt")) {
+        std::cout << "Open failed" << std::endl;
+        return 1;
+      }
+
+      std::vector<u8> readback(data.size());
+      std::vector<IOQueue::Ticket> tickets;
+      for (u32 i = 0; i < chunks; i++)
+        tickets.push_back(queue.Read(&diskfile, i * chunk, &readback[i * chunk], chunk));
+      tickets.push_back(queue.Completed());
+      if (!queue.WaitAll()) {
+        std::cout << "Queued reads failed" << std::endl;
+        return 1;
+      }
+      if (readback != data) {
+        std::cout << "Queued reads returned the wrong data (async=" << async << ")" << std::endl;
+        return 1;
+      }
+      diskfile.Close();
+    }
+
+    remove("input1.txt");
+  }
+
+  return 0;
+}
+
+
+// test concurrent reads of one open file from several threads
+int test9() {
+  const size_t chunk = 4096;
+  const u32 chunks = 64;
+  std::vector<u8> data(chunk * chunks);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (u8)(i * 13 + i / 509);
+
+  std::mutex output_lock;
+  {
+    DiskFile diskfile(std::cout, std::cerr, output_lock);
+    if (!diskfile.Create("input1.txt", data.size()) ||
+        !diskfile.Write(0, data.data(), data.size())) {
+      std::cout << "Create/Write failed" << std::endl;
+      return 1;
+    }
+    diskfile.Close();
+  }
+
+  DiskFile diskfile(std::cout, std::cerr, output_lock);
+  if (!diskfile.Open("input1.txt")) {
+    std::cout << "Open failed" << std::endl;
+    return 1;
+  }
+
+  // each thread reads every fourth chunk, working backwards
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (u32 t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+      u8 buffer[chunk];
+      for (u32 i = chunks - 4 + t; i < chunks; i -= 4) {
+        if (!diskfile.Read(i * chunk, buffer, chunk) ||
+            memcmp(buffer, &data[i * chunk], chunk) != 0)
+          failures++;
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  diskfile.Close();
+  remove("input1.txt");
+
+  if (failures) {
+    std::cout << "Concurrent reads failed " << failures << " times" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+
+// test that cached file handles aren't used once the file has been replaced
+int test10() {
+  std::mutex output_lock;
+  const char *contents1 = "diskfile_test test10 first";
+  const char *contents2 = "diskfile_test test10 second!";
+
+  {
+    DiskFile diskfile(std::cout, std::cerr, output_lock);
+    if (!diskfile.Create("input1.txt", strlen(contents1)) ||
+        !diskfile.Write(0, contents1, strlen(contents1))) {
+      std::cout << "Create/Write failed" << std::endl;
+      return 1;
+    }
+    diskfile.Close();
+  }
+
+  DiskFile diskfile(std::cout, std::cerr, output_lock);
+  char buffer[64];
+  // open and close several times, to go via the cache
+  for (int i = 0; i < 3; i++) {
+    if (!diskfile.Open("input1.txt")) {
+      std::cout << "Open " << i << " failed" << std::endl;
+      return 1;
+    }
+    memset(buffer, 0, sizeof(buffer));
+    if (diskfile.FileSize() != strlen(contents1) ||
+        !diskfile.Read(0, buffer, strlen(contents1)) ||
+        strcmp(buffer, contents1) != 0) {
+      std::cout << "Read " << i << " failed" << std::endl;
+      return 1;
+    }
+    diskfile.Close();
+  }
+
+  // move the file aside, and create a new one in its place
+  if (!diskfile.Rename("input2.txt")) {
+    std::cout << "Rename failed" << std::endl;
+    return 1;
+  }
+  {
+    DiskFile newfile(std::cout, std::cerr, output_lock);
+    if (!newfile.Create("input1.txt", strlen(contents2)) ||
+        !newfile.Write(0, contents2, strlen(contents2))) {
+      std::cout << "Create/Write of replacement failed" << std::endl;
+      return 1;
+    }
+    newfile.Close();
+  }
+
+  DiskFile reopened(std::cout, std::cerr, output_lock);
+  memset(buffer, 0, sizeof(buffer));
+  if (!reopened.Open("input1.txt") ||
+      reopened.FileSize() != strlen(contents2) ||
+      !reopened.Read(0, buffer, strlen(contents2)) ||
+      strcmp(buffer, contents2) != 0) {
+    std::cout << "Reopening replaced file returned old contents" << std::endl;
+    return 1;
+  }
+  reopened.Close();
+
+#ifndef _WIN32
+  // replace it from outside DiskFile, as another process might (rename()
+  // won't replace an existing file on Windows)
+  {
+    FILE *file = fopen("input3.txt", "wb");
+    if (!file || fwrite(contents1, 1, strlen(contents1), file) != strlen(contents1) || fclose(file) != 0 ||
+        rename("input3.txt", "input1.txt") != 0) {
+      std::cout << "Replacing the file from outside failed" << std::endl;
+      return 1;
+    }
+  }
+  memset(buffer, 0, sizeof(buffer));
+  if (!reopened.Open("input1.txt") ||
+      reopened.FileSize() != strlen(contents1) ||
+      !reopened.Read(0, buffer, strlen(contents1)) ||
+      strcmp(buffer, contents1) != 0) {
+    std::cout << "Reopening a file replaced from outside returned old contents" << std::endl;
+    return 1;
+  }
+  reopened.Close();
+#endif
+
+  DiskFile::CloseCachedFiles();
+  remove("input1.txt");
+  remove("input2.txt");
+  return 0;
+}
+
+
+// direct I/O, with transfers which aren't aligned
+int test11() {
+  std::mutex output_lock;
+  const size_t size = 3*DIRECT_IO_ALIGNMENT + 1234;  // unaligned tail
+  std::vector<u8> data(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = (u8)(i * 7 + (i >> 8));
+
+  FileAccess access;
+  access.directio = true;
+
+  {
+    DiskFile diskfile(std::cout, std::cerr, output_lock, access);
+    if (!diskfile.Create("input1.txt", size)) {
+      std::cout << "Create failed" << std::endl;
+      return 1;
+    }
+    // write in pieces of assorted sizes, none of them aligned
+    const size_t pieces[] = {1, 4095, 4097, 100, 3000, 1000};
+    size_t offset = 0;
+    for (size_t i = 0; offset < size; i++) {
+      size_t length = std::min(pieces[i % 6], size - offset);
+      if (!diskfile.Write(offset, &data[offset], length)) {
+        std::cout << "Write at " << offset << " failed" << std::endl;
+        return 1;
+      }
+      offset += length;
+    }
+    diskfile.Close();
+  }
+
+  if (DiskFile::GetFileSize("input1.txt") != size) {
+    std::cout << "File size is " << DiskFile::GetFileSize("input1.txt") << " instead of " << size << std::endl;
+    return 1;
+  }
+
+  DiskFile diskfile(std::cout, std::cerr, output_lock, access);
+  if (!diskfile.Open("input1.txt")) {
+    std::cout << "Open failed" << std::endl;
+    return 1;
+  }
+
+  // read everything with an aligned buffer, then pieces at odd offsets
+  u8 *buffer;
+  ALIGN_ALLOC(buffer, size + DIRECT_IO_ALIGNMENT, DIRECT_IO_ALIGNMENT);
+  if (!diskfile.Read(0, buffer, size) || memcmp(buffer, &data[0], size) != 0) {
+    std::cout << "Aligned read failed" << std::endl;
+    ALIGN_FREE(buffer);
+    return 1;
+  }
+  const size_t offsets[] = {1, 100, 4095, 4096, 4097, 3*DIRECT_IO_ALIGNMENT};
+  for (size_t i = 0; i < 6; i++) {
+    size_t offset = offsets[i];
+    memset(buffer, 0, size);
+    // misalign the buffer to the same extent as the offset, and then not
+    u8 *dest = buffer + (i & 1 ? offset % DIRECT_IO_ALIGNMENT : 3);
+    if (!diskfile.Read(offset, dest, size - offset) || memcmp(dest, &data[offset], size - offset) != 0) {
+      std::cout << "Read at " << offset << " failed" << std::endl;
+      ALIGN_FREE(buffer);
+      return 1;
+    }
+  }
+  ALIGN_FREE(buffer);
+
+  // reading past the end must still fail
+  u8 byte;
+  if (diskfile.Read(size, &byte, 1)) {
+    std::cout << "Read past end succeeded" << std::endl;
+    return 1;
+  }
+  diskfile.Close();
+
+  DiskFile::CloseCachedFiles();
+  remove("input1.txt");
+  return 0;
+}
+
+
+// Create reserves the file's full size, which reads back as zeroes
+int test12() {
+  std::mutex output_lock;
+  const size_t size = 1048576 + 123;
+
+  DiskFile diskfile(std::cout, std::cerr, output_lock);
+  if (!diskfile.Create("input1.txt", size)) {
+    std::cout << "Create failed" << std::endl;
+    return 1;
+  }
+  if (diskfile.FileSize() != size || DiskFile::GetFileSize("input1.txt") != size) {
+    std::cout << "File size is " << DiskFile::GetFileSize("input1.txt") << " instead of " << size << std::endl;
+    return 1;
+  }
+
+  // write the middle, and check that the rest is still zero
+  std::vector<u8> data(size, 0);
+  for (size_t i = 1000; i < 2000; i++)
+    data[i] = (u8)i;
+  if (!diskfile.Write(1000, &data[1000], 1000)) {
+    std::cout << "Write failed" << std::endl;
+    return 1;
+  }
+  diskfile.Close();
+
+  std::vector<u8> readback(size, 0xff);
+  if (!diskfile.Open("input1.txt") || diskfile.FileSize() != size) {
+    std::cout << "Open failed, or write changed the file size" << std::endl;
+    return 1;
+  }
+  if (!diskfile.Read(0, &readback[0], size) || readback != data) {
+    std::cout << "Read back did not match" << std::endl;
+    return 1;
+  }
+  diskfile.Close();
+  DiskFile::CloseCachedFiles();
+
+  remove("input1.txt");
+  return 0;
+}
+
+
+// holes in sparse files, and blocks of zeros
+int test13() {
+  std::mutex output_lock;
+  const u64 dataoffset = 4 * 1048576;
+  const size_t datasize = 1000;
+
+  // writing beyond the end of a file leaves a hole, where the filesystem allows
+  DiskFile diskfile(std::cout, std::cerr, output_lock);
+  std::vector<u8> data(datasize, 0x5a);
+  if (!diskfile.Create("input1.txt", 0) || !diskfile.Write(dataoffset, &data[0], datasize)) {
+    std::cout << "Create or write failed" << std::endl;
+    return 1;
+  }
+  diskfile.Close();
+
+  if (!diskfile.Open("input1.txt") || diskfile.FileSize() != dataoffset + datasize) {
+    std::cout << "Open failed" << std::endl;
+    return 1;
+  }
+  if (diskfile.IsHole(dataoffset, datasize) || diskfile.IsHole(dataoffset - 10, 20)) {
+    std::cout << "Data was reported as a hole" << std::endl;
+    return 1;
+  }
+  if (!diskfile.IsHole(dataoffset + datasize, 10)) {
+    std::cout << "The end of the file was not reported as a hole" << std::endl;
+    return 1;
+  }
+  // whether the start is found to be a hole depends on the filesystem, but if
+  // it is, it must be zeros
+  if (diskfile.IsHole(0, 65536)) {
+    std::vector<u8> readback(65536, 0xff);
+    if (!diskfile.Read(0, &readback[0], readback.size()) || !DataBlock::IsZero(&readback[0], readback.size())) {
+      std::cout << "A hole did not read as zeros" << std::endl;
+      return 1;
+    }
+  }
+
+  // beyond the end of a data block, its data is always zeros
+  DataBlock datablock;
+  datablock.SetLocation(&diskfile, dataoffset);
+  datablock.SetLength(datasize);
+  if (datablock.IsHole(0, datasize) || !datablock.IsHole(datasize, 100)) {
+    std::cout << "DataBlock::IsHole gave the wrong answer" << std::endl;
+    return 1;
+  }
+  diskfile.Close();
+  DiskFile::CloseCachedFiles();
+
+  if (!DataBlock::IsZero(&data[0], 0)) {
+    std::cout << "An empty buffer was not zeros" << std::endl;
+    return 1;
+  }
+  std::vector<u8> zeros(datasize, 0);
+  if (!DataBlock::IsZero(&zeros[0], datasize)) {
+    std::cout << "A buffer of zeros was not found to be" << std::endl;
+    return 1;
+  }
+  zeros[0] = 1;
+  if (DataBlock::IsZero(&zeros[0], datasize)) {
+    std::cout << "A non-zero first byte was missed" << std::endl;
+    return 1;
+  }
+  zeros[0] = 0;
+  zeros[datasize-1] = 1;
+  if (DataBlock::IsZero(&zeros[0], datasize)) {
+    std::cout << "A non-zero last byte was missed" << std::endl;
+    return 1;
+  }
+
+  remove("input1.txt");
+  return 0;
+}
+
+
+// vectored writes
+int test14() {
+  std::mutex output_lock;
+  std::vector<u8> data(100000);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (u8)(i * 7);
+
+  // the parts, including an empty one, written beyond the end of the file
+  DiskFile::WriteBuffer parts[4] = {
+    {&data[0], 10},
+    {&data[10], 0},
+    {&data[10], 60000},
+    {&data[60010], data.size() - 60010}
+  };
+
+  DiskFile diskfile(std::cout, std::cerr, output_lock);
+  if (!diskfile.Create("input1.txt", 1000)) {
+    std::cout << "Create failed" << std::endl;
+    return 1;
+  }
+  if (!diskfile.WriteV(500, parts, 4) || diskfile.FileSize() != 500 + data.size()) {
+    std::cout << "WriteV failed, or did not extend the file" << std::endl;
+    return 1;
+  }
+  diskfile.Close();
+
+  std::vector<u8> readback(data.size());
+  if (!diskfile.Open("input1.txt") || diskfile.FileSize() != 500 + data.size()) {
+    std::cout << "Open failed, or the file is the wrong size" << std::endl;
+    return 1;
+  }
+  if (!diskfile.Read(500, &readback[0], readback.size()) || readback != data) {
+    std::cout << "Read back did not match" << std::endl;
+    return 1;
+  }
+  diskfile.Close();
+  DiskFile::CloseCachedFiles();
+
+  remove("input1.txt");
+  return 0;
+}
+
+
+// copying between files
+int test15() {
+  std::mutex output_lock;
+  const size_t size = 3 * 65536 + 100;
+  std::vector<u8> data(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = (u8)(i * 13);
+
+  DiskFile source(std::cout, std::cerr, output_lock);
+  if (!source.Create("input1.txt", size) || !source.Write(0, &data[0], size)) {
+    std::cout << "Create or write of the source failed" << std::endl;
+    return 1;
+  }
+  source.Close();
+
+  DiskFile target(std::cout, std::cerr, output_lock);
+  if (!source.Open("input1.txt") || !target.Create("input2.txt", size)) {
+    std::cout << "Open of the source, or create of the target failed" << std::endl;
+    return 1;
+  }
+
+  // ranges beyond the end of either file are never copied
+  if (target.CopyFrom(source, 100, 0, size) || target.CopyFrom(source, 0, 100, size)) {
+    std::cout << "A copy beyond the end of a file succeeded" << std::endl;
+    return 1;
+  }
+
+  // the filesystem may not support copying at all, but if it does, the data
+  // must arrive intact: an aligned range (which may be shared), and an
+  // unaligned one (which can only be copied)
+  std::vector<u8> expected(size, 0);
+  if (target.CopyFrom(source, 65536, 0, 2 * 65536))
+    memcpy(&expected[0], &data[65536], 2 * 65536);
+  if (target.CopyFrom(source, 7, 2 * 65536 + 3, 65536 + 97))
+    memcpy(&expected[2 * 65536 + 3], &data[7], 65536 + 97);
+  source.Close();
+  target.Close();
+
+  std::vector<u8> readback(size);
+  if (!target.Open("input2.txt") || target.FileSize() != size ||
+      !target.Read(0, &readback[0], size) || readback != expected) {
+    std::cout << "Copied data did not match" << std::endl;
+    return 1;
+  }
+  target.Close();
+  DiskFile::CloseCachedFiles();
+
+  remove("input1.txt");
+  remove("input2.txt");
+  return 0;
+}
+
+// test that an operation's CachedFileSet closes only the cached handles of
+// the files it opened, leaving those of anyone else in the cache
+int test16() {
+#ifdef __linux__
+  std::mutex output_lock;
+  const char *contents = "diskfile_test test16";
+  for (int i = 1; i <= 2; i++) {
+    DiskFile diskfile(std::cout, std::cerr, output_lock);
+    std::string name = "input" + std::to_string(i) + ".txt";
+    if (!diskfile.Create(name, strlen(contents)) || !diskfile.Write(0, contents, strlen(contents))) {
+      std::cout << "Create/Write failed" << std::endl;
+      return 1;
+    }
+    diskfile.Close();
+  }
+
+  // the handles open in the process
+  auto openfiles = []() {
+    int count = 0;
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir)
+      return -1;
+    while (readdir(dir))
+      count++;
+    closedir(dir);
+    return count;
+  };
+  DiskFile::CloseCachedFiles();
+  int baseline = openfiles();
+  if (baseline < 0) {
+    std::cout << "Skipped: open files can't be counted" << std::endl;
+    return 0;
+  }
+
+  DiskFile other(std::cout, std::cerr, output_lock);
+  if (!other.Open("input1.txt")) {
+    std::cout << "Open of input1.txt failed" << std::endl;
+    return 1;
+  }
+  other.Close();
+  {
+    CachedFileSet cachedfiles;
+    FileAccess access;
+    access.cachedfiles = &cachedfiles;
+    DiskFile own(std::cout, std::cerr, output_lock, access);
+    if (!own.Open("input2.txt")) {
+      std::cout << "Open of input2.txt failed" << std::endl;
+      return 1;
+    }
+    own.Close();
+    if (openfiles() != baseline + 2) {
+      std::cout << "Closed files were not kept open by the cache" << std::endl;
+      return 1;
+    }
+  }
+  if (openfiles() != baseline + 1) {
+    std::cout << "The operation's cached handle was not closed, or another's was" << std::endl;
+    return 1;
+  }
+
+  DiskFile::CloseCachedFiles();
+  if (openfiles() != baseline) {
+    std::cout << "CloseCachedFiles left handles open" << std::endl;
+    return 1;
+  }
+  remove("input1.txt");
+  remove("input2.txt");
+#endif
+  return 0;
+}
+
+
 int main() {
   if (test1()) {
     std::cerr << "FAILED: test1" << std::endl;
@@ -765,6 +1393,46 @@ int main() {
     std::cerr << "FAILED: test6" << std::endl;
     return 1;
   }
+  if (test7()) {
+    std::cerr << "FAILED: test7" << std::endl;
+    return 1;
+  }
+  if (test8()) {
+    std::cerr << "FAILED: test8" << std::endl;
+    return 1;
+  }
+  if (test9()) {
+    std::cerr << "FAILED: test9" << std::endl;
+    return 1;
+  }
+  if (test10()) {
+    std::cerr << "FAILED: test10" << std::endl;
+    return 1;
+  }
+  if (test11()) {
+    std::cerr << "FAILED: test11" << std::endl;
+    return 1;
+  }
+  if (test12()) {
+    std::cerr << "FAILED: test12" << std::endl;
+    return 1;
+  }
+  if (test13()) {
+    std::cerr << "FAILED: test13" << std::endl;
+    return 1;
+  }
+  if (test14()) {
+    std::cerr << "FAILED: test14" << std::endl;
+    return 1;
+  }
+  if (test15()) {
+    std::cerr << "FAILED: test15" << std::endl;
+    return 1;
+  }
+  if (test16()) {
+    std::cerr << "FAILED: test16" << std::endl;
+    return 1;
+  }
 
   std::cout << "SUCCESS: diskfile_test complete." << std::endl;
 
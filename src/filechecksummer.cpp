@@ -209,10 +209,16 @@ bool FileCheckSummer::Fill(bool longfill)
 
   if (want > 0)
   {
-    // Read data
-    if (!diskfile->Read(readoffset, tailpointer, want))
+    // Read data, unless it's a hole in a sparse file and so all zeros
+    if (diskfile->IsHole(readoffset, want))
+      memset(tailpointer, 0, want);
+    else if (!diskfile->Read(readoffset, tailpointer, want))
       return false;
 
+    // Have the OS read ahead of the scan, and forget what has been scanned
+    diskfile->WillNeed(readoffset + want, blocksize);
+    diskfile->DontNeed(readoffset, want);
+
     UpdateHashes(readoffset, tailpointer, want);
     readoffset += want;
     tailpointer += want;
@@ -0,0 +1,228 @@
+#include "libpar2internal.h"
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+
+MemoryFileProvider::MemoryFileProvider(const std::string &_root)
+: root(DiskFile::GetCanonicalPathname(_root))
+, files()
+, clock(0)
+{
+  if (root.empty() || root.find_last_of(PATHSEP ALTPATHSEP) != root.size()-1)
+    root += PATHSEP;
+}
+
+MemoryFileProvider::~MemoryFileProvider(void)
+{
+}
+
+void MemoryFileProvider::AddFile(const std::string &filename, const void *data, size_t length)
+{
+  std::shared_ptr<Entry> entry = Add(filename);
+
+  std::lock_guard<std::mutex> lock(entry->lock);
+  entry->data = (const u8*)data;
+  entry->size = length;
+}
+
+void MemoryFileProvider::AddFileCopy(const std::string &filename, const void *data, size_t length)
+{
+  std::shared_ptr<Entry> entry = Add(filename);
+
+  std::lock_guard<std::mutex> lock(entry->lock);
+  entry->storage.assign((const u8*)data, (const u8*)data + length);
+  entry->data = entry->storage.data();
+  entry->size = length;
+}
+
+bool MemoryFileProvider::GetFile(const std::string &filename, const u8 *&data, u64 &length)
+{
+  std::shared_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(fileslock);
+    std::map<std::string, std::shared_ptr<Entry> >::iterator f = files.find(FullName(filename));
+    if (f == files.end())
+      return false;
+    entry = (*f).second;
+  }
+
+  std::lock_guard<std::mutex> lock(entry->lock);
+  data = entry->data;
+  length = entry->size;
+  return true;
+}
+
+bool MemoryFileProvider::Owns(const std::string &filename)
+{
+  return filename.compare(0, root.size(), root) == 0;
+}
+
+bool MemoryFileProvider::Stat(const std::string &filename, u64 &filesize, u64 &filetime)
+{
+  std::shared_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(fileslock);
+    std::map<std::string, std::shared_ptr<Entry> >::iterator f = files.find(filename);
+    if (f == files.end())
+      return false;
+    entry = (*f).second;
+  }
+
+  std::lock_guard<std::mutex> lock(entry->lock);
+  filesize = entry->size;
+  filetime = entry->time;
+  return true;
+}
+
+FileProvider::File* MemoryFileProvider::Open(const std::string &filename)
+{
+  std::lock_guard<std::mutex> lock(fileslock);
+  std::map<std::string, std::shared_ptr<Entry> >::iterator f = files.find(filename);
+  if (f == files.end())
+    return 0;
+
+  return new MemoryFile(*this, (*f).second);
+}
+
+FileProvider::File* MemoryFileProvider::Create(const std::string &filename, u64 filesize)
+{
+  if (filesize > (u64)(size_t)~(size_t)0)
+    return 0;
+
+  std::shared_ptr<Entry> entry(new Entry);
+  entry->storage.resize((size_t)filesize);
+  entry->data = entry->storage.data();
+  entry->size = filesize;
+  entry->time = ++clock;
+
+  std::lock_guard<std::mutex> lock(fileslock);
+  if (!files.insert(std::make_pair(filename, entry)).second)
+    return 0;
+
+  return new MemoryFile(*this, entry);
+}
+
+bool MemoryFileProvider::Rename(const std::string &oldname, const std::string &newname)
+{
+  std::lock_guard<std::mutex> lock(fileslock);
+  std::map<std::string, std::shared_ptr<Entry> >::iterator f = files.find(oldname);
+  if (f == files.end() || !Owns(newname))
+    return false;
+
+  std::shared_ptr<Entry> entry = (*f).second;
+  files.erase(f);
+  files[newname] = entry;
+  return true;
+}
+
+bool MemoryFileProvider::Delete(const std::string &filename)
+{
+  std::lock_guard<std::mutex> lock(fileslock);
+  return files.erase(filename) != 0;
+}
+
+void MemoryFileProvider::FindFiles(const std::string &path, const std::string &wildcard, bool recursive,
+                                   std::list<std::string> &matches)
+{
+  std::lock_guard<std::mutex> lock(fileslock);
+  for (std::map<std::string, std::shared_ptr<Entry> >::iterator f = files.lower_bound(path);
+       f != files.end() && (*f).first.compare(0, path.size(), path) == 0;
+       ++f)
+  {
+    // Match the name of the file, or of the subdirectory it's in
+    std::string name = (*f).first.substr(path.size());
+    std::string::size_type where = name.find_first_of(PATHSEP ALTPATHSEP);
+    if (where != std::string::npos && !recursive)
+      continue;
+    if (WildcardMatch(wildcard.c_str(), name.substr(0, where).c_str()))
+      matches.push_back((*f).first);
+  }
+}
+
+std::string MemoryFileProvider::FullName(const std::string &filename) const
+{
+  if (filename.compare(0, root.size(), root) == 0)
+    return filename;
+  return root + filename;
+}
+
+std::shared_ptr<MemoryFileProvider::Entry> MemoryFileProvider::Add(const std::string &filename)
+{
+  std::shared_ptr<Entry> entry(new Entry);
+  entry->data = 0;
+  entry->size = 0;
+  entry->time = ++clock;
+
+  std::lock_guard<std::mutex> lock(fileslock);
+  files[FullName(filename)] = entry;
+  return entry;
+}
+
+bool MemoryFileProvider::WildcardMatch(const char *wildcard, const char *name)
+{
+  while (*wildcard)
+  {
+    if (*wildcard == '*')
+    {
+      // Try everything that it could stand for
+      for (;; ++name)
+      {
+        if (WildcardMatch(wildcard+1, name))
+          return true;
+        if (!*name)
+          return false;
+      }
+    }
+
+    if (!*name || (*wildcard != '?' && *wildcard != *name))
+      return false;
+
+    ++wildcard;
+    ++name;
+  }
+
+  return *name == 0;
+}
+
+
+MemoryFileProvider::MemoryFile::MemoryFile(MemoryFileProvider &provider, std::shared_ptr<Entry> entry)
+: provider(provider)
+, entry(entry)
+{
+}
+
+bool MemoryFileProvider::MemoryFile::Read(u64 offset, void *buffer, size_t length)
+{
+  std::lock_guard<std::mutex> lock(entry->lock);
+  if (offset > entry->size || length > entry->size - offset)
+    return false;
+
+  memcpy(buffer, entry->data + offset, length);
+  return true;
+}
+
+bool MemoryFileProvider::MemoryFile::Write(u64 offset, const void *buffer, size_t length)
+{
+  std::lock_guard<std::mutex> lock(entry->lock);
+  if (offset + length > (u64)(size_t)~(size_t)0)
+    return false;
+
+  // Take a copy of data which belongs to the caller
+  if (entry->data != entry->storage.data())
+    entry->storage.assign(entry->data, entry->data + entry->size);
+
+  if (offset + length > entry->storage.size())
+    entry->storage.resize((size_t)(offset + length));
+
+  memcpy(entry->storage.data() + offset, buffer, length);
+  entry->data = entry->storage.data();
+  entry->size = entry->storage.size();
+  entry->time = ++provider.clock;
+  return true;
+}
@@ -0,0 +1,141 @@
+#ifndef __FILEPROVIDER_H__
+#define __FILEPROVIDER_H__
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Files which DiskFile accesses through something other than the
+// filesystem, e.g. data which an application already holds in memory.
+// A provider passed to an operation (or given to a DiskFile in its
+// FileAccess) is used in place of the filesystem for all of the files which
+// it claims (by name), whether they are source files, PAR2 files or repaired
+// files, so creating, verifying and repairing all work with them unchanged. An application can implement
+// FileProvider itself, to serve its files through callbacks of its own, or
+// use MemoryFileProvider.
+
+class FileProvider
+{
+public:
+  virtual ~FileProvider(void) {}
+
+  // An open file, which is closed by deleting it.
+  // As with DiskFile, reads and writes are positional, and any number of
+  // threads may use the same file at once (other than writes which extend
+  // it, which are never concurrent).
+  class File
+  {
+  public:
+    virtual ~File(void) {}
+
+    // Reads must be satisfied in full, so reading beyond the end of the
+    // file fails
+    virtual bool Read(u64 offset, void *buffer, size_t length) = 0;
+    virtual bool Write(u64 offset, const void *buffer, size_t length) = 0;
+  };
+
+  // Whether the named file (which need not exist) belongs to the provider.
+  // Names are as given to DiskFile, which are generally canonical.
+  virtual bool Owns(const std::string &filename) = 0;
+
+  // Whether the file exists, and if so, its size and when it was last
+  // modified (in any units, as this is only compared with itself)
+  virtual bool Stat(const std::string &filename, u64 &filesize, u64 &filetime) = 0;
+
+  // Open an existing file, or create a new one of the specified size (which
+  // fails if it already exists). These return 0 on failure.
+  virtual File* Open(const std::string &filename) = 0;
+  virtual File* Create(const std::string &filename, u64 filesize) = 0;
+
+  virtual bool Rename(const std::string &oldname, const std::string &newname) = 0;
+  virtual bool Delete(const std::string &filename) = 0;
+
+  // Add the files in the directory path (which ends with a separator) whose
+  // names match the wildcard (which may contain * and ?) to matches, along
+  // with all of the files in any matching subdirectories if recursive.
+  virtual void FindFiles(const std::string &path, const std::string &wildcard, bool recursive,
+                         std::list<std::string> &matches) = 0;
+};
+
+
+// Files held in memory, under a directory which doesn't exist on disk
+// (e.g. "/par2mem"). Files can be added from memory which the caller keeps
+// hold of, without being copied, or can be copied in. Files which are
+// created or written, such as PAR2 files and repaired files, are kept in
+// memory belonging to the provider, and can be read back with GetFile.
+
+class MemoryFileProvider : public FileProvider
+{
+public:
+  MemoryFileProvider(const std::string &root);
+  ~MemoryFileProvider(void);
+
+  // The directory the files are in, which ends with a separator
+  const std::string& Root(void) const {return root;}
+
+  // Add a file whose data belongs to the caller, and must remain unchanged
+  // until the file has been deleted, or the provider destroyed. It's copied
+  // if it's written to. Names which aren't within Root are taken to be
+  // relative to it (as they are by GetFile).
+  void AddFile(const std::string &filename, const void *data, size_t length);
+
+  // Add a file, copying the data
+  void AddFileCopy(const std::string &filename, const void *data, size_t length);
+
+  // Get the contents of a file, which remain valid until it's next changed
+  bool GetFile(const std::string &filename, const u8 *&data, u64 &length);
+
+  virtual bool Owns(const std::string &filename);
+  virtual bool Stat(const std::string &filename, u64 &filesize, u64 &filetime);
+  virtual File* Open(const std::string &filename);
+  virtual File* Create(const std::string &filename, u64 filesize);
+  virtual bool Rename(const std::string &oldname, const std::string &newname);
+  virtual bool Delete(const std::string &filename);
+  virtual void FindFiles(const std::string &path, const std::string &wildcard, bool recursive,
+                         std::list<std::string> &matches);
+
+protected:
+  // A file's contents, which open files keep hold of even if it's deleted
+  struct Entry
+  {
+    std::mutex       lock;      // Guards all of the below
+    const u8        *data;      // The contents: either the caller's, or storage
+    u64              size;
+    std::vector<u8>  storage;   // The contents, once they belong to the provider
+    u64              time;      // When it was last modified
+  };
+
+  class MemoryFile : public File
+  {
+  public:
+    MemoryFile(MemoryFileProvider &provider, std::shared_ptr<Entry> entry);
+
+    virtual bool Read(u64 offset, void *buffer, size_t length);
+    virtual bool Write(u64 offset, const void *buffer, size_t length);
+
+  protected:
+    MemoryFileProvider     &provider;
+    std::shared_ptr<Entry>  entry;
+  };
+
+  // The full name of a file
+  std::string FullName(const std::string &filename) const;
+
+  // Add a file, replacing any existing one
+  std::shared_ptr<Entry> Add(const std::string &filename);
+
+  // Whether a name matches a wildcard containing * and ?
+  static bool WildcardMatch(const char *wildcard, const char *name);
+
+protected:
+  std::string                                    root;
+  std::mutex                                     fileslock;  // Guards files
+  std::map<std::string, std::shared_ptr<Entry> > files;      // The files, by full name
+  std::atomic<u64>                               clock;      // For modification times
+};
+
+#endif // __FILEPROVIDER_H__
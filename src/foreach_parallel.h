@@ -2,48 +2,200 @@
 #define __FOREACH_PARALLEL_H__
 
 #include <functional>
-#include <thread>
 #include <atomic>
-#include <future>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <cassert>
+#include <mutex>
+#include <condition_variable>
+#include "threadpool.h"
 
 template <class T>
 void foreach_parallel(const std::vector<T> &collection, u32 numThreads, const std::function<void(const T&)> &fn)
 {
-  if (numThreads == 1 || collection.size() == 1)
+  if (numThreads <= 1 || collection.size() <= 1)
   {
     for (const auto &item : collection)
       fn(item);
   }
-  else if (numThreads >= collection.size()) 
+  else
   {
-    // spawn a thread for each item
-    std::vector<std::future<void>> tasks;
-    tasks.reserve(collection.size());
-    for (const auto &item : collection)
-      tasks.push_back(std::async(std::launch::async, std::bind(fn, std::ref(item))));
-    for (auto &task : tasks)
-      task.wait();
+    // items are handed out from a shared position, on the shared thread pool
+    std::atomic<size_t> itemPos(0);
+    unsigned concurrency = (unsigned)std::min<size_t>(numThreads, collection.size());
+    ThreadPool::Instance().Run(concurrency, [&itemPos, &collection, &fn]()
+    {
+      while (1)
+      {
+        size_t i = itemPos.fetch_add(1, std::memory_order_relaxed);
+        if (i >= collection.size()) break;
+        fn(collection[i]);
+      }
+    });
   }
-  else
+}
+
+// The order in which foreach_parallel_grouped hands out items: the largest
+// first (equal sizes keep their relative order), skipping any whose group
+// already has as many being processed as its limit allows. It's not thread
+// safe, so the caller serialises Take and Release.
+class GroupedSchedule
+{
+public:
+  // Returned by Take when every item left is in a group at its limit
+  static const size_t Busy = ~(size_t)0;
+
+  // The sizes and groups of the items, by index
+  GroupedSchedule(const std::vector<u64> &sizes, const std::vector<u64> &groups,
+                  const std::function<u32(u64)> &grouplimitfn)
+  : groups(groups)
+  , taken(sizes.size(), false)
+  , firstuntaken(0)
   {
-    std::atomic<unsigned> itemPos(0);
-    std::vector<std::thread> threads;
-    threads.reserve(numThreads);
-    for (unsigned thread = 0; thread < numThreads; thread++)
+    order.reserve(sizes.size());
+    for (size_t i = 0; i < sizes.size(); i++)
+      order.push_back(i);
+    std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b)
     {
-      threads.emplace_back([&itemPos, &collection, &fn]()
+      return sizes[a] > sizes[b];
+    });
+
+    std::map<u64, size_t> groupcount;
+    for (u64 g : groups)
+      groupcount[g]++;
+    concurrency = 0;
+    for (const auto &g : groupcount)
+    {
+      u32 limit = std::max<u32>(grouplimitfn(g.first), 1);
+      grouplimit[g.first] = limit;
+      groupactive[g.first] = 0;
+      concurrency += std::min<size_t>(limit, g.second);
+    }
+  }
+
+  // How many items can be processed at once, at most
+  size_t Concurrency(void) const {return concurrency;}
+
+  // Whether every item has been taken
+  bool Finished(void) const {return firstuntaken == order.size();}
+
+  // Take the next item to be processed, returning its index
+  size_t Take(void)
+  {
+    for (size_t i = firstuntaken; i < order.size(); i++)
+    {
+      u64 g = groups[order[i]];
+      if (!taken[i] && groupactive[g] < grouplimit[g])
       {
-        while (1)
-        {
-          unsigned i = itemPos.fetch_add(1, std::memory_order_relaxed);
-          if (i >= collection.size()) break;
-          fn(collection.at(i));
-        }
-      });
+        taken[i] = true;
+        while (firstuntaken < order.size() && taken[firstuntaken])
+          firstuntaken++;
+        groupactive[g]++;
+        return order[i];
+      }
     }
-    for (auto &thread : threads)
-      thread.join();
+    return Busy;
+  }
+
+  // The item taken with this index has been processed
+  void Release(size_t index)
+  {
+    assert(groupactive[groups[index]] > 0);
+    groupactive[groups[index]]--;
+  }
+
+private:
+  std::vector<u64> groups;         // the group of each item, by index
+  std::vector<size_t> order;       // item indices, largest first
+  std::vector<bool> taken;         // whether each has been taken, in that order
+  size_t firstuntaken;
+  std::map<u64, u32> grouplimit, groupactive;
+  size_t concurrency;
+};
+
+// As foreach_parallel, but when running on multiple threads, items are
+// started in order of decreasing size, so that a large item which happens to
+// be near the end of the list doesn't leave the other threads idle while it
+// completes. Items are also grouped (e.g. by the device they're stored on),
+// with no more than grouplimitfn(group) items from any one group being
+// processed at once (see GroupedSchedule). groupfn is called for every item
+// before any is processed, so it should be cheap (see DeviceIdCache).
+// Single threaded processing retains the original order.
+template <class T>
+void foreach_parallel_grouped(const std::vector<T> &collection, u32 numThreads,
+                              const std::function<u64(const T&)> &sizefn,
+                              const std::function<u64(const T&)> &groupfn,
+                              const std::function<u32(u64)> &grouplimitfn,
+                              const std::function<void(const T&)> &fn)
+{
+  if (numThreads <= 1 || collection.size() <= 1)
+  {
+    foreach_parallel<T>(collection, 1, fn);
+    return;
+  }
+
+  std::vector<u64> sizes, groups;
+  sizes.reserve(collection.size());
+  groups.reserve(collection.size());
+  for (const auto &item : collection)
+  {
+    sizes.push_back(sizefn(item));
+    groups.push_back(groupfn(item));
   }
+  GroupedSchedule schedule(sizes, groups, grouplimitfn);
+
+  std::mutex schedule_lock;
+  std::condition_variable schedule_cond;
+  unsigned concurrency = (unsigned)std::min<size_t>(schedule.Concurrency(), numThreads);
+  ThreadPool::Instance().Run(concurrency, [&]()
+  {
+    std::unique_lock<std::mutex> lock(schedule_lock);
+    while (!schedule.Finished())
+    {
+      size_t index = schedule.Take();
+      if (index == GroupedSchedule::Busy)
+      {
+        // everything left is waiting on a busy group
+        schedule_cond.wait(lock);
+        continue;
+      }
+
+      lock.unlock();
+      fn(collection[index]);
+      lock.lock();
+
+      schedule.Release(index);
+      schedule_cond.notify_all();
+    }
+  });
+}
+
+// Size ordered processing, without any grouping
+template <class T>
+void foreach_parallel_bysize(const std::vector<T> &collection, u32 numThreads, const std::function<u64(const T&)> &sizefn, const std::function<void(const T&)> &fn)
+{
+  foreach_parallel_grouped<T>(collection, numThreads, sizefn,
+                              [](const T&) -> u64 { return 0; },
+                              [numThreads](u64) -> u32 { return numThreads; },
+                              fn);
 }
 
+// Futures for work which uses buffers of the caller's (such as the ParPar
+// backend's transfers to and from them). They're all waited for when the list
+// goes, so that the buffers can't be freed whilst they're still in use, even
+// if processing stops part way through.
+template <class T>
+class FutureList : public std::vector<std::future<T>>
+{
+public:
+  explicit FutureList(size_t count) : std::vector<std::future<T>>(count) {}
+  ~FutureList(void)
+  {
+    for (auto &future : *this)
+      if (future.valid())
+        future.wait();
+  }
+};
+
 #endif // __FOREACH_PARALLEL_H__
@@ -0,0 +1,567 @@
+#include "libpar2internal.h"
+
+#if defined(__linux__) && defined(HAVE_LINUX_IO_URING_H) && HAVE_DECL_IORING_OP_READ
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include <unistd.h>
+# include <limits.h>
+# include <chrono>
+# include <thread>
+# if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#  define USE_IO_URING 1
+# endif
+# ifndef IOV_MAX
+#  define IOV_MAX 1024
+# endif
+#endif
+
+
+#ifdef USE_IO_URING
+// liburing isn't commonly available, and only a handful of its functions are
+// needed, so the rings are managed directly
+
+struct IOQueue::Ring
+{
+  int fd;
+  unsigned entries;
+
+  void  *sqmap;
+  size_t sqmaplen;
+  void  *cqmap;
+  size_t cqmaplen;
+  io_uring_sqe *sqes;
+  size_t sqeslen;
+
+  unsigned *sqtail;
+  unsigned *sqmask;
+  unsigned *sqarray;
+  unsigned *cqhead;
+  unsigned *cqtail;
+  unsigned *cqmask;
+  io_uring_cqe *cqes;
+};
+
+// The buffers of a vectored write are handed to the kernel as they are
+static_assert(sizeof(DiskFile::WriteBuffer) == sizeof(struct iovec) &&
+              __builtin_offsetof(DiskFile::WriteBuffer, buffer) == __builtin_offsetof(struct iovec, iov_base) &&
+              __builtin_offsetof(DiskFile::WriteBuffer, length) == __builtin_offsetof(struct iovec, iov_len),
+              "DiskFile::WriteBuffer must match struct iovec");
+
+static int io_uring_enter(int fd, unsigned tosubmit, unsigned mincomplete, unsigned flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, tosubmit, mincomplete, flags, NULL, 0);
+}
+
+// The user_data of cancellations, which can't be confused with a ticket
+static const u64 canceltag = ~(u64)0;
+// How many times in a row the kernel may be too busy to wait on, before the
+// ring is given up on
+static const unsigned ringbusyretries = 1000;
+// How long to wait for the kernel to make any progress on the requests of
+// an abandoned ring, before they are failed
+static const std::chrono::seconds ringdraintimeout(30);
+#endif
+
+
+IOQueue::IOQueue(void)
+: ring(0)
+, inflight(0)
+, unsubmitted(0)
+, regbuffer(0)
+, reglength(0)
+{
+}
+
+IOQueue::~IOQueue(void)
+{
+  Close();
+}
+
+bool IOQueue::Init(unsigned depth)
+{
+  assert(ring == 0);
+#ifdef USE_IO_URING
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+  if (fd < 0)
+    return false; // not supported by the kernel, or disallowed
+
+  Ring *r = new Ring;
+  r->fd = fd;
+  r->entries = params.sq_entries;
+  r->sqmaplen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  r->cqmaplen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  r->sqeslen = params.sq_entries * sizeof(io_uring_sqe);
+  bool singlemap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singlemap)
+    r->sqmaplen = r->cqmaplen = std::max(r->sqmaplen, r->cqmaplen);
+
+  r->sqmap = mmap(0, r->sqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  r->cqmap = MAP_FAILED;
+  r->sqes = (io_uring_sqe*)MAP_FAILED;
+  if (r->sqmap != MAP_FAILED)
+  {
+    if (singlemap)
+      r->cqmap = r->sqmap;
+    else
+      r->cqmap = mmap(0, r->cqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  }
+  if (r->cqmap != MAP_FAILED)
+    r->sqes = (io_uring_sqe*)mmap(0, r->sqeslen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+  if (r->sqes == MAP_FAILED)
+  {
+    if (r->cqmap != MAP_FAILED && !singlemap)
+      munmap(r->cqmap, r->cqmaplen);
+    if (r->sqmap != MAP_FAILED)
+      munmap(r->sqmap, r->sqmaplen);
+    close(fd);
+    delete r;
+    return false;
+  }
+
+  u8 *sq = (u8*)r->sqmap;
+  r->sqtail  = (unsigned*)(sq + params.sq_off.tail);
+  r->sqmask  = (unsigned*)(sq + params.sq_off.ring_mask);
+  r->sqarray = (unsigned*)(sq + params.sq_off.array);
+  u8 *cq = (u8*)r->cqmap;
+  r->cqhead  = (unsigned*)(cq + params.cq_off.head);
+  r->cqtail  = (unsigned*)(cq + params.cq_off.tail);
+  r->cqmask  = (unsigned*)(cq + params.cq_off.ring_mask);
+  r->cqes    = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  ring = r;
+  return true;
+#else
+  (void)depth;
+  return false;
+#endif
+}
+
+void IOQueue::Close(void)
+{
+  WaitAll();
+  DestroyRing();
+}
+
+void IOQueue::DestroyRing(void)
+{
+#ifdef USE_IO_URING
+  if (ring)
+  {
+    munmap(ring->sqes, ring->sqeslen);
+    if (ring->cqmap != ring->sqmap)
+      munmap(ring->cqmap, ring->cqmaplen);
+    munmap(ring->sqmap, ring->sqmaplen);
+    close(ring->fd); // also drops any registered buffer
+    delete ring;
+    ring = 0;
+  }
+#endif
+  regbuffer = 0;
+  reglength = 0;
+}
+
+void IOQueue::RegisterBuffer(void *buffer, size_t length)
+{
+  assert(inflight == 0);
+  UnregisterBuffer();
+#ifdef USE_IO_URING
+  if (ring)
+  {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = length;
+    // this can fail if the buffer exceeds the locked memory limit, in which
+    // case requests just go without
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0)
+    {
+      regbuffer = (u8*)buffer;
+      reglength = length;
+    }
+  }
+#else
+  (void)buffer;
+  (void)length;
+#endif
+}
+
+void IOQueue::UnregisterBuffer(void)
+{
+  if (regbuffer == 0)
+    return;
+  WaitAll();
+#ifdef USE_IO_URING
+  syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+#endif
+  regbuffer = 0;
+  reglength = 0;
+}
+
+IOQueue::Ticket IOQueue::Read(DiskFile *diskfile, u64 offset, void *buffer, size_t length)
+{
+  return Queue(diskfile, offset, buffer, length, false);
+}
+
+IOQueue::Ticket IOQueue::Write(DiskFile *diskfile, u64 offset, const void *buffer, size_t length)
+{
+  return Queue(diskfile, offset, const_cast<void*>(buffer), length, true);
+}
+
+IOQueue::Ticket IOQueue::WriteV(DiskFile *diskfile, u64 offset, const DiskFile::WriteBuffer *buffers, size_t count)
+{
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++)
+    length += buffers[i].length;
+  return Queue(diskfile, offset, 0, length, true, buffers, count);
+}
+
+IOQueue::Ticket IOQueue::Completed(void)
+{
+  return Queue(0, 0, 0, 0, false);
+}
+
+IOQueue::Ticket IOQueue::Queue(DiskFile *diskfile, u64 offset, void *buffer, size_t length, bool write,
+                               const DiskFile::WriteBuffer *buffers, size_t count)
+{
+  Ticket ticket;
+  if (freetickets.empty())
+  {
+    ticket = (Ticket)requests.size();
+    requests.push_back(Request());
+  }
+  else
+  {
+    ticket = freetickets.back();
+    freetickets.pop_back();
+  }
+
+  Request &request = requests[ticket];
+  request.diskfile = diskfile;
+  request.offset = offset;
+  request.buffer = buffer;
+  request.length = length;
+  request.write = write;
+  request.inuse = true;
+  request.pending = false;
+  request.ok = true;
+  request.buffers.assign(buffers, buffers + count);
+
+  if (length == 0)
+    return ticket;
+
+#ifdef USE_IO_URING
+  // Writes which would extend the file are left to DiskFile, so that
+  // it can keep track of the file size, as are unaligned transfers (and
+  // vectored writes) to files using direct I/O
+  if (ring && !(write && offset + length > diskfile->FileSize()) && length <= 0x7fffffff
+      && count <= (size_t)IOV_MAX
+      && (!diskfile->IsDirect() || (count == 0 && DiskFile::IsDirectAligned(offset, buffer, length))))
+  {
+    int fd = diskfile->Descriptor();
+    if (fd >= 0)
+    {
+      // Make room if the kernel has all it can take
+      while (ring && inflight >= ring->entries)
+      {
+        Submit();
+        Reap(true);
+      }
+    }
+
+    // (the ring is given up on if it stops working)
+    if (fd >= 0 && ring)
+    {
+      unsigned tail = *ring->sqtail;
+      unsigned index = tail & *ring->sqmask;
+      io_uring_sqe *sqe = &ring->sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->fd = fd;
+      sqe->off = offset;
+      sqe->addr = (u64)(uintptr_t)buffer;
+      sqe->len = (u32)length;
+      sqe->user_data = ticket;
+      if (count > 0)
+      {
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->addr = (u64)(uintptr_t)request.buffers.data();
+        sqe->len = (u32)count;
+      }
+      else if (regbuffer && (u8*)buffer >= regbuffer && (u8*)buffer + length <= regbuffer + reglength)
+      {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = 0;
+      }
+      else
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+      ring->sqarray[index] = index;
+      __atomic_store_n(ring->sqtail, tail + 1, __ATOMIC_RELEASE);
+
+      request.pending = true;
+      inflight++;
+      unsubmitted++;
+      return ticket;
+    }
+  }
+#endif
+
+  Perform(request, 0);
+  return ticket;
+}
+
+void IOQueue::Perform(Request &request, size_t done)
+{
+  TraceScope trace(request.write || !request.buffers.empty() ? "write" : "read");
+
+  if (!request.buffers.empty())
+  {
+    // Leave out whatever has already been written
+    std::vector<DiskFile::WriteBuffer> rest;
+    size_t skip = done;
+    for (std::vector<DiskFile::WriteBuffer>::const_iterator part = request.buffers.begin();
+         part != request.buffers.end();
+         ++part)
+    {
+      if (skip >= part->length)
+      {
+        skip -= part->length;
+        continue;
+      }
+      DiskFile::WriteBuffer remainder = {(const u8*)part->buffer + skip, part->length - skip};
+      rest.push_back(remainder);
+      skip = 0;
+    }
+    request.ok = request.diskfile->WriteV(request.offset + done, rest.data(), rest.size());
+  }
+  else if (request.write)
+    request.ok = request.diskfile->Write(request.offset + done, (u8*)request.buffer + done, request.length - done);
+  else
+    request.ok = request.diskfile->Read(request.offset + done, (u8*)request.buffer + done, request.length - done);
+}
+
+void IOQueue::Submit(void)
+{
+#ifdef USE_IO_URING
+  while (unsubmitted > 0)
+  {
+    int ret = io_uring_enter(ring->fd, unsubmitted, 0, 0);
+    if (ret > 0)
+    {
+      unsubmitted -= ret;
+    }
+    else if (ret < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    else if (ret < 0 && (errno == EAGAIN || errno == EBUSY) && inflight > unsubmitted)
+    {
+      // Kernel is out of resources; wait for something to complete first
+      Reap(true);
+    }
+    else
+    {
+      // The kernel won't take the remaining requests, so withdraw them from
+      // the ring and perform them here instead
+      unsigned tail = *ring->sqtail;
+      for (unsigned i = 0; i < unsubmitted; i++)
+      {
+        tail--;
+        Request &request = requests[(Ticket)ring->sqes[tail & *ring->sqmask].user_data];
+        request.pending = false;
+        Perform(request, 0);
+      }
+      __atomic_store_n(ring->sqtail, tail, __ATOMIC_RELEASE);
+      inflight -= unsubmitted;
+      unsubmitted = 0;
+    }
+  }
+#endif
+}
+
+void IOQueue::Reap(bool wait)
+{
+#ifdef USE_IO_URING
+  if (!ring)
+    return;
+
+  unsigned busy = 0;
+  while (Collect() == 0 && wait)
+  {
+    if (io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+    {
+      // The kernel is short of resources, or has completions which didn't
+      // fit in the ring and will be passed on as room is made: those that
+      // are there are collected, and the wait tried again
+      if ((errno == EAGAIN || errno == EBUSY) && ++busy < ringbusyretries)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+
+      // Completions can't be waited for, so nothing pending would ever
+      // finish: give up on the ring
+      Abandon();
+      return;
+    }
+    busy = 0;
+  }
+#else
+  (void)wait;
+#endif
+}
+
+unsigned IOQueue::Collect(void)
+{
+#ifdef USE_IO_URING
+  unsigned head = *ring->cqhead;
+  unsigned tail = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE);
+  unsigned count = tail - head;
+  for (; head != tail; head++)
+  {
+    io_uring_cqe *cqe = &ring->cqes[head & *ring->cqmask];
+    if (cqe->user_data == canceltag)
+      continue;
+
+    Request &request = requests[(Ticket)cqe->user_data];
+    int res = cqe->res;
+    request.pending = false;
+    inflight--;
+
+    // Anything unexpected, including short transfers (e.g. reading past the
+    // end of a file which has been truncated), an operation unsupported by
+    // an older kernel, or one cancelled by Abandon, is redone synchronously
+    // so that DiskFile can deal with and report it in the usual way
+    if (res < 0 || (size_t)res != request.length)
+      Perform(request, res > 0 ? (size_t)res : 0);
+  }
+  __atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+  return count;
+#else
+  return 0;
+#endif
+}
+
+void IOQueue::Abandon(void)
+{
+#ifdef USE_IO_URING
+  // Withdraw whatever hasn't been submitted yet, and perform it here, as
+  // the kernel has never seen it
+  unsigned tail = *ring->sqtail;
+  for (; unsubmitted > 0; unsubmitted--, inflight--)
+  {
+    tail--;
+    Request &request = requests[(Ticket)ring->sqes[tail & *ring->sqmask].user_data];
+    request.pending = false;
+    Perform(request, 0);
+  }
+
+  // Closing the ring doesn't stop the kernel from using the buffers of
+  // requests it already has, so it's asked to cancel them and then each is
+  // waited for; only once it has reported a request as finished can it be
+  // performed (again) synchronously. The kernel has room for a cancellation
+  // of each, as the ring has been emptied of everything else.
+  unsigned cancels = 0;
+  for (Ticket ticket = 0; ticket < requests.size() && cancels < ring->entries; ticket++)
+  {
+    if (requests[ticket].inuse && requests[ticket].pending)
+    {
+      unsigned index = tail & *ring->sqmask;
+      io_uring_sqe *sqe = &ring->sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = ticket;
+      sqe->user_data = canceltag;
+      ring->sqarray[index] = index;
+      tail++;
+      cancels++;
+    }
+  }
+  __atomic_store_n(ring->sqtail, tail, __ATOMIC_RELEASE);
+  while (cancels > 0)
+  {
+    int ret = io_uring_enter(ring->fd, cancels, 0, 0);
+    if (ret > 0)
+      cancels -= ret;
+    else if (ret < 0 && errno == EINTR)
+      continue;
+    else
+      break; // the requests may yet finish without being cancelled
+  }
+
+  // Wait for the kernel to let go of everything. The completions are
+  // watched for directly, as waiting for them through the kernel is what
+  // failed, although it's still asked to pass on any which didn't fit in
+  // the ring.
+  std::chrono::steady_clock::time_point giveup = std::chrono::steady_clock::now() + ringdraintimeout;
+  while (inflight > 0 && std::chrono::steady_clock::now() < giveup)
+  {
+    if (Collect() > 0)
+    {
+      giveup = std::chrono::steady_clock::now() + ringdraintimeout;
+      continue;
+    }
+    io_uring_enter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS);
+    if (Collect() == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // Anything still pending may yet be transferred by the kernel, so it
+  // can't be performed again, and its buffer mustn't be reused: it fails,
+  // so that the operation stops. Requests from now on are synchronous.
+  for (std::vector<Request>::iterator request = requests.begin(); request != requests.end(); ++request)
+  {
+    if (request->inuse && request->pending)
+    {
+      request->pending = false;
+      request->ok = false;
+      request->diskfile->ReportFailure(request->write || !request->buffers.empty(),
+                                       request->offset, request->length,
+                                       "asynchronous I/O could not be cancelled");
+    }
+  }
+  inflight = 0;
+  DestroyRing();
+#endif
+}
+
+bool IOQueue::IsDone(Ticket ticket)
+{
+  assert(ticket < requests.size() && requests[ticket].inuse);
+  if (requests[ticket].pending)
+  {
+    Submit();
+    Reap(false);
+  }
+  return !requests[ticket].pending;
+}
+
+bool IOQueue::Wait(Ticket ticket)
+{
+  assert(ticket < requests.size() && requests[ticket].inuse);
+  if (requests[ticket].pending)
+  {
+    Submit();
+    while (requests[ticket].pending)
+      Reap(true);
+  }
+
+  Request &request = requests[ticket];
+  request.inuse = false;
+  freetickets.push_back(ticket);
+  return request.ok;
+}
+
+bool IOQueue::WaitAll(void)
+{
+  bool ok = true;
+  for (Ticket ticket = 0; ticket < requests.size(); ticket++)
+  {
+    if (requests[ticket].inuse)
+      ok = Wait(ticket) && ok;
+  }
+  return ok;
+}
@@ -0,0 +1,106 @@
+#ifndef __IOQUEUE_H__
+#define __IOQUEUE_H__
+
+// Queue of reads and writes against DiskFiles, so that one thread can keep
+// many requests in flight at once.
+// On Linux this uses io_uring, with requests submitted to the kernel in
+// batches. Elsewhere, or if the kernel doesn't support it, every request is
+// carried out synchronously as it is queued, so callers use the same code
+// path regardless.
+// A queue must only be used by one thread at a time.
+
+class DiskFile;
+
+class IOQueue
+{
+public:
+  IOQueue(void);
+  ~IOQueue(void);
+
+  // Set up asynchronous I/O with room for `depth` requests in flight.
+  // Returns false if this isn't available, in which case requests will be
+  // performed synchronously.
+  bool Init(unsigned depth);
+
+  // Wait for any outstanding requests and release the kernel resources
+  void Close(void);
+
+  // Whether requests are actually being performed asynchronously
+  bool IsAsync(void) const {return ring != 0;}
+
+  // Register the buffer which most requests will transfer to/from, so that
+  // the kernel needn't map it for every request. Must only be called when
+  // there are no outstanding requests.
+  void RegisterBuffer(void *buffer, size_t length);
+  void UnregisterBuffer(void);
+
+  // Every request is identified by a ticket, which must be waited on
+  typedef u32 Ticket;
+
+  // Queue a request. The buffer must be left alone until the request
+  // has been waited on.
+  Ticket Read(DiskFile *diskfile, u64 offset, void *buffer, size_t length);
+  Ticket Write(DiskFile *diskfile, u64 offset, const void *buffer, size_t length);
+  // A vectored write (see DiskFile::WriteV). The list of buffers is copied.
+  Ticket WriteV(DiskFile *diskfile, u64 offset, const DiskFile::WriteBuffer *buffers, size_t count);
+  // A request with nothing to do
+  Ticket Completed(void);
+
+  // Send all queued requests to the kernel
+  void Submit(void);
+
+  // Check whether a request has finished, without waiting for it
+  bool IsDone(Ticket ticket);
+
+  // Wait for a request to finish and release its ticket. Returns false if
+  // the request failed (in which case an error will have been reported).
+  bool Wait(Ticket ticket);
+
+  // Wait for all outstanding requests, returning false if any failed
+  bool WaitAll(void);
+
+private:
+  IOQueue(const IOQueue&) = delete;
+  IOQueue &operator=(const IOQueue&) = delete;
+
+  struct Request
+  {
+    DiskFile *diskfile;
+    u64       offset;
+    void     *buffer;
+    size_t    length;
+    bool      write;
+    bool      inuse;
+    bool      pending;  // still with the kernel
+    bool      ok;
+    std::vector<DiskFile::WriteBuffer> buffers;  // for a vectored write
+  };
+
+  Ticket Queue(DiskFile *diskfile, u64 offset, void *buffer, size_t length, bool write,
+               const DiskFile::WriteBuffer *buffers = 0, size_t count = 0);
+  // Carry out (the rest of) a request synchronously
+  void Perform(Request &request, size_t done);
+  // Process any completions, waiting for at least one if `wait` is set
+  void Reap(bool wait);
+  // Process the completions already in the ring, returning how many
+  unsigned Collect(void);
+  // Stop using the ring, if it fails: whatever was pending on it is
+  // cancelled and then performed synchronously, or failed if the kernel
+  // can't be seen to have let go of its buffers
+  void Abandon(void);
+  void DestroyRing(void);
+
+  std::vector<Request> requests;
+  std::vector<Ticket>  freetickets;
+
+  // io_uring state (opaque, as it's only available on Linux)
+  struct Ring;
+  Ring     *ring;
+  unsigned  inflight;     // requests queued or submitted, but not completed
+  unsigned  unsubmitted;  // requests queued, but not yet submitted
+
+  u8       *regbuffer;    // the registered buffer, if any
+  size_t    reglength;
+};
+
+#endif // __IOQUEUE_H__
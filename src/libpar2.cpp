@@ -32,10 +32,18 @@ Result par2create(std::ostream &sout,
 		  const u32 firstblock,
 		  const Scheme recoveryfilescheme,
 		  const u32 recoveryfilecount,
-		  const u32 recoveryblockcount
+		  const u32 recoveryblockcount,
+		  const bool directio,
+		  const CachePolicy cachepolicy,
+		  ProgressListener *progresslistener,
+		  Statistics *statistics,
+		  FileProvider *fileprovider
 		  )
 {
   Par2Creator creator(sout, serr, noiselevel);
+  creator.SetProgressListener(progresslistener);
+  creator.SetStatistics(statistics);
+  creator.SetFileProvider(fileprovider);
   Result result = creator.Process(
 				  memorylimit,
 				  basepath,
@@ -47,8 +55,11 @@ Result par2create(std::ostream &sout,
 				  firstblock,
 				  recoveryfilescheme,
 				  recoveryfilecount,
-				  recoveryblockcount
+				  recoveryblockcount,
+				  directio,
+				  cachepolicy
 				  );
+  creator.ReportMemory();
   return result;
 }
 
@@ -66,10 +77,18 @@ Result par2repair(std::ostream &sout,
 		  const bool purgefiles,
 		  const bool renameonly,
 		  const bool skipdata,
-		  const u64 skipleaway
+		  const u64 skipleaway,
+		  const bool directio,
+		  const CachePolicy cachepolicy,
+		  ProgressListener *progresslistener,
+		  Statistics *statistics,
+		  FileProvider *fileprovider
 		  )
 {
   Par2Repairer repairer(sout, serr, noiselevel);
+  repairer.SetProgressListener(progresslistener);
+  repairer.SetStatistics(statistics);
+  repairer.SetFileProvider(fileprovider);
   Result result = repairer.Process(
 				   memorylimit,
 				   basepath,
@@ -81,7 +100,10 @@ Result par2repair(std::ostream &sout,
 				   purgefiles,
 				   renameonly,
 				   skipdata,
-				   skipleaway);
+				   skipleaway,
+				   directio,
+				   cachepolicy);
+  repairer.ReportMemory();
 
   return result;
 }
@@ -97,12 +119,16 @@ Result par1repair(std::ostream &sout,
 		  const std::string &parfilename,
 		  const std::vector<std::string> &extrafiles,
 		  const bool dorepair,   // derived from operation
-		  const bool purgefiles
+		  const bool purgefiles,
 		  // skipdata is not used by Par1
 		  // skipleaway is not used by Par1
+		  ProgressListener *progresslistener,
+		  FileProvider *fileprovider
 		  )
 {
   Par1Repairer repairer(sout, serr, noiselevel);
+  repairer.SetProgressListener(progresslistener);
+  repairer.SetFileProvider(fileprovider);
   Result result = repairer.Process(memorylimit,
 				   nthreads,
 				   parfilename,
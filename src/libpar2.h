@@ -117,6 +117,19 @@ typedef enum
 } Scheme;
 
 
+// How files should make use of the OS's file cache
+typedef enum
+{
+  cpNormal = 0,    // Leave it to the OS
+  cpSequential,    // Tell the OS that files are read sequentially, and what
+                   // will be read next, so that it can read ahead
+  cpDrop           // As above, and also drop data from the cache once it has
+                   // been processed, and write out recovery/repaired data as
+                   // it's produced, so that the cache isn't filled with data
+                   // which won't be used again
+} CachePolicy;
+
+
 // How much logging/status information to write
 // to output or error stream
 typedef enum
@@ -161,6 +174,75 @@ typedef enum Result
 } Result;
 
 
+// The stages of processing which progress is reported for
+typedef enum
+{
+  ppLoading = 0,   // Loading packets from a PAR file
+  ppHashing,       // Computing the hashes of the source files (creating)
+  ppScanning,      // Scanning files for data blocks (verifying)
+  ppConstructing,  // Constructing the Reed Solomon matrix
+  ppSolving,       // Solving the Reed Solomon matrix
+  ppProcessing,    // Computing recovery data, or copying data blocks into
+                   // the repaired files
+  ppRepairing      // Computing missing data blocks and writing the repaired
+                   // files
+} ProgressPhase;
+
+
+// What was found when a file was verified
+typedef enum
+{
+  fvComplete = 0,  // The file is a complete copy of the target file
+  fvDamaged,       // Some data blocks were found in the file
+  fvNoData,        // No data blocks were found in the file
+  fvMissing        // The target file does not exist
+} FileVerifyStatus;
+
+
+// Receives progress and the results of verification as they happen, for
+// applications which want them other than as text. Progress is batched: it's
+// reported no more often than every 50ms (and on completion) however often
+// it's made. Events can come from several threads at once, so must be handled
+// in a thread safe way, and quickly, as the thread making the event waits.
+// The meaning of done and total depends on the phase, but is bytes (or for
+// ppConstructing and ppSolving, rows of the matrix).
+
+class ProgressListener
+{
+public:
+  virtual ~ProgressListener(void) {}
+
+  // A phase has started or finished (finished phases may not be complete, if
+  // they failed). subject is the file the phase is for, or empty.
+  virtual void PhaseStarted(ProgressPhase /*phase*/, const std::string &/*subject*/, u64 /*total*/) {}
+  virtual void PhaseFinished(ProgressPhase /*phase*/, const std::string &/*subject*/) {}
+
+  // How far a phase has got, and how fast (per second) since it started
+  virtual void PhaseProgress(ProgressPhase /*phase*/, const std::string &/*subject*/, u64 /*done*/, u64 /*total*/, double /*rate*/) {}
+
+  // Text which is output whilst a phase is in progress (at nlNoisy and above)
+  virtual void PhaseMessage(ProgressPhase /*phase*/, const std::string &/*line*/) {}
+
+  // A file has been verified: which target file (if any) data blocks were
+  // found for, and how many of its blocks were found
+  virtual void FileVerified(const std::string &/*filename*/, const std::string &/*target*/,
+                            FileVerifyStatus /*status*/, u32 /*blocksfound*/, u32 /*blockstotal*/) {}
+
+  // All of the files have been verified: how many data blocks were found, how
+  // many are missing, and how many recovery blocks there are to repair them
+  virtual void VerificationResult(u32 /*availableblocks*/, u32 /*missingblocks*/, u32 /*recoveryblocks*/) {}
+};
+
+
+// How long each stage of an operation took (see statistics.h)
+class Statistics;
+
+// Where the files are read from and written to, instead of the file system
+// (see fileprovider.h). It's only used by the operation it's passed to, and
+// must outlive it: files are still being closed as the operation returns.
+class FileProvider;
+
+
 Result par2create(std::ostream &sout,
 			  std::ostream &serr,
 			  const NoiseLevel noiselevel,
@@ -174,7 +256,12 @@ Result par2create(std::ostream &sout,
 			  const u32 firstblock,
 			  const Scheme recoveryfilescheme,
 			  const u32 recoveryfilecount,
-			  const u32 recoveryblockcount
+			  const u32 recoveryblockcount,
+			  const bool directio = false,  // bypass the OS's file cache
+			  const CachePolicy cachepolicy = cpNormal,
+			  ProgressListener *progresslistener = 0,  // or 0 for text output to sout
+			  Statistics *statistics = 0,  // or 0 not to record them
+			  FileProvider *fileprovider = 0  // or 0 for the file system
 			  );
 
 
@@ -191,7 +278,12 @@ Result par2repair(std::ostream &sout,
 		  const bool purgefiles,
 		  const bool renameonly,
 		  const bool skipdata,
-		  const u64 skipleaway
+		  const u64 skipleaway,
+		  const bool directio = false,  // bypass the OS's file cache
+		  const CachePolicy cachepolicy = cpNormal,
+		  ProgressListener *progresslistener = 0,  // or 0 for text output to sout
+		  Statistics *statistics = 0,  // or 0 not to record them
+		  FileProvider *fileprovider = 0  // or 0 for the file system
 		  );
 
 
@@ -205,9 +297,11 @@ Result par1repair(std::ostream &sout,
 		  const std::string &parfilename,
 		  const std::vector<std::string> &extrafiles,
 		  const bool dorepair,   // derived from operation
-		  const bool purgefiles
+		  const bool purgefiles,
 		  // skipdata is not used by Par1
 		  // skipleaway is not used by Par1
+		  ProgressListener *progresslistener = 0,  // or 0 for text output to sout
+		  FileProvider *fileprovider = 0  // or 0 for the file system
 		  );
 
 
@@ -24,7 +24,10 @@
 
 
 
-#include "libpar2.h"
+#include "libpar2internal.h"
+#include "threadpool.h"
+#include "foreach_parallel.h"
+#include "../parpar/gf16/gfmat_coeff.h"
 
 
 // ComputeRecoveryFileCount
@@ -445,6 +448,1312 @@ int test4() {
   return 0;
 }
 
+// Par2StreamVerifier
+// Data passed in as it is written to the files (in order, out of order, and
+// with some of it missing) is verified without the files being scanned, and
+// the files can then be repaired. Data written out of order is read back
+// from the file rather than held on to.
+int test5() {
+  const u64 blocksize = 4096;
+  const size_t filesizes[3] = {20000, 30000, 9000};
+  const size_t chunksize = 3000;
+
+  std::string basepath = DiskFile::GetCanonicalPathname("./");
+  if (basepath.substr(basepath.length()-1) != PATHSEP)
+    basepath += PATHSEP;
+
+  std::vector<std::string> filenames;
+  std::vector< std::vector<u8> > contents;
+  srand(5);
+  for (int i = 0; i < 3; i++) {
+    std::string filename = basepath + "stream" + std::to_string(i) + ".dat";
+    std::vector<u8> data(filesizes[i]);
+    for (size_t j = 0; j < data.size(); j++)
+      data[j] = (u8)rand();
+
+    std::ofstream output(filename, std::ios::binary);
+    output.write((const char*)&data[0], data.size());
+    output.close();
+
+    filenames.push_back(filename);
+    contents.push_back(data);
+  }
+
+  Result result = par2create(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                             0, _FILE_THREADS, basepath + "stream", filenames,
+                             blocksize, 0, scUniform, 1, 6, false, cpNormal);
+  if (result != eSuccess) {
+    std::cerr << "par2create failed: " << result << std::endl;
+    return 1;
+  }
+
+  // The second file is written backwards and is missing some data, and the
+  // third isn't written at all
+  std::vector<u8> damaged = contents[1];
+  std::fill(damaged.begin() + 4*chunksize, damaged.begin() + 5*chunksize, 0);
+  {
+    std::ofstream output(filenames[1], std::ios::binary);
+    output.write((const char*)&damaged[0], damaged.size());
+  }
+  remove(filenames[2].c_str());
+
+  int ret = 0;
+  {
+    std::ostringstream sout;
+    Par2StreamVerifier verifier(sout, std::cerr, nlNormal);
+    result = verifier.Open(basepath, _FILE_THREADS, basepath + "stream.par2", std::vector<std::string>());
+    if (result != eSuccess) {
+      std::cerr << "Par2StreamVerifier::Open failed: " << result << std::endl;
+      return 1;
+    }
+
+    // The first file is written with every other chunk first, so that each
+    // gap is filled in after the data which follows it
+    for (int pass = 0; pass < 2; pass++) {
+      for (size_t offset = (1 - pass) * chunksize; offset < contents[0].size(); offset += 2 * chunksize) {
+        size_t length = std::min(chunksize, contents[0].size() - offset);
+        if (!verifier.Write(filenames[0], offset, &contents[0][offset], length)) {
+          std::cerr << "Write failed" << std::endl;
+          return 1;
+        }
+      }
+    }
+    if (!verifier.Finish(filenames[0])) {
+      std::cerr << "Finish failed" << std::endl;
+      return 1;
+    }
+    if (sout.str().find("Target: \"stream0.dat\" - found.") == std::string::npos) {
+      std::cerr << "The first file was not found complete:\n" << sout.str() << std::endl;
+      return 1;
+    }
+
+    for (size_t chunk = contents[1].size() / chunksize; chunk-- > 0; ) {
+      if (chunk == 4)
+        continue;
+      size_t offset = chunk * chunksize;
+      size_t length = std::min(chunksize, contents[1].size() - offset);
+      if (!verifier.Write(filenames[1], offset, &contents[1][offset], length)) {
+        std::cerr << "Write failed" << std::endl;
+        return 1;
+      }
+    }
+
+    // Blocks 2 and 3 of the second file, and all of the third, are missing
+    if (verifier.BlockCount() != 16 || verifier.AvailableBlockCount() != 11 ||
+        verifier.MissingBlockCount() != 5 || verifier.RecoveryBlockCount() != 6 ||
+        !verifier.RepairPossible()) {
+      std::cerr << "Found " << verifier.AvailableBlockCount() << " of "
+                << verifier.BlockCount() << " blocks, expected 11 of 16" << std::endl;
+      ret = 1;
+    }
+    else if ((result = verifier.Verify()) != eRepairPossible) {
+      std::cerr << "Verify returned " << result << std::endl;
+      ret = 1;
+    }
+    else if ((result = verifier.Repair(16*1048576, 0)) != eSuccess) {
+      std::cerr << "Repair returned " << result << std::endl;
+      ret = 1;
+    }
+  }
+
+  for (int i = 0; ret == 0 && i < 3; i++) {
+    std::ifstream input(filenames[i], std::ios::binary);
+    std::vector<u8> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    if (data != contents[i]) {
+      std::cerr << filenames[i] << " was not repaired" << std::endl;
+      ret = 1;
+    }
+  }
+
+  for (int i = 0; i < 3; i++) {
+    remove(filenames[i].c_str());
+    remove((filenames[i] + ".1").c_str());
+  }
+  remove((basepath + "stream.par2").c_str());
+  remove((basepath + "stream.vol0+6.par2").c_str());
+
+  return ret;
+}
+
+
+// Par2RepairerSession
+// A set which is kept open can be verified again as files appear and are
+// damaged, and repaired more than once.
+int test6() {
+  const u64 blocksize = 4096;
+  const size_t filesizes[3] = {20000, 30000, 9000};
+
+  std::string basepath = DiskFile::GetCanonicalPathname("./");
+  if (basepath.substr(basepath.length()-1) != PATHSEP)
+    basepath += PATHSEP;
+
+  std::vector<std::string> filenames;
+  std::vector< std::vector<u8> > contents;
+  srand(6);
+  for (int i = 0; i < 3; i++) {
+    std::string filename = basepath + "session" + std::to_string(i) + ".dat";
+    std::vector<u8> data(filesizes[i]);
+    for (size_t j = 0; j < data.size(); j++)
+      data[j] = (u8)rand();
+
+    std::ofstream output(filename, std::ios::binary);
+    output.write((const char*)&data[0], data.size());
+    output.close();
+
+    filenames.push_back(filename);
+    contents.push_back(data);
+  }
+
+  Result result = par2create(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                             0, _FILE_THREADS, basepath + "session", filenames,
+                             blocksize, 0, scUniform, 1, 6, false, cpNormal);
+  if (result != eSuccess) {
+    std::cerr << "par2create failed: " << result << std::endl;
+    return 1;
+  }
+
+  // Overwrite part of a block of a file
+  auto damage = [&](int i, size_t offset) {
+    std::fstream file(filenames[i], std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(offset);
+    file.write("damage", 6);
+  };
+
+  remove(filenames[2].c_str());
+
+  int ret = 0;
+  {
+    Par2RepairerSession session(std::cout, std::cerr, nlSilent);
+    result = session.Open(basepath, _FILE_THREADS, basepath + "session.par2", std::vector<std::string>());
+    if (result != eSuccess) {
+      std::cerr << "Par2RepairerSession::Open failed: " << result << std::endl;
+      return 1;
+    }
+
+    // The third file is missing
+    if ((result = session.Verify()) != eRepairPossible || session.AvailableBlockCount() != 13) {
+      std::cerr << "Verify returned " << result << " with "
+                << session.AvailableBlockCount() << " blocks, expected 13" << std::endl;
+      ret = 1;
+    }
+
+    // It turns up
+    if (ret == 0) {
+      std::ofstream output(filenames[2], std::ios::binary);
+      output.write((const char*)&contents[2][0], contents[2].size());
+      output.close();
+
+      if ((result = session.Verify()) != eSuccess || session.AvailableBlockCount() != 16) {
+        std::cerr << "Verify returned " << result << " with "
+                  << session.AvailableBlockCount() << " blocks, expected 16" << std::endl;
+        ret = 1;
+      }
+    }
+
+    // The second file is damaged, and repaired
+    if (ret == 0) {
+      damage(1, 5000);
+      if ((result = session.Reverify(std::vector<std::string>(1, filenames[1]))) != eRepairPossible ||
+          session.AvailableBlockCount() != 15) {
+        std::cerr << "Reverify returned " << result << " with "
+                  << session.AvailableBlockCount() << " blocks, expected 15" << std::endl;
+        ret = 1;
+      }
+      else if ((result = session.Repair(16*1048576, 0)) != eSuccess) {
+        std::cerr << "Repair returned " << result << std::endl;
+        ret = 1;
+      }
+    }
+
+#ifndef _WIN32
+    // It's replaced by another damaged copy, which is written elsewhere and
+    // renamed into place (on Windows, that can't happen whilst the session
+    // has the file open)
+    if (ret == 0) {
+      std::string replacement = filenames[1] + ".new";
+      std::vector<u8> data = contents[1];
+      memcpy(&data[9000], "damage", 6);
+      std::ofstream output(replacement, std::ios::binary);
+      output.write((const char*)&data[0], data.size());
+      output.close();
+      if (rename(replacement.c_str(), filenames[1].c_str()) != 0) {
+        std::cerr << "Could not replace " << filenames[1] << std::endl;
+        ret = 1;
+      }
+      else if ((result = session.Reverify(std::vector<std::string>(1, filenames[1]))) != eRepairPossible ||
+               session.AvailableBlockCount() != 15) {
+        std::cerr << "Reverify of the replaced file returned " << result << " with "
+                  << session.AvailableBlockCount() << " blocks, expected 15" << std::endl;
+        ret = 1;
+      }
+      else if ((result = session.Repair(16*1048576, 0)) != eSuccess) {
+        std::cerr << "Repair returned " << result << std::endl;
+        ret = 1;
+      }
+    }
+#endif
+
+    // Then the first file is, twice over
+    if (ret == 0) {
+      damage(0, 100);
+      damage(0, 12300);
+      if ((result = session.Reverify(std::vector<std::string>(1, filenames[0]))) != eRepairPossible ||
+          session.AvailableBlockCount() != 14) {
+        std::cerr << "Reverify returned " << result << " with "
+                  << session.AvailableBlockCount() << " blocks, expected 14" << std::endl;
+        ret = 1;
+      }
+      else if ((result = session.Repair(16*1048576, 0)) != eSuccess) {
+        std::cerr << "Repair returned " << result << std::endl;
+        ret = 1;
+      }
+    }
+  }
+
+  for (int i = 0; ret == 0 && i < 3; i++) {
+    std::ifstream input(filenames[i], std::ios::binary);
+    std::vector<u8> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    if (data != contents[i]) {
+      std::cerr << filenames[i] << " was not repaired" << std::endl;
+      ret = 1;
+    }
+  }
+
+  for (int i = 0; i < 3; i++) {
+    remove(filenames[i].c_str());
+    remove((filenames[i] + ".1").c_str());
+    remove((filenames[i] + ".2").c_str());
+  }
+  remove((basepath + "session.par2").c_str());
+  remove((basepath + "session.vol0+6.par2").c_str());
+
+  return ret;
+}
+
+
+// MemoryFileProvider
+// Files can be created, verified and repaired without touching the disk.
+int test7() {
+  const u64 blocksize = 4096;
+  const size_t filesizes[3] = {20000, 30000, 9000};
+
+  MemoryFileProvider provider(PATHSEP "par2mem");
+  const std::string &basepath = provider.Root();
+
+  std::vector<std::string> filenames;
+  std::vector< std::vector<u8> > contents;
+  srand(7);
+  for (int i = 0; i < 3; i++) {
+    std::vector<u8> data(filesizes[i]);
+    for (size_t j = 0; j < data.size(); j++)
+      data[j] = (u8)rand();
+    contents.push_back(data);
+  }
+  for (int i = 0; i < 3; i++) {
+    filenames.push_back(basepath + "memory" + std::to_string(i) + ".dat");
+    provider.AddFile(filenames[i], &contents[i][0], contents[i].size());
+  }
+
+  int ret = 0;
+  Result result = par2create(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                             0, _FILE_THREADS, basepath + "memory", filenames,
+                             blocksize, 0, scUniform, 1, 6, false, cpNormal, 0, 0, &provider);
+  if (result != eSuccess) {
+    std::cerr << "par2create failed: " << result << std::endl;
+    ret = 1;
+  }
+
+  // Damage the second file, and lose the third
+  if (ret == 0) {
+    std::vector<u8> damaged = contents[1];
+    std::fill(damaged.begin() + 5000, damaged.begin() + 9000, 0);
+    provider.AddFileCopy(filenames[1], &damaged[0], damaged.size());
+    provider.Delete(filenames[2]);
+
+    result = par2repair(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                        0, _FILE_THREADS, basepath + "memory.par2", std::vector<std::string>(),
+                        true, false, false, false, 0, false, cpNormal, 0, 0, &provider);
+    if (result != eSuccess) {
+      std::cerr << "par2repair failed: " << result << std::endl;
+      ret = 1;
+    }
+  }
+
+  for (int i = 0; ret == 0 && i < 3; i++) {
+    const u8 *data;
+    u64 length;
+    if (!provider.GetFile(filenames[i], data, length) ||
+        std::vector<u8>(data, data + length) != contents[i]) {
+      std::cerr << filenames[i] << " was not repaired" << std::endl;
+      ret = 1;
+    }
+  }
+
+  // None of it should have gone to disk: the provider was only used by the
+  // operations it was passed to
+  if (ret == 0 && (DiskFile::FileExists(basepath + "memory.par2") || DiskFile::FileExists(filenames[0]))) {
+    std::cerr << "Files were written to disk" << std::endl;
+    ret = 1;
+  }
+  if (ret == 0 && !DiskFile::FileExists(basepath + "memory.par2", &provider)) {
+    std::cerr << "The PAR2 file was not written to the provider" << std::endl;
+    ret = 1;
+  }
+
+  return ret;
+}
+
+
+// ProgressListener
+// Progress and the results of verification are reported as events, rather
+// than as text.
+class TestProgressListener : public ProgressListener
+{
+public:
+  std::mutex lock;
+  std::map<ProgressPhase, int> started;
+  std::map<ProgressPhase, int> finished;
+  std::map<ProgressPhase, u64> done;      // the furthest progress reported
+  std::map<std::string, FileVerifyStatus> files;
+  std::map<std::string, u32> blocksfound;
+  u32 availableblocks = 0;
+  u32 missingblocks = 0;
+  bool bad = false;
+
+  virtual void PhaseStarted(ProgressPhase phase, const std::string &subject, u64 total) {
+    std::lock_guard<std::mutex> l(lock);
+    started[phase]++;
+    done[phase] = 0;
+  }
+  virtual void PhaseFinished(ProgressPhase phase, const std::string &subject) {
+    std::lock_guard<std::mutex> l(lock);
+    finished[phase]++;
+  }
+  virtual void PhaseProgress(ProgressPhase phase, const std::string &subject, u64 d, u64 total, double rate) {
+    std::lock_guard<std::mutex> l(lock);
+    if (d > total || rate < 0 || started[phase] == finished[phase])
+      bad = true;
+    done[phase] = std::max(done[phase], d);
+  }
+  virtual void FileVerified(const std::string &filename, const std::string &target,
+                            FileVerifyStatus status, u32 found, u32 total) {
+    std::lock_guard<std::mutex> l(lock);
+    if (found > total)
+      bad = true;
+    // Only the first verification of each file, rather than of the repair
+    if (files.insert(std::make_pair(filename, status)).second)
+      blocksfound[filename] = found;
+  }
+  virtual void VerificationResult(u32 available, u32 missing, u32 recovery) {
+    availableblocks = available;
+    missingblocks = missing;
+  }
+};
+
+int test8() {
+  const u64 blocksize = 4096;
+  const size_t filesizes[3] = {20000, 30000, 9000};
+
+  MemoryFileProvider provider(PATHSEP "par2mem");
+  const std::string &basepath = provider.Root();
+
+  std::vector<std::string> filenames;
+  std::vector< std::vector<u8> > contents;
+  srand(8);
+  for (int i = 0; i < 3; i++) {
+    std::vector<u8> data(filesizes[i]);
+    for (size_t j = 0; j < data.size(); j++)
+      data[j] = (u8)rand();
+    contents.push_back(data);
+    filenames.push_back(basepath + "events" + std::to_string(i) + ".dat");
+    provider.AddFileCopy(filenames[i], &contents[i][0], contents[i].size());
+  }
+
+  int ret = 0;
+  TestProgressListener created;
+  std::ostringstream sout;
+  Result result = par2create(sout, std::cerr, nlNormal, 16*1048576, basepath,
+                             0, _FILE_THREADS, basepath + "events", filenames,
+                             blocksize, 0, scUniform, 1, 6, false, cpNormal, &created, 0, &provider);
+  if (result != eSuccess) {
+    std::cerr << "par2create failed: " << result << std::endl;
+    ret = 1;
+  }
+  else if (created.bad || created.started[ppHashing] != 1 || created.finished[ppHashing] != 1 ||
+           created.started[ppProcessing] != 1 || created.done[ppProcessing] != 16 * blocksize) {
+    std::cerr << "par2create did not report its progress" << std::endl;
+    ret = 1;
+  }
+
+  // Damage the second file, and lose the third
+  TestProgressListener repaired;
+  if (ret == 0) {
+    std::vector<u8> damaged = contents[1];
+    std::fill(damaged.begin() + 5000, damaged.begin() + 9000, 0);
+    provider.AddFileCopy(filenames[1], &damaged[0], damaged.size());
+    provider.Delete(filenames[2]);
+
+    sout.str("");
+    result = par2repair(sout, std::cerr, nlNormal, 16*1048576, basepath,
+                        0, _FILE_THREADS, basepath + "events.par2", std::vector<std::string>(),
+                        true, false, false, false, 0, false, cpNormal, &repaired, 0, &provider);
+    if (result != eSuccess) {
+      std::cerr << "par2repair failed: " << result << std::endl;
+      ret = 1;
+    }
+  }
+
+  if (ret == 0) {
+    // 5 of the 16 data blocks were lost: 2 from the second file, and all 3
+    // of the third
+    if (repaired.bad || repaired.files[filenames[0]] != fvComplete ||
+        repaired.files[filenames[1]] != fvDamaged || repaired.blocksfound[filenames[1]] != 6 ||
+        repaired.files[filenames[2]] != fvMissing ||
+        repaired.availableblocks != 11 || repaired.missingblocks != 5) {
+      std::cerr << "par2repair did not report the verification results" << std::endl;
+      ret = 1;
+    }
+    for (int phase = ppLoading; phase <= ppRepairing; phase++) {
+      if (repaired.started[(ProgressPhase)phase] != repaired.finished[(ProgressPhase)phase]) {
+        std::cerr << "phase " << phase << " was not finished" << std::endl;
+        ret = 1;
+      }
+    }
+    if (repaired.started[ppRepairing] != 1 || repaired.done[ppRepairing] != 16 * blocksize) {
+      std::cerr << "par2repair did not report its progress" << std::endl;
+      ret = 1;
+    }
+    // Text is still output, other than progress
+    if (sout.str().find("Repair complete.") == std::string::npos ||
+        sout.str().find('%') != std::string::npos) {
+      std::cerr << "par2repair output progress as text" << std::endl;
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
+
+// Statistics
+// Each stage of creating and repairing is timed, and the amounts of data
+// they processed counted.
+int test9() {
+  const u64 blocksize = 4096;
+  const size_t filesizes[3] = {20000, 30000, 9000};
+
+  MemoryFileProvider provider(PATHSEP "par2mem");
+  const std::string &basepath = provider.Root();
+
+  std::vector<std::string> filenames;
+  std::vector< std::vector<u8> > contents;
+  srand(9);
+  for (int i = 0; i < 3; i++) {
+    std::vector<u8> data(filesizes[i]);
+    for (size_t j = 0; j < data.size(); j++)
+      data[j] = (u8)rand();
+    contents.push_back(data);
+    filenames.push_back(basepath + "stats" + std::to_string(i) + ".dat");
+    provider.AddFileCopy(filenames[i], &contents[i][0], contents[i].size());
+  }
+
+  int ret = 0;
+  Statistics created;
+  Result result = par2create(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                             0, _FILE_THREADS, basepath + "stats", filenames,
+                             blocksize, 0, scUniform, 1, 6, false, cpNormal, 0, &created, &provider);
+  created.Finish(result);
+  if (result != eSuccess) {
+    std::cerr << "par2create failed: " << result << std::endl;
+    ret = 1;
+  }
+  // All 16 blocks are read and given to the backend, and 6 recovery blocks
+  // are written
+  else if (created.GetStage(Statistics::stProcessing).calls != 1 ||
+           created.GetStage(Statistics::stProcessing).bytes != 16 * blocksize ||
+           created.GetStage(Statistics::stReading).calls != 16 ||
+           created.GetStage(Statistics::stReading).bytes != 16 * blocksize ||
+           created.GetStage(Statistics::stBackendAdd).bytes != 16 * blocksize ||
+           created.GetStage(Statistics::stWriting).bytes != 6 * blocksize ||
+           created.GetStage(Statistics::stCritical).calls != 1 ||
+           created.GetStage(Statistics::stLoading).calls != 0) {
+    std::cerr << "par2create did not record its stages" << std::endl;
+    ret = 1;
+  }
+
+  // Lose the third file
+  Statistics repaired;
+  if (ret == 0) {
+    provider.Delete(filenames[2]);
+
+    result = par2repair(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                        0, _FILE_THREADS, basepath + "stats.par2", std::vector<std::string>(),
+                        true, false, false, false, 0, false, cpNormal, 0, &repaired, &provider);
+    repaired.Finish(result);
+    if (result != eSuccess) {
+      std::cerr << "par2repair failed: " << result << std::endl;
+      ret = 1;
+    }
+    else if (repaired.GetStage(Statistics::stLoading).calls == 0 ||
+             repaired.GetStage(Statistics::stScanning).calls == 0 ||
+             repaired.GetStage(Statistics::stMatrix).calls != 1 ||
+             repaired.GetStage(Statistics::stProcessing).bytes != 16 * blocksize ||
+             repaired.GetStage(Statistics::stOutput).bytes != 3 * blocksize ||
+             repaired.GetStage(Statistics::stCritical).calls != 0 ||
+             repaired.WallTime() < repaired.GetStage(Statistics::stProcessing).walltime) {
+      std::cerr << "par2repair did not record its stages" << std::endl;
+      ret = 1;
+    }
+  }
+
+  if (ret == 0) {
+    std::ostringstream json;
+    repaired.WriteJSON(json);
+    if (json.str().find("\"result\": 0,") == std::string::npos ||
+        json.str().find("\"matrix\": {\"calls\": 1,") == std::string::npos ||
+        json.str().find("\"critical_packets\"") != std::string::npos ||
+        json.str().find("\"batches_started\": ") == std::string::npos) {
+      std::cerr << "Statistics were not written as JSON:\n" << json.str() << std::endl;
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
+
+
+// Trace
+// Whilst a trace is started, what each thread does is recorded.
+int test10() {
+  const u64 blocksize = 4096;
+  const size_t filesizes[3] = {20000, 30000, 9000};
+
+  MemoryFileProvider provider(PATHSEP "par2mem");
+  const std::string &basepath = provider.Root();
+
+  std::vector<std::string> filenames;
+  std::vector< std::vector<u8> > contents;
+  srand(10);
+  for (int i = 0; i < 3; i++) {
+    std::vector<u8> data(filesizes[i]);
+    for (size_t j = 0; j < data.size(); j++)
+      data[j] = (u8)rand();
+    contents.push_back(data);
+    filenames.push_back(basepath + "trace\"" + std::to_string(i) + ".dat");
+    provider.AddFileCopy(filenames[i], &contents[i][0], contents[i].size());
+  }
+
+  int ret = 0;
+  Trace trace;
+  if (Trace::Enabled()) {
+    std::cerr << "Tracing before a trace was started" << std::endl;
+    ret = 1;
+  }
+
+  trace.Start();
+  Result result = par2create(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                             2, _FILE_THREADS, basepath + "trace", filenames,
+                             blocksize, 0, scUniform, 1, 6, false, cpNormal, 0, 0, &provider);
+  trace.Stop();
+  if (result != eSuccess) {
+    std::cerr << "par2create failed: " << result << std::endl;
+    ret = 1;
+  }
+
+  // Nothing more is recorded once the trace is stopped
+  size_t count = trace.EventCount();
+  { TraceScope scope("after"); }
+  if (Trace::Enabled() || trace.EventCount() != count) {
+    std::cerr << "Tracing after the trace was stopped" << std::endl;
+    ret = 1;
+  }
+
+  if (ret == 0) {
+    std::ostringstream json;
+    trace.WriteJSON(json);
+    const char *events[] = {"\"reading\"", "\"backend_add\"", "\"writing\"", "\"gf_kernel\"", "\"gf_prepare\"",
+                            "\"hashing\"", "\"ph\": \"X\"", "trace\\\"0.dat"};
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+      if (json.str().find(events[i]) == std::string::npos) {
+        std::cerr << "The trace has no " << events[i] << " events:\n" << json.str() << std::endl;
+        ret = 1;
+        break;
+      }
+    }
+  }
+
+  // Traces can be stopped and destroyed whilst other threads carry on
+  // recording into whichever is started
+  std::atomic<bool> recording(true);
+  std::vector<std::thread> recorders;
+  for (int i = 0; i < 4; i++)
+    recorders.push_back(std::thread([&recording]() {
+      while (recording.load())
+        TraceScope scope("racing");
+    }));
+  for (int i = 0; i < 200; i++) {
+    Trace racing;
+    racing.Start();
+    std::this_thread::yield();
+  }
+  recording.store(false);
+  for (size_t i = 0; i < recorders.size(); i++)
+    recorders[i].join();
+
+  return ret;
+}
+
+
+// Memory limit
+// Everything allocated is accounted for against the limit, which is never
+// exceeded, and a limit too small to work within is an error.
+int test11() {
+  const u64 blocksize = 4096;
+  const size_t memorylimit = 65536;
+  const size_t filesizes[3] = {20000, 30000, 9000};
+
+  MemoryFileProvider provider(PATHSEP "par2mem");
+  const std::string &basepath = provider.Root();
+
+  std::vector<std::string> filenames;
+  std::vector< std::vector<u8> > contents;
+  srand(11);
+  for (int i = 0; i < 3; i++) {
+    std::vector<u8> data(filesizes[i]);
+    for (size_t j = 0; j < data.size(); j++)
+      data[j] = (u8)rand();
+    contents.push_back(data);
+    filenames.push_back(basepath + "budget" + std::to_string(i) + ".dat");
+    provider.AddFileCopy(filenames[i], &contents[i][0], contents[i].size());
+  }
+
+  int ret = 0;
+  std::ostringstream errors;
+  Result result = par2create(std::cout, errors, nlSilent, 4096, basepath,
+                             0, _FILE_THREADS, basepath + "small", filenames,
+                             blocksize, 0, scUniform, 1, 6, false, cpNormal, 0, 0, &provider);
+  if (result != eMemoryError || errors.str().find("Not enough memory") == std::string::npos) {
+    std::cerr << "par2create did not fail with too little memory: " << result << std::endl;
+    ret = 1;
+  }
+
+  Statistics created;
+  if (ret == 0) {
+    result = par2create(std::cout, std::cerr, nlSilent, memorylimit, basepath,
+                        0, _FILE_THREADS, basepath + "budget", filenames,
+                        blocksize, 0, scUniform, 1, 6, false, cpNormal, 0, &created, &provider);
+    if (result != eSuccess) {
+      std::cerr << "par2create failed: " << result << std::endl;
+      ret = 1;
+    }
+    else if (created.MemoryLimit() != memorylimit ||
+             created.PeakBudgetedMemory() == 0 ||
+             created.PeakBudgetedMemory() > memorylimit) {
+      std::cerr << "par2create used " << created.PeakBudgetedMemory() << " of " << created.MemoryLimit() << " bytes" << std::endl;
+      ret = 1;
+    }
+  }
+
+  // Lose the third file
+  Statistics repaired;
+  if (ret == 0) {
+    provider.Delete(filenames[2]);
+
+    result = par2repair(std::cout, std::cerr, nlSilent, memorylimit, basepath,
+                        0, _FILE_THREADS, basepath + "budget.par2", std::vector<std::string>(),
+                        true, false, false, false, 0, false, cpNormal, 0, &repaired, &provider);
+    if (result != eSuccess) {
+      std::cerr << "par2repair failed: " << result << std::endl;
+      ret = 1;
+    }
+    else if (repaired.PeakBudgetedMemory() == 0 ||
+             repaired.PeakBudgetedMemory() > memorylimit) {
+      std::cerr << "par2repair used " << repaired.PeakBudgetedMemory() << " of " << repaired.MemoryLimit() << " bytes" << std::endl;
+      ret = 1;
+    }
+  }
+
+  if (ret == 0) {
+    const u8 *data;
+    u64 length;
+    if (!provider.GetFile(filenames[2], data, length) ||
+        std::vector<u8>(data, data + length) != contents[2]) {
+      std::cerr << "The lost file was not repaired" << std::endl;
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
+
+
+// Chunk sizes
+// Passes cover the whole of each block, aligned and within the buffers,
+// and grow whilst they're waiting for I/O.
+int test12() {
+  const u64 blocksize = 64*1048576 + 100;
+  const size_t maxsize = 8*1048576;
+
+  ChunkSizer chunksizer;
+  chunksizer.Start(blocksize, maxsize, MIN_CHUNK_SIZE, false);
+  size_t first = chunksizer.Size();
+  if (first > maxsize || first < MIN_CHUNK_SIZE || first % 4 != 0) {
+    std::cerr << "The first pass is " << first << " bytes" << std::endl;
+    return 1;
+  }
+
+  u64 blockoffset = 0;
+  u32 passes = 0;
+  while (blockoffset < blocksize) {
+    size_t blocklength = chunksizer.Next(blockoffset);
+    if (blocklength == 0 || blocklength > maxsize ||
+        (blockoffset + blocklength < blocksize && blocklength % 4 != 0)) {
+      std::cerr << "Pass " << passes << " is " << blocklength << " bytes" << std::endl;
+      return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    chunksizer.AddWait(ChunkSizer::wtIO, std::chrono::milliseconds(1));
+    chunksizer.Finish(blocklength);
+    blockoffset += blocklength;
+    passes++;
+  }
+  if (blockoffset != blocksize || chunksizer.Size() != maxsize) {
+    std::cerr << "Passes covered " << blockoffset << " bytes, growing to " << chunksizer.Size() << std::endl;
+    return 1;
+  }
+
+  // A block which fits in the buffers is done in one pass
+  chunksizer.Start(maxsize - 10, maxsize, MIN_CHUNK_SIZE, false);
+  if (chunksizer.Next(0) != maxsize - 10) {
+    std::cerr << "A whole block was not processed in one pass" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+// MTProgressMeter
+// Progress made by several threads is reported in order, and its
+// completion is reported once, last.
+class OrderProgressListener : public ProgressListener
+{
+public:
+  std::mutex lock;
+  std::vector<u64> reports;
+
+  virtual void PhaseProgress(ProgressPhase, const std::string &, u64 done, u64, double) {
+    std::lock_guard<std::mutex> l(lock);
+    reports.push_back(done);
+  }
+};
+
+int test13() {
+  const u64 total = 200000;
+  const int threads = 4;
+
+  for (int round = 0; round < 20; round++) {
+    OrderProgressListener listener;
+    {
+      MTProgressMeter<u64> progress(listener, ppScanning, total);
+      std::vector<std::thread> workers;
+      for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&]() {
+          for (u64 j = 0; j < total / threads; j++)
+            progress.Add(1);
+        });
+      }
+      for (std::thread &worker : workers)
+        worker.join();
+    }
+
+    if (listener.reports.empty() || listener.reports.back() != total) {
+      std::cerr << "Completion was not reported last" << std::endl;
+      return 1;
+    }
+    for (size_t i = 1; i < listener.reports.size(); i++) {
+      if (listener.reports[i] <= listener.reports[i-1]) {
+        std::cerr << "Progress was reported out of order: " << listener.reports[i-1]
+                  << " then " << listener.reports[i] << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+// Multiply in the field used by PAR2
+static u16 gf16multiply(u16 a, u16 b) {
+  u32 product = 0;
+  for (u32 aa = a; b; b >>= 1, aa <<= 1) {
+    if (aa & 0x10000)
+      aa ^= 0x1100B;
+    if (b & 1)
+      product ^= aa;
+  }
+  return (u16)product;
+}
+
+// RS matrix inversion with unusable recovery blocks
+// When a pivot turns out to be zero, the recovery block is replaced by a
+// spare one in place. The result must be the same as if the matrix had been
+// solved without the bad block in the first place, and must repair the data.
+int test14() {
+  gfmat_init();
+
+  // The inputs whose logs are equal modulo 255 have coefficients which
+  // repeat every 257 exponents (as 2^255 has order 257), so recovery blocks
+  // with exponents 257 apart can't both be used when only they are missing
+  const u32 inputcount = 600;
+  const u32 missingcount = 5;
+  std::vector<bool> inputvalid(inputcount, true);
+  for (u32 input = 0, missing = 0; input < inputcount && missing < missingcount; input++) {
+    if (gfmat_input_log(input) % 255 == gfmat_input_log(0) % 255) {
+      inputvalid[input] = false;
+      missing++;
+    }
+  }
+  const u32 validcount = inputcount - missingcount;
+
+  // Each set has the exponents which are unusable
+  struct ExponentSet {
+    std::vector<u16> exponents;
+    std::vector<u16> bad;
+  } sets[] = {
+    {{1, 2, 3, 4, 260, 300}, {260}},             // the last row
+    {{1, 2, 259, 260, 300, 301, 302}, {259}},    // a row in the middle
+    {{1, 2, 258, 259, 300, 301, 302}, {258, 259}}, // one after another
+    {{1, 258, 515, 772, 1029, 1286, 1543, 1800, 2000, 2001, 2002, 2003}, // spares which are bad too
+     {258, 515, 772, 1029, 1286, 1543, 1800}},
+  };
+
+  srand(14);
+  std::vector<u16> data(inputcount);
+  for (u32 input = 0; input < inputcount; input++)
+    data[input] = (u16)rand();
+
+  for (size_t set = 0; set < sizeof(sets) / sizeof(sets[0]); set++) {
+    std::vector<u16> recovery = sets[set].exponents;
+    Galois16RecMatrix rs;
+    rs.setNumThreads(1);
+    if (!rs.Compute(inputvalid, validcount, recovery)) {
+      std::cerr << "Exponent set " << set << " could not be solved" << std::endl;
+      return 1;
+    }
+
+    std::vector<u16> discarded = rs.getDiscarded();
+    std::sort(discarded.begin(), discarded.end());
+    if (discarded != sets[set].bad) {
+      std::cerr << "Exponent set " << set << " discarded the wrong recovery blocks" << std::endl;
+      return 1;
+    }
+
+    // Solve it again without the bad blocks, as happened when a bad one
+    // caused the inversion to restart. The substitutes take the places of
+    // the bad blocks, so the recovery columns may be in a different order.
+    std::vector<u16> restarted;
+    for (u16 exponent : sets[set].exponents)
+      if (std::find(sets[set].bad.begin(), sets[set].bad.end(), exponent) == sets[set].bad.end())
+        restarted.push_back(exponent);
+    Galois16RecMatrix reference;
+    reference.setNumThreads(1);
+    std::vector<u16> sorted = recovery;
+    std::sort(sorted.begin(), sorted.end());
+    if (!reference.Compute(inputvalid, validcount, restarted) || !reference.getDiscarded().empty()
+        || restarted != sorted) {
+      std::cerr << "Exponent set " << set << " chose different recovery blocks without the bad ones" << std::endl;
+      return 1;
+    }
+    for (u32 row = 0; row < missingcount; row++) {
+      for (u32 col = 0; col < inputcount; col++) {
+        u32 referencecol = col;
+        if (col >= validcount)
+          referencecol = validcount + (u32)(std::find(restarted.begin(), restarted.end(), recovery[col - validcount]) - restarted.begin());
+        if (rs.GetFactor(col, row) != reference.GetFactor(referencecol, row)) {
+          std::cerr << "Exponent set " << set << " solved differently at " << col << ", " << row << std::endl;
+          return 1;
+        }
+      }
+    }
+
+    // The missing data is the valid data followed by the recovery data,
+    // multiplied by the solved matrix
+    std::vector<u16> inputs;
+    for (u32 input = 0; input < inputcount; input++)
+      if (inputvalid[input])
+        inputs.push_back(data[input]);
+    for (u16 exponent : recovery) {
+      u16 value = 0;
+      for (u32 input = 0; input < inputcount; input++)
+        value ^= gf16multiply(gfmat_coeff(input, exponent), data[input]);
+      inputs.push_back(value);
+    }
+    for (u32 input = 0, row = 0; input < inputcount; input++) {
+      if (inputvalid[input])
+        continue;
+      u16 value = 0;
+      for (u32 col = 0; col < inputcount; col++)
+        value ^= gf16multiply(rs.GetFactor(col, row), inputs[col]);
+      if (value != data[input]) {
+        std::cerr << "Exponent set " << set << " did not repair input " << input << std::endl;
+        return 1;
+      }
+      row++;
+    }
+  }
+
+  return 0;
+}
+
+
+// File access
+// How an operation accesses its files (direct I/O and the cache policy)
+// applies to its files alone, and is left to the OS unless asked for.
+int test15() {
+  const u64 blocksize = 4096;
+  const size_t filesizes[3] = {20000, 30000, 9000};
+
+  std::string basepath = DiskFile::GetCanonicalPathname("./");
+  if (basepath.substr(basepath.length()-1) != PATHSEP)
+    basepath += PATHSEP;
+
+  std::vector<std::string> filenames;
+  std::vector< std::vector<u8> > contents;
+  srand(15);
+  for (int i = 0; i < 3; i++) {
+    std::string filename = basepath + "access" + std::to_string(i) + ".dat";
+    std::vector<u8> data(filesizes[i]);
+    for (size_t j = 0; j < data.size(); j++)
+      data[j] = (u8)rand();
+
+    std::ofstream output(filename, std::ios::binary);
+    output.write((const char*)&data[0], data.size());
+    output.close();
+
+    filenames.push_back(filename);
+    contents.push_back(data);
+  }
+
+  int ret = 0;
+  Result result = par2create(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                             0, _FILE_THREADS, basepath + "access", filenames,
+                             blocksize, 0, scUniform, 1, 6, true, cpDrop);
+  if (result != eSuccess) {
+    std::cerr << "par2create failed: " << result << std::endl;
+    ret = 1;
+  }
+
+  // A handle which is kept open once a file is closed doesn't carry the
+  // settings it was used with over to the next user
+  std::mutex output_lock;
+  FileAccess access;
+  access.directio = true;
+  access.cachepolicy = cpDrop;
+  DiskFile direct(std::cout, std::cerr, output_lock, access);
+  DiskFile diskfile(std::cout, std::cerr, output_lock);
+  if (ret == 0) {
+    if (!direct.Open(filenames[0])) {
+      std::cerr << "Could not open " << filenames[0] << std::endl;
+      ret = 1;
+    }
+    direct.Close();
+    u8 buffer[100];
+    if (!diskfile.Open(filenames[0]) || diskfile.IsDirect() || !diskfile.Read(1, buffer, sizeof(buffer)) ||
+        std::vector<u8>(buffer, buffer + sizeof(buffer)) != std::vector<u8>(&contents[0][1], &contents[0][1] + sizeof(buffer))) {
+      std::cerr << "A file opened normally after direct I/O was used could not be read normally" << std::endl;
+      ret = 1;
+    }
+    diskfile.Close();
+  }
+
+  // Without being asked for them, neither is used
+  remove(filenames[2].c_str());
+  if (ret == 0) {
+    result = par2repair(std::cout, std::cerr, nlSilent, 16*1048576, basepath,
+                        0, _FILE_THREADS, basepath + "access.par2", std::vector<std::string>(),
+                        true, false, false, false, 0);
+    if (result != eSuccess) {
+      std::cerr << "par2repair failed: " << result << std::endl;
+      ret = 1;
+    }
+  }
+
+  for (int i = 0; ret == 0 && i < 3; i++) {
+    std::ifstream input(filenames[i], std::ios::binary);
+    std::vector<u8> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    if (data != contents[i]) {
+      std::cerr << filenames[i] << " was not repaired" << std::endl;
+      ret = 1;
+    }
+  }
+
+  DiskFile::CloseCachedFiles();
+  for (int i = 0; i < 3; i++)
+    remove(filenames[i].c_str());
+  remove((basepath + "access.par2").c_str());
+  remove((basepath + "access.vol0+6.par2").c_str());
+
+  return ret;
+}
+
+
+// ThreadPool
+// Work run on the shared pool is spread across its threads and the caller's,
+// invocations which haven't started by the time the work runs out are
+// skipped, and the pool only grows when more threads are reserved.
+int test16() {
+  ThreadPool &pool = ThreadPool::Instance();
+
+  // Every item is processed once, including by Runs within Runs
+  std::atomic<u32> next(0);
+  std::atomic<u64> sum(0);
+  pool.Run(4, [&]() {
+    while (1) {
+      u32 item = next.fetch_add(1);
+      if (item >= 1000)
+        break;
+      std::atomic<u32> inner(0);
+      pool.Run(2, [&inner]() {
+        while (inner.fetch_add(1) < 10) {}
+      });
+      sum.fetch_add(item);
+    }
+  });
+  if (sum.load() != 499500) {
+    std::cerr << "ThreadPool::Run processed " << sum.load() << ", expected 499500" << std::endl;
+    return 1;
+  }
+
+  std::future<int> answer = pool.Async([]() { return 42; });
+  if (answer.get() != 42) {
+    std::cerr << "ThreadPool::Async gave the wrong result" << std::endl;
+    return 1;
+  }
+
+  // Reserving no more than there are doesn't grow the pool, and what runs
+  // threads of its own is kept to its size
+  unsigned workers = pool.WorkerCount();
+  unsigned hwthreads = std::max(std::thread::hardware_concurrency(), 1u);
+  pool.Reserve(workers);
+  if (workers < hwthreads || pool.WorkerCount() != workers) {
+    std::cerr << "The pool has " << pool.WorkerCount() << " workers, expected " << workers << std::endl;
+    return 1;
+  }
+  pool.Reserve(workers + 2);
+  workers += 2;
+  if (pool.WorkerCount() != workers || pool.Size() != workers) {
+    std::cerr << "The pool did not grow to " << workers << " workers" << std::endl;
+    return 1;
+  }
+  // (an explicit thread count is honoured, even beyond the pool's size)
+  if (pool.Limit(0) != hwthreads || pool.Limit(1) != 1 || pool.Limit(workers + 5) != workers + 5) {
+    std::cerr << "ThreadPool::Limit did not give the number of threads asked for" << std::endl;
+    return 1;
+  }
+
+  // With every worker busy, Run returns as soon as the caller has done the
+  // work, and the invocations it queued do nothing once they start
+  std::mutex lock;
+  std::condition_variable wakeup;
+  bool release = false;
+  std::atomic<unsigned> busy(0);
+  for (unsigned i = 0; i < workers; i++) {
+    pool.Submit([&]() {
+      busy.fetch_add(1);
+      std::unique_lock<std::mutex> guard(lock);
+      wakeup.wait(guard, [&release]() { return release; });
+    });
+  }
+  while (busy.load() < workers)
+    std::this_thread::yield();
+
+  std::atomic<u32> calls(0);
+  pool.Run(3, [&calls]() { calls.fetch_add(1); });
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    release = true;
+  }
+  wakeup.notify_all();
+
+  // Once a task is running on every worker, whatever was queued before
+  // them has finished
+  std::atomic<unsigned> waiting(0);
+  std::vector<std::future<void>> barrier;
+  for (unsigned i = 0; i < workers; i++) {
+    barrier.push_back(pool.Async([&waiting, workers]() {
+      waiting.fetch_add(1);
+      while (waiting.load() < workers)
+        std::this_thread::yield();
+    }));
+  }
+  for (size_t i = 0; i < barrier.size(); i++)
+    barrier[i].get();
+
+  if (calls.load() != 1) {
+    std::cerr << "ThreadPool::Run made " << calls.load() << " calls, expected 1" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+// foreach_parallel_grouped
+// Items are handed out largest first, skipping those whose group is at its
+// limit, and no group ever has more items being processed than its limit.
+int test17() {
+  // groups 1 and 2 take one item at a time, and group 3 two
+  auto grouplimit = [](u64 group) -> u32 { return group == 3 ? 2 : 1; };
+  std::vector<u64> sizes  = {10, 50, 20, 40, 30, 60};
+  std::vector<u64> groups = { 3,  2,  3,  3,  2,  1};
+  GroupedSchedule schedule(sizes, groups, grouplimit);
+  if (schedule.Concurrency() != 4) {
+    std::cerr << "GroupedSchedule allowed for " << schedule.Concurrency() << " items at once, expected 4" << std::endl;
+    return 1;
+  }
+
+  // 60, 50 and 40 go first; 30 waits for 50 (in group 2); 20 is the second
+  // in group 3, and 10 waits for one of those
+  std::vector<size_t> taken;
+  size_t index;
+  while ((index = schedule.Take()) != GroupedSchedule::Busy)
+    taken.push_back(index);
+  if (taken != std::vector<size_t>({5, 1, 3, 2})) {
+    std::cerr << "GroupedSchedule handed out the wrong items before its groups were full" << std::endl;
+    return 1;
+  }
+  schedule.Release(1);
+  if (schedule.Take() != 4 || schedule.Take() != GroupedSchedule::Busy) {
+    std::cerr << "GroupedSchedule didn't hand out the next item of the group which was released" << std::endl;
+    return 1;
+  }
+  schedule.Release(3);
+  if (schedule.Take() != 0 || !schedule.Finished()) {
+    std::cerr << "GroupedSchedule didn't hand out the last item" << std::endl;
+    return 1;
+  }
+
+  // Run on the shared pool, every item is processed once, each group is
+  // looked up once, and no group exceeds its limit. Group 1 takes one at a
+  // time, so its items are processed strictly largest first.
+  std::vector<u32> items;
+  for (u32 i = 0; i < 60; i++)
+    items.push_back(i);
+  std::atomic<u32> groupcalls(0);
+  std::atomic<u32> active[4], peak[4];
+  for (int g = 0; g < 4; g++) {
+    active[g] = 0;
+    peak[g] = 0;
+  }
+  std::mutex order_lock;
+  std::vector<u32> processed, group1;
+  foreach_parallel_grouped<u32>(items, 8, [](const u32 &item) {
+    return (u64)((item * 37) % 61);
+  }, [&groupcalls](const u32 &item) {
+    groupcalls.fetch_add(1);
+    return (u64)(item % 3 + 1);
+  }, grouplimit, [&](const u32 &item) {
+    u32 g = item % 3 + 1;
+    u32 now = active[g].fetch_add(1) + 1;
+    u32 seen = peak[g].load();
+    while (now > seen && !peak[g].compare_exchange_weak(seen, now)) {}
+    {
+      std::lock_guard<std::mutex> guard(order_lock);
+      processed.push_back(item);
+      if (g == 1)
+        group1.push_back(item);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    active[g].fetch_sub(1);
+  });
+
+  std::sort(processed.begin(), processed.end());
+  if (processed != items || groupcalls.load() != items.size()) {
+    std::cerr << "foreach_parallel_grouped processed " << processed.size() << " items, and looked up "
+              << groupcalls.load() << " groups, expected " << items.size() << " of each" << std::endl;
+    return 1;
+  }
+  for (u32 g = 1; g <= 3; g++) {
+    if (peak[g].load() > grouplimit(g)) {
+      std::cerr << "foreach_parallel_grouped processed " << peak[g].load() << " items of group " << g
+                << " at once, more than its limit of " << grouplimit(g) << std::endl;
+      return 1;
+    }
+  }
+  for (size_t i = 1; i < group1.size(); i++) {
+    if ((group1[i-1] * 37) % 61 < (group1[i] * 37) % 61) {
+      std::cerr << "foreach_parallel_grouped didn't process a group's items largest first" << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+// foreach_parallel_bysize
+// The largest items are handed out first, equal sizes keeping their order,
+// however many threads there are; on one thread the order is left alone.
+int test18() {
+  // foreach_parallel_bysize schedules everything as one group, limited to
+  // the number of threads
+  std::vector<u64> sizes = {5, 900, 70, 900, 3000, 70, 1};
+  const u32 threads = 3;
+  GroupedSchedule schedule(sizes, std::vector<u64>(sizes.size(), 0), [threads](u64) { return threads; });
+  if (schedule.Concurrency() != threads) {
+    std::cerr << "GroupedSchedule allowed for " << schedule.Concurrency() << " items at once, expected " << threads << std::endl;
+    return 1;
+  }
+  std::vector<size_t> order;
+  size_t index;
+  while ((index = schedule.Take()) != GroupedSchedule::Busy)
+    order.push_back(index);
+  if (order.size() != threads) {
+    std::cerr << "GroupedSchedule handed out " << order.size() << " items at once, expected " << threads << std::endl;
+    return 1;
+  }
+  while (!schedule.Finished()) {
+    schedule.Release(order[order.size() - threads]);
+    order.push_back(schedule.Take());
+  }
+  if (order != std::vector<size_t>({4, 1, 3, 2, 5, 0, 6})) {
+    std::cerr << "GroupedSchedule didn't hand out the largest items first" << std::endl;
+    return 1;
+  }
+
+  // on one thread, items are processed in the order given
+  std::vector<u64> processed;
+  foreach_parallel_bysize<u64>(sizes, 1, [](const u64 &size) {
+    return size;
+  }, [&processed](const u64 &size) {
+    processed.push_back(size);
+  });
+  if (processed != sizes) {
+    std::cerr << "foreach_parallel_bysize reordered items on one thread" << std::endl;
+    return 1;
+  }
+
+  // with only one item allowed at a time, even on several threads, the
+  // order processed is exactly the order handed out: largest first
+  processed.clear();
+  foreach_parallel_grouped<u64>(sizes, threads, [](const u64 &size) {
+    return size;
+  }, [](const u64 &) -> u64 {
+    return 0;
+  }, [](u64) -> u32 {
+    return 1;
+  }, [&processed](const u64 &size) {
+    processed.push_back(size);
+  });
+  if (processed != std::vector<u64>({3000, 900, 900, 70, 70, 5, 1})) {
+    std::cerr << "foreach_parallel_grouped didn't process the largest items first" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
 
 int main() {
   if (test1()) {
@@ -463,6 +1772,62 @@ int main() {
     std::cerr << "FAILED: test4" << std::endl;
     return 1;
   }
+  if (test5()) {
+    std::cerr << "FAILED: test5" << std::endl;
+    return 1;
+  }
+  if (test6()) {
+    std::cerr << "FAILED: test6" << std::endl;
+    return 1;
+  }
+  if (test7()) {
+    std::cerr << "FAILED: test7" << std::endl;
+    return 1;
+  }
+  if (test8()) {
+    std::cerr << "FAILED: test8" << std::endl;
+    return 1;
+  }
+  if (test9()) {
+    std::cerr << "FAILED: test9" << std::endl;
+    return 1;
+  }
+  if (test10()) {
+    std::cerr << "FAILED: test10" << std::endl;
+    return 1;
+  }
+  if (test11()) {
+    std::cerr << "FAILED: test11" << std::endl;
+    return 1;
+  }
+  if (test12()) {
+    std::cerr << "FAILED: test12" << std::endl;
+    return 1;
+  }
+  if (test13()) {
+    std::cerr << "FAILED: test13" << std::endl;
+    return 1;
+  }
+  if (test14()) {
+    std::cerr << "FAILED: test14" << std::endl;
+    return 1;
+  }
+  if (test15()) {
+    std::cerr << "FAILED: test15" << std::endl;
+    return 1;
+  }
+  if (test16()) {
+    std::cerr << "FAILED: test16" << std::endl;
+    return 1;
+  }
+  if (test17()) {
+    std::cerr << "FAILED: test17" << std::endl;
+    return 1;
+  }
+  if (test18()) {
+    std::cerr << "FAILED: test18" << std::endl;
+    return 1;
+  }
 
   std::cout << "SUCCESS: libpar2_test complete." << std::endl;
 
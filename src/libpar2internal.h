@@ -178,8 +178,11 @@ typedef unsigned int     size_t;
 #endif
 
 #define NUM_TRANSFER_BUFFERS 2 // must be >= 2
+#define NUM_QUEUED_TRANSFER_BUFFERS 8 // used instead when I/O can be queued asynchronously, to keep more requests in flight
 #define NUM_PARPAR_BUFFERS 12 // maximum number of internal ParPar staging buffers
-#define MAX_CHUNK_SIZE 32*1048576 // too large chunks are likely detrimental to performance; set to 0 to disable
+#define START_CHUNK_SIZE (32*1048576) // the most of each block that passes start with (less if the CPU's cache is smaller)
+#define MIN_CHUNK_SIZE (256*1024) // passes smaller than this are likely dominated by their overheads
+#define CHUNK_SIZE_GROWTH 8 // how many times the start size passes may grow to, when waiting for I/O
 
 #define LONGMULTIPLY
 
@@ -208,6 +211,10 @@ typedef unsigned int     size_t;
 
 #include "letype.h"
 #include "progressmeter.h"
+#include "trace.h"
+#include "statistics.h"
+#include "memorybudget.h"
+#include "chunksizer.h"
 
 #include "galois.h"
 #include "crc.h"
@@ -215,6 +222,7 @@ typedef unsigned int     size_t;
 #include "par2fileformat.h"
 
 #include "diskfile.h"
+#include "ioqueue.h"
 #include "datablock.h"
 
 #include "criticalpacket.h"
@@ -233,6 +241,8 @@ typedef unsigned int     size_t;
 
 #include "par2creator.h"
 #include "par2repairer.h"
+#include "par2repairersession.h"
+#include "par2streamverifier.h"
 
 #include "par1fileformat.h"
 #include "par1repairersourcefile.h"
@@ -0,0 +1,62 @@
+#include "libpar2internal.h"
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+
+MemoryBudget::MemoryBudget(void)
+: limit(0)
+, used(0)
+, peak(0)
+{
+}
+
+void MemoryBudget::SetLimit(size_t _limit)
+{
+  limit = _limit;
+}
+
+void MemoryBudget::Charge(size_t bytes)
+{
+  UpdatePeak(used.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+bool MemoryBudget::Reserve(size_t bytes)
+{
+  size_t current = used.load(std::memory_order_relaxed);
+  do
+  {
+    if (limit != 0 && (current > limit || bytes > limit - current))
+      return false;
+  } while (!used.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+
+  UpdatePeak(current + bytes);
+  return true;
+}
+
+void MemoryBudget::Release(size_t bytes)
+{
+  used.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+size_t MemoryBudget::Available(void) const
+{
+  if (limit == 0)
+    return ~(size_t)0;
+
+  size_t current = Used();
+  return current < limit ? limit - current : 0;
+}
+
+void MemoryBudget::UpdatePeak(size_t total)
+{
+  size_t current = peak.load(std::memory_order_relaxed);
+  while (current < total && !peak.compare_exchange_weak(current, total, std::memory_order_relaxed))
+  {
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef __MEMORYBUDGET_H__
+#define __MEMORYBUDGET_H__
+
+#include <atomic>
+
+// Keeps account of the memory an operation uses, against the limit it was
+// given (the -m option), so that the limit covers everything of any size
+// which is allocated rather than only the buffers used for processing.
+//
+// Memory which is needed whatever the limit is (the packets loaded, the
+// verification hash table) is charged to the budget, and what's left is
+// then shared out between the buffers whose size can be chosen: how many
+// files are hashed or scanned at once, and how large a chunk of each block
+// is processed at a time. Those are reserved, and fail if they don't fit.
+// The most that was in use at once is recorded, to be reported.
+
+class MemoryBudget
+{
+public:
+  MemoryBudget(void);
+
+  // Set the limit, in bytes (0 for no limit)
+  void SetLimit(size_t limit);
+  size_t Limit(void) const {return limit;}
+
+  // Account for memory which is needed regardless of the limit
+  void Charge(size_t bytes);
+
+  // Account for memory if it fits within the limit
+  bool Reserve(size_t bytes);
+
+  // Stop accounting for memory which has been freed
+  void Release(size_t bytes);
+
+  // How much is in use, and the most that has been at once
+  size_t Used(void) const {return used.load(std::memory_order_relaxed);}
+  size_t Peak(void) const {return peak.load(std::memory_order_relaxed);}
+
+  // How much more can be reserved (or the most a size_t can hold, if
+  // there's no limit)
+  size_t Available(void) const;
+
+protected:
+  void UpdatePeak(size_t total);
+
+protected:
+  size_t               limit;
+  std::atomic<size_t>  used;
+  std::atomic<size_t>  peak;
+};
+
+// Charges memory to a budget for as long as it's in scope
+class MemoryCharge
+{
+public:
+  MemoryCharge(MemoryBudget &budget, size_t bytes)
+  : budget(budget)
+  , bytes(bytes)
+  {
+    budget.Charge(bytes);
+  }
+  ~MemoryCharge(void)
+  {
+    budget.Release(bytes);
+  }
+
+protected:
+  MemoryBudget  &budget;
+  const size_t   bytes;
+
+private:
+  MemoryCharge(const MemoryCharge &);
+  MemoryCharge& operator=(const MemoryCharge &);
+};
+
+// An allowance for the state of a hasher (its size depends on the method,
+// but is no more than this)
+#define HASHER_MEMORY 1024
+
+#endif // __MEMORYBUDGET_H__
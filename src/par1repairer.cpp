@@ -35,6 +35,8 @@ Par1Repairer::Par1Repairer(std::ostream &sout, std::ostream &serr, const NoiseLe
 : sout(sout)
 , serr(serr)
 , noiselevel(noiselevel)
+, textprogress(sout, output_lock, noiselevel)
+, progresslistener(&textprogress)
 , searchpath()
 , diskfilemap()
 , recoveryblocks()
@@ -62,6 +64,7 @@ Par1Repairer::Par1Repairer(std::ostream &sout, std::ostream &serr, const NoiseLe
 , ignore16kfilehash(false)
 {
   setup_hasher();
+  fileaccess.cachedfiles = &cachedfiles;
 }
 
 Par1Repairer::~Par1Repairer(void)
@@ -195,7 +198,7 @@ Result Par1Repairer::Process(const size_t memorylimit,
           sout << '\n';
 
         // Set the total amount of data to be processed.
-        ProgressMeter<u64> progress(sout, "Repairing: ", blocksize * sourcefiles.size() * verifylist.size());
+        std::unique_ptr<ProgressMeter<u64>> progress(new ProgressMeter<u64>(*progresslistener, ppRepairing, blocksize * sourcefiles.size() * verifylist.size()));
 
         // Start at an offset of 0 within a block.
         u64 blockoffset = 0;
@@ -205,7 +208,7 @@ Result Par1Repairer::Process(const size_t memorylimit,
           size_t blocklength = (size_t)std::min((u64)chunksize, blocksize-blockoffset);
 
           // Read source data, process it through the RS matrix and write it to disk.
-          if (!ProcessData(blockoffset, blocklength, progress))
+          if (!ProcessData(blockoffset, blocklength, *progress))
           {
             // Delete all of the partly reconstructed files
             DeleteIncompleteTargetFiles();
@@ -215,6 +218,7 @@ Result Par1Repairer::Process(const size_t memorylimit,
           // Advance to the need offset within each block
           blockoffset += blocklength;
         }
+        progress.reset(nullptr);
 
         if (noiselevel > nlSilent)
           sout << "\nVerifying repaired files:\n" << std::endl;
@@ -263,7 +267,7 @@ bool Par1Repairer::LoadRecoveryFile(std::string filename)
     return true;
   }
 
-  DiskFile *diskfile = new DiskFile(sout, serr, output_lock);
+  DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
 
   // Open the file
   if (!diskfile->Open(filename))
@@ -535,7 +539,7 @@ bool Par1Repairer::LoadOtherRecoveryFiles(std::string filename)
   // Search for additional PAR files
   std::string wildcard = name + ".???";
   std::unique_ptr< std::list<std::string> > files(
-				      DiskFile::FindFiles(path, wildcard, false)
+				      DiskFile::FindFiles(path, wildcard, false, fileaccess.provider)
 				      );
 
   for (std::list<std::string>::const_iterator s=files->begin(); s!=files->end(); ++s)
@@ -621,7 +625,7 @@ bool Par1Repairer::VerifySourceFiles(void)
     }
     else
     {
-      DiskFile *diskfile = new DiskFile(sout, serr, output_lock);
+      DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
 
       // Does the target file exist
       if (diskfile->Open(filename))
@@ -704,7 +708,7 @@ bool Par1Repairer::VerifyExtraFiles(const std::vector<std::string> &extrafiles)
       // Has this file already been dealt with
       if (diskfilemap.Find(filename) == 0)
       {
-        DiskFile *diskfile = new DiskFile(sout, serr, output_lock);
+        DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
 
         // Does the file exist
         if (!diskfile->Open(filename))
@@ -802,9 +806,7 @@ bool Par1Repairer::VerifyDataFile(DiskFile *diskfile, Par1RepairerSourceFile *so
       if (filesize > 16384)
       {
         u64 offset = 16384;
-        std::string message = "Scanning: \"";
-        message.append(name).append("\": ");
-        ProgressMeter<u64> progress(sout, message, filesize);
+        ProgressMeter<u64> progress(*progresslistener, ppScanning, filesize, name);
         while (offset < filesize)
         {
           want = (size_t)std::min((u64)buffersize, filesize-offset);
@@ -819,8 +821,7 @@ bool Par1Repairer::VerifyDataFile(DiskFile *diskfile, Par1RepairerSourceFile *so
 
           offset += want;
 
-          if (noiselevel > nlQuiet)
-            progress.Update(offset);
+          progress.Update(offset);
         }
       }
 
@@ -1119,7 +1120,7 @@ bool Par1Repairer::CreateTargetFiles(void)
     // If the file does not exist
     if (!sourcefile->GetTargetExists())
     {
-      DiskFile *targetfile = new DiskFile(sout, serr, output_lock);
+      DiskFile *targetfile = new DiskFile(sout, serr, output_lock, fileaccess);
       std::string filename = sourcefile->FileName();
       u64 filesize = sourcefile->FileSize();
 
@@ -1247,7 +1248,7 @@ bool Par1Repairer::ComputeRSmatrix(void)
     return true;
   }
 
-  bool success = rs.Compute(noiselevel, sout, serr);
+  bool success = rs.Compute(noiselevel, sout, serr, progresslistener);
   return success;
 }
 
@@ -1310,8 +1311,7 @@ bool Par1Repairer::ProcessData(u64 blockoffset, size_t blocklength, ProgressMete
         // Process the data
         rs.Process(blocklength, inputindex, inputbuffer, outputindex, outbuf);
 
-        if (noiselevel > nlQuiet)
-          progress.Add(blocklength);
+        progress.Add(blocklength);
       }
 
       ++inputblock;
@@ -1463,7 +1463,7 @@ bool Par1Repairer::RemoveParFiles(void)
 
   for (std::list<std::string>::const_iterator s=parlist.begin(); s!=parlist.end(); ++s)
   {
-    DiskFile *diskfile = new DiskFile(sout, serr, output_lock);
+    DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
 
     if (diskfile->Open(*s))
     {
@@ -41,6 +41,13 @@ public:
 		 // skipleaway is not used by Par1
 		 );
 
+  // Report progress to listener rather than as text (or as text again, if 0)
+  void SetProgressListener(ProgressListener *listener) {progresslistener = listener ? listener : &textprogress;}
+
+  // Access the files through provider rather than the file system (or the
+  // file system again, if 0). See FileAccess for how long it must live.
+  void SetFileProvider(FileProvider *provider) {fileaccess.provider = provider;}
+
 protected:
   // Load the main PAR file
   bool LoadRecoveryFile(std::string filename);
@@ -100,6 +107,12 @@ protected:
   std::mutex output_lock;
   const NoiseLevel   noiselevel;              // How noisy we should be
 
+  TextProgressListener textprogress;
+  ProgressListener  *progresslistener;        // Where progress is reported
+
+  CachedFileSet      cachedfiles;             // Files this left in the handle cache (outlives every DiskFile member)
+  FileAccess         fileaccess;              // How the files are accessed
+
   std::string               searchpath;              // Where to find files on disk
   DiskFileMap               diskfilemap;             // Map from filename to DiskFile
 
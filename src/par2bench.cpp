@@ -0,0 +1,717 @@
+//  This file is part of par2cmdline (a PAR 2.0 compatible file verification and
+//  repair tool). See http://parchive.sourceforge.net for details of PAR 2.0.
+//
+//  par2cmdline is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  par2cmdline is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+// par2bench: times creating PAR2 files for synthetic data sets, verifying
+// them, and verifying and repairing them once damaged, so that changes in
+// performance (of libpar2, or of ParPar) can be seen. The data sets are
+// generated the same way every time, and results can be saved and compared
+// with those of an earlier build.
+
+#include "libpar2internal.h"
+// This is included here, so that cout and cerr are not used elsewhere.
+#include <iostream>
+#include <fstream>
+#include <cmath>
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+
+// How the sizes of the files in a data set vary
+typedef enum
+{
+  sdEqual = 0,     // All the same size
+  sdVaried,        // Evenly spread between a 16th of the size and all of it
+  sdSkewed         // Mostly small files and a few large ones
+} SizeSpread;
+
+// How a data set is damaged before it's repaired. Damage uses up about half
+// of the recovery blocks.
+typedef enum
+{
+  dmBlocks = 0,    // Blocks spread across the files are overwritten
+  dmFiles,         // Files are lost
+  dmShift,         // Data is inserted into the middle of the largest file
+  dmTruncate,      // The largest file is cut short
+  dmRename         // A file is given another name
+} Damage;
+
+struct Scenario
+{
+  const char *name;
+  u32         filecount;
+  u64         filesize;    // The largest file (before scaling)
+  SizeSpread  spread;
+  u64         blocksize;
+  u32         redundancy;  // Percent
+  Damage      damage;
+};
+
+static const Scenario scenarios[] =
+{
+  {"large-files",      4, 16<<20, sdEqual,  256<<10, 10, dmBlocks},
+  {"small-files",   2000,  8<<10, sdVaried,   4<<10, 10, dmFiles},
+  {"mixed-sizes",     64,  4<<20, sdSkewed,  64<<10,  5, dmShift},
+  {"truncated",        8,  8<<20, sdEqual,  256<<10, 10, dmTruncate},
+  {"misnamed",        16,  4<<20, sdVaried, 128<<10,  5, dmRename},
+  {"high-redundancy",  4,  8<<20, sdEqual,   64<<10, 50, dmBlocks},
+};
+
+static const char *phases[] = {"create", "verify", "verify-damaged", "repair"};
+static const size_t phasecount = sizeof(phases) / sizeof(phases[0]);
+
+
+// Reproducible pseudo-random numbers (xorshift64*)
+class Random
+{
+public:
+  Random(u64 seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+  u64 Next(void)
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+  }
+  u64 Below(u64 limit) {return Next() % limit;}
+
+  void Fill(u8 *data, size_t length)
+  {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+      u64 value = Next();
+      memcpy(data + i, &value, 8);
+    }
+    for (u64 value = Next(); i < length; i++, value >>= 8)
+      data[i] = (u8)value;
+  }
+
+protected:
+  u64 state;
+};
+
+
+// Where the data sets are kept whilst they're used: files in a directory,
+// or in memory (which leaves out the cost of the filesystem)
+class Store
+{
+public:
+  Store(const std::string &directory, bool inmemory)
+  : provider(inmemory ? new MemoryFileProvider(PATHSEP "par2bench") : 0)
+  {
+    if (provider)
+    {
+      root = provider->Root();
+    }
+    else
+    {
+      root = DiskFile::GetCanonicalPathname(directory);
+      if (root.empty() || root.find_last_of(PATHSEP ALTPATHSEP) != root.size()-1)
+        root += PATHSEP;
+    }
+  }
+
+  const std::string& Root(void) const {return root;}
+
+  // What the operations should access the files through (0 for the disk)
+  FileProvider* Provider(void) const {return provider.get();}
+
+  bool Write(const std::string &filename, const std::vector<u8> &data)
+  {
+    if (provider)
+    {
+      provider->AddFileCopy(filename, data.data(), data.size());
+      return true;
+    }
+    std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+    file.write((const char*)data.data(), data.size());
+    return file.good();
+  }
+
+  bool Read(const std::string &filename, std::vector<u8> &data)
+  {
+    if (provider)
+    {
+      const u8 *contents;
+      u64 length;
+      if (!provider->GetFile(filename, contents, length))
+        return false;
+      data.assign(contents, contents + length);
+      return true;
+    }
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file)
+      return false;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+  }
+
+  bool Delete(const std::string &filename)
+  {
+    if (provider)
+      return provider->Delete(filename);
+    return remove(filename.c_str()) == 0;
+  }
+
+  bool Rename(const std::string &oldname, const std::string &newname)
+  {
+    if (provider)
+      return provider->Rename(oldname, newname);
+    return rename(oldname.c_str(), newname.c_str()) == 0;
+  }
+
+  // Delete all of the files whose names start with prefix
+  void DeleteAll(const std::string &prefix)
+  {
+    std::unique_ptr< std::list<std::string> > files(DiskFile::FindFiles(root, prefix + "*", false, provider.get()));
+    for (std::list<std::string>::const_iterator f = files->begin(); f != files->end(); ++f)
+      Delete(*f);
+  }
+
+protected:
+  std::unique_ptr<MemoryFileProvider> provider;
+  std::string                         root;
+};
+
+
+// The best time for a phase of a scenario
+struct Timing
+{
+  double     seconds;
+  u64        bytes;
+  Statistics stages[1];  // From the best run (an array as it can't be copied)
+};
+
+struct Options
+{
+  Options(void) : repetitions(3), scale(1), nthreads(0), memorylimit(256*1048576),
+                  inmemory(false), verbose(false), threshold(10), directory(".") {}
+
+  u32                       repetitions;
+  u32                       scale;
+  u32                       nthreads;
+  size_t                    memorylimit;
+  bool                      inmemory;
+  bool                      verbose;
+  double                    threshold;    // Percent slower which counts as a regression
+  std::string               directory;
+  std::string               resultsfile;
+  std::string               baselinefile;
+  std::vector<std::string>  names;        // Scenarios to run (or all)
+};
+
+
+static void usage(void)
+{
+  std::cout <<
+    "Usage: par2bench [options] [scenario ...]\n"
+    "\n"
+    "Times creating, verifying, and repairing PAR2 files for synthetic data\n"
+    "sets, reporting the throughput of each phase.\n"
+    "\n"
+    "Options:\n"
+    "  -l       : List the scenarios\n"
+    "  -r<n>    : Repetitions of each scenario, keeping the best time (default 3)\n"
+    "  -s<n>    : Scale the size of the files by n (default 1)\n"
+    "  -t<n>    : Number of threads used for main processing\n"
+    "  -m<n>    : Memory (in MB) to use (default 256)\n"
+    "  -d<dir>  : Directory to create the data sets in (default current)\n"
+    "  -M       : Keep the data sets in memory rather than in files\n"
+    "  -v       : Also show how long each stage of each phase took\n"
+    "  -o<file> : Save the results to file\n"
+    "  -b<file> : Compare the results with those saved in file\n"
+    "  -p<n>    : Percent slower than the baseline which is a regression\n"
+    "             (default 10)\n"
+    "\n"
+    "The exit status is 1 if any phase failed, or was a regression.\n";
+}
+
+static void list(void)
+{
+  static const char *spreads[] = {"equal", "varied", "skewed"};
+  static const char *damages[] = {"overwritten blocks", "lost files", "inserted data", "truncated file", "renamed file"};
+
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+  {
+    const Scenario &s = scenarios[i];
+    std::cout << std::left << std::setw(18) << s.name << std::right
+      << s.filecount << " files of up to " << (s.filesize >> 10) << " KB (" << spreads[s.spread] << "), "
+      << (s.blocksize >> 10) << " KB blocks, " << s.redundancy << "% redundancy, "
+      << damages[s.damage] << std::endl;
+  }
+}
+
+static bool ParseOptions(int argc, char *argv[], Options &options, bool &listonly)
+{
+  listonly = false;
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (arg[0] != '-')
+    {
+      options.names.push_back(arg);
+      continue;
+    }
+
+    // Values may follow the option, or be the next argument
+    const char *value = arg + 2;
+    if (arg[1] && strchr("rstmpdob", arg[1]))
+    {
+      if (!*value && i+1 < argc)
+        value = argv[++i];
+      if (!*value)
+      {
+        std::cerr << "Option " << arg << " needs a value" << std::endl;
+        return false;
+      }
+    }
+
+    switch (arg[1])
+    {
+    case 'l': listonly = true; break;
+    case 'M': options.inmemory = true; break;
+    case 'v': options.verbose = true; break;
+    case 'r': options.repetitions = (u32)atoi(value); break;
+    case 's': options.scale = (u32)atoi(value); break;
+    case 't': options.nthreads = (u32)atoi(value); break;
+    case 'm': options.memorylimit = (size_t)atoi(value) * 1048576; break;
+    case 'p': options.threshold = atof(value); break;
+    case 'd': options.directory = value; break;
+    case 'o': options.resultsfile = value; break;
+    case 'b': options.baselinefile = value; break;
+    default:
+      std::cerr << "Invalid option: " << arg << std::endl;
+      return false;
+    }
+  }
+
+  if (options.repetitions == 0 || options.scale == 0 || options.memorylimit == 0)
+  {
+    std::cerr << "Invalid repetitions, scale or memory" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+// Generate the sizes of the files of a scenario
+static std::vector<u64> FileSizes(const Scenario &scenario, u32 scale, Random &random)
+{
+  const u64 largest = scenario.filesize * scale;
+  std::vector<u64> sizes(scenario.filecount);
+  for (u32 i = 0; i < scenario.filecount; i++)
+  {
+    switch (scenario.spread)
+    {
+    case sdEqual:
+      sizes[i] = largest;
+      break;
+    case sdVaried:
+      sizes[i] = largest/16 + random.Below(largest - largest/16 + 1);
+      break;
+    case sdSkewed:
+      {
+        // Evenly spread on a log scale, from 4 KB
+        double fraction = (double)random.Below(1000000) / 1000000;
+        sizes[i] = (u64)(4096 * pow((double)largest / 4096, fraction));
+      }
+      break;
+    }
+  }
+  return sizes;
+}
+
+// Damage a data set, returning any files which verifying or repairing need
+// to be told about
+static bool DamageFiles(const Scenario &scenario, Store &store, Random &random,
+                        const std::vector<std::string> &filenames, const std::vector<std::vector<u8> > &contents,
+                        u32 recoveryblockcount, std::vector<std::string> &extrafiles)
+{
+  const u64 blocksize = scenario.blocksize;
+  const u32 lose = std::max(recoveryblockcount / 2, (u32)1);
+
+  size_t largest = 0;
+  for (size_t i = 1; i < contents.size(); i++)
+  {
+    if (contents[i].size() > contents[largest].size())
+      largest = i;
+  }
+
+  switch (scenario.damage)
+  {
+  case dmBlocks:
+    {
+      // Overwrite part of blocks spread evenly across the data set
+      u64 sourceblockcount = 0;
+      for (size_t i = 0; i < contents.size(); i++)
+        sourceblockcount += (contents[i].size() + blocksize-1) / blocksize;
+
+      std::vector<std::vector<u8> > damaged(contents);
+      std::vector<bool> changed(contents.size());
+      for (u32 n = 0; n < lose; n++)
+      {
+        u64 block = (2*n+1) * sourceblockcount / (2*lose);
+        size_t file = 0;
+        while (block >= (contents[file].size() + blocksize-1) / blocksize)
+          block -= (contents[file++].size() + blocksize-1) / blocksize;
+
+        u64 offset = block * blocksize + random.Below(std::min(blocksize, contents[file].size() - block * blocksize));
+        size_t length = (size_t)std::min((u64)16, contents[file].size() - offset);
+        random.Fill(&damaged[file][(size_t)offset], length);
+        changed[file] = true;
+      }
+      for (size_t i = 0; i < contents.size(); i++)
+      {
+        if (changed[i] && !store.Write(filenames[i], damaged[i]))
+          return false;
+      }
+    }
+    break;
+
+  case dmFiles:
+    {
+      // Lose whole files, until enough blocks are lost
+      u64 lost = 0;
+      for (size_t i = 0; i < contents.size() && lost < lose; i += contents.size() / lose + 1)
+      {
+        if (!store.Delete(filenames[i]))
+          return false;
+        lost += (contents[i].size() + blocksize-1) / blocksize;
+      }
+    }
+    break;
+
+  case dmShift:
+    {
+      // Insert some bytes which aren't a multiple of the block size
+      std::vector<u8> damaged(contents[largest]);
+      std::vector<u8> inserted(1237);
+      random.Fill(inserted.data(), inserted.size());
+      damaged.insert(damaged.begin() + damaged.size()/2, inserted.begin(), inserted.end());
+      if (!store.Write(filenames[largest], damaged))
+        return false;
+    }
+    break;
+
+  case dmTruncate:
+    {
+      // Cut off as many blocks as are to be lost
+      std::vector<u8> damaged(contents[largest]);
+      u64 cut = std::min((u64)lose * blocksize, (u64)damaged.size() / 2);
+      damaged.resize(damaged.size() - (size_t)cut);
+      if (!store.Write(filenames[largest], damaged))
+        return false;
+    }
+    break;
+
+  case dmRename:
+    {
+      // The renamed file is complete, so needs to be found under its new name
+      std::string newname = filenames[largest] + ".renamed";
+      if (!store.Rename(filenames[largest], newname))
+        return false;
+      extrafiles.push_back(newname);
+    }
+    break;
+  }
+
+  return true;
+}
+
+// Run one repetition of a scenario, keeping the best times for each phase
+static bool RunScenario(const Scenario &scenario, const Options &options, Store &store,
+                        const std::vector<std::vector<u8> > &contents, u32 repetition,
+                        std::map<std::string, std::unique_ptr<Timing> > &timings)
+{
+  const std::string prefix = std::string("bench_") + scenario.name;
+  const std::string base = store.Root() + prefix;
+
+  std::vector<std::string> filenames;
+  u64 totalsize = 0;
+  u64 sourceblockcount = 0;
+  for (size_t i = 0; i < contents.size(); i++)
+  {
+    filenames.push_back(base + "_" + std::to_string(i) + ".dat");
+    totalsize += contents[i].size();
+    sourceblockcount += (contents[i].size() + scenario.blocksize-1) / scenario.blocksize;
+  }
+  if (sourceblockcount > 32768)
+  {
+    std::cerr << scenario.name << ": too many blocks (" << sourceblockcount << ") at this scale" << std::endl;
+    return false;
+  }
+  u32 recoveryblockcount = (u32)std::max((sourceblockcount * scenario.redundancy + 99) / 100, (u64)1);
+
+  // Start from nothing
+  store.DeleteAll(prefix);
+  for (size_t i = 0; i < contents.size(); i++)
+  {
+    if (!store.Write(filenames[i], contents[i]))
+    {
+      std::cerr << "Could not write " << filenames[i] << std::endl;
+      return false;
+    }
+  }
+
+  // Discard the output of each phase, other than errors
+  std::ostream nullout(0);
+
+  Random random(repetition);
+  std::vector<std::string> extrafiles;
+  bool ok = true;
+  for (size_t phase = 0; phase < phasecount && ok; phase++)
+  {
+    if (phase == 2 && !DamageFiles(scenario, store, random, filenames, contents, recoveryblockcount, extrafiles))
+    {
+      std::cerr << scenario.name << ": could not damage the files" << std::endl;
+      ok = false;
+      break;
+    }
+
+    std::unique_ptr<Timing> timing(new Timing);
+    timing->bytes = totalsize;
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    Result result;
+    Result expected = eSuccess;
+    if (phase == 0)
+    {
+      result = par2create(nullout, std::cerr, nlSilent, options.memorylimit, store.Root(),
+                          options.nthreads, _FILE_THREADS, base, filenames,
+                          scenario.blocksize, 0, scUniform, 1, recoveryblockcount,
+                          false, cpNormal, 0, timing->stages, store.Provider());
+    }
+    else
+    {
+      expected = phase == 2 ? eRepairPossible : eSuccess;
+      result = par2repair(nullout, std::cerr, nlSilent, options.memorylimit, store.Root(),
+                          options.nthreads, _FILE_THREADS, base + ".par2", extrafiles,
+                          phase == 3, false, false, false, 0,
+                          false, cpNormal, 0, timing->stages, store.Provider());
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    timing->seconds = elapsed.count();
+    timing->stages->Finish(result);
+
+    if (result != expected)
+    {
+      std::cerr << scenario.name << ": " << phases[phase] << " returned " << result << " rather than " << expected << std::endl;
+      ok = false;
+      break;
+    }
+
+    std::unique_ptr<Timing> &best = timings[std::string(scenario.name) + " " + phases[phase]];
+    if (!best || timing->seconds < best->seconds)
+      best = std::move(timing);
+  }
+
+  // The repaired files must be as they were
+  for (size_t i = 0; i < contents.size() && ok; i++)
+  {
+    std::vector<u8> data;
+    if (!store.Read(filenames[i], data) || data != contents[i])
+    {
+      std::cerr << scenario.name << ": " << filenames[i] << " was not repaired" << std::endl;
+      ok = false;
+    }
+  }
+
+  store.DeleteAll(prefix);
+  return ok;
+}
+
+// A time read from a file saved by -o
+struct SavedTiming
+{
+  double seconds;
+  u64    bytes;
+};
+
+// Read results saved by -o
+static bool ReadResults(const std::string &filename, std::map<std::string, SavedTiming> &results)
+{
+  std::ifstream file(filename.c_str());
+  if (!file)
+    return false;
+
+  std::string line;
+  while (std::getline(file, line))
+  {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::istringstream fields(line);
+    std::string scenario, phase;
+    SavedTiming saved;
+    if (fields >> scenario >> phase >> saved.seconds >> saved.bytes)
+      results[scenario + " " + phase] = saved;
+  }
+  return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+  Options options;
+  bool listonly;
+  if (argc > 1 && (argv[1] == std::string("-h") || argv[1] == std::string("--help")))
+  {
+    usage();
+    return 0;
+  }
+  if (!ParseOptions(argc, argv, options, listonly))
+  {
+    usage();
+    return eInvalidCommandLineArguments;
+  }
+  if (listonly)
+  {
+    list();
+    return 0;
+  }
+
+  std::vector<const Scenario*> torun;
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+  {
+    if (options.names.empty() ||
+        std::find(options.names.begin(), options.names.end(), scenarios[i].name) != options.names.end())
+      torun.push_back(&scenarios[i]);
+  }
+  if (torun.size() != (options.names.empty() ? sizeof(scenarios) / sizeof(scenarios[0]) : options.names.size()))
+  {
+    std::cerr << "Unknown scenario (run with -l to list them)" << std::endl;
+    return eInvalidCommandLineArguments;
+  }
+
+  std::map<std::string, SavedTiming> baseline;
+  if (!options.baselinefile.empty() && !ReadResults(options.baselinefile, baseline))
+  {
+    std::cerr << "Could not read the baseline " << options.baselinefile << std::endl;
+    return eFileIOError;
+  }
+
+  Store store(options.directory, options.inmemory);
+  std::map<std::string, std::unique_ptr<Timing> > timings;
+  bool failed = false;
+  for (size_t i = 0; i < torun.size(); i++)
+  {
+    const Scenario &scenario = *torun[i];
+
+    // Each scenario has its own data, which is the same every time
+    Random random(&scenario - scenarios + 1);
+    std::vector<u64> sizes = FileSizes(scenario, options.scale, random);
+    std::vector<std::vector<u8> > contents(sizes.size());
+    for (size_t f = 0; f < sizes.size(); f++)
+    {
+      contents[f].resize((size_t)sizes[f]);
+      random.Fill(contents[f].data(), contents[f].size());
+    }
+
+    std::cerr << "Running " << scenario.name << "..." << std::endl;
+    for (u32 repetition = 0; repetition < options.repetitions; repetition++)
+    {
+      if (!RunScenario(scenario, options, store, contents, repetition, timings))
+      {
+        failed = true;
+        break;
+      }
+    }
+  }
+
+  // Report the best time for each phase
+  std::cout << std::left << std::setw(18) << "Scenario" << std::setw(20) << "Phase" << std::right
+    << std::setw(10) << "Seconds" << std::setw(10) << "MB/s";
+  if (!baseline.empty())
+    std::cout << std::setw(12) << "Baseline";
+  std::cout << '\n' << std::fixed;
+
+  std::unique_ptr<std::ofstream> results;
+  if (!options.resultsfile.empty())
+  {
+    results.reset(new std::ofstream(options.resultsfile.c_str()));
+    *results << "# par2bench results: scenario phase seconds bytes" << std::endl << std::fixed;
+  }
+
+  for (size_t i = 0; i < torun.size(); i++)
+  {
+    for (size_t phase = 0; phase < phasecount; phase++)
+    {
+      std::string key = std::string(torun[i]->name) + " " + phases[phase];
+      std::map<std::string, std::unique_ptr<Timing> >::const_iterator t = timings.find(key);
+      if (t == timings.end())
+        continue;
+      const Timing &timing = *t->second;
+
+      std::cout << std::left << std::setw(18) << torun[i]->name << std::setw(20) << phases[phase] << std::right
+        << std::setprecision(3) << std::setw(10) << timing.seconds
+        << std::setprecision(1) << std::setw(10) << timing.bytes / timing.seconds / 1048576;
+
+      // Only times for the same data (at the same scale) can be compared
+      std::map<std::string, SavedTiming>::const_iterator b = baseline.find(key);
+      if (b != baseline.end() && b->second.bytes != timing.bytes)
+      {
+        std::cout << std::setw(12) << "n/a";
+      }
+      else if (b != baseline.end() && b->second.seconds > 0)
+      {
+        double change = (timing.seconds - b->second.seconds) / b->second.seconds * 100;
+        std::cout << std::setw(11) << std::showpos << change << std::noshowpos << '%';
+        if (change > options.threshold)
+        {
+          std::cout << "  REGRESSION";
+          failed = true;
+        }
+      }
+      std::cout << '\n';
+
+      if (options.verbose)
+      {
+        for (int stage = 0; stage < Statistics::stCount; stage++)
+        {
+          const Statistics::StageStatistics &s = timing.stages->GetStage((Statistics::Stage)stage);
+          if (s.calls == 0)
+            continue;
+          std::cout << std::left << std::setw(18) << "" << std::setw(20)
+            << (std::string("  ") + Statistics::StageName((Statistics::Stage)stage)) << std::right
+            << std::setprecision(3) << std::setw(10) << s.walltime;
+          if (s.bytes > 0 && s.walltime > 0)
+            std::cout << std::setprecision(1) << std::setw(10) << s.bytes / s.walltime / 1048576;
+          std::cout << '\n';
+        }
+      }
+
+      if (results)
+        *results << std::setprecision(6) << key << ' ' << timing.seconds << ' ' << timing.bytes << '\n';
+    }
+  }
+  std::cout.flush();
+
+  if (results && !results->flush())
+  {
+    std::cerr << "Could not write the results to " << options.resultsfile << std::endl;
+    failed = true;
+  }
+
+  return failed ? 1 : 0;
+}
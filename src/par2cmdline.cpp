@@ -19,9 +19,12 @@
 //  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "libpar2.h"
+#include "trace.h"
+#include "statistics.h"
 #include "commandline.h"
 // This is included here, so that cout and cerr are not used elsewhere.
 #include <iostream>
+#include <fstream>
 
 #ifdef _MSC_VER
 #ifdef _DEBUG
@@ -73,6 +76,14 @@ int main(int argc, char* argv[])
 
   if (commandline->Parse(argc, argv))
   {
+    // Where to record how long each stage takes, if wanted
+    std::unique_ptr<Statistics> statistics(commandline->GetStats() ? new Statistics : 0);
+
+    // What each thread does, if wanted
+    std::unique_ptr<Trace> trace(commandline->GetTraceFile().empty() ? 0 : new Trace);
+    if (trace)
+      trace->Start();
+
     // Which operation was selected
     switch (commandline->GetOperation())
     {
@@ -93,7 +104,11 @@ int main(int argc, char* argv[])
 			    commandline->GetFirstRecoveryBlock(),
 			    commandline->GetRecoveryFileScheme(),
 			    commandline->GetRecoveryFileCount(),
-			    commandline->GetRecoveryBlockCount()
+			    commandline->GetRecoveryBlockCount(),
+			    commandline->GetDirectIO(),
+			    commandline->GetCachePolicy(),
+			    0,
+			    statistics.get()
 			    );
 
         break;
@@ -129,7 +144,11 @@ int main(int argc, char* argv[])
 				  commandline->GetPurgeFiles(),
 				  commandline->GetRenameOnly(),
 				  commandline->GetSkipData(),
-				  commandline->GetSkipLeaway());
+				  commandline->GetSkipLeaway(),
+				  commandline->GetDirectIO(),
+				  commandline->GetCachePolicy(),
+				  0,
+				  statistics.get());
               break;
 	    default:
               break;
@@ -142,6 +161,33 @@ int main(int argc, char* argv[])
       default:
         break;
     }
+
+    if (statistics)
+    {
+      statistics->Finish(result);
+
+      if (commandline->GetStatsFile().empty())
+      {
+        statistics->WriteJSON(std::cout);
+      }
+      else
+      {
+        std::ofstream statsfile(commandline->GetStatsFile().c_str());
+        statistics->WriteJSON(statsfile);
+        if (!statsfile)
+          std::cerr << "Could not write statistics to " << commandline->GetStatsFile() << std::endl;
+      }
+    }
+
+    if (trace)
+    {
+      trace->Stop();
+
+      std::ofstream tracefile(commandline->GetTraceFile().c_str());
+      trace->WriteJSON(tracefile);
+      if (!tracefile)
+        std::cerr << "Could not write trace to " << commandline->GetTraceFile() << std::endl;
+    }
   }
 
   delete commandline;
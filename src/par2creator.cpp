@@ -20,6 +20,7 @@
 
 #include "libpar2internal.h"
 #include "foreach_parallel.h"
+#include <deque>
 
 #ifdef _MSC_VER
 #ifdef _DEBUG
@@ -38,9 +39,16 @@ Par2Creator::Par2Creator(std::ostream &sout, std::ostream &serr, const NoiseLeve
 : sout(sout)
 , serr(serr)
 , noiselevel(noiselevel)
+, textprogress(sout, output_lock, noiselevel)
+, progresslistener(&textprogress)
+, statistics(0)
+, memorybudget()
+, hashingmemory(0)
+, processingmemory(0)
 , blocksize(0)
 , chunksize(0)
 , transferbuffer(0)
+, transferbuffercount(NUM_TRANSFER_BUFFERS)
 
 , sourcefilecount(0)
 , sourceblockcount(0)
@@ -64,6 +72,7 @@ Par2Creator::Par2Creator(std::ostream &sout, std::ostream &serr, const NoiseLeve
 , deferhashcomputation(false)
 {
   setup_hasher();
+  fileaccess.cachedfiles = &cachedfiles;
 }
 
 Par2Creator::~Par2Creator(void)
@@ -71,7 +80,9 @@ Par2Creator::~Par2Creator(void)
   delete mainpacket;
   delete creatorpacket;
 
-  delete [] (u8*)transferbuffer;
+  // Queued requests may still reference the transfer buffer
+  ioqueue.Close();
+  ALIGN_FREE(transferbuffer);
 
   parpar.deinit();
 
@@ -94,9 +105,13 @@ Result Par2Creator::Process(
 			    const u32 _firstblock,
 			    const Scheme _recoveryfilescheme,
 			    const u32 _recoveryfilecount,
-			    const u32 _recoveryblockcount)
+			    const u32 _recoveryblockcount,
+			    const bool directio,
+			    const CachePolicy cachepolicy)
 {
   filethreads = _filethreads;
+  fileaccess.directio = directio;
+  fileaccess.cachepolicy = cachepolicy;
 
   if (!CheckBasepath(parfilename))
     return eFileIOError;
@@ -126,9 +141,19 @@ Result Par2Creator::Process(
     return eInvalidCommandLineArguments;
   }
 
-  // Determine how much recovery data can be computed on one pass
-  if (!CalculateProcessBlockSize(memorylimit))
-    return eLogicError;
+  // Account for the memory which is needed whatever the limit is
+  memorybudget.SetLimit(memorylimit);
+  ChargeSourceFiles(extrafiles);
+
+  // Use asynchronous I/O if available, so that more reads and writes can be
+  // kept in flight (this affects how many transfer buffers are needed)
+  if (recoveryblockcount > 0 && ioqueue.Init(NUM_QUEUED_TRANSFER_BUFFERS * 2))
+    transferbuffercount = NUM_QUEUED_TRANSFER_BUFFERS;
+
+  // Determine how many files can be hashed at once, and how much recovery
+  // data can be computed on one pass
+  if (!CalculateProcessBlockSize())
+    return eMemoryError;
 
   if (recoveryblockcount > 0 && noiselevel >= nlDebug)
     sout << "[DEBUG] Process chunk size: " << chunksize << std::endl;
@@ -136,8 +161,9 @@ Result Par2Creator::Process(
   // Init ParPar backend
   if (!parpar.init(chunksize, {{&parparcpu, 0, (size_t)chunksize}}))
     return eLogicError;
-  if (nthreads != 0)
-    parparcpu.setNumThreads(nthreads);
+  // ParPar runs compute threads of its own, outside the shared thread pool:
+  // as many as -t asks for, or one per hardware thread
+  parparcpu.setNumThreads(ThreadPool::Instance().Limit(nthreads));
 
   // If there aren't many input blocks, restrict the submission batch size
   u32 inputbatch = 0;
@@ -172,6 +198,10 @@ Result Par2Creator::Process(
   if (!OpenSourceFiles(extrafiles, basepath))
     return eFileIOError;
 
+  // The buffers used for hashing have been freed
+  memorybudget.Release(hashingmemory);
+  hashingmemory = 0;
+
   // Create the main packet and determine the setid to use with all packets
   if (!CreateMainPacket())
     return eLogicError;
@@ -202,23 +232,37 @@ Result Par2Creator::Process(
       return eMemoryError;
 
     // Set the total amount of data to be processed.
-    ProgressMeter<u64> progress(sout, "Processing: ", blocksize * sourceblockcount);
+    ProgressMeter<u64> progress(*progresslistener, ppProcessing, blocksize * sourceblockcount);
 
-    // Start at an offset of 0 within a block.
-    u64 blockoffset = 0;
-    while (blockoffset < blocksize) // Continue until the end of the block.
+    unsigned batchesstarted = parparcpu.getBatchesStarted();
     {
-      // Work out how much data to process this time.
-      size_t blocklength = (size_t)std::min((u64)chunksize, blocksize-blockoffset);
-      if (!parpar.setCurrentSliceSize(blocklength))
-        return eMemoryError;
-
-      // Read source data, process it through the RS matrix and write it to disk.
-      if (!ProcessData(blockoffset, blocklength, progress))
-        return eFileIOError;
+      StageTimer timer(statistics, Statistics::stProcessing, blocksize * sourceblockcount);
 
-      blockoffset += blocklength;
+      // Start at an offset of 0 within a block.
+      u64 blockoffset = 0;
+      chunksizer.Start(blocksize, chunksize, MIN_CHUNK_SIZE, fileaccess.directio);
+      while (blockoffset < blocksize) // Continue until the end of the block.
+      {
+        // Work out how much data to process this time.
+        size_t blocklength = chunksizer.Next(blockoffset);
+        if (!parpar.setCurrentSliceSize(blocklength))
+          return eMemoryError;
+
+        // Read source data, process it through the RS matrix and write it to disk.
+        if (!ProcessData(blockoffset, blocklength, progress))
+          return eFileIOError;
+
+        // Adapt the size of the next pass to how this one went
+        chunksizer.Finish(blocklength);
+        if (noiselevel >= nlDebug && blocklength < blocksize)
+          sout << "[DEBUG] Pass of " << blocklength << " bytes per block took " << chunksizer.PassTime()
+               << "s, waiting " << chunksizer.WaitTime(ChunkSizer::wtIO) << "s for I/O and "
+               << chunksizer.WaitTime(ChunkSizer::wtCompute) << "s for the backend" << std::endl;
+
+        blockoffset += blocklength;
+      }
     }
+    RecordBackendStatistics(batchesstarted);
 
     if (noiselevel > nlQuiet)
       sout << "Writing recovery packets" << std::endl;
@@ -257,7 +301,7 @@ Result Par2Creator::Process(
 bool Par2Creator::CheckBasepath(const std::string &parfilename)
 {
   std::string checkfilename = parfilename + ".check.par2";
-  std::unique_ptr<DiskFile> diskfile(new DiskFile(sout, serr, output_lock));
+  std::unique_ptr<DiskFile> diskfile(new DiskFile(sout, serr, output_lock, fileaccess));
   size_t dummysize = 4096;
 
   if (!diskfile->Create(checkfilename, dummysize))
@@ -275,7 +319,7 @@ bool Par2Creator::CheckBasepath(const std::string &parfilename)
 // specified on the command line
 bool Par2Creator::ComputeBlockCount(const std::vector<std::string> &extrafiles)
 {
-  FileSizeCache filesize_cache;
+  FileSizeCache filesize_cache(fileaccess.provider);
 
   largestfilesize = 0;
   for (std::vector<std::string>::const_iterator i=extrafiles.begin(); i!=extrafiles.end(); i++)
@@ -321,9 +365,50 @@ bool Par2Creator::ComputeBlockCount(const std::vector<std::string> &extrafiles)
 
 
 
-// Determine how much recovery data can be computed on one pass
-bool Par2Creator::CalculateProcessBlockSize(size_t memorylimit)
+// Account for the memory the source files will need whatever the limit is:
+// their packets, the state of their hashers, and the blocks they're sliced
+// into, as well as the recovery packets and files
+void Par2Creator::ChargeSourceFiles(const std::vector<std::string> &extrafiles)
+{
+  size_t needed = sourceblockcount * (sizeof(FILEVERIFICATIONENTRY) + sizeof(DataBlock))
+                + recoveryblockcount * sizeof(RecoveryPacket)
+                + recoveryfilecount * sizeof(DiskFile);
+
+  for (std::vector<std::string>::const_iterator i=extrafiles.begin(); i!=extrafiles.end(); i++)
+  {
+    needed += sizeof(Par2CreatorSourceFile) + sizeof(DiskFile) + HASHER_MEMORY
+            + sizeof(FILEDESCRIPTIONPACKET) + sizeof(FILEVERIFICATIONPACKET) + i->size();
+  }
+
+  memorybudget.Charge(needed);
+}
+
+// Determine how many files can be hashed at once, and how much recovery data
+// can be computed on one pass, within the memory budget
+bool Par2Creator::CalculateProcessBlockSize(void)
 {
+  // Each file being hashed needs a buffer to read it into. Hashing is given
+  // no more than a quarter of the memory available (as long as one file can
+  // be hashed), so that most can be used for processing.
+  size_t hashbuffersize = (size_t)std::min(blocksize, (u64)1024*1024);
+  if (memorybudget.Available() < hashbuffersize)
+  {
+    serr << "Not enough memory: " << memorybudget.Used() + hashbuffersize
+         << " bytes would be needed to hash the source files." << std::endl;
+    return false;
+  }
+  u32 hashthreads = (u32)std::min((size_t)filethreads, memorybudget.Available() / 4 / hashbuffersize);
+  if (hashthreads == 0)
+    hashthreads = 1;
+  if (hashthreads < filethreads)
+  {
+    if (noiselevel >= nlDebug)
+      sout << "[DEBUG] Hashing " << hashthreads << " files at once, rather than " << filethreads << ", to fit in memory" << std::endl;
+    filethreads = hashthreads;
+  }
+  hashingmemory = hashthreads * hashbuffersize;
+  memorybudget.Charge(hashingmemory);
+
   // Are we computing any recovery blocks
   if (recoveryblockcount == 0)
   {
@@ -334,13 +419,14 @@ bool Par2Creator::CalculateProcessBlockSize(size_t memorylimit)
   else
   {
     // We use intermediary buffers to transfer data with, so include those in the limit calculation
-    u32 blockoverhead = NUM_TRANSFER_BUFFERS + std::min((u32)NUM_PARPAR_BUFFERS*2, sourceblockcount+1);
+    u32 blockoverhead = transferbuffercount + std::min((u32)NUM_PARPAR_BUFFERS*2, sourceblockcount+1);
+    size_t available = memorybudget.Available();
 
     // Would single pass processing use too much memory
-    if (blocksize * (recoveryblockcount + blockoverhead) > memorylimit)
+    if (blocksize * (recoveryblockcount + blockoverhead) > available)
     {
       // Pick a size that is small enough
-      chunksize = ~3 & (memorylimit / (recoveryblockcount + blockoverhead));
+      chunksize = ~3 & (available / (recoveryblockcount + blockoverhead));
 
       deferhashcomputation = false;
     }
@@ -351,11 +437,27 @@ bool Par2Creator::CalculateProcessBlockSize(size_t memorylimit)
       deferhashcomputation = true;
     }
 
-    if (MAX_CHUNK_SIZE != 0 && chunksize > MAX_CHUNK_SIZE)
+    // Passes through the blocks which are smaller than this may be chosen
+    // (by chunksizer), but never larger
+    if (chunksize > ChunkSizer::MaxSize())
     {
-      chunksize = MAX_CHUNK_SIZE;
+      chunksize = ChunkSizer::MaxSize();
       deferhashcomputation = false;
     }
+
+    // Keep each chunk of a block aligned, so that it can be read directly
+    if (fileaccess.directio && chunksize < blocksize && chunksize > DIRECT_IO_ALIGNMENT
+        && blocksize % DIRECT_IO_ALIGNMENT == 0)
+      chunksize -= chunksize % DIRECT_IO_ALIGNMENT;
+
+    processingmemory = chunksize * (recoveryblockcount + blockoverhead);
+    if (chunksize == 0 || !memorybudget.Reserve(processingmemory))
+    {
+      serr << "Not enough memory: " << memorybudget.Used() + 4 * (recoveryblockcount + blockoverhead)
+           << " bytes would be needed to compute the recovery data." << std::endl;
+      processingmemory = 0;
+      return false;
+    }
   }
 
   return true;
@@ -370,13 +472,29 @@ bool Par2Creator::OpenSourceFiles(const std::vector<std::string> &extrafiles, st
 
   //Total size of files for mt-progress line
   u64 mttotalsize = 0;
+  std::map<std::string, u64> filesizes;
   for (size_t i=0; i<extrafiles.size(); ++i)
-    mttotalsize += DiskFile::GetFileSize(extrafiles[i]);
+  {
+    u64 filesize = DiskFile::GetFileSize(extrafiles[i], fileaccess.provider);
+    filesizes[extrafiles[i]] = filesize;
+    mttotalsize += filesize;
+  }
 
-  MTProgressMeter<u64> progress(sout, "", mttotalsize, output_lock);
+  MTProgressMeter<u64> progress(*progresslistener, ppHashing, mttotalsize);
+  // When hashing is deferred, the data is hashed whilst it's processed
+  StageTimer timer(statistics, Statistics::stHashing, deferhashcomputation ? 0 : mttotalsize);
 
   std::mutex packet_lock;
-  foreach_parallel<std::string>(extrafiles, Par2Creator::GetFileThreads(), [&, this](const std::string& extrafile) {
+  // Hash the largest files first if processing in parallel, limiting how
+  // many are read from each device at once
+  DeviceIdCache devices(fileaccess.provider);
+  foreach_parallel_grouped<std::string>(extrafiles, Par2Creator::GetFileThreads(), [&filesizes](const std::string& extrafile) {
+    return filesizes[extrafile];
+  }, [&devices](const std::string& extrafile) {
+    return devices.get(extrafile);
+  }, [](u64 device) {
+    return DiskFile::GetDeviceStreamLimit(device, Par2Creator::GetFileThreads());
+  }, [&, this](const std::string& extrafile) {
     if (openfailed.load(std::memory_order_relaxed)) return;
     Par2CreatorSourceFile *sourcefile = new Par2CreatorSourceFile;
 
@@ -389,7 +507,8 @@ bool Par2Creator::OpenSourceFiles(const std::vector<std::string> &extrafiles, st
     }
 
     // Open the source file and compute its Hashes and CRCs.
-    if (!sourcefile->Open(noiselevel, sout, serr, extrafile, blocksize, deferhashcomputation, basepath, progress, output_lock))
+    TraceScope trace("hashing", name);
+    if (!sourcefile->Open(noiselevel, sout, serr, extrafile, blocksize, deferhashcomputation, basepath, progress, output_lock, fileaccess))
     {
       delete sourcefile;
       openfailed.store(true, std::memory_order_relaxed);
@@ -642,7 +761,7 @@ bool Par2Creator::InitialiseOutputFiles(const std::string &parfilename)
 
   // Allocate the recovery files
   {
-    recoveryfiles.resize(recoveryfilecount+1, DiskFile(sout, serr, output_lock)); // pass default constructor.
+    recoveryfiles.resize(recoveryfilecount+1, DiskFile(sout, serr, output_lock, fileaccess)); // pass default constructor.
 
     // Sort critical packets, so we get consistency.
     criticalpackets.sort(CriticalPacket::CompareLess);
@@ -730,7 +849,17 @@ bool Par2Creator::InitialiseOutputFiles(const std::string &parfilename)
 
         // Create the file on disk and make it the required size
         if (!recoveryfile->Create(fileallocation->filename, offset))
+        {
+          // Don't leave the files which were created (and which have space
+          // reserved for them) behind
+          while (recoveryfile != recoveryfiles.begin())
+          {
+            --recoveryfile;
+            recoveryfile->Close();
+            recoveryfile->Delete();
+          }
           return false;
+        }
 
         ++recoveryfile;
         ++fileallocation;
@@ -744,7 +873,8 @@ bool Par2Creator::InitialiseOutputFiles(const std::string &parfilename)
 // Allocate memory buffers for reading and writing data to disk.
 bool Par2Creator::AllocateBuffers(void)
 {
-  transferbuffer = new u8[chunksize * NUM_TRANSFER_BUFFERS];
+  // Aligned, in case direct I/O is being used
+  ALIGN_ALLOC(transferbuffer, chunksize * transferbuffercount, DIRECT_IO_ALIGNMENT);
 
   if (transferbuffer == NULL)
   {
@@ -752,6 +882,8 @@ bool Par2Creator::AllocateBuffers(void)
     return false;
   }
 
+  ioqueue.RegisterBuffer(transferbuffer, chunksize * transferbuffercount);
+
   return true;
 }
 
@@ -767,18 +899,20 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength, ProgressMeter
   std::vector<DataBlock>::iterator sourceblock;
   u32 inputblock;
 
-  DiskFile *lastopenfile = NULL;
-
-  // For tracking input buffer availability
-  std::future<void> bufferavail[NUM_TRANSFER_BUFFERS];
-  u32 bufferindex = NUM_TRANSFER_BUFFERS - 1;
+  // Each block is read into the next transfer buffer in turn. Reads are
+  // queued ahead of the block being processed, as far as buffers are free.
+  FutureList<void> bufferavail(transferbuffercount);
+  std::vector<IOQueue::Ticket> bufferread(transferbuffercount);
+  // Which buffers were left unread because the block is a hole in its file
+  std::vector<bool> bufferhole(transferbuffercount);
   // Set all input buffers to available
-  for (i32 i = 0; i < NUM_TRANSFER_BUFFERS; i++)
+  for (u32 i = 0; i < transferbuffercount; i++)
   {
     std::promise<void> stub;
     bufferavail[i] = stub.get_future();
     stub.set_value();
   }
+  u32 readblock = 0; // The next block to be read
 
   // Clear existing output data in backend
   parpar.discardOutput();
@@ -788,47 +922,91 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength, ProgressMeter
        sourceblock != sourceblocks.end();
        ++sourceblock, ++inputblock)
   {
-    // Are we reading from a new file?
-    if (lastopenfile != (*sourceblock).GetDiskFile())
+    // Queue reads up to this block, and beyond if there are buffers free
+    while (readblock < sourceblockcount && readblock < inputblock + transferbuffercount)
     {
-      // Close the last file
-      if (lastopenfile != NULL)
+      u32 readbuffer = readblock % transferbuffercount;
+      if (readblock > inputblock &&
+          bufferavail[readbuffer].wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        break;
       {
-        lastopenfile->Close();
+        // Waiting for the backend to finish with the buffer
+        TraceScope trace("buffer_wait");
+        ChunkWaitTimer wait(chunksizer, ChunkSizer::wtCompute);
+        bufferavail[readbuffer].get();
       }
 
-      // Open the new file
-      lastopenfile = (*sourceblock).GetDiskFile();
-      if (!lastopenfile->Open())
-      {
+      // Open the file, if this is the first block to be read from it
+      DataBlock &block = sourceblocks[readblock];
+      if (!block.Open())
         return false;
+
+      // Holes in sparse files needn't be read, as they're all zeros (which
+      // only need to be there if the block is to be hashed)
+      void *readptr = (char*)transferbuffer + chunksize * readbuffer;
+      bufferhole[readbuffer] = block.IsHole(blockoffset, blocklength);
+      if (bufferhole[readbuffer])
+      {
+        if (deferhashcomputation)
+          memset(readptr, 0, blocklength);
+        bufferread[readbuffer] = ioqueue.Completed();
+      }
+      else
+      {
+        bufferread[readbuffer] = block.QueueRead(ioqueue, blockoffset, blocklength, readptr);
       }
+      ++readblock;
     }
 
-    // Wait for next input buffer to become available
-    bufferindex = (bufferindex + 1) % NUM_TRANSFER_BUFFERS;
+    // Wait for data from the current input block
+    u32 bufferindex = inputblock % transferbuffercount;
     void *inputbuffer = (char*)transferbuffer + chunksize * bufferindex;
-    bufferavail[bufferindex].get();
-    
-    // Read data from the current input block
-    if (!sourceblock->ReadData(blockoffset, blocklength, inputbuffer))
-      return false;
+    {
+      StageTimer timer(statistics, Statistics::stReading, blocklength);
+      ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
+      if (!ioqueue.Wait(bufferread[bufferindex]))
+        return false;
+    }
 
-    // Wait for ParPar backend to be ready, if busy
-    parpar.waitForAdd();
-    // Send block to backend
-    bufferavail[bufferindex] = parpar.addInput(inputbuffer, blocklength, inputblock);
+    // Close the file once its last block has been read, and the OS needn't
+    // keep it cached until the next pass
+    if (sourceblock+1 == sourceblocks.end() || sourceblock[1].GetDiskFile() != sourceblock->GetDiskFile())
+    {
+      sourceblock->GetDiskFile()->DontNeed(0, 0);
+      sourceblock->GetDiskFile()->Close();
+    }
+
+    // A block of zeros adds nothing to the recovery data, so the backend
+    // needn't be given it
+    if (bufferhole[bufferindex] || DataBlock::IsZero(inputbuffer, blocklength))
+    {
+      std::promise<void> stub;
+      bufferavail[bufferindex] = stub.get_future();
+      stub.set_value();
+    }
+    else
+    {
+      // Wait for ParPar backend to be ready, if busy
+      {
+        StageTimer timer(statistics, Statistics::stBackendWait);
+        ChunkWaitTimer wait(chunksizer, ChunkSizer::wtCompute);
+        parpar.waitForAdd();
+      }
+      // Send block to backend
+      StageTimer timer(statistics, Statistics::stBackendAdd, blocklength);
+      bufferavail[bufferindex] = parpar.addInput(inputbuffer, blocklength, inputblock);
+    }
 
     if (deferhashcomputation)
     {
       assert(blockoffset == 0 && blocklength == blocksize);
       assert(sourcefile != sourcefiles.end());
 
+      TraceScope trace("hashing");
       (*sourcefile)->UpdateHashes(sourceindex, inputbuffer, blocklength);
     }
 
-    if (noiselevel > nlQuiet)
-      progress.Add(blocklength);
+    progress.Add(blocklength);
 
     // Work out which source file the next block belongs to
     if (++sourceindex >= (*sourcefile)->BlockCount())
@@ -839,12 +1017,10 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength, ProgressMeter
   }
 
   // Flush backend
-  parpar.endInput().get();
-
-  // Close the last file
-  if (lastopenfile != NULL)
   {
-    lastopenfile->Close();
+    StageTimer timer(statistics, Statistics::stBackendWait);
+    ChunkWaitTimer wait(chunksizer, ChunkSizer::wtCompute);
+    parpar.endInput().get();
   }
 
   if (noiselevel > nlQuiet)
@@ -852,34 +1028,133 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength, ProgressMeter
 
   if (recoveryblockcount > 0)
   {
-    // For output, we only need two transfer buffers
-    std::future<bool> outbufavail[2];
-    // Prepare first output
-    outbufavail[0] = parpar.getOutput(0, transferbuffer);
-
-    // For each output block
-    for (u32 outputblock=0; outputblock<recoveryblockcount;outputblock++)
+    // Output blocks are fetched into the transfer buffers in turn, and
+    // written out from there a run at a time, a run being blocks that go to
+    // the same recovery file (in which they are in order of offset). In a
+    // single pass the packets are then complete, so each one's header is
+    // written along with its data, and packets which follow each other in
+    // the file are written with a single vectored write. A buffer can be
+    // reused once the write of its block has finished.
+    FutureList<bool> outbufavail(transferbuffercount);
+    struct PendingWrite
+    {
+      IOQueue::Ticket ticket;
+      u32             block;  // The first block in the write
+    };
+    std::deque<PendingWrite> pendingwrites;
+    std::vector<DiskFile::WriteBuffer> parts;
+    bool wholepackets = blockoffset == 0 && blocklength == blocksize;
+    // When writes are asynchronous, a run takes no more than half of the
+    // buffers, so that the next can be fetched whilst it is being written
+    u32 maxrun = ioqueue.IsAsync() ? std::max(transferbuffercount / 2, 1U) : transferbuffercount;
+    u32 fetchblock = 0; // The next output block to fetch
+
+    // For each run of output blocks
+    u32 outputblock = 0;
+    while (outputblock < recoveryblockcount)
     {
-      // Prepare next output
-      u32 nextoutputblock = outputblock + 1;
-      if (nextoutputblock < recoveryblockcount)
+      DiskFile *recoveryfile = recoverypackets[outputblock].GetDataBlock()->GetDiskFile();
+      u32 runend = outputblock + 1;
+      while (runend < recoveryblockcount && runend - outputblock < maxrun &&
+             recoverypackets[runend].GetDataBlock()->GetDiskFile() == recoveryfile)
+        ++runend;
+
+      // Prepare the outputs of this run, and beyond if there are buffers free
+      while (fetchblock < recoveryblockcount && fetchblock < outputblock + transferbuffercount)
       {
-        void *nextoutputbuffer = (char*)transferbuffer + chunksize * (nextoutputblock & 1);
-        outbufavail[nextoutputblock & 1] = parpar.getOutput(nextoutputblock, nextoutputbuffer);
+        // Whatever was last in the buffer must have been written
+        u32 fetchbuffer = fetchblock % transferbuffercount;
+        if (fetchblock >= transferbuffercount)
+        {
+          u32 previous = fetchblock - transferbuffercount;
+          if (fetchblock >= runend && !pendingwrites.empty() && pendingwrites.front().block <= previous &&
+              !ioqueue.IsDone(pendingwrites.front().ticket))
+            break;
+          StageTimer timer(statistics, Statistics::stWriting);
+          ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
+          while (!pendingwrites.empty() && pendingwrites.front().block <= previous)
+          {
+            if (!ioqueue.Wait(pendingwrites.front().ticket))
+              return false;
+            pendingwrites.pop_front();
+          }
+        }
+
+        StageTimer timer(statistics, Statistics::stOutput);
+        void *fetchptr = (char*)transferbuffer + chunksize * fetchbuffer;
+        outbufavail[fetchbuffer] = parpar.getOutput(fetchblock, fetchptr);
+        ++fetchblock;
       }
 
-      // Wait for current buffer to be available
-      if (!outbufavail[outputblock & 1].get())
+      // Wait for the outputs of the run to be available
       {
-        serr << "Internal checksum failure in recovery packet " << recoverypackets[outputblock].Exponent() << std::endl;
-        return false;
+        StageTimer timer(statistics, Statistics::stOutput, (u64)(runend - outputblock) * blocklength);
+        ChunkWaitTimer wait(chunksizer, ChunkSizer::wtCompute);
+        for (u32 block = outputblock; block < runend; block++)
+        {
+          if (!outbufavail[block % transferbuffercount].get())
+          {
+            serr << "Internal checksum failure in recovery packet " << recoverypackets[block].Exponent() << std::endl;
+            return false;
+          }
+        }
       }
-      
-      // Write the data to the recovery packet
-      void *outputbuffer = (char*)transferbuffer + chunksize * (outputblock & 1);
-      if (!recoverypackets[outputblock].WriteData(blockoffset, blocklength, outputbuffer))
+
+      // Write the data to the recovery packets
+      StageTimer timer(statistics, Statistics::stWriting, (u64)(runend - outputblock) * blocklength);
+      if (wholepackets && !recoveryfile->IsDirect())
+      {
+        // Complete packets which are next to each other go in one write;
+        // the gaps are where the critical packets go
+        u32 first = outputblock;
+        for (u32 block = outputblock; block < runend; block++)
+        {
+          RecoveryPacket &recoverypacket = recoverypackets[block];
+          void *outputbuffer = (char*)transferbuffer + chunksize * (block % transferbuffercount);
+          DiskFile::WriteBuffer packetparts[2];
+          recoverypacket.FinishPacket(outputbuffer, packetparts);
+          parts.push_back(packetparts[0]);
+          parts.push_back(packetparts[1]);
+
+          if (block+1 == runend || recoverypackets[block+1].Offset() != recoverypacket.Offset() + recoverypacket.PacketLength())
+          {
+            PendingWrite pending = {ioqueue.WriteV(recoveryfile, recoverypackets[first].Offset(), parts.data(), parts.size()), first};
+            pendingwrites.push_back(pending);
+            parts.clear();
+            first = block+1;
+          }
+        }
+      }
+      else
+      {
+        for (u32 block = outputblock; block < runend; block++)
+        {
+          void *outputbuffer = (char*)transferbuffer + chunksize * (block % transferbuffercount);
+          PendingWrite pending = {recoverypackets[block].QueueWriteData(ioqueue, blockoffset, blocklength, outputbuffer), block};
+          pendingwrites.push_back(pending);
+        }
+      }
+      ioqueue.Submit();
+
+      outputblock = runend;
+    }
+
+    // Wait for all writes to complete
+    {
+      StageTimer timer(statistics, Statistics::stWriting);
+      ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
+      if (!ioqueue.WaitAll())
         return false;
     }
+
+    // Get this pass's data on its way to disk, so that it can be dropped
+    // from the cache during the next
+    for (std::vector<DiskFile>::iterator recoveryfile = recoveryfiles.begin();
+         recoveryfile != recoveryfiles.end();
+         ++recoveryfile)
+    {
+      recoveryfile->FlushBehind(false);
+    }
   }
 
   if (noiselevel > nlQuiet)
@@ -888,6 +1163,29 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength, ProgressMeter
   return true;
 }
 
+// Note the backend's counters in the statistics, once processing is done
+void Par2Creator::RecordBackendStatistics(unsigned batchesstarted)
+{
+  if (!statistics)
+    return;
+
+  u64 idleevents = 0;
+#ifdef DEBUG_STAT_THREAD_EMPTY
+  idleevents = parparcpu.getWorkerIdleCount();
+#endif
+  statistics->SetBackend(parparcpu.getMethodName(), parparcpu.getNumThreads(), parparcpu.getBatchesStarted() - batchesstarted, idleevents);
+}
+
+// Report the most memory that was in use at once, against the limit
+void Par2Creator::ReportMemory(void)
+{
+  if (noiselevel >= nlDebug)
+    sout << "[DEBUG] Peak memory use: " << memorybudget.Peak() << " of " << memorybudget.Limit() << " bytes" << std::endl;
+
+  if (statistics)
+    statistics->SetMemory(memorybudget.Limit(), memorybudget.Peak());
+}
+
 // Finish computation of the recovery packets and write the headers to disk.
 bool Par2Creator::WriteRecoveryPacketHeaders(void)
 {
@@ -945,19 +1243,91 @@ bool Par2Creator::FinishCriticalPackets(void)
 // Write all other critical packets to disk.
 bool Par2Creator::WriteCriticalPackets(void)
 {
-  std::list<CriticalPacketEntry>::const_iterator packetentry = criticalpacketentries.begin();
+  StageTimer timer(statistics, Statistics::stCritical);
+
+  // Every recovery file holds copies of the same packets, so rather than
+  // writing each copy separately, the packets are laid out once in memory:
+  // in their sorted order (which is the order in which they are allocated
+  // to the files, round and round), followed by the creator packet (which
+  // ends every file). Packets next to each other in a file then mostly come
+  // from next to each other in memory.
+  std::map<const CriticalPacket*, size_t> packetposition;
+  size_t packetslength = 0;
+  for (std::list<CriticalPacket*>::const_iterator criticalpacket = criticalpackets.begin();
+       criticalpacket != criticalpackets.end();
+       ++criticalpacket)
+  {
+    packetposition[*criticalpacket] = packetslength;
+    packetslength += (*criticalpacket)->PacketLength();
+  }
+  packetposition[creatorpacket] = packetslength;
+  packetslength += creatorpacket->PacketLength();
 
-  // For each critical packet
-  while (packetentry != criticalpacketentries.end())
+  std::vector<u8> packets(packetslength);
+  for (std::map<const CriticalPacket*, size_t>::const_iterator packet = packetposition.begin();
+       packet != packetposition.end();
+       ++packet)
   {
-    // Write it to disk
-    if (!packetentry->WritePacket())
-      return false;
+    memcpy(&packets[packet->second], packet->first->PacketData(), packet->first->PacketLength());
+  }
 
-    ++packetentry;
+  // Work out the writes for each recovery file. Packets which are next to
+  // each other in the file are written with one vectored write, in which
+  // packets next to each other in memory are a single buffer.
+  struct PacketRun
+  {
+    u64 offset;
+    u64 end;
+    std::vector<DiskFile::WriteBuffer> buffers;
+  };
+  typedef std::pair<DiskFile*, std::vector<PacketRun> > FileRuns;
+  std::vector<FileRuns> fileruns;
+
+  for (std::list<CriticalPacketEntry>::const_iterator packetentry = criticalpacketentries.begin();
+       packetentry != criticalpacketentries.end();
+       ++packetentry)
+  {
+    // The entries for each file are together, and in order of offset
+    if (fileruns.empty() || fileruns.back().first != packetentry->GetDiskFile())
+      fileruns.push_back(FileRuns(packetentry->GetDiskFile(), std::vector<PacketRun>()));
+    std::vector<PacketRun> &runs = fileruns.back().second;
+
+    if (runs.empty() || runs.back().end != packetentry->Offset())
+    {
+      PacketRun run;
+      run.offset = run.end = packetentry->Offset();
+      runs.push_back(run);
+    }
+    PacketRun &run = runs.back();
+
+    const u8 *packet = &packets[packetposition[packetentry->Packet()]];
+    size_t length = (size_t)packetentry->PacketLength();
+    if (!run.buffers.empty() && (const u8*)run.buffers.back().buffer + run.buffers.back().length == packet)
+    {
+      run.buffers.back().length += length;
+    }
+    else
+    {
+      DiskFile::WriteBuffer buffer = {packet, length};
+      run.buffers.push_back(buffer);
+    }
+    run.end += length;
   }
 
-  return true;
+  // Write the files in parallel, as far as the device they're on allows
+  u32 threads = DiskFile::GetDeviceStreamLimit(DiskFile::GetDeviceId(recoveryfiles.front().FileName(), fileaccess.provider), GetFileThreads());
+  std::atomic<bool> success(true);
+  foreach_parallel<FileRuns>(fileruns, threads, [&success](const FileRuns &filerun) {
+    for (std::vector<PacketRun>::const_iterator run = filerun.second.begin();
+         run != filerun.second.end() && success;
+         ++run)
+    {
+      if (!filerun.first->WriteV(run->offset, run->buffers.data(), run->buffers.size()))
+        success = false;
+    }
+  });
+
+  return success;
 }
 
 // Close all files.
@@ -976,6 +1346,7 @@ bool Par2Creator::CloseFiles(void)
        recoveryfile != recoveryfiles.end();
        ++recoveryfile)
   {
+    recoveryfile->FlushBehind(true);
     recoveryfile->Close();
   }
 
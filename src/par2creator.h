@@ -45,9 +45,24 @@ public:
 		 const u32 firstblock,
 		 const Scheme recoveryfilescheme,
 		 const u32 recoveryfilecount,
-		 const u32 recoveryblockcount
+		 const u32 recoveryblockcount,
+		 const bool directio,
+		 const CachePolicy cachepolicy
 		 );
 
+  // Report progress to listener rather than as text (or as text again, if 0)
+  void SetProgressListener(ProgressListener *listener) {progresslistener = listener ? listener : &textprogress;}
+
+  // Record how long each stage takes in statistics (or stop, if 0)
+  void SetStatistics(Statistics *_statistics) {statistics = _statistics;}
+
+  // Access the files through provider rather than the file system (or the
+  // file system again, if 0). See FileAccess for how long it must live.
+  void SetFileProvider(FileProvider *provider) {fileaccess.provider = provider;}
+
+  // Report the most memory that was in use at once, against the limit
+  void ReportMemory(void);
+
 protected:
   // Steps in the creation process:
 
@@ -58,8 +73,12 @@ protected:
   // specified on the command line
   bool ComputeBlockCount(const std::vector<std::string> &extrafiles);
 
-  // Determine how much recovery data can be computed on one pass
-  bool CalculateProcessBlockSize(size_t memorylimit);
+  // Account for the memory the source files will need, whatever the limit
+  void ChargeSourceFiles(const std::vector<std::string> &extrafiles);
+
+  // Determine how many files can be hashed at once, and how much recovery
+  // data can be computed on one pass, within the memory budget
+  bool CalculateProcessBlockSize(void);
 
   // Open all of the source files, compute the Hashes and CRC values, and store
   // the results in the file verification and file description packets.
@@ -83,6 +102,10 @@ protected:
   // Read source data, process it through the RS matrix and write it to disk.
   bool ProcessData(u64 blockoffset, size_t blocklength, ProgressMeter<u64> &progress);
 
+  // Note the backend's counters in the statistics, once processing is done
+  // (batchesstarted being how many batches it had started beforehand)
+  void RecordBackendStatistics(unsigned batchesstarted);
+
   // Finish computation of the recovery packets and write the headers to disk.
   bool WriteRecoveryPacketHeaders(void);
 
@@ -107,13 +130,29 @@ protected:
 
   const NoiseLevel noiselevel; // How noisy we should be
 
+  TextProgressListener textprogress;
+  ProgressListener *progresslistener; // Where progress is reported
+  Statistics *statistics;             // Where stage timings are recorded, or 0
+
+  MemoryBudget memorybudget;          // What memory is used, against the limit
+  size_t hashingmemory;               // Reserved for hashing the source files
+  size_t processingmemory;            // Reserved for processing a chunk at a time
+
+  CachedFileSet cachedfiles;          // Files this left in the handle cache (outlives every DiskFile member)
+  FileAccess fileaccess;              // How the files are accessed
+
   static u32 filethreads;      // Number of threads for file processing
 
   u64 blocksize;      // The size of each block.
   size_t chunksize;   // How much of each block will be processed at a
                       // time (due to memory constraints).
+  ChunkSizer chunksizer; // How much of each block is processed on each
+                         // pass (no more than chunksize).
+
+  void *transferbuffer;  // chunksize * transferbuffercount
+  u32 transferbuffercount;
 
-  void *transferbuffer;  // chunksize * num_transfer_buffers
+  IOQueue ioqueue;       // Queue for reading and writing DataBlocks
 
   u32 sourcefilecount;   // Number of source files for which recovery data will be computed.
   u32 sourceblockcount;  // Total number of data blocks that the source files will be
@@ -53,11 +53,11 @@ Par2CreatorSourceFile::~Par2CreatorSourceFile(void)
 // 16k of the file, and then compute the FileId and store the results
 // in a file description packet and a file verification packet.
 
-bool Par2CreatorSourceFile::Open(NoiseLevel noiselevel, std::ostream &sout, std::ostream &serr, const std::string &extrafile, u64 blocksize, bool deferhashcomputation, std::string basepath, MTProgressMeter<u64> &progress, std::mutex &output_lock)
+bool Par2CreatorSourceFile::Open(NoiseLevel noiselevel, std::ostream &sout, std::ostream &serr, const std::string &extrafile, u64 blocksize, bool deferhashcomputation, std::string basepath, MTProgressMeter<u64> &progress, std::mutex &output_lock, const FileAccess &access)
 {
   // Get the filename and filesize
   diskfilename = extrafile;
-  filesize = DiskFile::GetFileSize(extrafile);
+  filesize = DiskFile::GetFileSize(extrafile, access.provider);
 
   // Work out how many blocks the file will be sliced into
   blockcount = (u32)((filesize + blocksize-1) / blocksize);
@@ -75,7 +75,7 @@ bool Par2CreatorSourceFile::Open(NoiseLevel noiselevel, std::ostream &sout, std:
   verificationpacket->Create(blockcount);
 
   // Create the diskfile object
-  diskfile  = new DiskFile(sout, serr, output_lock);
+  diskfile  = new DiskFile(sout, serr, output_lock, access);
 
   // Open the source file
   if (!diskfile->Open(diskfilename, filesize))
@@ -136,13 +136,21 @@ bool Par2CreatorSourceFile::Open(NoiseLevel noiselevel, std::ostream &sout, std:
       // Work out how much we can read
       size_t want = (size_t)std::min(filesize-offset, (u64)buffersize);
 
-      // Read some data from the file into the buffer
-      if (!diskfile->Read(offset, buffer, want))
+      // Read some data from the file into the buffer (unless it's a hole
+      // in a sparse file, which needn't be read to know it's all zeros)
+      if (diskfile->IsHole(offset, want))
+      {
+        memset(buffer, 0, want);
+      }
+      else if (!diskfile->Read(offset, buffer, want))
       {
         diskfile->Close();
         delete [] buffer;
         return false;
       }
+      // Have the OS read ahead, and forget what has been read
+      diskfile->WillNeed(offset + want, want);
+      diskfile->DontNeed(offset, want);
 
       // Whilst we haven't passed the 16k boundary, compute the 16k hash
       if (offset < 16384)
@@ -192,8 +200,7 @@ bool Par2CreatorSourceFile::Open(NoiseLevel noiselevel, std::ostream &sout, std:
         }
       }
 
-      if (noiselevel > nlQuiet)
-        progress.Add(want);
+      progress.Add(want);
 
       offset += want;
     }
@@ -38,6 +38,11 @@ Par2Repairer::Par2Repairer(std::ostream &sout, std::ostream &serr, const NoiseLe
 : sout(sout)
 , serr(serr)
 , noiselevel(noiselevel)
+, textprogress(sout, output_lock, noiselevel)
+, progresslistener(&textprogress)
+, statistics(0)
+, memorybudget()
+, processingmemory(0)
 , searchpath()
 , basepath()
 , setid()
@@ -60,6 +65,8 @@ Par2Repairer::Par2Repairer(std::ostream &sout, std::ostream &serr, const NoiseLe
 {
   setup_hasher();
 
+  fileaccess.cachedfiles = &cachedfiles;
+
   skipdata = false;
   skipleaway = 0;
 
@@ -84,11 +91,19 @@ Par2Repairer::Par2Repairer(std::ostream &sout, std::ostream &serr, const NoiseLe
   missingfilecount = 0;
 
   transferbuffer = 0;
+  transferbuffercount = NUM_TRANSFER_BUFFERS;
+  copiedblockcount = 0;
+
+  parparchunksize = 0;
+  parparinputbatch = 0;
+  parparslices = 0;
 }
 
 Par2Repairer::~Par2Repairer(void)
 {
-  delete [] (u8*)transferbuffer;
+  // Queued requests may still reference the transfer buffer
+  ioqueue.Close();
+  ALIGN_FREE(transferbuffer);
 
   parpar.deinit();
 
@@ -124,10 +139,15 @@ Result Par2Repairer::Process(
 			     const bool purgefiles,
 			     const bool renameonly,
 			     const bool _skipdata,
-			     const u64 _skipleaway
+			     const u64 _skipleaway,
+			     const bool directio,
+			     const CachePolicy cachepolicy
 			     )
 {
   filethreads = _filethreads;
+  memorybudget.SetLimit(memorylimit);
+  fileaccess.directio = directio;
+  fileaccess.cachepolicy = cachepolicy;
 
   // Should we skip data whilst scanning files
   skipdata = _skipdata;
@@ -139,6 +159,61 @@ Result Par2Repairer::Process(
   basepath = _basepath;
   std::vector<std::string> extrafiles = _extrafiles;
 
+  // Load the packets, and prepare to verify the source files
+  Result result = LoadRecoverySet(parfilename, extrafiles);
+  if (result != eSuccess)
+    return result;
+
+  // Attempt to verify all of the source files
+  if (!VerifySourceFiles(basepath, extrafiles))
+    return eFileIOError;
+
+  if (completefilecount < mainpacket->RecoverableFileCount())
+  {
+    // Scan any extra files specified on the command line
+    if (!VerifyExtraFiles(extrafiles, basepath, renameonly))
+      return eLogicError;
+  }
+
+  // Find out how much data we have found
+  UpdateVerificationResults();
+
+  if (noiselevel > nlSilent)
+    sout << '\n';
+
+  // Check the verification results and report the results
+  if (!CheckVerificationResults())
+    return eRepairNotPossible;
+
+  // Are any of the files incomplete
+  if (completefilecount < mainpacket->RecoverableFileCount())
+  {
+    // Do we want to carry out a repair
+    if (dorepair)
+    {
+      result = Repair(memorylimit, nthreads);
+      if (result != eSuccess)
+        return result;
+    }
+    else
+    {
+      return eRepairPossible;
+    }
+  }
+
+  if (purgefiles == true)
+  {
+    RemoveBackupFiles();
+    RemoveParFiles();
+  }
+
+  return eSuccess;
+}
+
+// Load the packets from the main PAR2 file, and from any others that can be
+// found, and prepare to verify the source files against them
+Result Par2Repairer::LoadRecoverySet(const std::string &parfilename, const std::vector<std::string> &extrafiles)
+{
   // Determine the searchpath from the location of the main PAR2 file
   std::string name;
   DiskFile::SplitFilename(parfilename, searchpath, name);
@@ -184,164 +259,200 @@ Result Par2Repairer::Process(
   if (!ComputeWindowTable())
     return eLogicError;
 
-  // Attempt to verify all of the source files
-  if (!VerifySourceFiles(basepath, extrafiles))
-    return eFileIOError;
-
-  if (completefilecount < mainpacket->RecoverableFileCount())
-  {
-    // Scan any extra files specified on the command line
-    if (!VerifyExtraFiles(extrafiles, basepath, renameonly))
-      return eLogicError;
-  }
+  // Account for the memory used so far, and see how many files can be
+  // scanned at once
+  if (!ChargeRecoverySet())
+    return eMemoryError;
 
-  // Find out how much data we have found
-  UpdateVerificationResults();
+  return eSuccess;
+}
 
+// Repair the damaged and missing files, once verification has found enough
+// data to do so
+Result Par2Repairer::Repair(const size_t memorylimit, const u32 nthreads)
+{
   if (noiselevel > nlSilent)
     sout << '\n';
 
-  // Check the verification results and report the results
-  if (!CheckVerificationResults())
-    return eRepairNotPossible;
+  // Forget the files created by any previous repair
+  verifylist.clear();
+  for (std::vector<DataBlock>::iterator tb = targetblocks.begin(); tb != targetblocks.end(); ++tb)
+    tb->ClearLocation();
 
-  // Are any of the files incomplete
+  // Rename any damaged or missnamed target files.
+  if (!RenameTargetFiles())
+    return eFileIOError;
+
+  // Are we still missing any files
   if (completefilecount < mainpacket->RecoverableFileCount())
   {
-    // Do we want to carry out a repair
-    if (dorepair)
-    {
-      if (noiselevel > nlSilent)
-        sout << '\n';
+    // Work out which data blocks are available, which need to be copied
+    // directly to the output, and which need to be recreated.
+    AssignDataBlocks();
+
+    // Allocate memory buffers for reading and writing data to disk.
+    memorybudget.SetLimit(memorylimit);
+    if (!AllocateBuffers())
+      return eMemoryError;
+
+    // The matrix is solved, and the backend run, on threads of ParPar's own,
+    // outside the shared thread pool: as many as -t asks for, or one per
+    // hardware thread
+    rs.setNumThreads(ThreadPool::Instance().Limit(nthreads));
+
+    // Compute the appropriate Reed Solomon matrix in the background, as
+    // the target files can be created, and available blocks copied to
+    // them, whilst this is happening. It gets a thread of its own rather
+    // than a task on the shared pool, where it could be queued behind the
+    // per-file work of this or another operation, holding up the repair.
+    std::future<bool> rssolved = std::async(std::launch::async, [this]() {
+      return ComputeRSmatrix();
+    });
 
-      // Rename any damaged or missnamed target files.
-      if (!RenameTargetFiles())
-        return eFileIOError;
+    // Work out which files are being repaired, create them, and allocate
+    // target DataBlocks to them, and remember them for later verification.
+    if (!CreateTargetFiles())
+    {
+      rssolved.wait();
+      DeleteIncompleteTargetFiles();
+      return eFileIOError;
+    }
 
-      // Are we still missing any files
-      if (completefilecount < mainpacket->RecoverableFileCount())
-      {
-        // Work out which files are being repaired, create them, and allocate
-        // target DataBlocks to them, and remember them for later verification.
-        if (!CreateTargetFiles())
-          return eFileIOError;
+    // Copy blocks to the target files until the RS matrix is ready
+    if (!CopyBlocksWhileSolving(rssolved))
+    {
+      rssolved.wait();
+      DeleteIncompleteTargetFiles();
+      return eFileIOError;
+    }
 
-        if (nthreads != 0)
-          rs.setNumThreads(nthreads);
+    if (!rssolved.get())
+    {
+      // Delete all of the partly reconstructed files
+      DeleteIncompleteTargetFiles();
+      return eFileIOError;
+    }
 
-        // Work out which data blocks are available, which need to be copied
-        // directly to the output, and which need to be recreated, and compute
-        // the appropriate Reed Solomon matrix.
-        if (!ComputeRSmatrix())
-        {
-          // Delete all of the partly reconstructed files
-          DeleteIncompleteTargetFiles();
-          return eFileIOError;
-        }
+    if (noiselevel >= nlDebug)
+      sout << "[DEBUG] Blocks copied whilst computing RS matrix: " << copiedblockcount << std::endl;
 
-        if (noiselevel > nlSilent)
-          sout << '\n';
+    if (noiselevel > nlSilent)
+      sout << '\n';
 
-        // Allocate memory buffers for reading and writing data to disk.
-        if (!AllocateBuffers(memorylimit))
-        {
-          // Delete all of the partly reconstructed files
-          DeleteIncompleteTargetFiles();
-          return eMemoryError;
-        }
+    // If there aren't many input blocks, restrict the submission batch size
+    u32 inputbatch = 0;
+    if (sourceblockcount < NUM_PARPAR_BUFFERS*2)
+      inputbatch = (sourceblockcount + 1) / 2;
 
-        // Init ParPar backend
-        if (!parpar.init(chunksize, {{&parparcpu, 0, (size_t)chunksize}}))
-        {
-          DeleteIncompleteTargetFiles();
-          return eLogicError;
-        }
-        if (nthreads != 0)
-          parparcpu.setNumThreads(nthreads);
+    // Init ParPar backend, unless it's still set up from a previous repair
+    // in a way which suits this one
+    if (parparchunksize != chunksize || parparinputbatch != inputbatch || parparslices < missingblockcount)
+    {
+      parparchunksize = 0;
+      if (!parpar.init(chunksize, {{&parparcpu, 0, (size_t)chunksize}}))
+      {
+        DeleteIncompleteTargetFiles();
+        return eLogicError;
+      }
+      parparcpu.setNumThreads(ThreadPool::Instance().Limit(nthreads));
 
-        // If there aren't many input blocks, restrict the submission batch size
-        u32 inputbatch = 0;
-        if (sourceblockcount < NUM_PARPAR_BUFFERS*2)
-          inputbatch = (sourceblockcount + 1) / 2;
+      if (!parparcpu.init(GF16_AUTO, inputbatch) || !parpar.setRecoverySlices(missingblockcount))
+      {
+        DeleteIncompleteTargetFiles();
+        return eMemoryError;
+      }
 
-        if (!parparcpu.init(GF16_AUTO, inputbatch) || !parpar.setRecoverySlices(missingblockcount))
-        {
-          DeleteIncompleteTargetFiles();
-          return eMemoryError;
-        }
+      parparchunksize = chunksize;
+      parparinputbatch = inputbatch;
+      parparslices = missingblockcount;
+    }
+    else
+    {
+      parparcpu.setNumThreads(ThreadPool::Instance().Limit(nthreads));
 
-        if (noiselevel >= nlNoisy)
-        {
-          sout << "Multiply method: " << parparcpu.getMethodName() << '\n';
-          if (noiselevel >= nlDebug)
-          {
-            sout << "[DEBUG] Compute tile size: " << parparcpu.getChunkLen()
-              << "\n[DEBUG] Compute block grouping: " << parparcpu.getInputBatchSize() << '\n';
-          }
-          sout << std::endl;
-        }
+      if (!parpar.setRecoverySlices(missingblockcount))
+      {
+        DeleteIncompleteTargetFiles();
+        return eMemoryError;
+      }
+    }
 
-        // Set the total amount of data to be processed.
-        ProgressMeter<u64> progress(sout, missingblockcount > 0 ? "Repairing: " : "Processing: ", blocksize * sourceblockcount);
+    if (noiselevel >= nlNoisy)
+    {
+      sout << "Multiply method: " << parparcpu.getMethodName() << '\n';
+      if (noiselevel >= nlDebug)
+      {
+        sout << "[DEBUG] Compute tile size: " << parparcpu.getChunkLen()
+          << "\n[DEBUG] Compute block grouping: " << parparcpu.getInputBatchSize() << '\n';
+      }
+      sout << std::endl;
+    }
 
-        // Start at an offset of 0 within a block.
-        u64 blockoffset = 0;
-        while (blockoffset < blocksize) // Continue until the end of the block.
-        {
-          // Work out how much data to process this time.
-          size_t blocklength = (size_t)std::min((u64)chunksize, blocksize-blockoffset);
-          if (!parpar.setCurrentSliceSize(blocklength))
-          {
-            DeleteIncompleteTargetFiles();
-            return eMemoryError;
-          }
+    // Set the total amount of data to be processed.
+    std::unique_ptr<ProgressMeter<u64>> progress(new ProgressMeter<u64>(*progresslistener, missingblockcount > 0 ? ppRepairing : ppProcessing, blocksize * sourceblockcount));
 
-          // Read source data, process it through the RS matrix and write it to disk.
-          if (!ProcessData(blockoffset, blocklength, progress))
-          {
-            // Delete all of the partly reconstructed files
-            DeleteIncompleteTargetFiles();
-            return eFileIOError;
-          }
+    // The backend may have been used by a previous repair
+    unsigned batchesstarted = parparcpu.getBatchesStarted();
+    {
+      StageTimer timer(statistics, Statistics::stProcessing, blocksize * sourceblockcount);
 
-          // Advance to the need offset within each block
-          blockoffset += blocklength;
+      // Start at an offset of 0 within a block.
+      u64 blockoffset = 0;
+      chunksizer.Start(blocksize, (size_t)chunksize, MIN_CHUNK_SIZE, fileaccess.directio);
+      while (blockoffset < blocksize) // Continue until the end of the block.
+      {
+        // Work out how much data to process this time.
+        size_t blocklength = chunksizer.Next(blockoffset);
+        if (!parpar.setCurrentSliceSize(blocklength))
+        {
+          DeleteIncompleteTargetFiles();
+          return eMemoryError;
         }
 
-        if (noiselevel > nlSilent)
-          sout << "\nVerifying repaired files:\n" << std::endl;
-
-        // Verify that all of the reconstructed target files are now correct
-        if (!VerifyTargetFiles(basepath))
+        // Read source data, process it through the RS matrix and write it to disk.
+        if (!ProcessData(blockoffset, blocklength, *progress))
         {
           // Delete all of the partly reconstructed files
           DeleteIncompleteTargetFiles();
           return eFileIOError;
         }
-      }
 
-      // Are all of the target files now complete?
-      if (completefilecount<mainpacket->RecoverableFileCount())
-      {
-        serr << "Repair Failed." << std::endl;
-        return eRepairFailed;
-      }
-      else
-      {
-        if (noiselevel > nlSilent)
-          sout << "\nRepair complete." << std::endl;
+        // Adapt the size of the next pass to how this one went
+        chunksizer.Finish(blocklength);
+        if (noiselevel >= nlDebug && blocklength < blocksize)
+          sout << "[DEBUG] Pass of " << blocklength << " bytes per block took " << chunksizer.PassTime()
+               << "s, waiting " << chunksizer.WaitTime(ChunkSizer::wtIO) << "s for I/O and "
+               << chunksizer.WaitTime(ChunkSizer::wtCompute) << "s for the backend" << std::endl;
+
+        // Advance to the need offset within each block
+        blockoffset += blocklength;
       }
     }
-    else
+    progress.reset(nullptr);
+    RecordBackendStatistics(batchesstarted);
+
+    if (noiselevel > nlSilent)
+      sout << "\nVerifying repaired files:\n" << std::endl;
+
+    // Verify that all of the reconstructed target files are now correct
+    if (!VerifyTargetFiles(basepath))
     {
-      return eRepairPossible;
+      // Delete all of the partly reconstructed files
+      DeleteIncompleteTargetFiles();
+      return eFileIOError;
     }
   }
 
-  if (purgefiles == true)
+  // Are all of the target files now complete?
+  if (completefilecount<mainpacket->RecoverableFileCount())
   {
-    RemoveBackupFiles();
-    RemoveParFiles();
+    serr << "Repair Failed." << std::endl;
+    return eRepairFailed;
+  }
+  else
+  {
+    if (noiselevel > nlSilent)
+      sout << "\nRepair complete." << std::endl;
   }
 
   return eSuccess;
@@ -356,7 +467,7 @@ bool Par2Repairer::LoadPacketsFromFile(std::string filename)
     return true;
   }
 
-  DiskFile *diskfile = new DiskFile(sout, serr, output_lock);
+  DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
 
   // Open the file
   if (!diskfile->Open(filename))
@@ -393,7 +504,8 @@ bool Par2Repairer::LoadPacketsFromFile(std::string filename)
     u8 *buffer = new u8[buffersize];
 
     // Progress indicator
-    ProgressMeter<u64> progress(sout, "Loading: ", filesize);
+    ProgressMeter<u64> progress(*progresslistener, ppLoading, filesize, filename);
+    StageTimer timer(statistics, Statistics::stLoading, filesize);
 
     // Start at the beginning of the file
     u64 offset = 0;
@@ -401,8 +513,7 @@ bool Par2Repairer::LoadPacketsFromFile(std::string filename)
     // Continue as long as there is at least enough for the packet header
     while (offset + sizeof(PACKET_HEADER) <= filesize)
     {
-      if (noiselevel > nlQuiet)
-        progress.Update(offset);
+      progress.Update(offset);
 
       // Attempt to read the next packet header
       PACKET_HEADER header;
@@ -551,8 +662,7 @@ bool Par2Repairer::LoadPacketsFromFile(std::string filename)
       // Advance to the next packet
       offset += header.length;
     }
-    if (noiselevel > nlQuiet)
-      progress.Update(offset);
+    progress.Update(offset);
 
     delete [] buffer;
   }
@@ -825,13 +935,13 @@ bool Par2Repairer::LoadPacketsFromOtherFiles(std::string filename)
   {
     std::string wildcard = name.empty() ? "*.par2" : name + ".*.par2";
     std::unique_ptr< std::list<std::string> > files(
-					DiskFile::FindFiles(path, wildcard, false)
+					DiskFile::FindFiles(path, wildcard, false, fileaccess.provider)
 					);
     par2list.splice(par2list.end(), *files);
 
     std::string wildcardu = name.empty() ? "*.PAR2" : name + ".*.PAR2";
     std::unique_ptr< std::list<std::string> > filesu(
-					 DiskFile::FindFiles(path, wildcardu, false)
+					 DiskFile::FindFiles(path, wildcardu, false, fileaccess.provider)
 					 );
     par2list.splice(par2list.end(), *filesu);
 
@@ -1006,7 +1116,7 @@ bool Par2Repairer::CreateSourceFileList(void)
       sourcefile->ComputeTargetFileName(sout, serr, noiselevel, basepath);
 
       // Need actual filesize on disk for mt-progress line
-      sourcefile->SetDiskFileSize();
+      sourcefile->SetDiskFileSize(fileaccess.provider);
     }
 
     sourcefiles.push_back(sourcefile);
@@ -1170,6 +1280,52 @@ bool Par2Repairer::ComputeWindowTable(void)
   return true;
 }
 
+// Account for the memory which the recovery set needs whatever the limit
+// is, and determine how many files can be scanned at once with what's left
+bool Par2Repairer::ChargeRecoverySet(void)
+{
+  size_t needed = (sourceblocks.size() + targetblocks.size()) * sizeof(DataBlock)
+                + recoverypacketmap.size() * (sizeof(RecoveryPacket) + 4 * sizeof(void*))
+                + verificationhashtable.MemoryUsed();
+  if (mainpacket)
+    needed += mainpacket->PacketLength();
+  if (creatorpacket)
+    needed += creatorpacket->PacketLength();
+  for (std::map<MD5Hash,Par2RepairerSourceFile*>::const_iterator sf = sourcefilemap.begin();
+       sf != sourcefilemap.end();
+       ++sf)
+  {
+    const Par2RepairerSourceFile *sourcefile = sf->second;
+    needed += sizeof(Par2RepairerSourceFile) + sizeof(DiskFile);
+    if (sourcefile->GetDescriptionPacket())
+      needed += sourcefile->GetDescriptionPacket()->PacketLength();
+    if (sourcefile->GetVerificationPacket())
+      needed += sourcefile->GetVerificationPacket()->PacketLength();
+  }
+  memorybudget.Charge(needed);
+
+  if (noiselevel >= nlDebug)
+    sout << "[DEBUG] Memory used by the recovery set: " << needed << " bytes" << std::endl;
+
+  // Each file scanned needs a buffer of two blocks, and a hasher
+  size_t scanmemory = (size_t)blocksize*2 + HASHER_MEMORY;
+  size_t available = memorybudget.Available();
+  if (available < scanmemory)
+  {
+    serr << "Not enough memory: " << memorybudget.Used() + scanmemory
+         << " bytes would be needed to scan files for data blocks." << std::endl;
+    return false;
+  }
+  if (available / scanmemory < filethreads)
+  {
+    if (noiselevel >= nlDebug)
+      sout << "[DEBUG] Scanning " << available / scanmemory << " files at once, rather than " << filethreads << ", to fit in memory" << std::endl;
+    filethreads = (u32)(available / scanmemory);
+  }
+
+  return true;
+}
+
 static bool SortSourceFilesByFileName(Par2RepairerSourceFile *low,
                                       Par2RepairerSourceFile *high)
 {
@@ -1207,9 +1363,13 @@ bool Par2Repairer::VerifySourceFiles(const std::string& basepath, std::vector<st
     Par2RepairerSourceFile *sourcefile = *sf;
     if (sourcefile)
     {
-      sortedfiles.push_back(sourcefile);
-      // Total filesizes for mt-progress line
-      mttotalsize += sourcefile->DiskFileSize();
+      // Skip any file which has already been verified
+      if (sourcefile->GetTargetFile() == 0)
+      {
+        sortedfiles.push_back(sourcefile);
+        // Total filesizes for mt-progress line
+        mttotalsize += sourcefile->DiskFileSize();
+      }
      }
     else
     {
@@ -1231,12 +1391,21 @@ bool Par2Repairer::VerifySourceFiles(const std::string& basepath, std::vector<st
   }
 
   std::sort(sortedfiles.begin(), sortedfiles.end(), SortSourceFilesByFileName);
-  MTProgressMeter<u64> progress(sout, "Scanning: ", mttotalsize, output_lock);
+  MTProgressMeter<u64> progress(*progresslistener, ppScanning, mttotalsize);
+  StageTimer timer(statistics, Statistics::stScanning, mttotalsize);
 
   std::mutex dfm_lock, xfiles_lock;
   
-  // Start verifying the files
-  foreach_parallel<Par2RepairerSourceFile*>(sortedfiles, Par2Repairer::GetFileThreads(), [&, this](Par2RepairerSourceFile* const& sortedfile) {
+  // Start verifying the files, largest first if verifying in parallel,
+  // and limiting how many are read from each device at once
+  DeviceIdCache devices(fileaccess.provider);
+  foreach_parallel_grouped<Par2RepairerSourceFile*>(sortedfiles, Par2Repairer::GetFileThreads(), [](Par2RepairerSourceFile* const& sortedfile) {
+    return sortedfile->DiskFileSize();
+  }, [&devices](Par2RepairerSourceFile* const& sortedfile) {
+    return devices.get(sortedfile->TargetFileName());
+  }, [](u64 device) {
+    return DiskFile::GetDeviceStreamLimit(device, Par2Repairer::GetFileThreads());
+  }, [&, this](Par2RepairerSourceFile* const& sortedfile) {
     // Do we have a source file
     Par2RepairerSourceFile *sourcefile = sortedfile;
 
@@ -1285,7 +1454,7 @@ bool Par2Repairer::VerifySourceFiles(const std::string& basepath, std::vector<st
     }
     else
     {
-      DiskFile *diskfile = new DiskFile(sout, serr, output_lock);
+      DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
 
       // Does the target file exist
       if (diskfile->Open(file))
@@ -1313,6 +1482,8 @@ bool Par2Repairer::VerifySourceFiles(const std::string& basepath, std::vector<st
         // The file does not exist.
         delete diskfile;
 
+        progresslistener->FileVerified(file, file, fvMissing, 0, sourcefile->BlockCount());
+
         if (noiselevel > nlSilent)
         {
           std::lock_guard<std::mutex> lock(output_lock);
@@ -1339,9 +1510,10 @@ bool Par2Repairer::VerifyExtraFiles(const std::vector<std::string> &extrafiles,
     // Total size of extra files for mt-progress line
     u64 mttotalextrasize = 0;
     for (size_t i=0; i<extrafiles.size(); ++i)
-      mttotalextrasize += DiskFile::GetFileSize(extrafiles[i]);
+      mttotalextrasize += DiskFile::GetFileSize(extrafiles[i], fileaccess.provider);
 
-    MTProgressMeter<u64> progress(sout, "Scanning: ", mttotalextrasize, output_lock);
+    MTProgressMeter<u64> progress(*progresslistener, ppScanning, mttotalextrasize);
+    StageTimer timer(statistics, Statistics::stScanning, mttotalextrasize);
 
     std::mutex dfm_lock;
     foreach_parallel<std::string>(extrafiles, Par2Repairer::GetFileThreads(), [&, this](const std::string& extrafile) {
@@ -1359,7 +1531,7 @@ bool Par2Repairer::VerifyExtraFiles(const std::vector<std::string> &extrafiles,
         dfm_lock.unlock();
         if (b)
         {
-          DiskFile *diskfile = new DiskFile(sout, serr, output_lock);
+          DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
 
           // Does the file exist
           if (!diskfile->Open(filename))
@@ -1397,6 +1569,8 @@ bool Par2Repairer::VerifyDataFile(DiskFile *diskfile, Par2RepairerSourceFile *so
   MD5Hash hashfull;    // The MD5 Hash of the whole file
   MD5Hash hash16k;     // The MD5 Hash of the files 16k of the file
 
+  TraceScope trace("scanning", diskfile->FileName());
+
   // Are there any files that can be verified at the block level
   if (blockverifiable)
   {
@@ -1425,6 +1599,8 @@ bool Par2Repairer::VerifyDataFile(DiskFile *diskfile, Par2RepairerSourceFile *so
       case ePartialMatch:
         {
           // We found some data.
+          progresslistener->FileVerified(diskfile->FileName(), sourcefile->TargetFileName(), fvDamaged,
+                                         count, sourcefile->BlockCount());
 
           // Return them.
           return true;
@@ -1433,6 +1609,8 @@ bool Par2Repairer::VerifyDataFile(DiskFile *diskfile, Par2RepairerSourceFile *so
       case eFullMatch:
         {
           // We found a perfect match.
+          progresslistener->FileVerified(diskfile->FileName(), sourcefile->TargetFileName(), fvComplete,
+                                         count, sourcefile->BlockCount());
 
           sourcefile->SetCompleteFile(diskfile);
 
@@ -1528,6 +1706,9 @@ bool Par2Repairer::VerifyDataFile(DiskFile *diskfile, Par2RepairerSourceFile *so
           std::lock_guard<std::mutex> lock(output_lock);
           sout << diskfile->FileName() << " is a perfect match for " << sourcefile->GetDescriptionPacket()->FileName() << std::endl;
         }
+        progresslistener->FileVerified(diskfile->FileName(), sourcefile->TargetFileName(), fvComplete,
+                                       sourcefile->BlockCount(), sourcefile->BlockCount());
+
         // Record that we have a perfect match for this source file
         sourcefile->SetCompleteFile(diskfile);
 
@@ -1560,6 +1741,8 @@ bool Par2Repairer::VerifyDataFile(DiskFile *diskfile, Par2RepairerSourceFile *so
     }
   }
 
+  progresslistener->FileVerified(diskfile->FileName(), std::string(), fvNoData, 0, 0);
+
   return true;
 }
 
@@ -1611,6 +1794,7 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
   }
 
   // Create the checksummer for the file and start reading from it
+  MemoryCharge charge(memorybudget, (size_t)blocksize*2 + HASHER_MEMORY);
   FileCheckSummer filechecksummer(diskfile, blocksize, windowtable);
   if (!filechecksummer.Start())
     return false;
@@ -1658,17 +1842,14 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
   // Whilst we have not reached the end of the file
   while (filechecksummer.Offset() < diskfile->FileSize())
   {
-    if (noiselevel > nlQuiet)
+    // Update progress indicator a block at a time
+    printprogress += filechecksummer.Offset() - oldoffset;
+    if (printprogress >= blocksize || filechecksummer.ShortBlock())
     {
-      // Update progress indicator
-      printprogress += filechecksummer.Offset() - oldoffset;
-      if (printprogress == blocksize || filechecksummer.ShortBlock())
-      {
-        progress.Add(printprogress);
-        printprogress = 0;
-      }
-      oldoffset = filechecksummer.Offset();
+      progress.Add(printprogress);
+      printprogress = 0;
     }
+    oldoffset = filechecksummer.Offset();
 
     // If we fail to find a match, it might be because it was a duplicate of a block
     // that we have already found.
@@ -1804,11 +1985,9 @@ bool Par2Repairer::ScanDataFile(DiskFile                *diskfile,    // [in]
     }
   }
 
-  if (noiselevel > nlQuiet)
-  {
-    if (filechecksummer.Offset() == diskfile->FileSize())
-      progress.Add(filechecksummer.Offset() - oldoffset);
-  }
+  if (filechecksummer.Offset() == diskfile->FileSize())
+    printprogress += filechecksummer.Offset() - oldoffset;
+  progress.Add(printprogress);
 
   if (lastmatchoffset < filechecksummer.Offset() && noiselevel > nlNormal)
   {
@@ -2086,6 +2265,8 @@ void Par2Repairer::UpdateVerificationResults(void)
 // Check the verification results and report the results
 bool Par2Repairer::CheckVerificationResults(void)
 {
+  progresslistener->VerificationResult(availableblockcount, missingblockcount, (u32)recoverypacketmap.size());
+
   // Is repair needed
   if (completefilecount < mainpacket->RecoverableFileCount() ||
       renamedfilecount > 0 ||
@@ -2244,7 +2425,7 @@ bool Par2Repairer::CreateTargetFiles(void)
     // If the file does not exist
     if (!sourcefile->GetTargetExists())
     {
-      DiskFile *targetfile = new DiskFile(sout, serr, output_lock);
+      DiskFile *targetfile = new DiskFile(sout, serr, output_lock, fileaccess);
       std::string filename = sourcefile->TargetFileName();
       u64 filesize = sourcefile->GetDescriptionPacket()->FileSize();
 
@@ -2291,9 +2472,8 @@ bool Par2Repairer::CreateTargetFiles(void)
 }
 
 // Work out which data blocks are available, which need to be copied
-// directly to the output, and which need to be recreated, and compute
-// the appropriate Reed Solomon matrix.
-bool Par2Repairer::ComputeRSmatrix(void)
+// directly to the output, and which need to be recreated.
+void Par2Repairer::AssignDataBlocks(void)
 {
   inputblocks.resize(sourceblockcount);   // The DataBlocks that will read from disk
   copyblocks.resize(availableblockcount); // Those DataBlocks which need to be copied
@@ -2304,7 +2484,6 @@ bool Par2Repairer::ComputeRSmatrix(void)
   std::vector<DataBlock*>::iterator outputblock = outputblocks.begin();
 
   // Build an array listing which source data blocks are present and which are missing
-  std::vector<bool> present;
   present.resize(sourceblockcount);
 
   std::vector<DataBlock>::iterator sourceblock  = sourceblocks.begin();
@@ -2346,11 +2525,22 @@ bool Par2Repairer::ComputeRSmatrix(void)
     ++targetblock;
     ++pres;
   }
+}
 
+// Compute the appropriate Reed Solomon matrix, and add the recovery blocks
+// it selected to the list of input blocks. This runs whilst target files are
+// created and blocks copied to them, so all output is made under output_lock.
+bool Par2Repairer::ComputeRSmatrix(void)
+{
   // If we need to, compute and solve the RS matrix
   if (missingblockcount == 0)
     return true;
 
+  StageTimer timer(statistics, Statistics::stMatrix);
+
+  // Recovery blocks are read after all of the available source blocks
+  std::vector<DataBlock*>::iterator inputblock = inputblocks.begin() + availableblockcount;
+
   // Create a list of available recovery exponents
   std::vector<u16> recindex;
   recindex.reserve(recoverypacketmap.size());
@@ -2359,49 +2549,72 @@ bool Par2Repairer::ComputeRSmatrix(void)
 
   // Set up progress display
   std::function<void(u16, u16)> progressfunc;
+  std::unique_ptr<ProgressMeter<u32>> construction;
   std::unique_ptr<ProgressMeter<u32>> progress;
   bool progressStarted = false;
   if (noiselevel > nlQuiet)
   {
+    std::lock_guard<std::mutex> lock(output_lock);
     sout << "Computing Reed Solomon matrix." << std::endl;
-    progressfunc = [&](u16 done, u16 total) {
-      if (done == 0)
+  }
+  progressfunc = [&](u16 done, u16 total) {
+    if (done == 0)
+    {
+      if (noiselevel > nlQuiet)
       {
-        if(progressStarted)
+        std::lock_guard<std::mutex> lock(output_lock);
+        if (progressStarted)
           sout << "Bad recovery block discarded and retrying RS matrix inversion." << std::endl;
-        else
+        else if (noiselevel >= nlNoisy)
         {
-          progressStarted = true;
-          if (noiselevel >= nlNoisy)
-          {
-            sout << "Construction accel: " << rs.getPointMulMethodName()
-              << "\nInversion method: " << Galois16Mul::methodToText((Galois16Methods)rs.regionMethod) << std::endl;
-          }
+          sout << "Construction accel: " << rs.getPointMulMethodName()
+            << "\nInversion method: " << Galois16Mul::methodToText((Galois16Methods)rs.regionMethod) << std::endl;
         }
-        sout << "Constructing: 0.0%\r" << std::flush;
-        progress.reset(new ProgressMeter<u32>(sout, "Solving: ", total));
-        return;
       }
-      if (done == 1)
+      progressStarted = true;
+      progress.reset(nullptr);
+      construction.reset(new ProgressMeter<u32>(*progresslistener, ppConstructing, 1));
+      return;
+    }
+    if (done == 1)
+    {
+      construction->Update(1);
+      construction.reset(nullptr);
+      if (noiselevel > nlQuiet)
+      {
+        std::lock_guard<std::mutex> lock(output_lock);
         sout << "Constructing: done." << std::endl;
-      
-      progress->Update(done-1);
-    };
-  }
+      }
+      progress.reset(new ProgressMeter<u32>(*progresslistener, ppSolving, total-1));
+    }
+
+    if (progress)
+      progress->Update(done);
+  };
 
   // Compute + solve RS matrix
   if (!rs.Compute(present, availableblockcount, recindex, progressfunc))
   {
+    std::lock_guard<std::mutex> lock(output_lock);
     serr << "RS computation error (this may be fixable with more recovery blocks)." << std::endl;
     return false;
   }
   progress.reset(nullptr);
 
   if (noiselevel > nlQuiet)
+  {
+    std::lock_guard<std::mutex> lock(output_lock);
     sout << "Solving: done." << std::endl;
 
+    // Recovery blocks which turned out not to be usable with the others
+    // were replaced by spare ones
+    for (u16 exponent : rs.getDiscarded())
+      sout << "Bad recovery block discarded (exponent " << exponent << ")." << std::endl;
+  }
+
   if (noiselevel >= nlDebug)
   {
+    std::lock_guard<std::mutex> lock(output_lock);
     for (unsigned int row=0; row<missingblockcount; row++)
     {
       bool lastrow = row==missingblockcount-1;
@@ -2435,31 +2648,75 @@ bool Par2Repairer::ComputeRSmatrix(void)
   return true;
 }
 
-// Allocate memory buffers for reading and writing data to disk.
-bool Par2Repairer::AllocateBuffers(size_t memorylimit)
+// Allocate memory buffers for reading and writing data to disk, choosing how
+// much of each block to process at a time from the memory budget.
+bool Par2Repairer::AllocateBuffers(void)
 {
+  // Use asynchronous I/O if available, so that more reads and writes can be
+  // kept in flight (this affects how many transfer buffers are needed)
+  if (missingblockcount > 0 && (ioqueue.IsAsync() || ioqueue.Init(NUM_QUEUED_TRANSFER_BUFFERS * 2)))
+    transferbuffercount = NUM_QUEUED_TRANSFER_BUFFERS;
+
+  // The buffers from any previous repair are about to be replaced
+  memorybudget.Release(processingmemory);
+  processingmemory = 0;
+
   // We use intermediary buffers to transfer data with, so include those in the limit calculation
-  u32 blockoverhead = NUM_TRANSFER_BUFFERS + std::min((u32)NUM_PARPAR_BUFFERS*2, sourceblockcount+1);
+  u32 blockoverhead = transferbuffercount + std::min((u32)NUM_PARPAR_BUFFERS*2, sourceblockcount+1);
+  size_t available = memorybudget.Available();
+
+  // The buffers are still held whilst the repaired files are verified, so
+  // leave room for scanning them (using no more than half of what's left)
+  size_t scanmemory = (size_t)blocksize*2 + HASHER_MEMORY;
+  if (filethreads > 1 && available / 2 / scanmemory < filethreads)
+    filethreads = (u32)std::max((size_t)1, available / 2 / scanmemory);
+  size_t verifymemory = scanmemory * std::max(filethreads, (u32)1);
+  available = available > verifymemory ? available - verifymemory : 0;
 
   // Would single pass processing use too much memory
-  if (blocksize * (missingblockcount + blockoverhead) > memorylimit)
+  if (blocksize * (missingblockcount + blockoverhead) > available)
   {
     // Pick a size that is small enough
-    chunksize = ~3 & (memorylimit / (missingblockcount + blockoverhead));
+    chunksize = ~3 & (available / (missingblockcount + blockoverhead));
   }
   else
   {
     chunksize = (size_t)blocksize;
   }
 
-  if (MAX_CHUNK_SIZE != 0 && chunksize > MAX_CHUNK_SIZE)
-    chunksize = MAX_CHUNK_SIZE;
+  // Passes through the blocks which are smaller than this may be chosen
+  // (by chunksizer), but never larger
+  if (chunksize > ChunkSizer::MaxSize())
+    chunksize = ChunkSizer::MaxSize();
+
+  // Keep each chunk of a block aligned, so that it can be read directly
+  if (fileaccess.directio && chunksize < blocksize && chunksize > DIRECT_IO_ALIGNMENT
+      && blocksize % DIRECT_IO_ALIGNMENT == 0)
+    chunksize -= chunksize % DIRECT_IO_ALIGNMENT;
+
+  size_t needed = (size_t)chunksize * (missingblockcount + blockoverhead);
+  if (chunksize == 0 || !memorybudget.Reserve(needed))
+  {
+    serr << "Not enough memory: " << memorybudget.Used() + 4 * (missingblockcount + blockoverhead)
+         << " bytes would be needed to repair the data." << std::endl;
+    return false;
+  }
+  processingmemory = needed;
 
   if (noiselevel >= nlDebug)
     sout << "[DEBUG] Process chunk size: " << chunksize << std::endl;
 
+  // Release the buffer from any previous repair
+  if (transferbuffer)
+  {
+    ioqueue.UnregisterBuffer();
+    ALIGN_FREE(transferbuffer);
+    transferbuffer = 0;
+  }
+
   // Allocate buffer
-  transferbuffer = new u8[(size_t)chunksize * NUM_TRANSFER_BUFFERS];
+  // Aligned, in case direct I/O is being used
+  ALIGN_ALLOC(transferbuffer, (size_t)chunksize * transferbuffercount, DIRECT_IO_ALIGNMENT);
 
   if (transferbuffer == NULL)
   {
@@ -2467,9 +2724,81 @@ bool Par2Repairer::AllocateBuffers(size_t memorylimit)
     return false;
   }
 
+  ioqueue.RegisterBuffer(transferbuffer, (size_t)chunksize * transferbuffercount);
+
   return true;
 }
 
+// Copy the available data blocks to the target files, for as long as the
+// RS matrix is still being computed. ProcessData will then skip copying the
+// blocks which have already been done here.
+bool Par2Repairer::CopyBlocksWhileSolving(const std::future<bool> &rssolved)
+{
+  copiedblockcount = 0;
+  if (missingblockcount == 0)
+    return true;
+
+  std::vector<DataBlock*>::iterator inputblock = inputblocks.begin();
+  std::vector<DataBlock*>::iterator copyblock  = copyblocks.begin();
+
+  DiskFile *lastopenfile = NULL;
+  bool success = true;
+
+  while (copyblock != copyblocks.end() &&
+         rssolved.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+  {
+    // Does this block need to be copied to the target file
+    if ((*copyblock)->IsSet())
+    {
+      // Are we reading from a new file?
+      if (lastopenfile != (*inputblock)->GetDiskFile())
+      {
+        // Close the last file
+        if (lastopenfile != NULL)
+        {
+          lastopenfile->Close();
+        }
+
+        // Open the new file
+        lastopenfile = (*inputblock)->GetDiskFile();
+        if (!lastopenfile->Open())
+        {
+          lastopenfile = NULL;
+          success = false;
+          break;
+        }
+      }
+
+      // Copy the whole block, leaving it to the OS if it can, otherwise a
+      // chunk at a time
+      size_t wrote;
+      if (!(*copyblock)->CopyData(**inputblock, 0, (size_t)blocksize, wrote))
+      {
+        for (u64 blockoffset = 0; blockoffset < blocksize && success; blockoffset += chunksize)
+        {
+          size_t blocklength = (size_t)std::min((u64)chunksize, blocksize-blockoffset);
+          success = (*inputblock)->ReadData(blockoffset, blocklength, transferbuffer)
+                 && (*copyblock)->WriteData(blockoffset, blocklength, transferbuffer, wrote);
+        }
+      }
+      if (!success)
+        break;
+    }
+
+    ++copyblock;
+    ++inputblock;
+    ++copiedblockcount;
+  }
+
+  // Close the last file
+  if (lastopenfile != NULL)
+  {
+    lastopenfile->Close();
+  }
+
+  return success;
+}
+
 // Read source data, process it through the RS matrix and write it to disk.
 bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength, ProgressMeter<u64> &progress)
 {
@@ -2484,16 +2813,25 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength, ProgressMete
   // Are there any blocks which need to be reconstructed
   if (missingblockcount > 0)
   {
-    // For tracking input buffer availability
-    std::future<void> bufferavail[NUM_TRANSFER_BUFFERS];
-    u32 bufferindex = NUM_TRANSFER_BUFFERS - 1;
+    // Each block is read into the next transfer buffer in turn. Reads are
+    // queued ahead of the block being processed, as far as buffers are free.
+    // A buffer is free once the backend has taken its data, and any copy
+    // of it to a target file has been written.
+    FutureList<void> bufferavail(transferbuffercount);
+    std::vector<IOQueue::Ticket> bufferread(transferbuffercount);
+    std::vector<IOQueue::Ticket> bufferwrite(transferbuffercount);
+    // Which buffers were left unread because the block is a hole in its file
+    std::vector<bool> bufferhole(transferbuffercount);
     // Set all input buffers to available
-    for (i32 i = 0; i < NUM_TRANSFER_BUFFERS; i++)
+    for (u32 i = 0; i < transferbuffercount; i++)
     {
       std::promise<void> stub;
       bufferavail[i] = stub.get_future();
       stub.set_value();
+      bufferwrite[i] = ioqueue.Completed();
     }
+    u32 inputcount = (u32)inputblocks.size();
+    u32 readindex = 0; // The next block to be read
 
     // Clear existing output data in backend
     parpar.discardOutput();
@@ -2504,65 +2842,136 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength, ProgressMete
     // For each input block
     while (inputblock != inputblocks.end())
     {
-      // Are we reading from a new file?
-      if (lastopenfile != (*inputblock)->GetDiskFile())
+      // Queue reads up to this block, and beyond if there are buffers free
+      while (readindex < inputcount && readindex < inputindex + transferbuffercount)
       {
-        // Close the last file
-        if (lastopenfile != NULL)
+        u32 readbuffer = readindex % transferbuffercount;
+        if (readindex > inputindex &&
+            (bufferavail[readbuffer].wait_for(std::chrono::seconds(0)) != std::future_status::ready ||
+             !ioqueue.IsDone(bufferwrite[readbuffer])))
+          break;
         {
-          lastopenfile->Close();
+          // Waiting for the backend, and any copy, to finish with the buffer
+          TraceScope trace("buffer_wait");
+          {
+            ChunkWaitTimer wait(chunksizer, ChunkSizer::wtCompute);
+            bufferavail[readbuffer].get();
+          }
+          ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
+          if (!ioqueue.Wait(bufferwrite[readbuffer]))
+            return false;
         }
+        bufferwrite[readbuffer] = ioqueue.Completed();
 
-        // Open the new file
-        lastopenfile = (*inputblock)->GetDiskFile();
-        if (!lastopenfile->Open())
-        {
+        // Open the file, if it isn't already
+        if (!inputblocks[readindex]->Open())
           return false;
+
+        // Holes in sparse files needn't be read, as they're all zeros (which
+        // still need to be there in case the block is to be copied)
+        void *readptr = (char*)transferbuffer + chunksize * readbuffer;
+        bufferhole[readbuffer] = inputblocks[readindex]->IsHole(blockoffset, blocklength);
+        if (bufferhole[readbuffer])
+        {
+          memset(readptr, 0, blocklength);
+          bufferread[readbuffer] = ioqueue.Completed();
+        }
+        else
+        {
+          bufferread[readbuffer] = inputblocks[readindex]->QueueRead(ioqueue, blockoffset, blocklength, readptr);
         }
+        ++readindex;
       }
 
-      // Wait for next input buffer to become available
-      bufferindex = (bufferindex + 1) % NUM_TRANSFER_BUFFERS;
+      // Wait for data from the current input block
+      u32 bufferindex = inputindex % transferbuffercount;
       void *inputbuffer = (char*)transferbuffer + chunksize * bufferindex;
-      bufferavail[bufferindex].get();
+      {
+        StageTimer timer(statistics, Statistics::stReading, blocklength);
+        ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
+        if (!ioqueue.Wait(bufferread[bufferindex]))
+          return false;
+      }
 
-      // Read data from the current input block
-      if (!(*inputblock)->ReadData(blockoffset, blocklength, inputbuffer))
-        return false;
+      // Close the file, unless the next block, or one already queued, is
+      // also to be read from it
+      DiskFile *inputfile = (*inputblock)->GetDiskFile();
+      bool stillneeded = false;
+      for (u32 index = inputindex+1; index < std::max(readindex, inputindex+2) && index < inputcount; index++)
+      {
+        if (inputblocks[index]->GetDiskFile() == inputfile)
+        {
+          stillneeded = true;
+          break;
+        }
+      }
+      if (!stillneeded)
+      {
+        // The OS needn't keep it cached until the next pass either
+        inputfile->DontNeed(0, 0);
+        inputfile->Close();
+      }
 
       // Have we reached the last source data block
       if (copyblock != copyblocks.end())
       {
-        // Does this block need to be copied to the target file
-        if ((*copyblock)->IsSet())
+        // Does this block need to be copied to the target file, and
+        // wasn't already copied whilst computing the RS matrix
+        if ((*copyblock)->IsSet() && inputindex >= copiedblockcount)
         {
           size_t wrote;
 
           // Write the block back to disk in the new target file
-          if (!(*copyblock)->WriteData(blockoffset, blocklength, inputbuffer, wrote))
-            return false;
+          StageTimer timer(statistics, Statistics::stWriting, blocklength);
+          bufferwrite[bufferindex] = (*copyblock)->QueueWrite(ioqueue, blockoffset, blocklength, inputbuffer, wrote);
+          ioqueue.Submit();
 
           totalwritten += wrote;
         }
         ++copyblock;
       }
 
-      // Copy RS matrix column to send to backend
-      for (u32 outputindex=0; outputindex<missingblockcount; outputindex++)
-        factors[outputindex] = rs.GetFactor(inputindex, outputindex);
-      // Wait for ParPar backend to be ready, if busy
-      parpar.waitForAdd();
-      // Send block to backend
-      bufferavail[bufferindex] = parpar.addInput(inputbuffer, blocklength, factors.data());
+      // A block of zeros adds nothing to the missing blocks, so the backend
+      // needn't be given it
+      if (bufferhole[bufferindex] || DataBlock::IsZero(inputbuffer, blocklength))
+      {
+        std::promise<void> stub;
+        bufferavail[bufferindex] = stub.get_future();
+        stub.set_value();
+      }
+      else
+      {
+        // Copy RS matrix column to send to backend
+        for (u32 outputindex=0; outputindex<missingblockcount; outputindex++)
+          factors[outputindex] = rs.GetFactor(inputindex, outputindex);
+        // Wait for ParPar backend to be ready, if busy
+        {
+          StageTimer timer(statistics, Statistics::stBackendWait);
+          ChunkWaitTimer wait(chunksizer, ChunkSizer::wtCompute);
+          parpar.waitForAdd();
+        }
+        // Send block to backend
+        StageTimer timer(statistics, Statistics::stBackendAdd, blocklength);
+        bufferavail[bufferindex] = parpar.addInput(inputbuffer, blocklength, factors.data());
+      }
 
-      if (noiselevel > nlQuiet)
-        progress.Add(blocklength);
+      progress.Add(blocklength);
 
       ++inputblock;
       ++inputindex;
     }
 
+    // Wait for the copies to the target files
+    {
+      StageTimer timer(statistics, Statistics::stWriting);
+      ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
+      if (!ioqueue.WaitAll())
+        return false;
+    }
+
     // Flush backend
+    StageTimer timer(statistics, Statistics::stBackendWait);
+    ChunkWaitTimer wait(chunksizer, ChunkSizer::wtCompute);
     parpar.endInput().get();
   }
   else
@@ -2592,18 +3001,23 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength, ProgressMete
           }
         }
 
-        // Read data from the current input block
-        if (!(*inputblock)->ReadData(blockoffset, blocklength, transferbuffer))
-          return false;
-
+        // Have the OS copy the data if it can, otherwise read data from the
+        // current input block and write it out
+        StageTimer timer(statistics, Statistics::stWriting, blocklength);
+        ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
         size_t wrote;
-        if (!(*copyblock)->WriteData(blockoffset, blocklength, transferbuffer, wrote))
-          return false;
+        if (!(*copyblock)->CopyData(**inputblock, blockoffset, blocklength, wrote))
+        {
+          if (!(*inputblock)->ReadData(blockoffset, blocklength, transferbuffer))
+            return false;
+
+          if (!(*copyblock)->WriteData(blockoffset, blocklength, transferbuffer, wrote))
+            return false;
+        }
         totalwritten += wrote;
       }
 
-      if (noiselevel > nlQuiet)
-        progress.Add(blocklength);
+      progress.Add(blocklength);
 
       ++copyblock;
       ++inputblock;
@@ -2621,39 +3035,74 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength, ProgressMete
 
   if (missingblockcount > 0)
   {
-    // For output, we only need two transfer buffers
-    std::future<bool> outbufavail[2];
-    // Prepare first output
-    outbufavail[0] = parpar.getOutput(0, transferbuffer);
+    // Output blocks are fetched into the transfer buffers in turn, and written
+    // out from there; a buffer can be reused once its write has finished
+    FutureList<bool> outbufavail(transferbuffercount);
+    std::vector<IOQueue::Ticket> bufferwrite(transferbuffercount);
+    for (u32 i = 0; i < transferbuffercount; i++)
+      bufferwrite[i] = ioqueue.Completed();
+    u32 fetchindex = 0; // The next output block to fetch
 
     // For each output block that has been recomputed
     std::vector<DataBlock*>::iterator outputblock = outputblocks.begin();
     for (u32 outputindex=0; outputindex<missingblockcount;outputindex++)
     {
-      // Prepare next output
-      u32 nextoutputindex = outputindex + 1;
-      if (nextoutputindex < missingblockcount)
+      // Prepare outputs up to the next one, and beyond if there are buffers free
+      while (fetchindex < missingblockcount && fetchindex <= outputindex + transferbuffercount - 1)
       {
-        void *nextoutputbuffer = (char*)transferbuffer + chunksize * (nextoutputindex & 1);
-        outbufavail[nextoutputindex & 1] = parpar.getOutput(nextoutputindex, nextoutputbuffer);
+        u32 fetchbuffer = fetchindex % transferbuffercount;
+        if (fetchindex > outputindex + 1 && !ioqueue.IsDone(bufferwrite[fetchbuffer]))
+          break;
+        {
+          StageTimer timer(statistics, Statistics::stWriting);
+          ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
+          if (!ioqueue.Wait(bufferwrite[fetchbuffer]))
+            return false;
+        }
+
+        StageTimer timer(statistics, Statistics::stOutput);
+        void *fetchptr = (char*)transferbuffer + chunksize * fetchbuffer;
+        outbufavail[fetchbuffer] = parpar.getOutput(fetchindex, fetchptr);
+        ++fetchindex;
       }
 
       // Wait for current buffer to be available
-      if (!outbufavail[outputindex & 1].get())
+      u32 bufferindex = outputindex % transferbuffercount;
       {
-        serr << "Internal checksum failure in block " << outputindex << std::endl;
-        return false;
+        StageTimer timer(statistics, Statistics::stOutput, blocklength);
+        ChunkWaitTimer wait(chunksizer, ChunkSizer::wtCompute);
+        if (!outbufavail[bufferindex].get())
+        {
+          serr << "Internal checksum failure in block " << outputindex << std::endl;
+          return false;
+        }
       }
 
       // Write the data to the target file
-      void *outputbuffer = (char*)transferbuffer + chunksize * (outputindex & 1);
+      StageTimer timer(statistics, Statistics::stWriting, blocklength);
+      void *outputbuffer = (char*)transferbuffer + chunksize * bufferindex;
       size_t wrote;
-      if (!(*outputblock)->WriteData(blockoffset, blocklength, outputbuffer, wrote))
-        return false;
+      bufferwrite[bufferindex] = (*outputblock)->QueueWrite(ioqueue, blockoffset, blocklength, outputbuffer, wrote);
+      ioqueue.Submit();
       totalwritten += wrote;
 
       ++outputblock;
     }
+
+    // Wait for all writes to complete
+    StageTimer timer(statistics, Statistics::stWriting);
+    ChunkWaitTimer wait(chunksizer, ChunkSizer::wtIO);
+    if (!ioqueue.WaitAll())
+      return false;
+  }
+
+  // Get this pass's data on its way to disk, so that it can be dropped from
+  // the cache during the next
+  for (std::vector<Par2RepairerSourceFile*>::iterator sf = verifylist.begin(); sf != verifylist.end(); ++sf)
+  {
+    DiskFile *targetfile = *sf ? (*sf)->GetTargetFile() : 0;
+    if (targetfile && targetfile->IsOpen())
+      targetfile->FlushBehind(false);
   }
 
   if (noiselevel > nlQuiet)
@@ -2662,6 +3111,29 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength, ProgressMete
   return true;
 }
 
+// Note the backend's counters in the statistics, once processing is done
+void Par2Repairer::RecordBackendStatistics(unsigned batchesstarted)
+{
+  if (!statistics)
+    return;
+
+  u64 idleevents = 0;
+#ifdef DEBUG_STAT_THREAD_EMPTY
+  idleevents = parparcpu.getWorkerIdleCount();
+#endif
+  statistics->SetBackend(parparcpu.getMethodName(), parparcpu.getNumThreads(), parparcpu.getBatchesStarted() - batchesstarted, idleevents);
+}
+
+// Report the most memory that was in use at once, against the limit
+void Par2Repairer::ReportMemory(void)
+{
+  if (noiselevel >= nlDebug)
+    sout << "[DEBUG] Peak memory use: " << memorybudget.Peak() << " of " << memorybudget.Limit() << " bytes" << std::endl;
+
+  if (statistics)
+    statistics->SetMemory(memorybudget.Limit(), memorybudget.Peak());
+}
+
 // Verify that all of the reconstructed target files are now correct
 bool Par2Repairer::VerifyTargetFiles(const std::string &basepath)
 {
@@ -2677,16 +3149,27 @@ bool Par2Repairer::VerifyTargetFiles(const std::string &basepath)
     if (verifylist[i])
       mttotalsize += verifylist[i]->GetDescriptionPacket()->FileSize();
   }
-  MTProgressMeter<u64> progress(sout, "Scanning: ", mttotalsize, output_lock);
+  MTProgressMeter<u64> progress(*progresslistener, ppScanning, mttotalsize);
+  StageTimer timer(statistics, Statistics::stScanning, mttotalsize);
 
   // Iterate through each file in the verification list
-  foreach_parallel<Par2RepairerSourceFile*>(verifylist, Par2Repairer::GetFileThreads(), [&, this](Par2RepairerSourceFile* const& verifyfile) {
+  DeviceIdCache devices(fileaccess.provider);
+  foreach_parallel_grouped<Par2RepairerSourceFile*>(verifylist, Par2Repairer::GetFileThreads(), [](Par2RepairerSourceFile* const& verifyfile) {
+    return verifyfile->GetDescriptionPacket()->FileSize();
+  }, [&devices](Par2RepairerSourceFile* const& verifyfile) {
+    return devices.get(verifyfile->GetTargetFile()->FileName());
+  }, [](u64 device) {
+    return DiskFile::GetDeviceStreamLimit(device, Par2Repairer::GetFileThreads());
+  }, [&, this](Par2RepairerSourceFile* const& verifyfile) {
     Par2RepairerSourceFile *sourcefile = verifyfile;
     DiskFile *targetfile = sourcefile->GetTargetFile();
 
-    // Close the file
+    // Close the file, making sure that it's read back from disk
     if (targetfile->IsOpen())
+    {
+      targetfile->FlushBehind(true);
       targetfile->Close();
+    }
 
     // Mark all data blocks for the file as unknown
     std::vector<DataBlock>::iterator sb = sourcefile->SourceBlocks();
@@ -2794,7 +3277,7 @@ bool Par2Repairer::RemoveParFiles(void)
 
   for (std::list<std::string>::const_iterator s=par2list.begin(); s!=par2list.end(); ++s)
   {
-    DiskFile *diskfile = new DiskFile(sout, serr, output_lock);
+    DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
 
     if (diskfile->Open(*s))
     {
@@ -29,6 +29,7 @@
 
 #include <atomic>
 #include <mutex>
+#include <future>
 
 class Par2Repairer
 {
@@ -46,10 +47,33 @@ public:
 		 const bool purgefiles,
 		 const bool renameonly,
 		 const bool skipdata,
-		 const u64 skipleaway
+		 const u64 skipleaway,
+		 const bool directio,
+		 const CachePolicy cachepolicy
 		 );
 
+  // Report progress to listener rather than as text (or as text again, if 0)
+  void SetProgressListener(ProgressListener *listener) {progresslistener = listener ? listener : &textprogress;}
+
+  // Record how long each stage takes in statistics (or stop, if 0)
+  void SetStatistics(Statistics *_statistics) {statistics = _statistics;}
+
+  // Access the files through provider rather than the file system (or the
+  // file system again, if 0). See FileAccess for how long it must live.
+  void SetFileProvider(FileProvider *provider) {fileaccess.provider = provider;}
+
+  // Report the most memory that was in use at once, against the limit
+  void ReportMemory(void);
+
 protected:
+  // Load the packets and prepare to verify the source files (all of the
+  // steps up to VerifySourceFiles below)
+  Result LoadRecoverySet(const std::string &parfilename, const std::vector<std::string> &extrafiles);
+
+  // Repair the files once they have been verified (all of the steps from
+  // RenameTargetFiles below)
+  Result Repair(const size_t memorylimit, const u32 nthreads);
+
   // Steps in verifying and repairing files:
 
   // Load packets from the specified file
@@ -90,7 +114,12 @@ protected:
   // Compute the table for the sliding CRC computation
   bool ComputeWindowTable(void);
 
-  // Attempt to verify all of the source files
+  // Account for the memory the packets, blocks and hash table use, and
+  // determine how many files can be scanned at once within the budget
+  bool ChargeRecoverySet(void);
+
+  // Attempt to verify all of the source files (other than any which have
+  // already been verified)
   bool VerifySourceFiles(const std::string& basepath, std::vector<std::string>& extrafiles);
 
   // Scan any extra files specified on the command line
@@ -128,16 +157,27 @@ protected:
   bool CreateTargetFiles(void);
 
   // Work out which data blocks are available, which need to be copied
-  // directly to the output, and which need to be recreated, and compute
-  // the appropriate Reed Solomon matrix.
+  // directly to the output, and which need to be recreated.
+  void AssignDataBlocks(void);
+
+  // Compute the appropriate Reed Solomon matrix.
   bool ComputeRSmatrix(void);
 
-  // Allocate memory buffers for reading and writing data to disk.
-  bool AllocateBuffers(size_t memorylimit);
+  // Allocate memory buffers for reading and writing data to disk, choosing
+  // how much of each block to process at a time from the memory budget.
+  bool AllocateBuffers(void);
+
+  // Copy available data blocks to the target files whilst the RS matrix
+  // is being computed.
+  bool CopyBlocksWhileSolving(const std::future<bool> &rssolved);
 
   // Read source data, process it through the RS matrix and write it to disk.
   bool ProcessData(u64 blockoffset, size_t blocklength, ProgressMeter<u64> &progress);
 
+  // Note the backend's counters in the statistics, once processing is done
+  // (batchesstarted being how many batches it had started beforehand)
+  void RecordBackendStatistics(unsigned batchesstarted);
+
   // Verify that all of the reconstructed target files are now correct
   bool VerifyTargetFiles(const std::string &basepath);
 
@@ -157,6 +197,16 @@ protected:
 
   const NoiseLevel noiselevel;              // OnScreen display
 
+  TextProgressListener textprogress;
+  ProgressListener *progresslistener;       // Where progress is reported
+  Statistics *statistics;                   // Where stage timings are recorded, or 0
+
+  MemoryBudget memorybudget;                // What memory is used, against the limit
+  size_t processingmemory;                  // Reserved for processing a chunk at a time
+
+  CachedFileSet             cachedfiles;             // Files this left in the handle cache (outlives every DiskFile member)
+  FileAccess                fileaccess;              // How the files are accessed
+
   std::string               searchpath;              // Where to find files on disk
 
   std::string               basepath;
@@ -183,6 +233,7 @@ protected:
 
   u64                       blocksize;               // The block size.
   u64                       chunksize;               // How much of a block can be processed.
+  ChunkSizer                chunksizer;              // How much of a block is processed on each pass.
   u32                       sourceblockcount;        // The total number of blocks
   u32                       availableblockcount;     // How many undamaged blocks have been found
   u32                       missingblockcount;       // How many blocks are missing
@@ -205,12 +256,19 @@ protected:
   std::vector<DataBlock*>   inputblocks;             // Which DataBlocks will be read from disk
   std::vector<DataBlock*>   copyblocks;              // Which DataBlocks will copied back to disk
   std::vector<DataBlock*>   outputblocks;            // Which DataBlocks have to calculated using RS
+  std::vector<bool>         present;                 // Which source blocks are available
+  u32                       copiedblockcount;        // How many copyblocks were copied whilst computing the RS matrix
 
   Galois16RecMatrix         rs;                      // The Reed Solomon matrix.
   PAR2Proc parpar;                                   // Main ParPar backend
   PAR2ProcCPU parparcpu;                             // ParPar CPU sub-backend
+  u64                       parparchunksize;         // The settings the backend was set up with (0 if it
+  u32                       parparinputbatch;        // hasn't been), so that it can be kept for another
+  u32                       parparslices;            // repair, rather than being set up again
 
-  void                     *transferbuffer;          // Buffer for reading/writing DataBlocks (chunksize * num_transfer_buffers)
+  void                     *transferbuffer;          // Buffer for reading/writing DataBlocks (chunksize * transferbuffercount)
+  u32                       transferbuffercount;
+  IOQueue                   ioqueue;                 // Queue for reading and writing DataBlocks
 };
 
 #endif // __PAR2REPAIRER_H__
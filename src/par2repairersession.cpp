@@ -0,0 +1,220 @@
+#include "libpar2internal.h"
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+
+Par2RepairerSession::Par2RepairerSession(std::ostream &sout, std::ostream &serr, const NoiseLevel noiselevel)
+: Par2Repairer(sout, serr, noiselevel)
+, extrafiles()
+, stamps()
+{
+  verified = false;
+}
+
+Par2RepairerSession::~Par2RepairerSession(void)
+{
+}
+
+Result Par2RepairerSession::Open(const std::string &_basepath,
+                                 const u32 _filethreads,
+                                 const std::string &parfilename,
+                                 const std::vector<std::string> &_extrafiles,
+                                 const bool _skipdata,
+                                 const u64 _skipleaway)
+{
+  filethreads = _filethreads;
+  basepath = _basepath;
+  extrafiles = _extrafiles;
+  skipdata = _skipdata;
+  skipleaway = _skipleaway;
+
+  return LoadRecoverySet(parfilename, extrafiles);
+}
+
+Result Par2RepairerSession::Verify(void)
+{
+  // Forget any files which have changed since they were verified
+  std::vector<DiskFile*> changed;
+  for (std::map<std::string, FileStamp>::iterator st = stamps.begin(); st != stamps.end(); ++st)
+  {
+    if (!(GetFileStamp((*st).first) == (*st).second))
+    {
+      DiskFile *diskfile = diskFileMap.Find((*st).first);
+      if (diskfile)
+        changed.push_back(diskfile);
+    }
+  }
+  for (std::vector<DiskFile*>::iterator df = changed.begin(); df != changed.end(); ++df)
+    ForgetFile(*df);
+
+  // Note the state of the files which are about to be verified beforehand,
+  // so that any change made whilst they are being read is noticed next time
+  std::vector<std::string> datafiles;
+  GetDataFiles(datafiles);
+
+  std::map<std::string, FileStamp> newstamps;
+  for (std::vector<std::string>::iterator df = datafiles.begin(); df != datafiles.end(); ++df)
+  {
+    if (diskFileMap.Find(*df) == 0)
+      newstamps[*df] = GetFileStamp(*df);
+  }
+
+  // Verify the source files which haven't been, and any extra files
+  std::vector<std::string> files = extrafiles;
+  bool success = VerifySourceFiles(basepath, files);
+  if (success && completefilecount < mainpacket->RecoverableFileCount())
+    VerifyExtraFiles(files, basepath, false);
+
+  for (std::map<std::string, FileStamp>::iterator st = newstamps.begin(); st != newstamps.end(); ++st)
+  {
+    if (diskFileMap.Find((*st).first) != 0)
+      stamps[(*st).first] = (*st).second;
+  }
+
+  if (!success)
+    return eFileIOError;
+
+  verified = true;
+
+  // Find out how much data we have found
+  UpdateVerificationResults();
+
+  if (noiselevel > nlSilent)
+    sout << '\n';
+
+  // Check the verification results and report the results
+  if (!CheckVerificationResults())
+    return eRepairNotPossible;
+
+  if (completefilecount < mainpacket->RecoverableFileCount())
+    return eRepairPossible;
+
+  return eSuccess;
+}
+
+Result Par2RepairerSession::Reverify(const std::vector<std::string> &files)
+{
+  std::vector<std::string> datafiles;
+  GetDataFiles(datafiles);
+
+  for (std::vector<std::string>::const_iterator f = files.begin(); f != files.end(); ++f)
+  {
+    // Only data files can be forgotten, as the recovery packets refer to
+    // the PAR2 files
+    std::string name = DiskFile::GetCanonicalPathname(*f);
+    std::vector<std::string>::iterator df = datafiles.begin();
+    while (df != datafiles.end() && *df != *f && *df != name)
+      ++df;
+    if (df == datafiles.end())
+      continue;
+
+    DiskFile *diskfile = diskFileMap.Find(*df);
+    if (diskfile)
+      ForgetFile(diskfile);
+  }
+
+  return Verify();
+}
+
+Result Par2RepairerSession::Repair(const size_t memorylimit, const u32 nthreads)
+{
+  if (!verified)
+  {
+    Result result = Verify();
+    if (result != eRepairPossible)
+      return result;
+  }
+  else
+  {
+    if (completefilecount >= mainpacket->RecoverableFileCount())
+      return eSuccess;
+    if (recoverypacketmap.size() < missingblockcount)
+      return eRepairNotPossible;
+  }
+
+  Result result = Par2Repairer::Repair(memorylimit, nthreads);
+
+  // Files have been renamed, created and verified again, so note the state
+  // of all of them afresh
+  stamps.clear();
+
+  std::vector<std::string> datafiles;
+  GetDataFiles(datafiles);
+  for (std::vector<std::string>::iterator df = datafiles.begin(); df != datafiles.end(); ++df)
+  {
+    if (diskFileMap.Find(*df) != 0)
+      stamps[*df] = GetFileStamp(*df);
+  }
+
+  return result;
+}
+
+Par2RepairerSession::FileStamp Par2RepairerSession::GetFileStamp(const std::string &filename) const
+{
+  FileStamp stamp;
+  stamp.size = DiskFile::GetFileSize(filename, fileaccess.provider);
+  stamp.time = DiskFile::GetFileTime(filename, fileaccess.provider);
+  return stamp;
+}
+
+void Par2RepairerSession::ForgetFile(DiskFile *diskfile)
+{
+  for (std::vector<Par2RepairerSourceFile*>::iterator sf = sourcefiles.begin(); sf != sourcefiles.end(); ++sf)
+  {
+    Par2RepairerSourceFile *sourcefile = *sf;
+    if (!sourcefile)
+      continue;
+
+    if (sourcefile->GetTargetFile() == diskfile)
+    {
+      sourcefile->SetTargetExists(false);
+      sourcefile->SetTargetFile(0);
+      sourcefile->SetDiskFileSize(fileaccess.provider);
+    }
+    if (sourcefile->GetCompleteFile() == diskfile)
+      sourcefile->SetCompleteFile(0);
+  }
+
+  // Any blocks found in it will have to be found again
+  for (std::vector<DataBlock>::iterator sb = sourceblocks.begin(); sb != sourceblocks.end(); ++sb)
+  {
+    if (sb->GetDiskFile() == diskfile)
+      sb->ClearLocation();
+  }
+
+  backuplist.erase(std::remove(backuplist.begin(), backuplist.end(), diskfile), backuplist.end());
+  stamps.erase(diskfile->FileName());
+
+  // It's to be opened afresh when it's verified again
+  DiskFile::CloseCachedFile(diskfile->FileName());
+
+  diskFileMap.Remove(diskfile);
+  delete diskfile;
+}
+
+void Par2RepairerSession::GetDataFiles(std::vector<std::string> &filenames)
+{
+  for (std::vector<Par2RepairerSourceFile*>::iterator sf = sourcefiles.begin(); sf != sourcefiles.end(); ++sf)
+  {
+    if (*sf)
+      filenames.push_back((*sf)->TargetFileName());
+  }
+
+  // Damaged files which were renamed by a repair
+  for (std::vector<DiskFile*>::iterator bf = backuplist.begin(); bf != backuplist.end(); ++bf)
+    filenames.push_back((*bf)->FileName());
+
+  // As VerifyExtraFiles, skipping any PAR2 files
+  for (std::vector<std::string>::iterator ef = extrafiles.begin(); ef != extrafiles.end(); ++ef)
+  {
+    if (std::string::npos == ef->find(".par2") &&
+        std::string::npos == ef->find(".PAR2"))
+      filenames.push_back(DiskFile::GetCanonicalPathname(*ef));
+  }
+}
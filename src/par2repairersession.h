@@ -0,0 +1,69 @@
+#ifndef __PAR2REPAIRERSESSION_H__
+#define __PAR2REPAIRERSESSION_H__
+
+// A recovery set which is kept loaded so that it can be verified and
+// repaired repeatedly, e.g. whilst the data files are being downloaded.
+// The packets, verification hash table and ParPar backend are only set up
+// once, and each verification only reads the files which have changed since
+// they were last verified (those which don't exist yet are looked for each
+// time).
+
+class Par2RepairerSession : protected Par2Repairer
+{
+public:
+  Par2RepairerSession(std::ostream &sout, std::ostream &serr, const NoiseLevel noiselevel);
+  ~Par2RepairerSession(void);
+
+  // Load the packets from the PAR2 files. basepath is where the data files
+  // are, and extrafiles are any other files which may contain data.
+  Result Open(const std::string &basepath,
+              const u32 filethreads,
+              const std::string &parfilename,
+              const std::vector<std::string> &extrafiles,
+              const bool skipdata = false,
+              const u64 skipleaway = 0);
+
+  // Verify any data files which are new, or have been modified since they
+  // were last verified, and report the results: eSuccess if all files are
+  // complete, otherwise eRepairPossible or eRepairNotPossible.
+  Result Verify(void);
+
+  // As above, but also read the specified files again whether or not they
+  // appear to have changed
+  Result Reverify(const std::vector<std::string> &files);
+
+  // Repair the files as they were found by the last verification
+  // (verifying them first if they haven't been yet)
+  Result Repair(const size_t memorylimit, const u32 nthreads);
+
+  // How many data blocks are there, how many were found by the last
+  // verification, and how many recovery blocks are there
+  u32 BlockCount(void) const {return sourceblockcount;}
+  u32 AvailableBlockCount(void) const {return availableblockcount;}
+  u32 MissingBlockCount(void) const {return missingblockcount;}
+  u32 RecoveryBlockCount(void) const {return (u32)recoverypacketmap.size();}
+
+protected:
+  // The state of a file when it was verified
+  struct FileStamp
+  {
+    u64 size;
+    u64 time;
+
+    bool operator==(const FileStamp &other) const {return size == other.size && time == other.time;}
+  };
+  FileStamp GetFileStamp(const std::string &filename) const;
+
+  // Discard everything that was found in a file, so that it's verified again
+  void ForgetFile(DiskFile *diskfile);
+
+  // The data files which may be verified: the target files and extra files
+  void GetDataFiles(std::vector<std::string> &filenames);
+
+protected:
+  std::vector<std::string>            extrafiles;   // Other files which may contain data
+  std::map<std::string, FileStamp>    stamps;       // The data files verified, by name
+  bool                                verified;     // Whether Verify has been done
+};
+
+#endif // __PAR2REPAIRERSESSION_H__
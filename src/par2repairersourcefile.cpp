@@ -165,7 +165,7 @@ bool Par2RepairerSourceFile::SetBlockCount(u64 blocksize)
   return true;
 }
 
-void Par2RepairerSourceFile::SetDiskFileSize()
+void Par2RepairerSourceFile::SetDiskFileSize(FileProvider *provider)
 {
-  diskfilesize = DiskFile::GetFileSize(targetfilename);
+  diskfilesize = DiskFile::GetFileSize(targetfilename, provider);
 }
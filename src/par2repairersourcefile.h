@@ -88,7 +88,7 @@ public:
   std::vector<DataBlock>::iterator TargetBlocks(void) const {return targetblocks;}
 
   // Set/Get "filesize on disk" needed for mt progress line
-  void SetDiskFileSize();
+  void SetDiskFileSize(FileProvider *provider);
   u64 DiskFileSize(void) const {return diskfilesize;}
 
 protected:
@@ -0,0 +1,392 @@
+//  This file is part of par2cmdline (a PAR 2.0 compatible file verification and
+//  repair tool). See http://parchive.sourceforge.net for details of PAR 2.0.
+//
+//  par2cmdline is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  par2cmdline is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+// par2scanbench: times scanning data for blocks, as verifying does, in
+// isolation. A file is made in memory and a VerificationHashTable is loaded
+// with its blocks; some of the blocks are then damaged, and FileCheckSummer
+// and FindMatch are driven over the file the same way as by
+// Par2Repairer::ScanDataFile (without recording the blocks found).
+//
+// Besides the overall rate, the time is split between sliding the CRC
+// (FileCheckSummer::Step), probing the hash table for CRCs, and computing
+// MD5 hashes of blocks whose CRC matched. Timing each call would cost more
+// than the calls themselves, so the scan is timed as a whole, the calls are
+// counted in a separate run, and each kind of call is timed on its own; the
+// remainder ("other") is jumping over found blocks and reading.
+
+#include "libpar2internal.h"
+// This is included here, so that cout and cerr are not used elsewhere.
+#include <iostream>
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+
+struct Options
+{
+  Options(void) : filesize(64*1048576), repetitions(3) {}
+
+  std::vector<u64>  blocksizes;
+  std::vector<u32>  damages;      // Percent of blocks damaged
+  std::vector<u32>  tablesizes;   // Hash table size (0 for the number of blocks, as verifying uses)
+  u64               filesize;
+  u32               repetitions;
+};
+
+// How many of each call a scan made
+struct Counts
+{
+  u64 steps;
+  u64 jumps;
+  u64 lookups;   // Calls of FindMatch
+  u64 probes;    // Of the hash table for a CRC
+  u64 hashes;    // MD5 of a block, for a matching CRC
+  u64 matches;
+};
+
+static double Now(void)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage(void)
+{
+  std::cout <<
+    "Usage: par2scanbench [options]\n"
+    "\n"
+    "Times scanning damaged data for blocks with FileCheckSummer and\n"
+    "VerificationHashTable, without reading from disk.\n"
+    "\n"
+    "Options:\n"
+    "  -b<n>[,<n>...] : Block sizes (default 4096,65536,1048576)\n"
+    "  -d<n>[,<n>...] : Percent of blocks damaged (default 0,10,100)\n"
+    "  -h<n>[,<n>...] : Hash table sizes (default the number of blocks)\n"
+    "  -s<n>          : Size of the file in MB (default 64)\n"
+    "  -r<n>          : Repetitions, keeping the best time (default 3)\n";
+}
+
+template<typename T>
+static bool ParseList(const char *value, std::vector<T> &list)
+{
+  list.clear();
+  std::istringstream values(value);
+  std::string item;
+  while (std::getline(values, item, ','))
+  {
+    char *end;
+    unsigned long long n = strtoull(item.c_str(), &end, 10);
+    if (item.empty() || *end)
+      return false;
+    list.push_back((T)n);
+  }
+  return !list.empty();
+}
+
+static bool ParseOptions(int argc, char *argv[], Options &options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || !arg[1])
+      return false;
+
+    // Values may follow the option, or be the next argument
+    const char *value = arg + 2;
+    if (!*value && i+1 < argc)
+      value = argv[++i];
+
+    bool ok;
+    switch (arg[1])
+    {
+    case 'b': ok = ParseList(value, options.blocksizes); break;
+    case 'd': ok = ParseList(value, options.damages); break;
+    case 'h': ok = ParseList(value, options.tablesizes); break;
+    case 's': options.filesize = (u64)atoi(value) * 1048576; ok = options.filesize > 0; break;
+    case 'r': options.repetitions = (u32)atoi(value); ok = options.repetitions > 0; break;
+    default:  ok = false; break;
+    }
+    if (!ok)
+    {
+      std::cerr << "Invalid option: " << arg << std::endl;
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < options.blocksizes.size(); i++)
+  {
+    if (options.blocksizes[i] == 0 || options.blocksizes[i] % 4 != 0)
+    {
+      std::cerr << "Block sizes must be a multiple of 4" << std::endl;
+      return false;
+    }
+  }
+  for (size_t i = 0; i < options.damages.size(); i++)
+  {
+    if (options.damages[i] > 100)
+    {
+      std::cerr << "Damage must be a percentage" << std::endl;
+      return false;
+    }
+  }
+
+  if (options.blocksizes.empty())
+    options.blocksizes = {4096, 65536, 1048576};
+  if (options.damages.empty())
+    options.damages = {0, 10, 100};
+  if (options.tablesizes.empty())
+    options.tablesizes.push_back(0);
+  return true;
+}
+
+
+// Scan the file as Par2Repairer::ScanDataFile does, counting the calls made
+// if counts is given
+static bool Scan(DiskFile &diskfile, u64 blocksize, const u32 (&windowtable)[256],
+                 const VerificationHashTable &table, Par2RepairerSourceFile *sourcefile,
+                 Counts *counts)
+{
+  FileCheckSummer filechecksummer(&diskfile, blocksize, windowtable);
+  if (!filechecksummer.Start())
+    return false;
+
+  const VerificationHashEntry *nextentry = 0;
+  while (filechecksummer.Offset() < diskfile.FileSize())
+  {
+    if (counts)
+    {
+      // What FindMatch will do: compare with the expected block, then
+      // probe the table, computing the hash if the CRC is found anywhere
+      u32 crc = filechecksummer.Checksum();
+      bool hashed = nextentry && nextentry->Next() && !nextentry->IsSet() && nextentry->Checksum() == crc;
+      counts->lookups++;
+      counts->probes++;
+      if (!hashed && table.Lookup(crc) != 0)
+        hashed = true;
+      if (hashed)
+        counts->hashes++;
+    }
+
+    bool duplicate;
+    const VerificationHashEntry *currententry = table.FindMatch(nextentry, sourcefile, filechecksummer, duplicate);
+    if (currententry != 0)
+    {
+      nextentry = currententry->Next();
+      if (counts)
+      {
+        counts->matches++;
+        counts->jumps++;
+      }
+      if (!filechecksummer.Jump(currententry->GetDataBlock()->GetLength()))
+        return false;
+    }
+    else
+    {
+      nextentry = 0;
+      if (counts)
+        counts->steps++;
+      if (!filechecksummer.Step())
+        return false;
+    }
+  }
+
+  return true;
+}
+
+// Run the benchmark with one block size, damage, and table size
+static bool Run(const Options &options, MemoryFileProvider &provider,
+                u64 blocksize, u32 damage, u32 tablesize)
+{
+  // The file is a whole number of blocks, as near to the size asked for as
+  // possible
+  const u32 blockcount = (u32)std::max(options.filesize / blocksize, (u64)1);
+  const u64 filesize = blocksize * blockcount;
+  if (filesize > (u64)std::numeric_limits<size_t>::max() / 2)
+  {
+    std::cerr << "The file is too large" << std::endl;
+    return false;
+  }
+
+  // Make the file, and the verification entries for its blocks
+  std::vector<u8> data((size_t)filesize);
+  u64 state = blocksize * 1000 + damage + 1;
+  for (size_t i = 0; i < data.size(); i++)
+  {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    data[i] = (u8)(state >> 56);
+  }
+
+  DescriptionPacket *descriptionpacket = new DescriptionPacket;
+  descriptionpacket->Create("scan.dat", filesize);
+  VerificationPacket *verificationpacket = new VerificationPacket;
+  verificationpacket->Create(blockcount);
+  for (u32 block = 0; block < blockcount; block++)
+  {
+    const u8 *blockdata = &data[(size_t)(block * blocksize)];
+    MD5Context context;
+    context.Update(blockdata, (size_t)blocksize);
+    MD5Hash hash;
+    context.Final(hash);
+    verificationpacket->SetBlockHashAndCRC(block, hash, CRCCompute((size_t)blocksize, blockdata));
+  }
+
+  Par2RepairerSourceFile sourcefile(descriptionpacket, verificationpacket);
+  std::vector<DataBlock> sourceblocks(blockcount);
+  sourcefile.SetBlocks(0, blockcount, sourceblocks.begin(), sourceblocks.begin(), blocksize);
+
+  VerificationHashTable table;
+  table.SetLimit(tablesize ? tablesize : blockcount);
+  table.Load(&sourcefile, blocksize);
+
+  u32 windowtable[256];
+  GenerateWindowTable(blocksize, windowtable);
+
+  // Damage blocks spread evenly through the file, in the middle of each
+  u32 damagedcount = (u32)((u64)blockcount * damage / 100);
+  for (u32 n = 0; n < damagedcount; n++)
+  {
+    u64 block = (u64)n * blockcount / damagedcount;
+    data[(size_t)(block * blocksize + blocksize / 2)] ^= 0x55;
+  }
+
+  std::mutex output_lock;
+  const std::string filename = provider.Root() + "scan.dat";
+  provider.AddFile(filename, data.data(), data.size());
+  FileAccess access;
+  access.provider = &provider;
+  DiskFile diskfile(std::cout, std::cerr, output_lock, access);
+  if (!diskfile.Open(filename))
+    return false;
+
+  // Count the calls a scan makes
+  Counts counts;
+  memset(&counts, 0, sizeof(counts));
+  if (!Scan(diskfile, blocksize, windowtable, table, &sourcefile, &counts))
+    return false;
+  if (counts.matches != blockcount - damagedcount)
+  {
+    std::cerr << "Found " << counts.matches << " blocks rather than " << blockcount - damagedcount << std::endl;
+    return false;
+  }
+
+  // Time the scan, and each kind of call on its own
+  double scantime = 0, steptime = 0, probetime = 0, hashtime = 0;
+  std::vector<u32> crcs;
+  for (u32 repetition = 0; repetition < options.repetitions; repetition++)
+  {
+    double started = Now();
+    if (!Scan(diskfile, blocksize, windowtable, table, &sourcefile, 0))
+      return false;
+    double elapsed = Now() - started;
+    if (repetition == 0 || elapsed < scantime)
+      scantime = elapsed;
+
+    // Stepping through the damaged data (or as much of it as was stepped
+    // through in the scan), keeping the CRCs to probe with
+    if (counts.steps > 0)
+    {
+      FileCheckSummer filechecksummer(&diskfile, blocksize, windowtable);
+      if (!filechecksummer.Start())
+        return false;
+      bool keep = crcs.empty();
+      started = Now();
+      for (u64 step = 0; step < counts.steps && filechecksummer.Step(); step++)
+      {
+        if (keep && crcs.size() < (1 << 22))
+          crcs.push_back(filechecksummer.Checksum());
+      }
+      elapsed = Now() - started;
+      if (repetition == 0 || elapsed < steptime)
+        steptime = elapsed;
+    }
+
+    // Probing the table
+    started = Now();
+    u64 found = 0;
+    size_t next = 0;
+    for (u64 probe = 0; probe < counts.probes && !crcs.empty(); probe++)
+    {
+      found += table.Lookup(crcs[next]) != 0;
+      if (++next == crcs.size())
+        next = 0;
+    }
+    elapsed = Now() - started;
+    if (repetition == 0 || elapsed < probetime)
+      probetime = elapsed;
+    if (found > counts.probes)  // Keep the lookups from being optimised away
+      return false;
+
+    // Hashing blocks
+    started = Now();
+    for (u64 hash = 0; hash < counts.hashes; hash++)
+    {
+      MD5Context context;
+      context.Update(&data[(size_t)((hash % blockcount) * blocksize)], (size_t)blocksize);
+      MD5Hash result;
+      context.Final(result);
+    }
+    elapsed = Now() - started;
+    if (repetition == 0 || elapsed < hashtime)
+      hashtime = elapsed;
+  }
+
+  provider.Delete(filename);
+
+  // Report the rates, and the share of the scan each kind of call took
+  double othertime = std::max(scantime - steptime - probetime - hashtime, 0.0);
+  std::cout << std::setw(9) << blocksize << std::setw(8) << damage << '%'
+    << std::setw(7) << (tablesize ? tablesize : blockcount)
+    << std::setprecision(1)
+    << std::setw(10) << filesize / scantime / 1048576
+    << std::setprecision(2)
+    << std::setw(11) << counts.lookups / scantime / 1e6
+    << std::setprecision(1)
+    << std::setw(7) << 100 * steptime / scantime << '%'
+    << std::setw(7) << 100 * probetime / scantime << '%'
+    << std::setw(7) << 100 * hashtime / scantime << '%'
+    << std::setw(7) << 100 * othertime / scantime << '%'
+    << std::endl;
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  Options options;
+  if (!ParseOptions(argc, argv, options))
+  {
+    usage();
+    return eInvalidCommandLineArguments;
+  }
+
+  setup_hasher();
+
+  MemoryFileProvider provider(PATHSEP "par2scanbench");
+
+  std::cout << "Blocksize  Damage  Table      MB/s  Mlookup/s  Slide  Probe    MD5  Other" << std::endl << std::fixed;
+
+  bool ok = true;
+  for (size_t b = 0; b < options.blocksizes.size() && ok; b++)
+    for (size_t d = 0; d < options.damages.size() && ok; d++)
+      for (size_t h = 0; h < options.tablesizes.size() && ok; h++)
+        ok = Run(options, provider, options.blocksizes[b], options.damages[d], options.tablesizes[h]);
+
+  return ok ? eSuccess : eLogicError;
+}
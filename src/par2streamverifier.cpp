@@ -0,0 +1,611 @@
+#include "libpar2internal.h"
+#include "hasher.h"
+#include "foreach_parallel.h"
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+
+Par2StreamVerifier::StreamFile::StreamFile(void)
+: filename()
+, diskfile(0)
+, reader(0)
+, sourcefile(0)
+, filesize(~(u64)0)
+, end(0)
+, hashed(0)
+, context16k()
+, hash16k()
+, written()
+, matches()
+, finished(false)
+{
+  hasher = HasherInput_Create();
+}
+
+Par2StreamVerifier::StreamFile::~StreamFile(void)
+{
+  hasher->destroy();
+
+  delete reader;
+
+  // Once the file is finished, it belongs to the DiskFileMap
+  if (!finished)
+    delete diskfile;
+}
+
+
+Par2StreamVerifier::Par2StreamVerifier(std::ostream &sout, std::ostream &serr, const NoiseLevel noiselevel)
+: Par2Repairer(sout, serr, noiselevel)
+, streams()
+, targets()
+, found()
+{
+  foundcount = 0;
+  verified = false;
+}
+
+Par2StreamVerifier::~Par2StreamVerifier(void)
+{
+  std::map<std::string, StreamFile*>::iterator sf = streams.begin();
+  while (sf != streams.end())
+  {
+    delete (*sf).second;
+
+    ++sf;
+  }
+}
+
+Result Par2StreamVerifier::Open(const std::string &_basepath,
+                                const u32 _filethreads,
+                                const std::string &parfilename,
+                                const std::vector<std::string> &extrafiles)
+{
+  filethreads = _filethreads;
+  basepath = _basepath;
+
+  Result result = LoadRecoverySet(parfilename, extrafiles);
+  if (result != eSuccess)
+    return result;
+
+  // Data is written to the files by name
+  for (std::vector<Par2RepairerSourceFile*>::iterator sf = sourcefiles.begin(); sf != sourcefiles.end(); ++sf)
+  {
+    Par2RepairerSourceFile *sourcefile = *sf;
+    if (sourcefile)
+      targets[DiskFile::GetCanonicalPathname(sourcefile->TargetFileName())] = sourcefile;
+  }
+
+  found.resize(sourceblockcount);
+
+  return eSuccess;
+}
+
+bool Par2StreamVerifier::Write(const std::string &filename, u64 offset, const void *buffer, size_t length)
+{
+  std::string name = DiskFile::GetCanonicalPathname(filename);
+
+  StreamFile *stream;
+  {
+    std::lock_guard<std::mutex> lock(streamlock);
+
+    std::map<std::string, StreamFile*>::iterator sf = streams.find(name);
+    if (sf != streams.end())
+    {
+      stream = (*sf).second;
+    }
+    else
+    {
+      stream = new StreamFile;
+      stream->filename = name;
+      stream->diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
+
+      // Is it one of the source files
+      std::map<std::string, Par2RepairerSourceFile*>::iterator target = targets.find(name);
+      if (target != targets.end())
+      {
+        Par2RepairerSourceFile *sourcefile = (*target).second;
+
+        stream->sourcefile = sourcefile;
+        stream->filename = sourcefile->TargetFileName();
+        stream->filesize = sourcefile->GetDescriptionPacket()->FileSize();
+
+        sourcefile->SetTargetExists(true);
+        sourcefile->SetTargetFile(stream->diskfile);
+      }
+
+      streams[name] = stream;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(stream->lock);
+
+  if (stream->finished)
+  {
+    std::lock_guard<std::mutex> lock(output_lock);
+    serr << "Data was written to " << filename << " after it was finished." << std::endl;
+    return false;
+  }
+
+  if (length == 0)
+    return true;
+
+  const u8 *data = (const u8*)buffer;
+  stream->end = std::max(stream->end, offset + length);
+
+  // Does the data follow on from what has been hashed
+  if (offset <= stream->hashed && offset + length > stream->hashed)
+  {
+    size_t skip = (size_t)(stream->hashed - offset);
+    HashData(*stream, data + skip, length - skip);
+
+    // The data written after it may now follow on too
+    return HashWritten(*stream);
+  }
+  else if (offset > stream->hashed)
+  {
+    return NoteWritten(*stream, offset, length);
+  }
+
+  return true;
+}
+
+bool Par2StreamVerifier::Finish(const std::string &filename)
+{
+  std::string name = DiskFile::GetCanonicalPathname(filename);
+
+  StreamFile *stream;
+  {
+    std::lock_guard<std::mutex> lock(streamlock);
+
+    std::map<std::string, StreamFile*>::iterator sf = streams.find(name);
+    if (sf == streams.end())
+    {
+      // Nothing was written to it
+      return true;
+    }
+    stream = (*sf).second;
+  }
+
+  std::lock_guard<std::mutex> lock(stream->lock);
+
+  if (stream->finished)
+    return true;
+
+  return FinishStream(*stream);
+}
+
+u32 Par2StreamVerifier::AvailableBlockCount(void)
+{
+  std::lock_guard<std::mutex> lock(streamlock);
+
+  return foundcount;
+}
+
+Result Par2StreamVerifier::Verify(void)
+{
+  // Finish any files still being written
+  for (std::map<std::string, StreamFile*>::iterator sf = streams.begin(); sf != streams.end(); ++sf)
+  {
+    StreamFile *stream = (*sf).second;
+
+    std::lock_guard<std::mutex> lock(stream->lock);
+    if (!stream->finished && !FinishStream(*stream))
+      return eFileIOError;
+  }
+
+  // Verify any files which weren't written, but which exist
+  std::vector<Par2RepairerSourceFile*> unwritten;
+  u64 mttotalsize = 0;
+  for (std::vector<Par2RepairerSourceFile*>::iterator sf = sourcefiles.begin(); sf != sourcefiles.end(); ++sf)
+  {
+    Par2RepairerSourceFile *sourcefile = *sf;
+    if (sourcefile && !sourcefile->GetTargetExists() && DiskFile::FileExists(sourcefile->TargetFileName(), fileaccess.provider))
+    {
+      unwritten.push_back(sourcefile);
+      mttotalsize += sourcefile->DiskFileSize();
+    }
+  }
+
+  if (!unwritten.empty())
+  {
+    if (noiselevel > nlQuiet)
+      sout << "\nVerifying source files:\n" << std::endl;
+
+    MTProgressMeter<u64> progress(*progresslistener, ppScanning, mttotalsize);
+
+    std::mutex dfm_lock;
+    std::atomic<bool> finalresult(true);
+    foreach_parallel<Par2RepairerSourceFile*>(unwritten, Par2Repairer::GetFileThreads(), [&, this](Par2RepairerSourceFile* const& sourcefile) {
+      DiskFile *diskfile = new DiskFile(sout, serr, output_lock, fileaccess);
+
+      if (!diskfile->Open(sourcefile->TargetFileName()))
+      {
+        delete diskfile;
+        return;
+      }
+
+      sourcefile->SetTargetExists(true);
+      sourcefile->SetTargetFile(diskfile);
+
+      dfm_lock.lock();
+      bool success = diskFileMap.Insert(diskfile);
+      dfm_lock.unlock();
+      assert(success);
+
+      if (!VerifyDataFile(diskfile, sourcefile, basepath, progress))
+        finalresult.store(false, std::memory_order_relaxed);
+
+      diskfile->Close();
+    });
+
+    if (!finalresult.load(std::memory_order_relaxed))
+      return eFileIOError;
+
+    // Count the blocks found in them
+    std::lock_guard<std::mutex> lock(streamlock);
+    for (u32 block=0; block<sourceblockcount; ++block)
+    {
+      if (!found[block] && sourceblocks[block].IsSet())
+      {
+        found[block] = true;
+        foundcount++;
+      }
+    }
+  }
+
+  verified = true;
+
+  // Find out how much data we have found
+  UpdateVerificationResults();
+
+  if (noiselevel > nlSilent)
+    sout << '\n';
+
+  // Check the verification results and report the results
+  if (!CheckVerificationResults())
+    return eRepairNotPossible;
+
+  return completefilecount < mainpacket->RecoverableFileCount() ? eRepairPossible : eSuccess;
+}
+
+Result Par2StreamVerifier::Repair(const size_t memorylimit, const u32 nthreads)
+{
+  if (!verified)
+  {
+    Result result = Verify();
+    if (result != eRepairPossible)
+      return result;
+  }
+  else if (completefilecount >= mainpacket->RecoverableFileCount())
+  {
+    return eSuccess;
+  }
+
+  return Par2Repairer::Repair(memorylimit, nthreads);
+}
+
+void Par2StreamVerifier::HashData(StreamFile &stream, const u8 *buffer, size_t length)
+{
+  // Data beyond the end of the file doesn't belong to any block
+  while (length > 0 && stream.hashed < stream.filesize)
+  {
+    // Where does the current block start and end
+    u64 blockstart = stream.hashed - stream.hashed % blocksize;
+    u64 blocklength = std::min(blocksize, stream.filesize - blockstart);
+
+    size_t want = (size_t)std::min((u64)length, blockstart + blocklength - stream.hashed);
+
+    // The first 16k of the file has a hash of its own
+    if (stream.hashed < 16384)
+    {
+      size_t use = (size_t)std::min((u64)want, 16384 - stream.hashed);
+      stream.context16k.Update(buffer, use);
+      if (stream.hashed + use == 16384)
+        stream.context16k.Final(stream.hash16k);
+    }
+
+    stream.hasher->update(buffer, want);
+    stream.hashed += want;
+
+    buffer += want;
+    length -= want;
+
+    // Has a whole block been hashed
+    if (stream.hashed == blockstart + blocklength)
+    {
+      MD5Hash hash;
+      u32 crc = HasherGetBlock(stream.hasher, hash, blocksize - blocklength);
+
+      MatchBlock(stream, blockstart, blocklength, hash, crc);
+    }
+  }
+}
+
+bool Par2StreamVerifier::HashWritten(StreamFile &stream)
+{
+  std::vector<u8> buffer;
+
+  while (!stream.written.empty() && stream.written.begin()->first <= stream.hashed)
+  {
+    // Data beyond the end of the file isn't hashed
+    u64 rangeend = std::min(stream.written.begin()->second, stream.filesize);
+    stream.written.erase(stream.written.begin());
+
+    // Read it back a cache sized piece at a time
+    while (stream.hashed < rangeend)
+    {
+      size_t want = (size_t)std::min(rangeend - stream.hashed, (u64)ChunkSizer::StartSize());
+      buffer.resize(want);
+      if (!ReadWritten(stream, stream.hashed, &buffer[0], want))
+        return false;
+
+      HashData(stream, &buffer[0], want);
+    }
+  }
+
+  return true;
+}
+
+bool Par2StreamVerifier::NoteWritten(StreamFile &stream, u64 offset, size_t length)
+{
+  // Merge the data with any that it overlaps or adjoins
+  u64 start = offset;
+  u64 end = offset + length;
+
+  std::map<u64, u64>::iterator range = stream.written.upper_bound(start);
+  if (range != stream.written.begin())
+  {
+    std::map<u64, u64>::iterator previous = range;
+    --previous;
+    if (previous->second >= start)
+    {
+      start = previous->first;
+      range = previous;
+    }
+  }
+  while (range != stream.written.end() && range->first <= end)
+  {
+    end = std::max(end, range->second);
+    stream.written.erase(range++);
+  }
+  stream.written[start] = end;
+
+  // Match the blocks that the data completes, unless the block has
+  // already been started on by the hasher (which will finish it)
+  u64 blockstart = offset - offset % blocksize;
+  if (blockstart < stream.hashed)
+    blockstart += blocksize;
+
+  for (; blockstart < offset + length && blockstart < stream.filesize; blockstart += blocksize)
+  {
+    if (!MatchWrittenBlock(stream, blockstart))
+      return false;
+  }
+
+  return true;
+}
+
+bool Par2StreamVerifier::MatchWrittenBlock(StreamFile &stream, u64 blockstart)
+{
+  if (stream.matches.find(blockstart) != stream.matches.end())
+    return true;
+
+  // Would a full block run past the end of the file
+  u64 blocklength = blocksize;
+  if (stream.filesize != ~(u64)0)
+    blocklength = std::min(blocksize, stream.filesize - blockstart);
+  u64 blockend = blockstart + blocklength;
+
+  // Has the whole block been written (the ranges are merged, so one range
+  // must cover it)
+  std::map<u64, u64>::iterator range = stream.written.upper_bound(blockstart);
+  if (range == stream.written.begin())
+    return true;
+  --range;
+  if (range->second < blockend)
+    return true;
+
+  std::vector<u8> block((size_t)blocklength);
+  if (!ReadWritten(stream, blockstart, &block[0], (size_t)blocklength))
+    return false;
+
+  MD5Hash hash;
+  u32 crc = MD5CRC_Calc(&block[0], (size_t)blocklength, (size_t)(blocksize - blocklength), hash.hash);
+
+  MatchBlock(stream, blockstart, blocklength, hash, crc);
+
+  return true;
+}
+
+bool Par2StreamVerifier::ReadWritten(StreamFile &stream, u64 offset, void *buffer, size_t length)
+{
+  if (stream.reader == 0)
+  {
+    stream.reader = new DiskFile(sout, serr, output_lock, fileaccess);
+    if (!stream.reader->Open(stream.filename, stream.end))
+    {
+      delete stream.reader;
+      stream.reader = 0;
+
+      std::lock_guard<std::mutex> lock(output_lock);
+      serr << "Could not open " << stream.filename << std::endl;
+      return false;
+    }
+  }
+
+  // The data should already be in the file
+  return stream.reader->Read(offset, buffer, length);
+}
+
+void Par2StreamVerifier::MatchBlock(StreamFile &stream, u64 offset, u64 length, const MD5Hash &hash, u32 crc)
+{
+  // Has the block already been matched from data that arrived out of order
+  if (stream.matches.find(offset) != stream.matches.end())
+    return;
+
+  std::lock_guard<std::mutex> lock(streamlock);
+
+  // Is it the block which belongs there
+  Par2RepairerSourceFile *sourcefile = stream.sourcefile;
+  if (sourcefile && sourcefile->GetVerificationPacket() && offset / blocksize < sourcefile->BlockCount())
+  {
+    u32 blocknumber = (u32)(offset / blocksize);
+    const FILEVERIFICATIONENTRY *entry = sourcefile->GetVerificationPacket()->VerificationEntry(blocknumber);
+    u32 block = (u32)(sourcefile->SourceBlocks() - sourceblocks.begin()) + blocknumber;
+
+    if (entry->crc == crc && entry->hash == hash && sourceblocks[block].GetLength() == length && !found[block])
+    {
+      stream.matches[offset] = block;
+      found[block] = true;
+      foundcount++;
+      return;
+    }
+  }
+
+  // Is it a block from somewhere else
+  const VerificationHashEntry *entry = verificationhashtable.Lookup(crc);
+  if (entry)
+    entry = verificationhashtable.Lookup(entry, hash);
+
+  while (entry)
+  {
+    u32 block = (u32)(entry->GetDataBlock() - &sourceblocks[0]);
+
+    if (entry->GetDataBlock()->GetLength() == length && !found[block])
+    {
+      stream.matches[offset] = block;
+      found[block] = true;
+      foundcount++;
+      return;
+    }
+
+    entry = entry->Same();
+  }
+}
+
+bool Par2StreamVerifier::FinishStream(StreamFile &stream)
+{
+  // If the file wasn't expected to be a particular size, it ends wherever the
+  // data does, which may complete a short block at the end
+  if (stream.sourcefile == 0)
+  {
+    stream.filesize = stream.end;
+
+    u64 blockstart = stream.end - stream.end % blocksize;
+    if (blockstart < stream.end)
+    {
+      if (stream.hashed == stream.end)
+      {
+        MD5Hash hash;
+        u32 crc = HasherGetBlock(stream.hasher, hash, blocksize - (stream.end - blockstart));
+
+        MatchBlock(stream, blockstart, stream.end - blockstart, hash, crc);
+      }
+      else if (!MatchWrittenBlock(stream, blockstart))
+      {
+        return false;
+      }
+    }
+  }
+  stream.written.clear();
+
+  if (stream.reader)
+  {
+    stream.reader->Close();
+    delete stream.reader;
+    stream.reader = 0;
+  }
+
+  // The data should now be in the file
+  if (!stream.diskfile->Open(stream.filename, stream.end))
+  {
+    std::lock_guard<std::mutex> lock(output_lock);
+    serr << "Could not open " << stream.filename << std::endl;
+    return false;
+  }
+  stream.diskfile->Close();
+
+  std::string name;
+  DiskFile::SplitRelativeFilename(stream.filename, basepath, name);
+
+  std::lock_guard<std::mutex> lock(streamlock);
+
+  if (!diskFileMap.Insert(stream.diskfile))
+  {
+    std::lock_guard<std::mutex> lock(output_lock);
+    serr << "Source file " << name << " is a duplicate." << std::endl;
+    return false;
+  }
+  stream.finished = true;
+
+  // Record where the blocks are
+  for (std::map<u64, u32>::iterator match = stream.matches.begin(); match != stream.matches.end(); ++match)
+  {
+    sourceblocks[match->second].SetLocation(stream.diskfile, match->first);
+  }
+
+  // Is it a perfect match for its source file
+  Par2RepairerSourceFile *sourcefile = stream.sourcefile;
+  bool complete = false;
+  if (sourcefile != 0 &&
+      stream.end == sourcefile->GetDescriptionPacket()->FileSize() &&
+      stream.hashed == stream.end)
+  {
+    MD5Hash hashfull;
+    stream.hasher->end(hashfull.hash);
+
+    // If there wasn't 16k of data, the 16k hash is the same as the full hash
+    if (stream.end < 16384)
+      stream.hash16k = hashfull;
+
+    if (hashfull == sourcefile->GetDescriptionPacket()->HashFull() &&
+        stream.hash16k == sourcefile->GetDescriptionPacket()->Hash16k())
+    {
+      complete = true;
+      sourcefile->SetCompleteFile(stream.diskfile);
+
+      // All of its blocks are here, even if they weren't all matched (as
+      // when there is no verification packet)
+      std::vector<DataBlock>::iterator sb = sourcefile->SourceBlocks();
+      for (u32 blocknumber=0; blocknumber<sourcefile->BlockCount(); ++blocknumber, ++sb)
+      {
+        (*sb).SetLocation(stream.diskfile, (u64)blocknumber * blocksize);
+
+        u32 block = (u32)(sb - sourceblocks.begin());
+        if (!found[block])
+        {
+          found[block] = true;
+          foundcount++;
+        }
+      }
+    }
+  }
+
+  if (noiselevel > nlSilent)
+  {
+    std::lock_guard<std::mutex> lock(output_lock);
+    if (complete)
+    {
+      sout << "Target: \"" << name << "\" - found." << std::endl;
+    }
+    else if (sourcefile != 0)
+    {
+      sout << "Target: \"" << name << "\" - damaged. Found "
+        << (u32)stream.matches.size() << " of " << sourcefile->BlockCount()
+        << " data blocks." << std::endl;
+    }
+    else
+    {
+      sout << "File: \"" << name << "\" - found "
+        << (u32)stream.matches.size() << " data blocks." << std::endl;
+    }
+  }
+
+  return true;
+}
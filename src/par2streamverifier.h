@@ -0,0 +1,116 @@
+#ifndef __PAR2STREAMVERIFIER_H__
+#define __PAR2STREAMVERIFIER_H__
+
+// Verification of data files whilst they are still being written, e.g. by a
+// downloader.
+// Rather than reading the files back once they are complete, the data is
+// passed in as it arrives and is matched against the data blocks of the
+// recovery set there and then, so that by the time the files are complete
+// they have already been verified, and can be repaired straight away.
+//
+// Data is only matched at the offsets at which the blocks belong, so data
+// which has been shifted (e.g. by inserted or lost bytes) isn't found. Only
+// where data which arrives out of order was written is kept: any blocks that
+// it completes are read back from the file and matched immediately, and the
+// rest of it is read back once the data before it arrives, as the file
+// hashes have to be computed in order.
+
+class Par2StreamVerifier : protected Par2Repairer
+{
+public:
+  Par2StreamVerifier(std::ostream &sout, std::ostream &serr, const NoiseLevel noiselevel);
+  ~Par2StreamVerifier(void);
+
+  // Load the critical packets from the PAR2 files. basepath is where the
+  // data files are (to be) written.
+  Result Open(const std::string &basepath,
+              const u32 filethreads,
+              const std::string &parfilename,
+              const std::vector<std::string> &extrafiles);
+
+  // Pass in data that has been written to the specified file at the
+  // specified offset. The data must already be in the file, as it is read
+  // back from there if it is needed for a repair.
+  // Files may be written concurrently, but not the same file.
+  bool Write(const std::string &filename, u64 offset, const void *buffer, size_t length);
+
+  // Indicate that no more data will be written to the specified file
+  bool Finish(const std::string &filename);
+
+  // How many data blocks are there, how many have been found so far, and
+  // how many recovery blocks are there to make up for the missing ones
+  u32 BlockCount(void) const {return sourceblockcount;}
+  u32 AvailableBlockCount(void);
+  u32 MissingBlockCount(void) {return sourceblockcount - AvailableBlockCount();}
+  u32 RecoveryBlockCount(void) const {return (u32)recoverypacketmap.size();}
+
+  // Whether the data found so far is enough to repair the files
+  bool RepairPossible(void) {return RecoveryBlockCount() >= MissingBlockCount();}
+
+  // Finish all of the files, verify any data files that exist but were not
+  // written (from disk, as usual) and report the results: eSuccess if all
+  // files are complete, otherwise eRepairPossible or eRepairNotPossible.
+  Result Verify(void);
+
+  // Repair the files once they have been verified
+  Result Repair(const size_t memorylimit, const u32 nthreads);
+
+protected:
+  // The data written to a file so far
+  struct StreamFile
+  {
+    StreamFile(void);
+    ~StreamFile(void);
+
+    std::mutex               lock;
+    std::string              filename;
+    DiskFile                *diskfile;     // The file (only opened when it's finished)
+    DiskFile                *reader;       // The file as it's written, to read data back
+    Par2RepairerSourceFile  *sourcefile;   // The source file it is the target of, if any
+    u64                      filesize;     // How large it should be, if it's known
+    u64                      end;          // How much has been written to it
+
+    IHasherInput            *hasher;       // Block and file hashes of the data, in order
+    u64                      hashed;       // How much data has been hashed
+    MD5Context               context16k;   // The hash of the first 16k
+    MD5Hash                  hash16k;
+
+    std::map<u64, u64>       written;      // Data which can't be hashed yet, from start to end
+    std::map<u64, u32>       matches;      // The blocks found, by offset
+    bool                     finished;
+  };
+
+  // Hash data which follows on from the data already hashed
+  void HashData(StreamFile &stream, const u8 *buffer, size_t length);
+
+  // Hash the data written beyond what has been hashed which now follows on
+  // from it, reading it back from the file
+  bool HashWritten(StreamFile &stream);
+
+  // Note where data which arrived out of order was written, matching any
+  // blocks that it completes
+  bool NoteWritten(StreamFile &stream, u64 offset, size_t length);
+
+  // Look for the block with the specified hash and crc
+  void MatchBlock(StreamFile &stream, u64 offset, u64 length, const MD5Hash &hash, u32 crc);
+
+  // Match the block at the specified offset if the data written covers it,
+  // reading it back from the file
+  bool MatchWrittenBlock(StreamFile &stream, u64 offset);
+
+  // Read data which has been written back from the file
+  bool ReadWritten(StreamFile &stream, u64 offset, void *buffer, size_t length);
+
+  // Record where the blocks found in the file are, and whether it's complete
+  bool FinishStream(StreamFile &stream);
+
+protected:
+  std::mutex                                  streamlock;   // Guards streams and found
+  std::map<std::string, StreamFile*>          streams;      // Files being written, by name
+  std::map<std::string, Par2RepairerSourceFile*> targets;   // Source files, by target name
+  std::vector<bool>                           found;        // Which blocks have been found
+  u32                                         foundcount;
+  bool                                        verified;     // Whether Verify has been done
+};
+
+#endif // __PAR2STREAMVERIFIER_H__
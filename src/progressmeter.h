@@ -24,123 +24,192 @@
 #include <atomic>
 #include <mutex>
 
-template<typename TValue>
-class ProgressMeter
+// Progress output as text (for commandline, to cout), which is what is used
+// unless an application supplies a ProgressListener of its own
+class TextProgressListener : public ProgressListener
 {
-  using steady_clock = std::chrono::steady_clock;
-  const std::chrono::milliseconds PRINT_INTERVAL = std::chrono::milliseconds(50);
-
   std::ostream &sout;        // stream for output (for commandline, this is cout)
-  const std::string message; // message to display alongside percentage
-  const float scale;         // pre-computed multiplier to convert progress value into a percentage*10
-  TValue current;            // last known progress value
-  steady_clock::duration::rep printed; // last time progress was outputted
+  std::mutex &output_lock;
+  const NoiseLevel noiselevel;
+  std::string label;         // message displayed alongside the percentage of the last phase started
+  u32 fraction;              // percentage*10 last displayed
 
-  inline u32 CalcThousandths(TValue val) const
+  static std::string Label(ProgressPhase phase, const std::string &subject)
   {
-    return (u32)(scale * val + 0.5f);
+    switch (phase)
+    {
+    case ppLoading:      return "Loading: ";
+    case ppHashing:      return "";
+    case ppScanning:     return subject.empty() ? "Scanning: " : "Scanning: \"" + subject + "\": ";
+    case ppConstructing: return "Constructing: ";
+    case ppSolving:      return "Solving: ";
+    case ppProcessing:   return "Processing: ";
+    case ppRepairing:    return "Repairing: ";
+    }
+    return "";
   }
-  inline bool PrintFraction(TValue oldval, TValue newval)
+
+public:
+  TextProgressListener(std::ostream &sout, std::mutex &output_lock, const NoiseLevel noiselevel) :
+    sout(sout), output_lock(output_lock), noiselevel(noiselevel), label(), fraction(0) {}
+
+  virtual void PhaseStarted(ProgressPhase phase, const std::string &subject, u64 /*total*/)
   {
+    std::lock_guard<std::mutex> lock(output_lock);
+    label = Label(phase, subject);
+    fraction = 0;
+  }
+  virtual void PhaseProgress(ProgressPhase phase, const std::string &subject, u64 done, u64 total, double /*rate*/)
+  {
+    if (noiselevel <= nlQuiet)
+      return;
+
+    u32 newfraction = (done >= total) ? 1000 : (u32)(1000.0 * done / total + 0.5);
+    std::lock_guard<std::mutex> lock(output_lock);
     // if the displayed value won't change, don't print
-    u32 newfraction = CalcThousandths(newval);
-    if (CalcThousandths(oldval) == newfraction)
-      return false;
+    if (newfraction == fraction)
+      return;
+    fraction = newfraction;
+    sout << Label(phase, subject) << newfraction/10 << '.' << newfraction%10 << "%\r" << std::flush;
+  }
+  // print a line whilst progress is still running
+  virtual void PhaseMessage(ProgressPhase /*phase*/, const std::string &line)
+  {
+    std::lock_guard<std::mutex> lock(output_lock);
+    sout << std::setw(label.size()+7) << std::setfill(' ') << "\r"
+      << line << '\n'
+      << label << fraction/10 << '.' << fraction%10 << "%\r" << std::flush;
+  }
+};
 
-    // check if enough time has passed
-    steady_clock::time_point now = steady_clock::now();
-    steady_clock::time_point lastpoint = steady_clock::time_point(steady_clock::duration(printed));
+// Tracks the progress of a phase, and reports it to a ProgressListener.
+// Progress is reported when it has advanced by at least 0.1%, and at least
+// PROGRESS_INTERVAL has passed since it was last reported, or it's complete,
+// so that the cost of most updates is only that of an addition and comparison.
+#define PROGRESS_INTERVAL std::chrono::milliseconds(50)
 
-    // if enough time has passed, print the current progress, and update the time record
-    if (now - lastpoint >= PRINT_INTERVAL || newfraction == 1000)
+template<typename TValue>
+class ProgressMeter
+{
+  using steady_clock = std::chrono::steady_clock;
+
+  ProgressListener &listener;
+  const ProgressPhase phase;
+  const std::string subject; // the file the phase is for, if any
+  const TValue total;
+  const TValue step;         // how far progress must advance before it's reported
+  TValue current;            // last known progress value
+  TValue next;               // progress value at which to consider reporting again
+  const steady_clock::time_point started;
+  steady_clock::time_point reported; // last time progress was reported
+
+  void Report(void)
+  {
+    steady_clock::time_point now = steady_clock::now();
+    if (now - reported >= PROGRESS_INTERVAL || current >= total)
     {
-      sout << message << newfraction/10 << '.' << newfraction%10 << "%\r" << std::flush;
-      printed = now.time_since_epoch().count();
-      return true;
+      std::chrono::duration<double> elapsed = now - started;
+      listener.PhaseProgress(phase, subject, current, total, elapsed.count() > 0 ? current / elapsed.count() : 0.0);
+      reported = now;
     }
-    return false;
+    // completion is always reported
+    next = (current < total && total - current < step) ? total : current + step;
   }
 
 public:
-  ProgressMeter(std::ostream &sout, const std::string &message, TValue total) :
-    sout(sout), message(message), scale(1000.0f / total), current(0), printed(0) {}
-  ProgressMeter(std::ostream &sout, const char *message, TValue total) :
-    sout(sout), message(message), scale(1000.0f / total), current(0), printed(0) {}
+  ProgressMeter(ProgressListener &listener, ProgressPhase phase, TValue total, const std::string &subject = std::string()) :
+    listener(listener), phase(phase), subject(subject), total(total), step(std::max(total / 1000, (TValue)1)),
+    current(0), next(step), started(steady_clock::now()), reported()
+  {
+    listener.PhaseStarted(phase, subject, total);
+  }
+  ~ProgressMeter(void)
+  {
+    listener.PhaseFinished(phase, subject);
+  }
 
-  // NOTE: Update() doesn't always update current value, so don't mix it with Add()
   void Update(TValue newval)
   {
-    if (PrintFraction(current, newval))
-      current = newval;
+    current = newval;
+    if (current >= next)
+      Report();
   }
   void Add(TValue amount)
   {
-    TValue oldval = current;
     current += amount;
-    PrintFraction(oldval, current);
+    if (current >= next)
+      Report();
   }
 };
 
+// As above, for progress made by several threads at once. Progress is only
+// reported by one thread at a time, and only ever forwards: a thread which
+// finds another reporting skips its report (so updates needn't wait), and
+// completion is reported exactly once, by whichever thread completes it.
 template<typename TValue>
 class MTProgressMeter
 {
   using steady_clock = std::chrono::steady_clock;
-  const std::chrono::milliseconds PRINT_INTERVAL = std::chrono::milliseconds(50);
 
-  std::ostream &sout;         // stream for output (for commandline, this is cout)
-  const std::string message;  // message to display alongside percentage
-  const float scale;          // pre-computed multiplier to convert progress value into a percentage*10
+  ProgressListener &listener;
+  const ProgressPhase phase;
+  const std::string subject;  // the file the phase is for, if any
+  const TValue total;
+  const TValue step;          // how far progress must advance before it's reported
   std::atomic<TValue> current; // last known progress value
-  std::atomic<steady_clock::duration::rep> printed; // last time progress was outputted
-  std::mutex &output_lock;
-
-  inline u32 CalcThousandths(TValue val) const
-  {
-    return (u32)(scale * val + 0.5f);
-  }
-  inline bool PrintFraction(TValue oldval, TValue newval)
+  std::atomic<TValue> next;    // progress value at which to consider reporting again
+  const steady_clock::time_point started;
+  std::atomic<steady_clock::duration::rep> reported; // last time progress was reported
+  std::mutex reporting;       // held whilst progress is being reported
+  TValue lastreported;        // progress value last reported (guarded by reporting)
+  bool completed;             // whether completion has been reported (guarded by reporting)
+
+  void Report(TValue newval)
   {
-    // if the displayed value won't change, don't print
-    u32 newfraction = CalcThousandths(newval);
-    if (CalcThousandths(oldval) == newfraction)
-      return false;
-
-    // check if enough time has passed
     steady_clock::time_point now = steady_clock::now();
-    steady_clock::time_point lastpoint = steady_clock::time_point(steady_clock::duration(printed.load(std::memory_order_relaxed)));
+    steady_clock::duration::rep last = reported.load(std::memory_order_relaxed);
+    bool complete = newval >= total;
 
-    // if enough time has passed, print the current progress, and update the time record
-    if (now - lastpoint >= PRINT_INTERVAL || newfraction == 1000)
+    if (complete || now - steady_clock::time_point(steady_clock::duration(last)) >= PROGRESS_INTERVAL)
     {
-      output_lock.lock();
-      sout << message << newfraction/10 << '.' << newfraction%10 << "%\r" << std::flush;
-      output_lock.unlock();
-      printed.store(now.time_since_epoch().count(), std::memory_order_relaxed);
-      return true;
+      // completion waits for any other report to finish, so that it comes last
+      std::unique_lock<std::mutex> lock(reporting, std::defer_lock);
+      if (complete)
+        lock.lock();
+      if ((complete || lock.try_lock()) && !completed && (newval > lastreported || complete))
+      {
+        lastreported = newval;
+        completed = complete;
+        reported.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        std::chrono::duration<double> elapsed = now - started;
+        listener.PhaseProgress(phase, subject, newval, total, elapsed.count() > 0 ? newval / elapsed.count() : 0.0);
+      }
     }
-    return false;
+    next.store((newval < total && total - newval < step) ? total : newval + step, std::memory_order_relaxed);
   }
 
 public:
-  MTProgressMeter(std::ostream &sout, const std::string &message, TValue total, std::mutex &output_lock) :
-    sout(sout), message(message), scale(1000.0f / total), current(0), printed(0), output_lock(output_lock) {}
-  MTProgressMeter(std::ostream &sout, const char *message, TValue total, std::mutex &output_lock) :
-    sout(sout), message(message), scale(1000.0f / total), current(0), printed(0), output_lock(output_lock) {}
+  MTProgressMeter(ProgressListener &listener, ProgressPhase phase, TValue total, const std::string &subject = std::string()) :
+    listener(listener), phase(phase), subject(subject), total(total), step(std::max(total / 1000, (TValue)1)),
+    current(0), next(step), started(steady_clock::now()), reported(0), reporting(), lastreported(0), completed(false)
+  {
+    listener.PhaseStarted(phase, subject, total);
+  }
+  ~MTProgressMeter(void)
+  {
+    listener.PhaseFinished(phase, subject);
+  }
 
   void Add(TValue amount)
   {
-    TValue oldval = current.fetch_add(amount, std::memory_order_relaxed);
-    PrintFraction(oldval, oldval + amount);
+    TValue newval = current.fetch_add(amount, std::memory_order_relaxed) + amount;
+    if (newval >= next.load(std::memory_order_relaxed))
+      Report(newval);
   }
   // print a line whilst progress is still running
   void PrintLine(const std::string &line)
   {
-    TValue val = current.load(std::memory_order_relaxed);
-    u32 fraction = CalcThousandths(val);
-    std::lock_guard<std::mutex> lock(output_lock);
-    sout << std::setw(message.size()+7) << std::setfill(' ') << "\r"
-      << line << '\n'
-      << message << fraction/10 << '.' << fraction%10 << "%\r" << std::flush;
+    listener.PhaseMessage(phase, line);
   }
 };
 
@@ -35,6 +35,7 @@ RecoveryPacket::RecoveryPacket(void)
   diskfile = NULL;
   offset = 0;
   packetcontext = NULL;
+  headerwritten = false;
 }
 
 RecoveryPacket::~RecoveryPacket(void)
@@ -88,9 +89,41 @@ bool RecoveryPacket::WriteData(u64 position,
   return datablock.WriteData(position, size, buffer, wrote);
 }
 
+// Queue a write of data from the buffer to the data block on disk
+IOQueue::Ticket RecoveryPacket::QueueWriteData(IOQueue &queue,
+                                               u64 position,
+                                               size_t size,
+                                               const void *buffer)
+{
+  // Update the packet hash
+  packetcontext->Update(buffer, size);
+
+  // Queue the write to the data block
+  size_t wrote;
+  return datablock.QueueWrite(queue, position, size, buffer, wrote);
+}
+
+// Finish the packet, given all of its data, ready for it to be written out
+void RecoveryPacket::FinishPacket(const void *buffer, DiskFile::WriteBuffer (&parts)[2])
+{
+  // Update and finish the packet hash
+  packetcontext->Update(buffer, (size_t)BlockSize());
+  packetcontext->Final(packet.header.hash);
+  headerwritten = true;
+
+  parts[0].buffer = &packet;
+  parts[0].length = sizeof(packet);
+  parts[1].buffer = buffer;
+  parts[1].length = (size_t)BlockSize();
+}
+
 // Write the header of the packet to disk
 bool RecoveryPacket::WriteHeader(void)
 {
+  // Nothing to do if it went out along with the data
+  if (headerwritten)
+    return true;
+
   // Finish computing the packet hash
   packetcontext->Final(packet.header.hash);
 
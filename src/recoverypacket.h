@@ -46,6 +46,15 @@ public:
   bool WriteData(u64         position,  // Relative position within the data block
                  size_t      size,      // Size of data to write to block
                  const void *buffer);   // Buffer containing the data to write
+  // The same as WriteData, but with the write done via an IOQueue.
+  IOQueue::Ticket QueueWriteData(IOQueue    &queue,
+                                 u64         position,
+                                 size_t      size,
+                                 const void *buffer);
+  // For when the buffer holds all of the recovery data: finish computing the
+  // hash of the packet, and set out the header and the data to be written
+  // to disk together, at Offset(). WriteHeader then has nothing left to do.
+  void FinishPacket(const void *buffer, DiskFile::WriteBuffer (&parts)[2]);
   // Finish computing the hash of the recovery packet and write the header to disk.
   bool WriteHeader(void);
 
@@ -57,6 +66,9 @@ public:
   // Get the length of the packet.
   u64 PacketLength(void) const;
 
+  // The offset of the packet within its file
+  u64 Offset(void) const;
+
   // The exponent of the packet.
   u32 Exponent(void) const;
 
@@ -73,6 +85,7 @@ protected:
   RECOVERYBLOCKPACKET packet;         // The packet (excluding the actual recovery data)
 
   MD5Context         *packetcontext;  // MD5 Context used to compute the packet hash
+  bool                headerwritten;  // Whether the header has been written (or is being)
 
   DataBlock           datablock;      // The recovery data block.
 };
@@ -82,6 +95,11 @@ inline u64 RecoveryPacket::PacketLength(void) const
   return packet.header.length;
 }
 
+inline u64 RecoveryPacket::Offset(void) const
+{
+  return offset;
+}
+
 inline u32 RecoveryPacket::Exponent(void) const
 {
   return packet.exponent;
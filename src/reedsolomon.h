@@ -58,8 +58,9 @@ public:
   bool SetOutput(bool present, u16 exponent);
   bool SetOutput(bool present, u16 lowexponent, u16 highexponent);
 
-  // Compute the RS Matrix
-  bool Compute(NoiseLevel noiselevel, std::ostream &sout, std::ostream &serr);
+  // Compute the RS Matrix, reporting progress to progresslistener (or as
+  // text to sout, if 0)
+  bool Compute(NoiseLevel noiselevel, std::ostream &sout, std::ostream &serr, ProgressListener *progresslistener = 0);
 
   // Process a block of data
   bool Process(size_t size,             // The size of the block of data
@@ -78,6 +79,7 @@ protected:
   bool GaussElim(NoiseLevel noiselevel,
 		 std::ostream &sout,
 		 std::ostream &serr,
+		 ProgressListener &progresslistener,
 		 unsigned int rows,
                  unsigned int leftcols,
                  G *leftmatrix,
@@ -221,7 +223,7 @@ inline bool ReedSolomon<g>::SetOutput(bool present, u16 lowexponent, u16 highexp
 
 // Construct the Vandermonde matrix and solve it if necessary
 template<class g>
-inline bool ReedSolomon<g>::Compute(NoiseLevel noiselevel, std::ostream &sout, std::ostream &serr)
+inline bool ReedSolomon<g>::Compute(NoiseLevel noiselevel, std::ostream &sout, std::ostream &serr, ProgressListener *progresslistener)
 {
   u32 outcount = datamissing + parmissing;
   u32 incount = datapresent + datamissing;
@@ -240,7 +242,11 @@ inline bool ReedSolomon<g>::Compute(NoiseLevel noiselevel, std::ostream &sout, s
   if (noiselevel > nlQuiet)
     sout << "Computing Reed Solomon matrix." << std::endl;
 
-  ProgressMeter<u32> progress(sout, "Constructing: ", datamissing+parmissing);
+  std::mutex output_lock;
+  TextProgressListener textprogress(sout, output_lock, noiselevel);
+  ProgressListener &listener = progresslistener ? *progresslistener : textprogress;
+
+  std::unique_ptr<ProgressMeter<u32>> progress(new ProgressMeter<u32>(listener, ppConstructing, datamissing+parmissing));
 
   /*  Layout of RS Matrix:
       NOTE: The second set of columns represents the parity vectors present,
@@ -280,8 +286,7 @@ inline bool ReedSolomon<g>::Compute(NoiseLevel noiselevel, std::ostream &sout, s
   // One row for each present recovery block that will be used for a missing data block
   for (unsigned int row=0; row<datamissing; row++)
   {
-    if (noiselevel > nlQuiet)
-      progress.Update(row);
+    progress->Update(row);
 
     // Get the exponent of the next present recovery block
     while (!outputrow->present)
@@ -321,8 +326,7 @@ inline bool ReedSolomon<g>::Compute(NoiseLevel noiselevel, std::ostream &sout, s
   outputrow = outputrows.begin();
   for (unsigned int row=0; row<parmissing; row++)
   {
-    if (noiselevel > nlQuiet)
-      progress.Update(row+datamissing);
+    progress->Update(row+datamissing);
 
     // Get the exponent of the next missing recovery block
     while (outputrow->present)
@@ -358,6 +362,7 @@ inline bool ReedSolomon<g>::Compute(NoiseLevel noiselevel, std::ostream &sout, s
 
     outputrow++;
   }
+  progress.reset(nullptr);
   if (noiselevel > nlQuiet)
     sout << "Constructing: done." << std::endl;
 
@@ -366,7 +371,7 @@ inline bool ReedSolomon<g>::Compute(NoiseLevel noiselevel, std::ostream &sout, s
   {
     // Perform Gaussian Elimination and then delete the right matrix (which
     // will no longer be required).
-    bool success = GaussElim(noiselevel, sout, serr, outcount, incount, leftmatrix, rightmatrix, datamissing);
+    bool success = GaussElim(noiselevel, sout, serr, listener, outcount, incount, leftmatrix, rightmatrix, datamissing);
     delete [] rightmatrix;
     return success;
   }
@@ -376,7 +381,7 @@ inline bool ReedSolomon<g>::Compute(NoiseLevel noiselevel, std::ostream &sout, s
 
 // Use Gaussian Elimination to solve the matrices
 template<class g>
-inline bool ReedSolomon<g>::GaussElim(NoiseLevel noiselevel, std::ostream &sout, std::ostream &serr, unsigned int rows, unsigned int leftcols, G *leftmatrix, G *rightmatrix, unsigned int datamissing)
+inline bool ReedSolomon<g>::GaussElim(NoiseLevel noiselevel, std::ostream &sout, std::ostream &serr, ProgressListener &progresslistener, unsigned int rows, unsigned int leftcols, G *leftmatrix, G *rightmatrix, unsigned int datamissing)
 {
   if (noiselevel >= nlDebug)
   {
@@ -413,7 +418,7 @@ inline bool ReedSolomon<g>::GaussElim(NoiseLevel noiselevel, std::ostream &sout,
 
   // Solve one row at a time
 
-  ProgressMeter<u32> progress(sout, "Solving: ", datamissing*rows);
+  ProgressMeter<u32> progress(progresslistener, ppSolving, datamissing*rows);
 
   // For each row in the matrix
   for (unsigned int row=0; row<datamissing; row++)
@@ -453,8 +458,7 @@ inline bool ReedSolomon<g>::GaussElim(NoiseLevel noiselevel, std::ostream &sout,
     // For every other row in the matrix
     for (unsigned int row2=0; row2<rows; row2++)
     {
-      if (noiselevel > nlQuiet)
-        progress.Update(row*rows+row2);
+      progress.Update(row*rows+row2);
 
       if (row != row2)
       {
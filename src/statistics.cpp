@@ -0,0 +1,214 @@
+#include "libpar2internal.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+
+Statistics::Statistics(void)
+: started(std::chrono::steady_clock::now())
+, startcpu(ProcessCPUTime())
+, walltime(0)
+, cputime(0)
+, peakmemory(0)
+, memorylimit(0)
+, budgetpeak(0)
+, result(eSuccess)
+, backendmethod()
+, backendthreads(0)
+, backendbatches(0)
+, backendidleevents(0)
+{
+  memset(stages, 0, sizeof(stages));
+}
+
+void Statistics::Add(Stage stage, u64 bytes, double walltime, double cputime)
+{
+  std::lock_guard<std::mutex> l(lock);
+  stages[stage].calls++;
+  stages[stage].bytes += bytes;
+  stages[stage].walltime += walltime;
+  stages[stage].cputime += cputime;
+}
+
+void Statistics::SetBackend(const std::string &method, u32 threads, u64 batches, u64 idleevents)
+{
+  std::lock_guard<std::mutex> l(lock);
+  backendmethod = method;
+  backendthreads = threads;
+  backendbatches += batches;
+  backendidleevents += idleevents;
+}
+
+void Statistics::SetMemory(u64 limit, u64 peak)
+{
+  std::lock_guard<std::mutex> l(lock);
+  memorylimit = limit;
+  budgetpeak = peak;
+}
+
+void Statistics::Finish(Result _result)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+  walltime = elapsed.count();
+  cputime = ProcessCPUTime() - startcpu;
+  peakmemory = ProcessPeakMemory();
+  result = _result;
+}
+
+void Statistics::WriteJSON(std::ostream &out) const
+{
+  std::lock_guard<std::mutex> l(lock);
+
+  std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(6);
+
+  out << "{\n"
+    "  \"result\": " << (int)result << ",\n"
+    "  \"wall_time\": " << walltime << ",\n"
+    "  \"cpu_time\": " << cputime << ",\n"
+    "  \"peak_memory\": " << peakmemory << ",\n"
+    "  \"memory_budget\": {\"limit\": " << memorylimit << ", \"peak\": " << budgetpeak << "},\n"
+    "  \"stages\": {";
+
+  const char *separator = "\n";
+  for (int stage = 0; stage < stCount; stage++)
+  {
+    const StageStatistics &s = stages[stage];
+    if (s.calls == 0)
+      continue;
+
+    out << separator << "    \"" << StageName((Stage)stage) << "\": {"
+      "\"calls\": " << s.calls << ", "
+      "\"bytes\": " << s.bytes << ", "
+      "\"wall_time\": " << s.walltime << ", "
+      "\"cpu_time\": " << s.cputime;
+    // Bytes per second, for stages which process data
+    if (s.bytes > 0 && s.walltime > 0)
+      out << ", \"throughput\": " << s.bytes / s.walltime;
+    out << "}";
+    separator = ",\n";
+  }
+  out << (*separator == ',' ? "\n  },\n" : "},\n");
+
+  // The method name is one of ParPar's, which needs no escaping
+  out << "  \"backend\": {"
+    "\"method\": \"" << backendmethod << "\", "
+    "\"threads\": " << backendthreads << ", "
+    "\"batches_started\": " << backendbatches;
+#ifdef DEBUG_STAT_THREAD_EMPTY
+  out << ", \"worker_idle_events\": " << backendidleevents;
+#endif
+  out << "}\n"
+    "}" << std::endl;
+
+  out.flags(flags);
+}
+
+const char* Statistics::StageName(Stage stage)
+{
+  switch (stage)
+  {
+  case stLoading:     return "loading";
+  case stHashing:     return "hashing";
+  case stScanning:    return "scanning";
+  case stMatrix:      return "matrix";
+  case stProcessing:  return "processing";
+  case stCritical:    return "critical_packets";
+  case stReading:     return "reading";
+  case stBackendAdd:  return "backend_add";
+  case stBackendWait: return "backend_wait";
+  case stOutput:      return "output";
+  case stWriting:     return "writing";
+  default:            return "unknown";
+  }
+}
+
+#ifdef _WIN32
+static double FileTimeSeconds(const FILETIME &ft)
+{
+  return (((u64)ft.dwHighDateTime << 32) | ft.dwLowDateTime) * 1e-7;
+}
+
+double Statistics::ProcessCPUTime(void)
+{
+  FILETIME creation, exit, kernel, user;
+  if (!::GetProcessTimes(::GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    return 0;
+  return FileTimeSeconds(kernel) + FileTimeSeconds(user);
+}
+
+double Statistics::ThreadCPUTime(void)
+{
+  FILETIME creation, exit, kernel, user;
+  if (!::GetThreadTimes(::GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return 0;
+  return FileTimeSeconds(kernel) + FileTimeSeconds(user);
+}
+
+u64 Statistics::ProcessPeakMemory(void)
+{
+  // As with GlobalMemoryStatusEx in CommandLine, look the function up rather
+  // than link with psapi
+  u64 peak = 0;
+
+  HMODULE hLib = ::LoadLibraryA("kernel32.dll");
+  if (NULL != hLib)
+  {
+    BOOL (WINAPI *pfn)(HANDLE, PPROCESS_MEMORY_COUNTERS, DWORD) =
+      (BOOL (WINAPI*)(HANDLE, PPROCESS_MEMORY_COUNTERS, DWORD))::GetProcAddress(hLib, "K32GetProcessMemoryInfo");
+
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (NULL != pfn && pfn(::GetCurrentProcess(), &pmc, sizeof(pmc)))
+      peak = pmc.PeakWorkingSetSize;
+
+    ::FreeLibrary(hLib);
+  }
+
+  return peak;
+}
+#else
+double Statistics::ProcessCPUTime(void)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+    (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+double Statistics::ThreadCPUTime(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+  return 0;
+#endif
+}
+
+u64 Statistics::ProcessPeakMemory(void)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return (u64)usage.ru_maxrss;         // bytes
+#else
+  return (u64)usage.ru_maxrss * 1024;  // kilobytes
+#endif
+}
+#endif
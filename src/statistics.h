@@ -0,0 +1,145 @@
+#ifndef __STATISTICS_H__
+#define __STATISTICS_H__
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// How long each stage of creating or repairing took, and how much work it
+// did, so that it can be seen where the time goes. An application passes one
+// to par2create or par2repair, and can then read it, or write it as JSON.
+//
+// The stages up to stProcessing are the steps of the operation, which are
+// timed from start to finish, with the CPU time being that of the whole
+// process (all threads) whilst they ran; the matrix is computed whilst
+// other steps are running, so its CPU time overlaps theirs. The stages from
+// stReading are what the thread driving processing spends its time in
+// (mostly waiting), which are timed for each call, with the CPU time being
+// that of the thread.
+
+class Statistics
+{
+public:
+  typedef enum
+  {
+    stLoading = 0,   // Loading packets from PAR2 files
+    stHashing,       // Hashing the source files (creating)
+    stScanning,      // Scanning files for data blocks (verifying)
+    stMatrix,        // Computing the Reed Solomon matrix (repairing)
+    stProcessing,    // Computing recovery data or repaired data, in total
+    stCritical,      // Writing the critical packets (creating)
+
+    stReading,       // Waiting for source data to be read
+    stBackendAdd,    // Passing data to the backend to be computed with
+    stBackendWait,   // Waiting for the backend to accept data, or finish
+    stOutput,        // Waiting for computed data from the backend
+    stWriting,       // Waiting for recovery or repaired data to be written
+
+    stCount
+  } Stage;
+
+  struct StageStatistics
+  {
+    u64    calls;     // How many times the stage was done
+    u64    bytes;     // How much data it processed
+    double walltime;  // Seconds
+    double cputime;   // Seconds
+  };
+
+public:
+  Statistics(void);
+
+  // Record some time spent in a stage (this is thread safe)
+  void Add(Stage stage, u64 bytes, double walltime, double cputime);
+
+  // Note the backend's counters once processing has finished
+  void SetBackend(const std::string &method, u32 threads, u64 batches, u64 idleevents);
+
+  // Note the memory limit, and the most memory accounted for against it
+  void SetMemory(u64 limit, u64 peak);
+
+  // Note the totals, once the operation has finished
+  void Finish(Result result);
+
+  // Write everything recorded as a JSON object
+  void WriteJSON(std::ostream &out) const;
+
+  const StageStatistics& GetStage(Stage stage) const {return stages[stage];}
+  double WallTime(void) const {return walltime;}
+  double CPUTime(void) const {return cputime;}
+  u64 PeakMemory(void) const {return peakmemory;}
+  u64 MemoryLimit(void) const {return memorylimit;}
+  u64 PeakBudgetedMemory(void) const {return budgetpeak;}
+
+  static const char* StageName(Stage stage);
+
+  // The CPU time used by the whole process, and by the calling thread
+  static double ProcessCPUTime(void);
+  static double ThreadCPUTime(void);
+
+  // The most memory the process has used
+  static u64 ProcessPeakMemory(void);
+
+protected:
+  mutable std::mutex                    lock;        // Guards stages
+  StageStatistics                       stages[stCount];
+
+  std::chrono::steady_clock::time_point started;
+  double                                startcpu;
+  double                                walltime;    // Of the whole operation
+  double                                cputime;
+  u64                                   peakmemory;  // Of the process, as the OS sees it
+  u64                                   memorylimit; // The -m limit (0 if none)
+  u64                                   budgetpeak;  // The most accounted for against the limit
+  Result                                result;
+
+  std::string                           backendmethod;
+  u32                                   backendthreads;
+  u64                                   backendbatches;     // Batches of input the backend started computing
+  u64                                   backendidleevents;  // Times a backend worker ran out of work
+};
+
+// Times a stage whilst it's in scope, if statistics are being kept, and
+// records it in the trace, if tracing
+class StageTimer
+{
+public:
+  StageTimer(Statistics *statistics, Statistics::Stage stage, u64 bytes = 0)
+  : statistics(statistics)
+  , stage(stage)
+  , bytes(bytes)
+  , traced(Trace::Enabled())
+  {
+    if (statistics || traced)
+      started = std::chrono::steady_clock::now();
+    if (statistics)
+      startcpu = stage < Statistics::stReading ? Statistics::ProcessCPUTime() : Statistics::ThreadCPUTime();
+  }
+  ~StageTimer(void)
+  {
+    if (statistics || traced)
+    {
+      std::chrono::steady_clock::time_point finished = std::chrono::steady_clock::now();
+      if (statistics)
+      {
+        std::chrono::duration<double> elapsed = finished - started;
+        double cpu = stage < Statistics::stReading ? Statistics::ProcessCPUTime() : Statistics::ThreadCPUTime();
+        statistics->Add(stage, bytes, elapsed.count(), cpu - startcpu);
+      }
+      if (traced)
+        Trace::Record(Statistics::StageName(stage), "par2",
+                      (u64)started.time_since_epoch().count(), (u64)finished.time_since_epoch().count());
+    }
+  }
+
+protected:
+  Statistics                            *statistics;
+  const Statistics::Stage                stage;
+  const u64                              bytes;
+  const bool                             traced;
+  std::chrono::steady_clock::time_point  started;
+  double                                 startcpu;
+};
+
+#endif // __STATISTICS_H__
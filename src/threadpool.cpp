@@ -0,0 +1,139 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool &ThreadPool::Instance(void)
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+ThreadPool::ThreadPool(void)
+: stopping(false)
+{
+}
+
+ThreadPool::~ThreadPool(void)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeup.notify_all();
+  for (auto &worker : workers)
+    worker.join();
+}
+
+void ThreadPool::Reserve(unsigned count)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (workers.empty())
+  {
+    // size the pool once, to the number of available cores
+    unsigned hwthreads = std::thread::hardware_concurrency();
+    if (count < hwthreads) count = hwthreads;
+  }
+  while (workers.size() < count)
+    workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+unsigned ThreadPool::WorkerCount(void)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return (unsigned)workers.size();
+}
+
+unsigned ThreadPool::Size(void)
+{
+  unsigned hwthreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return std::max((unsigned)workers.size(), hwthreads);
+}
+
+unsigned ThreadPool::Limit(unsigned requested)
+{
+  if (requested == 0)
+    return std::max(std::thread::hardware_concurrency(), 1u);
+  return requested;
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+  bool needworker;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(std::move(task));
+    needworker = workers.empty();
+  }
+  if (needworker)
+    Reserve(1);
+  wakeup.notify_one();
+}
+
+void ThreadPool::WorkerLoop(void)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (1)
+  {
+    wakeup.wait(lock, [this]() { return stopping || !queue.empty(); });
+    if (queue.empty()) break; // stopping, and nothing left to do
+
+    std::function<void()> task = std::move(queue.front());
+    queue.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
+
+namespace
+{
+  // Tracks invocations of a ThreadPool::Run call which have been handed to workers
+  struct RunGroup
+  {
+    std::mutex mutex;
+    std::condition_variable done;
+    unsigned running;
+    bool closed;
+
+    RunGroup(void) : running(0), closed(false) {}
+  };
+}
+
+void ThreadPool::Run(unsigned concurrency, const std::function<void()> &fn)
+{
+  if (concurrency <= 1)
+  {
+    fn();
+    return;
+  }
+
+  Reserve(concurrency - 1);
+
+  // queued invocations only reference `fn` if they start before the group is
+  // closed, so the group (but not `fn`) must outlive this call
+  auto group = std::make_shared<RunGroup>();
+  const std::function<void()> *fnptr = &fn;
+  for (unsigned i = 1; i < concurrency; i++)
+  {
+    Submit([group, fnptr]()
+    {
+      {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        if (group->closed) return;
+        group->running++;
+      }
+      (*fnptr)();
+      std::lock_guard<std::mutex> lock(group->mutex);
+      if (--group->running == 0 && group->closed)
+        group->done.notify_all();
+    });
+  }
+
+  fn();
+
+  std::unique_lock<std::mutex> lock(group->mutex);
+  group->closed = true;
+  group->done.wait(lock, [&group]() { return group->running == 0; });
+}
@@ -0,0 +1,77 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+// Process-wide pool of worker threads, taking tasks from a single FIFO queue.
+// All Par2Creator/Par2Repairer instances share the one pool for file
+// hashing, scanning and other per-file work, so repeated operations (e.g. a
+// library user running many small verifies) don't pay for thread creation
+// on every call, and overlapping phases draw from the same set of workers
+// instead of each spawning their own. ParPar's GF16 compute threads and the
+// matrix solver's threads are not part of it (see Limit).
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <future>
+#include <memory>
+
+class ThreadPool
+{
+public:
+  // The pool shared by everything in this process
+  static ThreadPool &Instance(void);
+
+  // Ensure at least `count` workers exist. The pool starts out sized to the
+  // hardware concurrency and only grows if more are explicitly requested.
+  void Reserve(unsigned count);
+  unsigned WorkerCount(void);
+
+  // How many threads the pool is sized for (whether or not they've been
+  // started yet): the hardware concurrency, or more if more were reserved
+  unsigned Size(void);
+
+  // How many threads something which runs its own (e.g. ParPar's compute
+  // threads) should use when `requested` were asked for (e.g. with -t):
+  // that many, or one per hardware thread if 0
+  unsigned Limit(unsigned requested);
+
+  // Queue a task to be run on a worker
+  void Submit(std::function<void()> task);
+
+  // Run a function on a worker, with the result being available via a future
+  template <class F>
+  auto Async(F fn) -> std::future<decltype(fn())>
+  {
+    typedef decltype(fn()) R;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::move(fn));
+    std::future<R> result = task->get_future();
+    Submit([task]() { (*task)(); });
+    return result;
+  }
+
+  // Run `fn` on up to `concurrency` threads at once, one of which is the
+  // calling thread, and wait until all invocations have returned.
+  // `fn` is expected to pull work from a shared source until there's none
+  // left; once the calling thread's invocation returns, queued invocations
+  // which haven't started yet are skipped.
+  void Run(unsigned concurrency, const std::function<void()> &fn);
+
+private:
+  ThreadPool(void);
+  ~ThreadPool(void);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool &operator=(const ThreadPool&) = delete;
+
+  void WorkerLoop(void);
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::deque<std::function<void()>> queue;
+  std::vector<std::thread> workers;
+  bool stopping;
+};
+
+#endif // __THREADPOOL_H__
@@ -0,0 +1,170 @@
+#include "libpar2internal.h"
+
+#ifdef _MSC_VER
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+#endif
+
+
+std::atomic<Trace*> Trace::active(0);
+std::atomic<u64> Trace::nextserial(1);
+std::atomic<u32> Trace::recorders(0);
+
+Trace::Trace(void)
+: serial(nextserial++)
+, started(0)
+, threads()
+{
+}
+
+Trace::~Trace(void)
+{
+  Stop();
+}
+
+void Trace::Start(void)
+{
+  started = Now();
+  Trace *previous = active.exchange(this);
+  IPAR2ProcBackend::setTraceHook(&Trace::RecordBackend);
+
+  // The trace replaced may be destroyed as soon as this returns
+  if (previous && previous != this)
+    WaitForRecorders();
+}
+
+void Trace::Stop(void)
+{
+  Trace *trace = this;
+  if (active.compare_exchange_strong(trace, 0))
+  {
+    IPAR2ProcBackend::setTraceHook(0);
+    WaitForRecorders();
+  }
+}
+
+// Wait for any thread which may still be recording an event into a trace
+// which is no longer active. Any which starts recording from now on will
+// find the trace which is (or none).
+void Trace::WaitForRecorders(void)
+{
+  while (recorders.load() != 0)
+    std::this_thread::yield();
+}
+
+size_t Trace::EventCount(void) const
+{
+  std::lock_guard<std::mutex> l(lock);
+
+  size_t count = 0;
+  for (std::list<std::unique_ptr<Thread> >::const_iterator thread = threads.begin();
+       thread != threads.end();
+       ++thread)
+  {
+    count += (*thread)->events.size();
+  }
+  return count;
+}
+
+void Trace::Record(const char *name, const char *category, u64 begin, u64 end, const char *detail)
+{
+  // Counted as recording before looking for the trace, so that it can't be
+  // stopped (and destroyed) until the event has been added
+  Recorder recorder;
+  Trace *trace = active.load();
+  if (!trace)
+    return;
+
+  // Each thread remembers where its events go, so that it only needs to
+  // lock the trace when it records its first
+  static thread_local u64 threadserial = 0;
+  static thread_local Thread *thread = 0;
+  if (threadserial != trace->serial)
+  {
+    std::lock_guard<std::mutex> l(trace->lock);
+    trace->threads.push_back(std::unique_ptr<Thread>(new Thread));
+    thread = trace->threads.back().get();
+    thread->id = (u32)trace->threads.size();
+    threadserial = trace->serial;
+  }
+
+  Event event = {name, category, begin, end, detail ? detail : ""};
+  thread->events.push_back(std::move(event));
+}
+
+void Trace::RecordBackend(const char *name, std::chrono::steady_clock::time_point start,
+                          std::chrono::steady_clock::time_point end)
+{
+  Record(name, "parpar", (u64)start.time_since_epoch().count(), (u64)end.time_since_epoch().count());
+}
+
+// Write a string as a JSON string
+static void WriteJSONString(std::ostream &out, const std::string &str)
+{
+  out << '"';
+  for (std::string::const_iterator c = str.begin(); c != str.end(); ++c)
+  {
+    switch (*c)
+    {
+    case '"':  out << "\\\""; break;
+    case '\\': out << "\\\\"; break;
+    case '\n': out << "\\n";  break;
+    case '\r': out << "\\r";  break;
+    case '\t': out << "\\t";  break;
+    default:
+      if ((unsigned char)*c < 0x20)
+        out << "\\u00" << "0123456789abcdef"[(*c >> 4) & 0xf] << "0123456789abcdef"[*c & 0xf];
+      else
+        out << *c;
+    }
+  }
+  out << '"';
+}
+
+void Trace::WriteJSON(std::ostream &out) const
+{
+  std::lock_guard<std::mutex> l(lock);
+
+  std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(3);
+
+  // Times are in microseconds from when the trace was started
+  typedef std::chrono::duration<double, std::micro> microseconds;
+
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  const char *separator = "\n";
+  for (std::list<std::unique_ptr<Thread> >::const_iterator thread = threads.begin();
+       thread != threads.end();
+       ++thread)
+  {
+    for (std::vector<Event>::const_iterator event = (*thread)->events.begin();
+         event != (*thread)->events.end();
+         ++event)
+    {
+      microseconds ts = std::chrono::steady_clock::duration((i64)(event->begin - started));
+      microseconds dur = std::chrono::steady_clock::duration((i64)(event->end - event->begin));
+
+      out << separator << "{\"name\": \"" << event->name << "\", "
+        "\"cat\": \"" << event->category << "\", "
+        "\"ph\": \"X\", "
+        "\"pid\": 1, "
+        "\"tid\": " << (*thread)->id << ", "
+        "\"ts\": " << ts.count() << ", "
+        "\"dur\": " << dur.count();
+      if (!event->detail.empty())
+      {
+        out << ", \"args\": {\"detail\": ";
+        WriteJSONString(out, event->detail);
+        out << "}";
+      }
+      out << "}";
+      separator = ",\n";
+    }
+  }
+  out << "\n]}" << std::endl;
+
+  out.flags(flags);
+}
@@ -0,0 +1,122 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A timeline of what each thread was doing, for seeing where reading,
+// computing and writing fail to overlap. Whilst a trace is started, the
+// stages timed by StageTimer, reads and writes, hashing, and the work of
+// the backend's threads are recorded as they happen (each thread records
+// its own events, without locking), and can be written afterwards in the
+// trace event format read by chrome://tracing and Perfetto.
+// Only one trace can be started at a time. When none is, recording costs
+// no more than checking whether one is. Stopping a trace (or starting
+// another in its place) waits for any event still being recorded into it,
+// so that it can then be written or destroyed whilst other threads (such as
+// the backend's, which outlive an operation) carry on.
+
+class Trace
+{
+public:
+  Trace(void);
+  ~Trace(void);
+
+  // Record events from now on (in place of any other trace), or stop. The
+  // trace mustn't be started or stopped by several threads at once.
+  void Start(void);
+  void Stop(void);
+
+  // Write the events recorded as trace event JSON. This should be done once
+  // whatever was traced has finished.
+  void WriteJSON(std::ostream &out) const;
+
+  size_t EventCount(void) const;
+
+  // Whether a trace has been started
+  static bool Enabled(void) {return active.load(std::memory_order_relaxed) != 0;}
+
+  // The time (in steady_clock ticks) to record an event with
+  static u64 Now(void) {return (u64)std::chrono::steady_clock::now().time_since_epoch().count();}
+
+  // Record an event on the calling thread, if a trace has been started
+  static void Record(const char *name, const char *category, u64 begin, u64 end, const char *detail = 0);
+
+protected:
+  struct Event
+  {
+    const char  *name;
+    const char  *category;
+    u64          begin;
+    u64          end;
+    std::string  detail;    // e.g. the file which was being processed
+  };
+
+  // The events of one thread, which only it adds to
+  struct Thread
+  {
+    u32                 id;
+    std::vector<Event>  events;
+  };
+
+  // Record the work done on a backend thread
+  static void RecordBackend(const char *name, std::chrono::steady_clock::time_point start,
+                            std::chrono::steady_clock::time_point end);
+
+  // Wait until no thread is recording an event
+  static void WaitForRecorders(void);
+
+  // Counts a thread as recording for as long as it's in scope
+  struct Recorder
+  {
+    Recorder(void) {recorders.fetch_add(1);}
+    ~Recorder(void) {recorders.fetch_sub(1);}
+  };
+
+protected:
+  static std::atomic<Trace*>           active;      // The trace which has been started
+  static std::atomic<u64>              nextserial;
+  static std::atomic<u32>              recorders;   // Threads in the middle of recording an event
+
+  const u64                            serial;      // Tells traces apart, even at the same address
+  u64                                  started;     // When the trace was started
+  mutable std::mutex                   lock;        // Guards threads
+  std::list<std::unique_ptr<Thread> >  threads;
+};
+
+// Records an event for as long as it's in scope, if tracing
+class TraceScope
+{
+public:
+  TraceScope(const char *name)
+  : name(name)
+  , begin(Trace::Enabled() ? Trace::Now() : 0)
+  {
+  }
+  TraceScope(const char *name, const std::string &_detail)
+  : name(name)
+  , begin(Trace::Enabled() ? Trace::Now() : 0)
+  {
+    if (begin)
+      detail = _detail;
+  }
+  ~TraceScope(void)
+  {
+    if (begin)
+      Trace::Record(name, "par2", begin, Trace::Now(), detail.c_str());
+  }
+
+protected:
+  const char   *name;
+  const u64     begin;
+  std::string   detail;
+};
+
+#endif // __TRACE_H__
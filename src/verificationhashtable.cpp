@@ -31,6 +31,7 @@ VerificationHashTable::VerificationHashTable(void)
 {
   hashmask = 0;
   hashtable = 0;
+  entrycount = 0;
 }
 
 VerificationHashTable::~VerificationHashTable(void)
@@ -92,6 +93,7 @@ void VerificationHashTable::Load(Par2RepairerSourceFile *sourcefile, u64 blocksi
 
     // Insert the entry in the hash table
     entry->Insert(&hashtable[entry->Checksum() & hashmask]);
+    entrycount++;
 
     // Make the previous entry point forwards to this one
     if (preventry)
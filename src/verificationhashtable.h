@@ -242,6 +242,9 @@ public:
   // Load the data from the verification packet
   void Load(Par2RepairerSourceFile *sourcefile, u64 blocksize);
 
+  // How much memory the table and its entries use
+  size_t MemoryUsed(void) const;
+
   // Try to find a match.
   //   nextentry   - The entry which we expect to find next. This is used
   //                 when a sequence of matches are found.
@@ -266,8 +269,14 @@ public:
 protected:
   VerificationHashEntry **hashtable;
   unsigned int hashmask;
+  size_t entrycount;
 };
 
+inline size_t VerificationHashTable::MemoryUsed(void) const
+{
+  return (hashtable ? (hashmask + 1) * sizeof(hashtable[0]) : 0) + entrycount * sizeof(VerificationHashEntry);
+}
+
 // Search for an entry with the specified crc
 inline const VerificationHashEntry* VerificationHashTable::Lookup(u32 crc) const
 {